@@ -0,0 +1,97 @@
+/* BINARY FILE HELPERS */
+
+#include <string.h>
+#include <glib.h>
+#include "binio.h"
+
+
+/* FNV-1a hash, used to detect truncated or corrupted files */
+guint32
+binio_checksum (const guint8 *data, gsize length)
+{
+    guint32 hash = 2166136261u;
+    for (gsize i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void
+binio_put_varint (GByteArray *buf, guint64 value)
+{
+    guint8 byte;
+    do {
+        byte = value & 0x7f;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        g_byte_array_append (buf, &byte, 1);
+    } while (value);
+}
+
+void
+binio_put_string (GByteArray *buf, const gchar *str, gsize length)
+{
+    binio_put_varint (buf, length);
+    if (length)
+        g_byte_array_append (buf, (const guint8 *) str, length);
+}
+
+gboolean
+binio_get_varint (BinReader *r, guint64 *value)
+{
+    guint64 result = 0;
+    for (guint shift = 0; shift < 64; shift += 7) {
+        if (r->pos >= r->length)
+            return FALSE;
+        guint8 byte = r->data[r->pos++];
+        result |= (guint64) (byte & 0x7f) << shift;
+        if (! (byte & 0x80)) {
+            *value = result;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Read string into newly allocated buffer; empty strings are returned as NULL */
+gboolean
+binio_get_string (BinReader *r, gchar **str)
+{
+    guint64 length;
+    if (! binio_get_varint (r, &length) || length > r->length - r->pos)
+        return FALSE;
+
+    *str = length ? g_strndup ((const gchar *) r->data + r->pos, length) : NULL;
+    r->pos += length;
+    return TRUE;
+}
+
+/* Append checksum over everything written so far (4 bytes little-endian) */
+void
+binio_seal (GByteArray *buf)
+{
+    guint32 checksum = GUINT32_TO_LE (binio_checksum (buf->data, buf->len));
+    g_byte_array_append (buf, (const guint8 *) &checksum, sizeof (checksum));
+}
+
+/* Check magic and checksum, and position reader after the magic */
+gboolean
+binio_open (BinReader *r, const guint8 *data, gsize length, const gchar *magic)
+{
+    gsize magic_len = strlen (magic);
+    if (length < magic_len + sizeof (guint32) || memcmp (data, magic, magic_len) != 0)
+        return FALSE;
+
+    guint32 checksum;
+    memcpy (&checksum, data + length - sizeof (checksum), sizeof (checksum));
+    length -= sizeof (checksum);
+    if (GUINT32_FROM_LE (checksum) != binio_checksum (data, length))
+        return FALSE;
+
+    r->data = data;
+    r->length = length;
+    r->pos = magic_len;
+    return TRUE;
+}
@@ -0,0 +1,38 @@
+#ifndef __BINIO_H
+#define __BINIO_H
+
+#include <glib.h>
+
+/* Helpers for the compact binary files kept by the plugin. Integers are
+ * written as unsigned LEB128 varints, strings as varint length + bytes.
+ */
+typedef struct
+{
+    const guint8    *data;
+    gsize           length;
+    gsize           pos;
+} BinReader;
+
+
+guint32
+binio_checksum (const guint8 *data, gsize length);
+
+void
+binio_put_varint (GByteArray *buf, guint64 value);
+
+void
+binio_put_string (GByteArray *buf, const gchar *str, gsize length);
+
+gboolean
+binio_get_varint (BinReader *r, guint64 *value);
+
+gboolean
+binio_get_string (BinReader *r, gchar **str);
+
+void
+binio_seal (GByteArray *buf);
+
+gboolean
+binio_open (BinReader *r, const guint8 *data, gsize length, const gchar *magic);
+
+#endif  /* __BINIO_H */
@@ -0,0 +1,185 @@
+/* DIRECTORY STATE - fingerprints of scanned directories for quick rescans */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "dirstate.h"
+#include "binio.h"
+
+
+/* File layout (all integers are unsigned LEB128 varints):
+ *     magic           8 bytes "DBFBDIRS"
+ *     version         varint
+ *     signature       string, root and filter of the scan
+ *     count           varint, number of directories
+ *     directories     count * (path, mtime, fingerprint, n_entries, entries),
+ *                     mtime is stored as unsigned
+ *     checksum        4 bytes little-endian FNV-1a over everything above
+ */
+#define DIRSTATE_MAGIC          "DBFBDIRS"
+#define DIRSTATE_VERSION        1
+
+struct _DirState
+{
+    gchar           *signature;
+    GHashTable      *dirs;          // path -> DirRecord
+};
+
+
+static void
+record_free (DirRecord *record)
+{
+    g_strfreev (record->entries);
+    g_free (record);
+}
+
+DirState *
+dirstate_new (const gchar *signature)
+{
+    DirState *state = g_new0 (DirState, 1);
+    state->signature = g_strdup (signature);
+    state->dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) record_free);
+    return state;
+}
+
+void
+dirstate_free (DirState *state)
+{
+    if (! state)
+        return;
+    g_hash_table_destroy (state->dirs);
+    g_free (state->signature);
+    g_free (state);
+}
+
+const gchar *
+dirstate_get_signature (const DirState *state)
+{
+    return state->signature;
+}
+
+guint
+dirstate_size (const DirState *state)
+{
+    return g_hash_table_size (state->dirs);
+}
+
+const DirRecord *
+dirstate_lookup (const DirState *state, const gchar *path)
+{
+    return g_hash_table_lookup (state->dirs, path);
+}
+
+/* Add or replace directory, takes ownership of entries */
+void
+dirstate_insert (DirState *state, const gchar *path, gint64 mtime, guint64 fingerprint,
+                            gchar **entries)
+{
+    DirRecord *record = g_new (DirRecord, 1);
+    record->mtime = mtime;
+    record->fingerprint = fingerprint;
+    record->entries = entries ? entries : g_new0 (gchar *, 1);
+    g_hash_table_insert (state->dirs, g_strdup (path), record);
+}
+
+/* FNV-1a, 64 bit; start with DIRSTATE_HASH_INIT */
+guint64
+dirstate_hash (guint64 hash, const void *data, gsize length)
+{
+    const guint8 *bytes = data;
+    for (gsize i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+    return hash;
+}
+
+DirState *
+dirstate_load (const gchar *filename)
+{
+    gchar *contents;
+    gsize length;
+    if (! g_file_get_contents (filename, &contents, &length, NULL))
+        return NULL;
+
+    BinReader r;
+    guint64 version, count;
+    gchar *signature = NULL;
+    DirState *state = NULL;
+    gboolean ok = FALSE;
+
+    if (! binio_open (&r, (const guint8 *) contents, length, DIRSTATE_MAGIC)
+            || ! binio_get_varint (&r, &version) || version != DIRSTATE_VERSION
+            || ! binio_get_string (&r, &signature)
+            || ! binio_get_varint (&r, &count))
+        goto out;
+
+    state = dirstate_new (signature ? signature : "");
+    for (guint64 i = 0; i < count; i++) {
+        gchar *path;
+        guint64 mtime, fingerprint, n_entries;
+        if (! binio_get_string (&r, &path) || ! path)
+            goto out;
+        if (! binio_get_varint (&r, &mtime) || ! binio_get_varint (&r, &fingerprint)
+                || ! binio_get_varint (&r, &n_entries) || n_entries > r.length - r.pos) {
+            g_free (path);
+            goto out;
+        }
+
+        gchar **entries = g_new0 (gchar *, n_entries + 1);
+        for (guint64 e = 0; e < n_entries; e++) {
+            if (! binio_get_string (&r, &entries[e]) || ! entries[e]) {
+                g_strfreev (entries);
+                g_free (path);
+                goto out;
+            }
+        }
+        dirstate_insert (state, path, (gint64) mtime, fingerprint, entries);
+        g_free (path);
+    }
+    ok = TRUE;
+
+out:
+    if (! ok) {
+        fprintf (stderr, "filebrowser: ignoring invalid directory state %s\n", filename);
+        dirstate_free (state);
+        state = NULL;
+    }
+    g_free (signature);
+    g_free (contents);
+    return state;
+}
+
+gboolean
+dirstate_save (const DirState *state, const gchar *filename)
+{
+    GByteArray *buf = g_byte_array_sized_new (64 * 1024);
+    g_byte_array_append (buf, (const guint8 *) DIRSTATE_MAGIC, strlen (DIRSTATE_MAGIC));
+    binio_put_varint (buf, DIRSTATE_VERSION);
+    binio_put_string (buf, state->signature, strlen (state->signature));
+    binio_put_varint (buf, g_hash_table_size (state->dirs));
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init (&iter, state->dirs);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        const DirRecord *record = value;
+        binio_put_string (buf, key, strlen (key));
+        binio_put_varint (buf, (guint64) record->mtime);
+        binio_put_varint (buf, record->fingerprint);
+        binio_put_varint (buf, g_strv_length (record->entries));
+        for (gchar **entry = record->entries; *entry; entry++)
+            binio_put_string (buf, *entry, strlen (*entry));
+    }
+    binio_seal (buf);
+
+    GError *error = NULL;
+    gboolean ok = g_file_set_contents (filename, (const gchar *) buf->data, buf->len, &error);
+    if (! ok) {
+        fprintf (stderr, "filebrowser: could not write directory state: %s\n", error->message);
+        g_error_free (error);
+    }
+    g_byte_array_free (buf, TRUE);
+
+    return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef __DIRSTATE_H
+#define __DIRSTATE_H
+
+#include <glib.h>
+
+/* Directories below the root as seen by the last tag scan. A directory
+ * whose modification time didn't change still has the same entries, so a
+ * rescan can take them from here instead of listing it. Each directory has
+ * a fingerprint over its time, its entries and the fingerprints of its
+ * subdirectories, so equal root fingerprints mean nothing changed.
+ */
+typedef struct _DirState DirState;
+
+typedef struct
+{
+    gint64          mtime;          // -1 if it may have changed during the scan
+    guint64         fingerprint;
+    gchar           **entries;      // shown entries in listing order, directories end with a separator
+} DirRecord;
+
+#define DIRSTATE_HASH_INIT      G_GUINT64_CONSTANT (14695981039346656037)
+
+
+DirState *
+dirstate_new (const gchar *signature);
+
+DirState *
+dirstate_load (const gchar *filename);
+
+gboolean
+dirstate_save (const DirState *state, const gchar *filename);
+
+void
+dirstate_free (DirState *state);
+
+const gchar *
+dirstate_get_signature (const DirState *state);
+
+guint
+dirstate_size (const DirState *state);
+
+const DirRecord *
+dirstate_lookup (const DirState *state, const gchar *path);
+
+void
+dirstate_insert (DirState *state, const gchar *path, gint64 mtime, guint64 fingerprint,
+                            gchar **entries);
+
+guint64
+dirstate_hash (guint64 hash, const void *data, gsize length);
+
+#endif  /* __DIRSTATE_H */
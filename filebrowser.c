@@ -39,6 +39,17 @@
 #include "filebrowser.h"
 #include "support.h"
 #include "utils.h"
+#include "gtkutils.h"
+#include "pathtrie.h"
+#include "listing.h"
+#include "import.h"
+#include "filter.h"
+#include "metacache.h"
+#include "searchindex.h"
+#include "tagscan.h"
+#include "tagquery.h"
+#include "smartfolder.h"
+#include "scheduler.h"
 
 // Uncomment to enable debug messages
 //#define DEBUG
@@ -61,6 +72,8 @@ static gboolean             CONFIG_ENABLED;
 static gboolean             CONFIG_HIDDEN;
 static const gchar *        CONFIG_DEFAULT_PATH         = NULL;
 static gboolean             CONFIG_SHOW_HIDDEN_FILES;
+static gboolean             CONFIG_SHOW_RECENT;
+static gboolean             CONFIG_FOLLOW_PLAYING;
 static gboolean             CONFIG_FILTER_ENABLED;
 static const gchar *        CONFIG_FILTER               = NULL;
 static gboolean             CONFIG_FILTER_AUTO;
@@ -70,12 +83,44 @@ static gint                 CONFIG_WIDTH;
 static const gchar *        CONFIG_COVERART             = NULL;
 static gint                 CONFIG_COVERART_SIZE        = 24;
 static gboolean             CONFIG_SAVE_TREEVIEW        = TRUE;
+static gint                 CONFIG_UNLOAD_AFTER         = 10;
+static gint                 CONFIG_MAX_ROWS             = 50000;
 static const gchar *        CONFIG_COLOR_BG             = NULL;
 static const gchar *        CONFIG_COLOR_FG             = NULL;
 static const gchar *        CONFIG_COLOR_BG_SEL         = NULL;
 static const gchar *        CONFIG_COLOR_FG_SEL         = NULL;
 static gint                 CONFIG_ICON_SIZE            = 24;
 static gint                 CONFIG_FONT_SIZE            = 0;
+static gint                 CONFIG_VIEW_MODE            = VIEW_MODE_FOLDERS;
+
+static const ConfigKey      config_keys[CONFIG_KEYC]    = {
+    [CONFIG_KEY_ENABLED]            = { CONFSTR_FB_ENABLED,             NULL,                       TRUE },
+    [CONFIG_KEY_HIDDEN]             = { CONFSTR_FB_HIDDEN,              NULL,                       FALSE },
+    [CONFIG_KEY_DEFAULT_PATH]       = { CONFSTR_FB_DEFAULT_PATH,        DEFAULT_FB_DEFAULT_PATH,    0 },
+    [CONFIG_KEY_SHOW_HIDDEN_FILES]  = { CONFSTR_FB_SHOW_HIDDEN_FILES,   NULL,                       FALSE },
+    [CONFIG_KEY_SHOW_RECENT]        = { CONFSTR_FB_SHOW_RECENT,         NULL,                       FALSE },
+    [CONFIG_KEY_FOLLOW_PLAYING]     = { CONFSTR_FB_FOLLOW_PLAYING,      NULL,                       FALSE },
+    [CONFIG_KEY_FILTER_ENABLED]     = { CONFSTR_FB_FILTER_ENABLED,      NULL,                       TRUE },
+    [CONFIG_KEY_FILTER]             = { CONFSTR_FB_FILTER,              DEFAULT_FB_FILTER,          0 },
+    [CONFIG_KEY_FILTER_AUTO]        = { CONFSTR_FB_FILTER_AUTO,         NULL,                       TRUE },
+    [CONFIG_KEY_SHOW_ICONS]         = { CONFSTR_FB_SHOW_ICONS,          NULL,                       TRUE },
+    [CONFIG_KEY_SHOW_TREE_LINES]    = { CONFSTR_FB_SHOW_TREE_LINES,     NULL,                       FALSE },
+    [CONFIG_KEY_WIDTH]              = { CONFSTR_FB_WIDTH,               NULL,                       200 },
+    [CONFIG_KEY_COVERART]           = { CONFSTR_FB_COVERART,            DEFAULT_FB_COVERART,        0 },
+    [CONFIG_KEY_COVERART_SIZE]      = { CONFSTR_FB_COVERART_SIZE,       NULL,                       24 },
+    [CONFIG_KEY_SAVE_TREEVIEW]      = { CONFSTR_FB_SAVE_TREEVIEW,       NULL,                       TRUE },
+    [CONFIG_KEY_UNLOAD_AFTER]       = { CONFSTR_FB_UNLOAD_AFTER,        NULL,                       10 },
+    [CONFIG_KEY_MAX_ROWS]           = { CONFSTR_FB_MAX_ROWS,            NULL,                       50000 },
+    [CONFIG_KEY_COLOR_BG]           = { CONFSTR_FB_COLOR_BG,            "",                         0 },
+    [CONFIG_KEY_COLOR_FG]           = { CONFSTR_FB_COLOR_FG,            "",                         0 },
+    [CONFIG_KEY_COLOR_BG_SEL]       = { CONFSTR_FB_COLOR_BG_SEL,        "",                         0 },
+    [CONFIG_KEY_COLOR_FG_SEL]       = { CONFSTR_FB_COLOR_FG_SEL,        "",                         0 },
+    [CONFIG_KEY_ICON_SIZE]          = { CONFSTR_FB_ICON_SIZE,           NULL,                       24 },
+    [CONFIG_KEY_FONT_SIZE]          = { CONFSTR_FB_FONT_SIZE,           NULL,                       0 },
+    [CONFIG_KEY_VIEW_MODE]          = { CONFSTR_FB_VIEW_MODE,           NULL,                       VIEW_MODE_FOLDERS },
+};
+static ConfigSnapshot *     config_snapshot             = NULL;     // settings the CONFIG_* values were taken from
+static gint                 config_change_pending       = FALSE;
 
 /* Global variables */
 static DB_misc_t            plugin;
@@ -89,16 +134,74 @@ static GtkWidget *          treeview;
 static GtkTreeStore *       treestore;
 static GtkWidget *          sidebar_vbox                = NULL;
 static GtkWidget *          sidebar_vbox_bars;
+static GtkWidget *          tree_scrollwin              = NULL;
+static GtkWidget *          search_entry                = NULL;
+static GtkWidget *          search_scrollwin            = NULL;
+static GtkWidget *          search_view                 = NULL;
+static GtkListStore *       search_store                = NULL;
+static GtkWidget *          search_menu                 = NULL;
+static GPtrArray *          search_query_results        = NULL;     // paths of all tracks matching a query
+static SearchIndex *        search_index                = NULL;
+static gchar *              search_index_target         = NULL;     // root and filter of running build
+static GtkWidget *          view_selector               = NULL;
+static GtkWidget *          tag_scrollwin               = NULL;
+static GtkWidget *          tag_view                    = NULL;
+static GtkTreeStore *       tag_model                   = NULL;
+static GtkWidget *          tag_menu                    = NULL;
+static TagStore *           tag_store                   = NULL;
+static guint32 *            tag_order                   = NULL;     // tracks of tag_store sorted for the view
+static gchar *              tag_scan_target             = NULL;     // root and filter of the last scan
+static gboolean             tag_scan_running            = FALSE;
+static gboolean             tag_scan_wanted             = FALSE;    // a query needs tags
+static GPtrArray *          smart_folders               = NULL;     // SmartFolder, in the order shown
+static gboolean             smart_folders_stale         = FALSE;    // a scan was cancelled, changes were missed
+static GtkWidget *          import_bar                  = NULL;
+static GtkWidget *          import_progress             = NULL;
 static GtkTreeViewColumn *  treeview_column_text;
 static GtkCellRenderer *    render_icon, *render_text;
-static GSList *             expanded_rows               = NULL;
+static PathTrie *           expanded_rows               = NULL;
 static gchar *              known_extensions            = NULL;
-static gboolean             flag_on_expand_refresh      = FALSE;
+static ViewConfig *         current_view                = NULL;     // published settings, jobs hold their own reference
+static guint                session_save_timeout        = 0;
+static GQueue               unload_queue                = G_QUEUE_INIT;  // UnloadEntry, most recently collapsed first
+static GHashTable *         unload_links                = NULL;     // URI -> link in unload_queue
+static guint                unload_timeout              = 0;
+static guint                unload_job                  = 0;
+static guint                icon_job                    = 0;
+static gboolean             dormant                     = FALSE;    // tree is freed while the sidebar isn't shown
+static guint                dormant_timeout             = 0;
+static gboolean             dormant_search_pending      = FALSE;    // search index needs a refresh after waking up
+#if GLIB_CHECK_VERSION(2, 64, 0)
+static GMemoryMonitor *     memory_monitor              = NULL;
+#endif
+
+static GThreadPool *        restore_pool                = NULL;
+static guint                restore_generation          = 0;
+static gint                 restore_waves_active        = 0;
+static GList *              restore_waves               = NULL;     // started, not freed yet
+static GThreadPool *        reveal_pool                 = NULL;
+static guint                reveal_generation           = 0;
+static GList *              reveal_jobs                 = NULL;     // started, not freed yet
+static SessionState *       restore_position            = NULL;
+
+static GHashTable *         fill_jobs                   = NULL;     // row_state_key(), "" for the top level -> FillJob being scheduled
+static GHashTable *         row_index                   = NULL;     // URI -> GtkTreeIter of its row in the folder tree
+static GHashTable *         typeahead_indexes           = NULL;     // row_state_key(), "" for the top level -> TypeAheadIndex
+static GString *            typeahead_text              = NULL;
+static gint64               typeahead_last              = 0;
 
 static gint                 mouseclick_lastpos[2]       = { 0, 0 };
 static gboolean             mouseclick_dragwait         = FALSE;
 static GtkTreePath *        mouseclick_lastpath         = NULL;
 
+/* Grouping levels of the tag views; tracks are sorted by these, then by number */
+static const TagField       tag_view_levels[VIEW_MODEC][TAGVIEW_MAX_LEVELS] = {
+    [VIEW_MODE_ARTISTS]     = { TAG_FIELD_ALBUM_ARTIST, TAG_FIELD_ALBUM },
+    [VIEW_MODE_GENRES]      = { TAG_FIELD_GENRE, TAG_FIELD_ALBUM_ARTIST, TAG_FIELD_ALBUM },
+    [VIEW_MODE_YEARS]       = { TAG_FIELD_YEAR, TAG_FIELD_ALBUM },
+};
+static const gint           tag_view_n_levels[VIEW_MODEC] = { 0, 2, 3, 2 };
+
 
 /* Helper functions */
 
@@ -152,6 +255,23 @@ create_autofilter (void)
         g_free (known_extensions);
     known_extensions = g_string_free (buf, FALSE);  // frees GString, but leaves gchar* behind
     trace("autofilter: %s\n", known_extensions);
+
+    update_view_config ();
+}
+
+/* Compile filter and icon settings into a new version of current_view,
+ * must be called whenever they change */
+static void
+update_view_config (void)
+{
+    const gchar *patterns = NULL;
+    if (CONFIG_FILTER_ENABLED)
+        patterns = CONFIG_FILTER_AUTO ? known_extensions : CONFIG_FILTER;
+
+    FbFilter *filter = filter_new (CONFIG_SHOW_HIDDEN_FILES, patterns);
+    view_config_publish (&current_view, view_config_new (config_snapshot_get_version (config_snapshot),
+                    filter, CONFIG_SHOW_ICONS, CONFIG_COVERART, CONFIG_COVERART_SIZE, CONFIG_ICON_SIZE));
+    filter_unref (filter);
 }
 
 static void
@@ -161,6 +281,8 @@ save_config (void)
     deadbeef->conf_set_int (CONFSTR_FB_ENABLED,             CONFIG_ENABLED);
     deadbeef->conf_set_int (CONFSTR_FB_HIDDEN,              CONFIG_HIDDEN);
     deadbeef->conf_set_int (CONFSTR_FB_SHOW_HIDDEN_FILES,   CONFIG_SHOW_HIDDEN_FILES);
+    deadbeef->conf_set_int (CONFSTR_FB_SHOW_RECENT,         CONFIG_SHOW_RECENT);
+    deadbeef->conf_set_int (CONFSTR_FB_FOLLOW_PLAYING,      CONFIG_FOLLOW_PLAYING);
     deadbeef->conf_set_int (CONFSTR_FB_FILTER_ENABLED,      CONFIG_FILTER_ENABLED);
     deadbeef->conf_set_int (CONFSTR_FB_FILTER_AUTO,         CONFIG_FILTER_AUTO);
     deadbeef->conf_set_int (CONFSTR_FB_SHOW_ICONS,          CONFIG_SHOW_ICONS);
@@ -168,8 +290,11 @@ save_config (void)
     deadbeef->conf_set_int (CONFSTR_FB_WIDTH,               CONFIG_WIDTH);
     deadbeef->conf_set_int (CONFSTR_FB_COVERART_SIZE,       CONFIG_COVERART_SIZE);
     deadbeef->conf_set_int (CONFSTR_FB_SAVE_TREEVIEW,       CONFIG_SAVE_TREEVIEW);
+    deadbeef->conf_set_int (CONFSTR_FB_UNLOAD_AFTER,        CONFIG_UNLOAD_AFTER);
+    deadbeef->conf_set_int (CONFSTR_FB_MAX_ROWS,            CONFIG_MAX_ROWS);
     deadbeef->conf_set_int (CONFSTR_FB_ICON_SIZE,           CONFIG_ICON_SIZE);
     deadbeef->conf_set_int (CONFSTR_FB_FONT_SIZE,           CONFIG_FONT_SIZE);
+    deadbeef->conf_set_int (CONFSTR_FB_VIEW_MODE,           CONFIG_VIEW_MODE);
 
     if (CONFIG_DEFAULT_PATH)
         deadbeef->conf_set_str (CONFSTR_FB_DEFAULT_PATH,    CONFIG_DEFAULT_PATH);
@@ -185,91 +310,62 @@ save_config (void)
         deadbeef->conf_set_str (CONFSTR_FB_COLOR_BG_SEL,    CONFIG_COLOR_BG_SEL);
     if (CONFIG_COLOR_FG_SEL)
         deadbeef->conf_set_str (CONFSTR_FB_COLOR_FG_SEL,    CONFIG_COLOR_FG_SEL);
-
-    if (CONFIG_SAVE_TREEVIEW && expanded_rows)  // prevent overwriting with an empty list
-    {
-        GString *config_expanded_rows_str = g_string_new ("");
-        GSList *node;
-        for (node = expanded_rows->next; node; node = node->next)  // first item is always NULL
-        {
-            if (config_expanded_rows_str->len > 0)
-                config_expanded_rows_str = g_string_append_c (config_expanded_rows_str, ' ');
-            config_expanded_rows_str = g_string_append (config_expanded_rows_str, node->data);
-        }
-        gchar *config_expanded_rows = g_string_free (config_expanded_rows_str, FALSE);
-        trace("expanded rows: %s\n", config_expanded_rows);
-        deadbeef->conf_set_str (CONFSTR_FB_EXPANDED_ROWS, config_expanded_rows);
-        g_free (config_expanded_rows);
-    }
 }
 
-static void
+static guint64
 load_config (void)
 {
     trace("load config\n");
-    if (CONFIG_DEFAULT_PATH)
-        g_free ((gchar*) CONFIG_DEFAULT_PATH);
-    if (CONFIG_FILTER)
-        g_free ((gchar*) CONFIG_FILTER);
-    if (CONFIG_COVERART)
-        g_free ((gchar*) CONFIG_COVERART);
-    if (CONFIG_COLOR_BG)
-        g_free ((gchar*) CONFIG_COLOR_BG);
-    if (CONFIG_COLOR_FG)
-        g_free ((gchar*) CONFIG_COLOR_FG);
-    if (CONFIG_COLOR_BG_SEL)
-        g_free ((gchar*) CONFIG_COLOR_BG_SEL);
-    if (CONFIG_COLOR_FG_SEL)
-        g_free ((gchar*) CONFIG_COLOR_FG_SEL);
-
-    deadbeef->conf_lock ();
-
-    CONFIG_ENABLED              = deadbeef->conf_get_int (CONFSTR_FB_ENABLED,             TRUE);
-    CONFIG_HIDDEN               = deadbeef->conf_get_int (CONFSTR_FB_HIDDEN,              FALSE);
-    CONFIG_SHOW_HIDDEN_FILES    = deadbeef->conf_get_int (CONFSTR_FB_SHOW_HIDDEN_FILES,   FALSE);
-    CONFIG_FILTER_ENABLED       = deadbeef->conf_get_int (CONFSTR_FB_FILTER_ENABLED,      TRUE);
-    CONFIG_FILTER_AUTO          = deadbeef->conf_get_int (CONFSTR_FB_FILTER_AUTO,         TRUE);
-    CONFIG_SHOW_ICONS           = deadbeef->conf_get_int (CONFSTR_FB_SHOW_ICONS,          TRUE);
-    CONFIG_SHOW_TREE_LINES      = deadbeef->conf_get_int (CONFSTR_FB_SHOW_TREE_LINES,     FALSE);
-    CONFIG_WIDTH                = deadbeef->conf_get_int (CONFSTR_FB_WIDTH,               200);
-    CONFIG_COVERART_SIZE        = deadbeef->conf_get_int (CONFSTR_FB_COVERART_SIZE,       24);
-    CONFIG_SAVE_TREEVIEW        = deadbeef->conf_get_int (CONFSTR_FB_SAVE_TREEVIEW,       TRUE);
-    CONFIG_ICON_SIZE            = deadbeef->conf_get_int (CONFSTR_FB_ICON_SIZE,           24);
-    CONFIG_FONT_SIZE            = deadbeef->conf_get_int (CONFSTR_FB_FONT_SIZE,           0);
-
-    CONFIG_DEFAULT_PATH         = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_DEFAULT_PATH,   DEFAULT_FB_DEFAULT_PATH));
-    CONFIG_FILTER               = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_FILTER,         DEFAULT_FB_FILTER));
-    CONFIG_COVERART             = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_COVERART,       DEFAULT_FB_COVERART));
-    CONFIG_COLOR_BG             = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_COLOR_BG,       ""));
-    CONFIG_COLOR_FG             = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_COLOR_FG,       ""));
-    CONFIG_COLOR_BG_SEL         = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_COLOR_BG_SEL,   ""));
-    CONFIG_COLOR_FG_SEL         = g_strdup (deadbeef->conf_get_str_fast (CONFSTR_FB_COLOR_FG_SEL,   ""));
-
-    if (expanded_rows)
-        g_slist_free (expanded_rows);
-    expanded_rows = g_slist_alloc();
-
-    if (CONFIG_SAVE_TREEVIEW)
-    {
-        gchar **config_expanded_rows;
-        config_expanded_rows = g_strsplit (deadbeef->conf_get_str_fast (CONFSTR_FB_EXPANDED_ROWS,   ""), " ", 0);
-
-        for (int i = 0; i < g_strv_length(config_expanded_rows); i++)
-        {
-            expanded_rows = g_slist_append (expanded_rows, g_strdup (config_expanded_rows[i]));
-        }
-        g_strfreev (config_expanded_rows);
+    ConfigSnapshot *snapshot = config_snapshot_read (deadbeef, config_keys, CONFIG_KEYC,
+                    config_snapshot ? config_snapshot_get_version (config_snapshot) + 1 : 1);
+    guint64 changed = config_snapshot ? config_snapshot_diff (config_snapshot, snapshot) : ~G_GUINT64_CONSTANT (0);
+    if (! changed) {
+        config_snapshot_free (snapshot);
+        return 0;  // another plugin's setting changed
     }
 
-    deadbeef->conf_unlock ();
-
-    utils_construct_style (treeview, CONFIG_COLOR_BG, CONFIG_COLOR_FG, CONFIG_COLOR_BG_SEL, CONFIG_COLOR_FG_SEL);
+    config_snapshot_free (config_snapshot);
+    config_snapshot = snapshot;
+
+    CONFIG_ENABLED              = config_snapshot_get_int (snapshot, CONFIG_KEY_ENABLED);
+    CONFIG_HIDDEN               = config_snapshot_get_int (snapshot, CONFIG_KEY_HIDDEN);
+    CONFIG_SHOW_HIDDEN_FILES    = config_snapshot_get_int (snapshot, CONFIG_KEY_SHOW_HIDDEN_FILES);
+    CONFIG_SHOW_RECENT          = config_snapshot_get_int (snapshot, CONFIG_KEY_SHOW_RECENT);
+    CONFIG_FOLLOW_PLAYING       = config_snapshot_get_int (snapshot, CONFIG_KEY_FOLLOW_PLAYING);
+    CONFIG_FILTER_ENABLED       = config_snapshot_get_int (snapshot, CONFIG_KEY_FILTER_ENABLED);
+    CONFIG_FILTER_AUTO          = config_snapshot_get_int (snapshot, CONFIG_KEY_FILTER_AUTO);
+    CONFIG_SHOW_ICONS           = config_snapshot_get_int (snapshot, CONFIG_KEY_SHOW_ICONS);
+    CONFIG_SHOW_TREE_LINES      = config_snapshot_get_int (snapshot, CONFIG_KEY_SHOW_TREE_LINES);
+    CONFIG_WIDTH                = config_snapshot_get_int (snapshot, CONFIG_KEY_WIDTH);
+    CONFIG_COVERART_SIZE        = config_snapshot_get_int (snapshot, CONFIG_KEY_COVERART_SIZE);
+    CONFIG_SAVE_TREEVIEW        = config_snapshot_get_int (snapshot, CONFIG_KEY_SAVE_TREEVIEW);
+    CONFIG_UNLOAD_AFTER         = config_snapshot_get_int (snapshot, CONFIG_KEY_UNLOAD_AFTER);
+    CONFIG_MAX_ROWS             = config_snapshot_get_int (snapshot, CONFIG_KEY_MAX_ROWS);
+    CONFIG_ICON_SIZE            = config_snapshot_get_int (snapshot, CONFIG_KEY_ICON_SIZE);
+    CONFIG_FONT_SIZE            = config_snapshot_get_int (snapshot, CONFIG_KEY_FONT_SIZE);
+    CONFIG_VIEW_MODE            = config_snapshot_get_int (snapshot, CONFIG_KEY_VIEW_MODE);
+    if (CONFIG_VIEW_MODE < 0 || CONFIG_VIEW_MODE >= VIEW_MODEC)
+        CONFIG_VIEW_MODE = VIEW_MODE_FOLDERS;
+
+    /* Strings belong to the snapshot */
+    CONFIG_DEFAULT_PATH         = config_snapshot_get_str (snapshot, CONFIG_KEY_DEFAULT_PATH);
+    CONFIG_FILTER               = config_snapshot_get_str (snapshot, CONFIG_KEY_FILTER);
+    CONFIG_COVERART             = config_snapshot_get_str (snapshot, CONFIG_KEY_COVERART);
+    CONFIG_COLOR_BG             = config_snapshot_get_str (snapshot, CONFIG_KEY_COLOR_BG);
+    CONFIG_COLOR_FG             = config_snapshot_get_str (snapshot, CONFIG_KEY_COLOR_FG);
+    CONFIG_COLOR_BG_SEL         = config_snapshot_get_str (snapshot, CONFIG_KEY_COLOR_BG_SEL);
+    CONFIG_COLOR_FG_SEL         = config_snapshot_get_str (snapshot, CONFIG_KEY_COLOR_FG_SEL);
+
+    if (changed & CONFIG_KEYS_VIEW)
+        update_view_config ();
 
     trace("config loaded - new settings: \n"
         "enabled:           %d \n"
         "hidden:            %d \n"
         "defaultpath:       %s \n"
         "show_hidden:       %d \n"
+        "show_recent:       %d \n"
+        "follow_playing:    %d \n"
         "filter_enabled:    %d \n"
         "filter:            %s \n"
         "filter_auto:       %d \n"
@@ -279,16 +375,21 @@ load_config (void)
         "coverart:          %s \n"
         "coverart size:     %d \n"
         "save_treeview:     %d \n"
+        "unload_after:      %d \n"
+        "max_rows:          %d \n"
         "bgcolor:           %s \n"
         "fgcolor:           %s \n"
         "bgcolor_sel:       %s \n"
         "fgcolor_sel:       %s \n"
         "icon_size:         %d \n"
-        "font_size:         %d \n",
+        "font_size:         %d \n"
+        "view_mode:         %d \n",
         CONFIG_ENABLED,
         CONFIG_HIDDEN,
         CONFIG_DEFAULT_PATH,
         CONFIG_SHOW_HIDDEN_FILES,
+        CONFIG_SHOW_RECENT,
+        CONFIG_FOLLOW_PLAYING,
         CONFIG_FILTER_ENABLED,
         CONFIG_FILTER,
         CONFIG_FILTER_AUTO,
@@ -298,21 +399,456 @@ load_config (void)
         CONFIG_COVERART,
         CONFIG_COVERART_SIZE,
         CONFIG_SAVE_TREEVIEW,
+        CONFIG_UNLOAD_AFTER,
+        CONFIG_MAX_ROWS,
         CONFIG_COLOR_BG,
         CONFIG_COLOR_FG,
         CONFIG_COLOR_BG_SEL,
         CONFIG_COLOR_FG_SEL,
         CONFIG_ICON_SIZE,
-        CONFIG_FONT_SIZE
+        CONFIG_FONT_SIZE,
+        CONFIG_VIEW_MODE
         );
+
+    return changed;
+}
+
+/* Collect current tree state for saving */
+static void
+session_collect (SessionState *state)
+{
+    state->root = get_default_dir ();
+    state->expanded = expanded_rows;
+
+    if (! treeview)
+        return;
+
+    GtkTreePath *path = NULL;
+    GtkTreePath *end = NULL;
+    GtkTreeIter iter;
+
+    gtk_tree_view_get_cursor (GTK_TREE_VIEW (treeview), &path, NULL);
+    if (path && gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path))
+        gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                        TREEBROWSER_COLUMN_URI, &state->selected, -1);
+    if (path)
+        gtk_tree_path_free (path);
+    path = NULL;
+
+    if (gtk_tree_view_get_visible_range (GTK_TREE_VIEW (treeview), &path, &end)) {
+        if (gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path))
+            gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                            TREEBROWSER_COLUMN_URI, &state->scroll_anchor, -1);
+        gtk_tree_path_free (path);
+        gtk_tree_path_free (end);
+    }
+}
+
+static gboolean
+session_save_timeout_cb (void *ctx)
+{
+    session_save_timeout = 0;
+
+    SessionState state = { NULL };
+    session_collect (&state);
+
+    gchar *filename = utils_make_cache_file ("session.bin");
+    session_save_async (filename, &state);
+    g_free (filename);
+
+    session_state_clear (&state);
+
+    /* This function MUST return false because it's called from g_timeout_add() */
+    return FALSE;
+}
+
+/* Schedule writing of the session file once the tree state stopped changing */
+static void
+session_changed (void)
+{
+    if (! CONFIG_SAVE_TREEVIEW || ! expanded_rows)
+        return;
+
+    if (session_save_timeout)
+        g_source_remove (session_save_timeout);
+    session_save_timeout = g_timeout_add_seconds (SESSION_SAVE_DELAY, session_save_timeout_cb, NULL);
+}
+
+/* Write pending changes to the session file immediately */
+static void
+session_flush (void)
+{
+    if (session_save_timeout == 0)
+        return;
+
+    g_source_remove (session_save_timeout);
+    session_save_timeout = 0;
+
+    SessionState state = { NULL };
+    session_collect (&state);
+
+    gchar *filename = utils_make_cache_file ("session.bin");
+    session_save (filename, &state);
+    g_free (filename);
+
+    session_state_clear (&state);
+}
+
+/* Load expanded rows from the session file, state is returned for restoring the view */
+static void
+session_restore (SessionState *state)
+{
+    if (! expanded_rows)
+        expanded_rows = pathtrie_new ();
+    pathtrie_clear (expanded_rows);
+
+    if (! CONFIG_SAVE_TREEVIEW)
+        return;
+
+    state->expanded = expanded_rows;
+
+    gchar *filename = utils_make_cache_file ("session.bin");
+    gboolean loaded = session_load (filename, state);
+    g_free (filename);
+    if (loaded)
+        return;
+
+    /* Migrate rows saved by older versions into the session file */
+    deadbeef->conf_lock ();
+    const gchar *config_expanded_rows_str = deadbeef->conf_get_str_fast (CONFSTR_FB_EXPANDED_ROWS, "");
+    if (NZV (config_expanded_rows_str))
+    {
+        gchar **config_expanded_rows = g_strsplit (config_expanded_rows_str, " ", 0);
+        for (gint i = 0; config_expanded_rows[i]; i++)
+        {
+            /* Rows are saved as encoded URIs, but stored as plain filenames */
+            gchar *fname = g_filename_from_uri (config_expanded_rows[i], NULL, NULL);
+            if (fname)
+                pathtrie_add (expanded_rows, fname);
+            g_free (fname);
+        }
+        g_strfreev (config_expanded_rows);
+    }
+    deadbeef->conf_unlock ();
+
+    if (pathtrie_size (expanded_rows) > 0) {
+        deadbeef->conf_set_str (CONFSTR_FB_EXPANDED_ROWS, "");
+        session_changed ();
+    }
+}
+
+/* Load search index saved by the last session */
+static void
+search_index_load (void)
+{
+    gchar *filename = utils_make_cache_file ("search.idx");
+    if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+        searchindex_free (search_index);
+        search_index = searchindex_load (filename);
+    }
+    g_free (filename);
+}
+
+/* Rebuild search index in the background if root or filter changed, or
+ * always if force is set */
+static void
+search_index_update (gboolean force)
+{
+    gchar *root = get_default_dir ();
+    gchar *target = g_strconcat (root, "\n", current_view->filter->signature, NULL);
+
+    gboolean current = search_index
+                && utils_str_equal (searchindex_get_root (search_index), root)
+                && utils_str_equal (searchindex_get_signature (search_index), current_view->filter->signature);
+    gboolean building = utils_str_equal (search_index_target, target);
+
+    if ((force || ! current) && ! building) {
+        gchar *filename = utils_make_cache_file ("search.idx");
+        searchindex_build_async (root, current_view->filter, filename, on_search_index_ready, NULL);
+        g_free (filename);
+
+        g_free (search_index_target);
+        search_index_target = target;
+        target = NULL;
+    }
+
+    g_free (target);
+    g_free (root);
+}
+
+/* Map tags saved by the last session */
+static void
+tag_store_load (void)
+{
+    gchar *filename = utils_make_cache_file ("tags.db");
+    if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+        tagstore_unref (tag_store);
+        tag_store = tagstore_load (filename);
+    }
+    g_free (filename);
+}
+
+/* Scan tags below the root once per session, or again if root or filter
+ * changed. Nothing is scanned until something needs tags. */
+static void
+tag_scan_update (void)
+{
+    if (CONFIG_VIEW_MODE == VIEW_MODE_FOLDERS && ! tag_scan_wanted && ! CONFIG_SHOW_RECENT)
+        return;
+
+    gchar *root = get_default_dir ();
+    gchar *target = g_strconcat (root, "\n", current_view->filter->signature, NULL);
+
+    if (! utils_str_equal (tag_scan_target, target)) {
+        if (tag_scan_running)
+            smart_folders_stale = TRUE;
+
+        gchar *filename = utils_make_cache_file ("tags.db");
+        gchar *dirs_filename = utils_make_cache_file ("tagdirs.db");
+        tagscan_start (root, current_view->filter, tag_store, filename, dirs_filename,
+                            on_tag_scan_ready, NULL);
+        tag_scan_running = TRUE;
+        g_free (dirs_filename);
+        g_free (filename);
+
+        g_free (tag_scan_target);
+        tag_scan_target = target;
+        target = NULL;
+    }
+
+    g_free (target);
+    g_free (root);
+}
+
+/* Look up the row of given URI in the folder tree's row index */
+static gboolean
+treeview_find_iter (const gchar *target, GtkTreeIter *result)
+{
+    if (! target || ! row_index)
+        return FALSE;
+
+    GtkTreeIter *iter = g_hash_table_lookup (row_index, target);
+    if (! iter)
+        return FALSE;
+    *result = *iter;
+    return TRUE;
+}
+
+/* Expand all parent rows of target, loading them if needed, and move the
+ * cursor to it */
+static gboolean
+treeview_reveal (const gchar *target)
+{
+    if (! target || ! target[0] || ! treeview)
+        return FALSE;
+
+    /* Parent directories are looked up top-down, expanding each one loads
+     * the row of the next */
+    gboolean in_tree = FALSE;
+    gsize len = strlen (target);
+    for (gsize i = 1; i <= len; i++) {
+        if (target[i] != G_DIR_SEPARATOR && target[i] != '\0')
+            continue;
+
+        GtkTreeIter iter;
+        gchar *dir = g_strndup (target, i);
+        if (! treeview_find_iter (dir, &iter)) {
+            g_free (dir);
+            if (in_tree)
+                return FALSE;  // hidden or gone
+            continue;  // above the root
+        }
+        in_tree = TRUE;
+
+        GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &iter);
+        if (i == len) {
+            gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, NULL, FALSE);
+            gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (treeview), path, NULL, TRUE, 0.5, 0.0);
+            gtk_tree_path_free (path);
+            g_free (dir);
+            return TRUE;
+        }
+        gtk_tree_view_expand_row (GTK_TREE_VIEW (treeview), path, FALSE);  // loads the row
+        treebrowser_fill_complete (dir);  // the next row may not be added yet
+        gtk_tree_path_free (path);
+        g_free (dir);
+    }
+    return FALSE;
+}
+
+static void
+reveal_job_free (RevealJob *job)
+{
+    reveal_jobs = g_list_remove (reveal_jobs, job);
+    for (guint i = 0; i < job->paths->len; i++)
+        listing_unref (job->listings[i]);
+    g_free (job->listings);
+    g_free (job->tasks);
+    g_ptr_array_unref (job->paths);
+    g_free (job->target);
+    g_free (job);
+}
+
+static void
+reveal_job_worker (gpointer data, gpointer user_data)
+{
+    RevealTask *task = data;
+    RevealJob *job = task->job;
+    const gchar *path = g_ptr_array_index (job->paths, task->index);
+
+    /* Listings shown before are used if the directory didn't change */
+    job->listings[task->index] = listing_get (path);
+
+    if (g_atomic_int_dec_and_test (&job->pending))
+        g_idle_add (reveal_job_apply, job);
+}
+
+/* Reveal target once its parent directories are listed in the background.
+ * Only these directories are read, all of them at the same time. */
+static void
+treeview_reveal_async (const gchar *target)
+{
+    gchar *root = get_default_dir ();
+    gsize root_len = strlen (root);
+    while (root_len > 1 && root[root_len-1] == G_DIR_SEPARATOR)
+        root_len--;
+    gboolean below_root = strncmp (target, root, root_len) == 0
+                    && (target[root_len] == G_DIR_SEPARATOR || root_len == 1);
+    g_free (root);
+    if (! below_root || ! treeview)
+        return;
+
+    RevealJob *job = g_new0 (RevealJob, 1);
+    job->target = g_strdup (target);
+    job->paths = g_ptr_array_new_with_free_func (g_free);
+    job->generation = ++reveal_generation;
+    for (const gchar *sep = strchr (target + root_len + 1, G_DIR_SEPARATOR); sep;
+                sep = strchr (sep + 1, G_DIR_SEPARATOR))
+        g_ptr_array_add (job->paths, g_strndup (target, sep - target));
+
+    if (job->paths->len == 0) {
+        reveal_job_apply (job);
+        return;
+    }
+
+    if (! reveal_pool)
+        reveal_pool = g_thread_pool_new (reveal_job_worker, NULL,
+                        CLAMP (g_get_num_processors (), 2, 8), FALSE, NULL);
+
+    job->listings = g_new0 (DirListing *, job->paths->len);
+    job->tasks = g_new (RevealTask, job->paths->len);
+    job->pending = job->paths->len;
+    reveal_jobs = g_list_prepend (reveal_jobs, job);
+    for (guint i = 0; i < job->paths->len; i++) {
+        job->tasks[i].job = job;
+        job->tasks[i].index = i;
+        g_thread_pool_push (reveal_pool, &job->tasks[i], NULL);
+    }
+}
+
+/* Fill the rows of the listed parent directories, then reveal the target */
+static gboolean
+reveal_job_apply (gpointer data)
+{
+    RevealJob *job = data;
+
+    if (job->generation == reveal_generation && treeview) {
+        for (guint i = 0; i < job->paths->len; i++) {
+            GtkTreeIter iter;
+            gint flag;
+            const gchar *path = g_ptr_array_index (job->paths, i);
+            if (! treeview_find_iter (path, &iter))
+                break;  // hidden or gone
+            gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+            if (flag == TREEBROWSER_FLAGS_FILLING)
+                treebrowser_fill_complete (path);
+            else if (flag != TREEBROWSER_FLAGS_LOADED && job->listings[i]) {
+                gtk_tree_store_iter_clear_nodes (&iter, FALSE);
+                treebrowser_fill (job->listings[i], &iter, NULL);
+            }
+        }
+        treeview_reveal (job->target);  // rows are loaded, expanding them lists nothing
+    }
+    reveal_job_free (job);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+/* Local path of a track, NULL for streams and files inside archives */
+static gchar *
+get_track_uri (DB_playItem_t *track)
+{
+    gchar *uri = NULL;
+    deadbeef->pl_lock ();
+    const gchar *value = deadbeef->pl_find_meta (track, ":URI");
+    if (value && value[0] == G_DIR_SEPARATOR)
+        uri = g_strdup (value);
+    deadbeef->pl_unlock ();
+    return uri;
+}
+
+/* Follow the playing track in the folder tree, takes ownership of the URI */
+static gboolean
+reveal_playing (gpointer data)
+{
+    gchar *uri = data;
+    if (treeview && CONFIG_VIEW_MODE == VIEW_MODE_FOLDERS && ! CONFIG_HIDDEN && ! dormant)
+        treeview_reveal_async (uri);
+    g_free (uri);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+/* Restore cursor and scroll position from saved state */
+static void
+treeview_restore_position (SessionState *state)
+{
+    GtkTreeIter iter;
+    GtkTreePath *path;
+
+    gchar *root = get_default_dir ();
+    gboolean same_root = utils_str_equal (state->root, root);
+    g_free (root);
+    if (! same_root)
+        return;
+
+    if (treeview_find_iter (state->selected, &iter)) {
+        path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &iter);
+        gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, NULL, FALSE);
+        gtk_tree_path_free (path);
+    }
+
+    if (treeview_find_iter (state->scroll_anchor, &iter)) {
+        path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &iter);
+        gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (treeview), path, NULL, TRUE, 0.0, 0.0);
+        gtk_tree_path_free (path);
+    }
 }
 
+/* Update the parts of the view that depend on changed settings, ctx holds
+ * CONFIG_CHANGED_* flags */
 static gboolean
 treeview_update (void *ctx)
 {
-    trace("update treeview\n");
-    treebrowser_chroot (NULL);  // update treeview
-    treeview_restore_expanded (NULL);
+    guint changed = GPOINTER_TO_UINT (ctx);
+    trace("update treeview: %#x\n", changed);
+
+    if (changed & CONFIG_CHANGED_STYLE)
+        treeview_apply_style ();
+    if (changed & CONFIG_CHANGED_ROOT)
+        treebrowser_chroot (NULL);  // update treeview, expanded rows are restored automatically
+    else if (! dormant) {  // a dormant tree is filled with the new settings when waking up
+        if (changed & CONFIG_CHANGED_FILTER)
+            treeview_refilter ();  // rows that stay shown keep their icons
+        if (changed & CONFIG_CHANGED_ICONS)
+            treeview_refresh_icons ();
+        if (changed & CONFIG_CHANGED_RECENT) {
+            virtual_rows_show ();
+            tag_scan_update ();
+        }
+    }
 
     /* This function MUST return false because it's called from g_idle_add() */
     return FALSE;
@@ -334,8 +870,16 @@ handle_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2)
     if (! CONFIG_ENABLED)
         return 0;
 
-    if (id == DB_EV_CONFIGCHANGED)
-        on_config_changed (ctx);
+    /* Settings are read on the main thread once a burst of changes is over */
+    if (id == DB_EV_CONFIGCHANGED && g_atomic_int_compare_and_exchange (&config_change_pending, FALSE, TRUE))
+        g_timeout_add (CONFIG_CHANGE_DELAY_MS, on_config_changed, &config_change_pending);
+
+    if (id == DB_EV_SONGSTARTED && CONFIG_FOLLOW_PLAYING) {
+        ddb_event_track_t *ev = (ddb_event_track_t *) ctx;
+        gchar *uri = ev->track ? get_track_uri (ev->track) : NULL;
+        if (uri)
+            g_idle_add (reveal_playing, uri);
+    }
 
     return 0;
 }
@@ -353,12 +897,18 @@ on_menu_toggle (GtkMenuItem *menuitem, gpointer *user_data)
         gtk_widget_show (sidebar_vbox);
 }
 
-static int
-on_config_changed (uintptr_t ctx)
+/* Act on the settings that changed since the last snapshot. Integer
+ * settings are compared with the values in use, the menu applies some of
+ * them before the change event arrives. */
+static gboolean
+on_config_changed (gpointer data)
 {
+    g_atomic_int_set (&config_change_pending, FALSE);
+
     gboolean    enabled         = CONFIG_ENABLED;
     gboolean    hidden          = CONFIG_HIDDEN;
     gboolean    show_hidden     = CONFIG_SHOW_HIDDEN_FILES;
+    gboolean    show_recent     = CONFIG_SHOW_RECENT;
     gboolean    filter_enabled  = CONFIG_FILTER_ENABLED;
     gboolean    filter_auto     = CONFIG_FILTER_AUTO;
     gboolean    show_icons      = CONFIG_SHOW_ICONS;
@@ -366,18 +916,13 @@ on_config_changed (uintptr_t ctx)
     gint        width           = CONFIG_WIDTH;
     gint        coverart_size   = CONFIG_COVERART_SIZE;
     gint        icon_size       = CONFIG_ICON_SIZE;
+    gint        font_size       = CONFIG_FONT_SIZE;
 
-    gchar *     default_path    = g_strdup (CONFIG_DEFAULT_PATH);
-    gchar *     filter          = g_strdup (CONFIG_FILTER);
-    gchar *     coverart        = g_strdup (CONFIG_COVERART);
-    gchar *     bgcolor         = g_strdup (CONFIG_COLOR_BG);
-    gchar *     fgcolor         = g_strdup (CONFIG_COLOR_BG);
-    gchar *     bgcolor_sel     = g_strdup (CONFIG_COLOR_BG_SEL);
-    gchar *     fgcolor_sel     = g_strdup (CONFIG_COLOR_BG_SEL);
-
-    gboolean do_update              = FALSE;
+    guint       changed         = 0;
 
-    load_config ();
+    guint64 keys = load_config ();
+    if (! keys)
+        return FALSE;
 
     if (enabled != CONFIG_ENABLED) {
         if (CONFIG_ENABLED)
@@ -397,44 +942,49 @@ on_config_changed (uintptr_t ctx)
         if (width != CONFIG_WIDTH)
             gtk_widget_set_size_request (sidebar_vbox, CONFIG_WIDTH, -1);
 
+        if (keys & CONFIG_KEY_BIT (CONFIG_KEY_DEFAULT_PATH))
+            changed |= CONFIG_CHANGED_ROOT;
+
         if ((show_hidden != CONFIG_SHOW_HIDDEN_FILES) ||
                 (filter_enabled != CONFIG_FILTER_ENABLED) ||
                 (filter_enabled && (filter_auto != CONFIG_FILTER_AUTO)) ||
-                (show_icons != CONFIG_SHOW_ICONS) ||
-                (tree_lines != CONFIG_SHOW_TREE_LINES) ||
+                (CONFIG_FILTER_ENABLED && ! CONFIG_FILTER_AUTO
+                    && (keys & CONFIG_KEY_BIT (CONFIG_KEY_FILTER))))
+            changed |= CONFIG_CHANGED_FILTER;
+
+        if ((show_icons != CONFIG_SHOW_ICONS) ||
                 (show_icons && (coverart_size != CONFIG_COVERART_SIZE)) ||
-                (show_icons && (icon_size != CONFIG_ICON_SIZE)))
-            do_update = TRUE;
-
-        if (CONFIG_FILTER_ENABLED) {
-            if (CONFIG_FILTER_AUTO) {
-                gchar *autofilter = g_strdup (known_extensions);
-                create_autofilter ();
-                if (! utils_str_equal (autofilter, known_extensions))
-                    do_update = TRUE;
-                g_free (autofilter);
-            }
-            else
-                if (! utils_str_equal (filter, CONFIG_FILTER))
-                    do_update = TRUE;
-        }
+                (show_icons && (icon_size != CONFIG_ICON_SIZE)) ||
+                (show_icons && (keys & CONFIG_KEY_BIT (CONFIG_KEY_COVERART))))
+            changed |= CONFIG_CHANGED_ICONS;
+
+        if ((tree_lines != CONFIG_SHOW_TREE_LINES) ||
+                (font_size != CONFIG_FONT_SIZE))
+            changed |= CONFIG_CHANGED_STYLE;
 
-        if (! utils_str_equal (coverart, CONFIG_COVERART))
-            do_update = TRUE;
+        if (show_recent != CONFIG_SHOW_RECENT)
+            changed |= CONFIG_CHANGED_RECENT;
+
+        if (keys & CONFIG_KEYS_COLORS)
+            utils_construct_style (treeview, CONFIG_COLOR_BG, CONFIG_COLOR_FG, CONFIG_COLOR_BG_SEL, CONFIG_COLOR_FG_SEL);
     }
 
-    g_free (default_path);
-    g_free (filter);
-    g_free (coverart);
-    g_free (bgcolor);
-    g_free (fgcolor);
-    g_free (bgcolor_sel);
-    g_free (fgcolor_sel);
+    if (changed)
+        treeview_update (GUINT_TO_POINTER (changed));
 
-    if (do_update)
-        g_idle_add (treeview_update, NULL);
+    /* This function MUST return false because it's called from g_timeout_add() */
+    return FALSE;
+}
 
-    return 0;
+static void
+on_drag_data_get_smart_folder (gpointer data, gpointer userdata)
+{
+    GString *uri_str = userdata;
+    gchar *enc_uri = g_filename_to_uri (data, NULL, NULL);
+    if (uri_str->len > 0)
+        g_string_append_c (uri_str, ' ');
+    g_string_append (uri_str, enc_uri);
+    g_free (enc_uri);
 }
 
 void on_drag_data_get_helper (gpointer data, gpointer userdata)
@@ -447,6 +997,21 @@ void on_drag_data_get_helper (gpointer data, gpointer userdata)
     if (! gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path))
         return;
 
+    SmartFolder *folder = smart_folder_for_iter (&iter);
+    if (folder) {
+        smartfolder_foreach (folder, (GFunc) on_drag_data_get_smart_folder, uri_str);
+        return;
+    }
+    gint flag;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    if (flag == TREEBROWSER_FLAGS_RECENT) {
+        GList *files = NULL;
+        get_uris_from_recent_row (&files);
+        g_list_foreach (files, (GFunc) on_drag_data_get_smart_folder, uri_str);
+        g_list_free_full (files, g_free);
+        return;
+    }
+
     gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
                     TREEBROWSER_COLUMN_URI, &uri, -1);
 
@@ -706,6 +1271,18 @@ create_popup_menu (GtkTreePath *path, gchar *name, GList *uri_list)
     gtk_container_add (GTK_CONTAINER (menu), item);
     g_signal_connect (item, "activate", G_CALLBACK (on_menu_refresh), NULL);
 
+    item = gtk_menu_item_new_with_mnemonic (_("Reveal _now playing"));
+    gtk_container_add (GTK_CONTAINER (menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_menu_reveal_playing), NULL);
+
+    GtkTreeIter iter;
+    if (path && gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path)
+                && smart_folder_for_iter (&iter)) {
+        item = gtk_menu_item_new_with_mnemonic (_("Remove _smart folder"));
+        gtk_container_add (GTK_CONTAINER (menu), item);
+        g_signal_connect (item, "activate", G_CALLBACK (on_menu_remove_smart_folder), path);
+    }
+
     item = gtk_separator_menu_item_new ();
     gtk_container_add (GTK_CONTAINER (menu), item);
 
@@ -737,6 +1314,16 @@ create_popup_menu (GtkTreePath *path, gchar *name, GList *uri_list)
     gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), CONFIG_SHOW_HIDDEN_FILES);
     g_signal_connect (item, "activate", G_CALLBACK (on_menu_show_hidden_files), NULL);
 
+    item = gtk_check_menu_item_new_with_mnemonic (_("Show _recently added"));
+    gtk_container_add (GTK_CONTAINER (menu), item);
+    gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), CONFIG_SHOW_RECENT);
+    g_signal_connect (item, "activate", G_CALLBACK (on_menu_show_recent), NULL);
+
+    item = gtk_check_menu_item_new_with_mnemonic (_("F_ollow playing track"));
+    gtk_container_add (GTK_CONTAINER (menu), item);
+    gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), CONFIG_FOLLOW_PLAYING);
+    g_signal_connect (item, "activate", G_CALLBACK (on_menu_follow_playing), NULL);
+
     item = gtk_check_menu_item_new_with_mnemonic (_("_Filter files"));
     gtk_container_add (GTK_CONTAINER (menu), item);
     gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), CONFIG_FILTER_ENABLED);
@@ -771,9 +1358,6 @@ create_view_and_model (void)
     gtk_tree_view_column_add_attribute (treeview_column_text, render_text,
                     "text", TREEBROWSER_RENDER_TEXT);
 
-    if (CONFIG_FONT_SIZE > 0)
-        g_object_set (render_text, "size", CONFIG_FONT_SIZE*1024, NULL);
-
     gtk_tree_view_set_enable_search (GTK_TREE_VIEW (view), TRUE);
     gtk_tree_view_set_search_column (GTK_TREE_VIEW (view), TREEBROWSER_COLUMN_NAME);
 
@@ -788,42 +1372,422 @@ create_view_and_model (void)
 
 #if GTK_CHECK_VERSION(2, 10, 0)
     g_object_set (view, "has-tooltip", TRUE, "tooltip-column", TREEBROWSER_COLUMN_TOOLTIP, NULL);
-    gtk_tree_view_set_enable_tree_lines (GTK_TREE_VIEW (view), CONFIG_SHOW_TREE_LINES);
 #endif
 
     treestore = gtk_tree_store_new (TREEBROWSER_COLUMNC, GDK_TYPE_PIXBUF,
                     G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT);
     gtk_tree_view_set_model (GTK_TREE_VIEW(view), GTK_TREE_MODEL (treestore));
+    row_index_clear ();
 
     return view;
 }
 
+/* Apply settings that only change how rows are drawn */
 static void
-create_sidebar (void)
+treeview_apply_style (void)
 {
-    trace("create sidebar\n");
-    GtkWidget           *scrollwin;
-    GtkTreeSelection    *selection;
+    if (! treeview)
+        return;
 
-    treeview            = create_view_and_model ();
-#if !GTK_CHECK_VERSION(3,0,0)
-    sidebar_vbox        = gtk_vbox_new (FALSE, 0);
-    sidebar_vbox_bars   = gtk_vbox_new (FALSE, 0);
-#else
-    sidebar_vbox        = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
-    sidebar_vbox_bars   = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+#if GTK_CHECK_VERSION(2, 10, 0)
+    gtk_tree_view_set_enable_tree_lines (GTK_TREE_VIEW (treeview), CONFIG_SHOW_TREE_LINES);
 #endif
-    selection           = gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview));
-    scrollwin           = gtk_scrolled_window_new (NULL, NULL);
-
-    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrollwin),
-                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    if (CONFIG_FONT_SIZE > 0)
+        g_object_set (render_text, "size", CONFIG_FONT_SIZE*1024, NULL);
+    else
+        g_object_set (render_text, "size-set", FALSE, NULL);
 
+    gtk_tree_view_columns_autosize (GTK_TREE_VIEW (treeview));
+}
 
-    gtk_container_add(GTK_CONTAINER (scrollwin), treeview);
+static void
+icon_job_free (IconJob *job)
+{
+    g_strfreev (job->uris);
+    g_free (job);
+}
+
+/* Look up the icons of a chunk of rows again */
+static gboolean
+icon_job_step (gpointer data)
+{
+    IconJob *job = data;
+
+    for (guint i = 0; i < FILL_CHUNK_ROWS && job->uris[job->next]; i++) {
+        gchar *uri = job->uris[job->next++];
+        GtkTreeIter iter;
+        if (! treeview_find_iter (uri, &iter))
+            continue;
+
+        GdkPixbuf *icon = get_icon_for_uri (current_view, uri);
+        gtk_tree_store_set (treestore, &iter, TREEBROWSER_COLUMN_ICON, icon, -1);
+        if (icon)
+            g_object_unref (icon);
+    }
+
+    if (job->uris[job->next])
+        return TRUE;
+
+    icon_job = 0;
+    return FALSE;
+}
+
+/* Icon settings changed, rows keep their place */
+static void
+treeview_refresh_icons (void)
+{
+    if (icon_job)
+        scheduler_remove (icon_job);
+    icon_job = 0;
+
+    virtual_rows_show ();
+    if (! row_index || g_hash_table_size (row_index) == 0)
+        return;
+
+    IconJob *job = g_new0 (IconJob, 1);
+    job->uris = g_new0 (gchar *, g_hash_table_size (row_index) + 1);
+
+    GHashTableIter hash_iter;
+    gpointer key;
+    guint n = 0;
+    g_hash_table_iter_init (&hash_iter, row_index);
+    while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+        job->uris[n++] = g_strdup (key);
+
+    icon_job = scheduler_add (SCHEDULER_PRIORITY_USER, icon_job_step, job, (GDestroyNotify) icon_job_free);
+}
+
+/* Check if row shows entry of its directory */
+static gboolean
+treebrowser_row_is_entry (GtkTreeIter *iter, const ListingEntry *entry)
+{
+    gchar *uri, *name;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
+                    TREEBROWSER_COLUMN_NAME,    &name,
+                    TREEBROWSER_COLUMN_URI,     &uri,
+                    -1);
+    gboolean same = uri && utils_str_equal (name, entry->name);
+    g_free (name);
+    g_free (uri);
+    return same;
+}
+
+/* Remove row and move iter to the next one, returns FALSE if there is none */
+static gboolean
+treebrowser_remove_row (GtkTreeIter *iter)
+{
+    GtkTreeIter next = *iter;
+    gboolean valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (treestore), &next);
+    gtk_tree_store_iter_clear_nodes (iter, TRUE);
+    *iter = next;
+    return valid;
+}
+
+/* Filter the rows of a shown directory again, using the listing they were
+ * filled from. Rows that stay shown are kept with their children, so
+ * expanded rows, the cursor and the scroll position are not touched. */
+static void
+treebrowser_refilter_dir (const gchar *dir)
+{
+    GtkTreeIter     parent_iter, row;
+    GtkTreeIter     *parent = NULL;
+    gint            flag = 0;
+
+    if (dir[0]) {
+        if (! treeview_find_iter (dir, &parent_iter)) {
+            g_hash_table_remove (typeahead_indexes, dir);  // row was removed
+            return;
+        }
+        parent = &parent_iter;
+        gtk_tree_model_get (GTK_TREE_MODEL (treestore), parent, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    }
+
+    TypeAheadIndex *index = g_hash_table_lookup (typeahead_indexes, dir);
+    DirListing *listing = index ? typeahead_index_get_listing (index) : NULL;
+    if (! listing)
+        return;
+
+    GPtrArray *restore = g_ptr_array_new_with_free_func ((GDestroyNotify) gtk_tree_row_reference_free);
+    FillJob *job = fill_job_new (listing, parent, restore, FALSE);
+
+    /* Smart folders and recently added albums are on top of the tree */
+    gboolean valid = gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &row, parent);
+    while (valid && ! parent) {
+        gint row_flag;
+        gtk_tree_model_get (GTK_TREE_MODEL (treestore), &row, TREEBROWSER_COLUMN_FLAG, &row_flag, -1);
+        if (row_flag != TREEBROWSER_FLAGS_SMART_FOLDER && row_flag != TREEBROWSER_FLAGS_RECENT
+                    && row_flag != TREEBROWSER_FLAGS_SEPARATOR)
+            break;
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (treestore), &row);
+    }
+
+    /* Shown rows are in listing order, so both are walked together */
+    for (guint i = 0; i < listing->n_entries; i++) {
+        ListingEntry *entry = &listing->entries[i];
+        gboolean shown = ! check_hidden (job->config, entry->name)
+                    && (entry->is_dir || check_filtered (job->config, entry->display));
+        gboolean same = valid && treebrowser_row_is_entry (&row, entry);
+
+        if (shown && same) {
+            typeahead_index_add (job->index, entry);
+            valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (treestore), &row);
+        }
+        else if (shown)
+            treebrowser_add_entry (job, parent, valid ? &row : NULL, entry);
+        else if (same)
+            valid = treebrowser_remove_row (&row);
+        job->all_hidden &= ! shown;
+    }
+
+    /* Placeholders are added again if still needed */
+    while (valid)
+        valid = treebrowser_remove_row (&row);
+
+    fill_job_finish (job, parent);
+    fill_job_free (job);
+
+    /* Collapsed rows are still listed again when they are expanded */
+    if (parent)
+        gtk_tree_store_set (treestore, parent, TREEBROWSER_COLUMN_FLAG, flag, -1);
+}
+
+/* Filter settings changed, the shown directories are filtered again in
+ * memory; the tree is only rebuilt while rows are still being added */
+static void
+treeview_refilter (void)
+{
+    if (! typeahead_indexes || restore_waves_active > 0
+                || (fill_jobs && g_hash_table_size (fill_jobs) > 0)) {
+        treebrowser_chroot (NULL);
+        return;
+    }
+
+    /* Refiltering replaces the keys */
+    GPtrArray *dirs = g_ptr_array_new_with_free_func (g_free);
+    GHashTableIter hash_iter;
+    gpointer key;
+    g_hash_table_iter_init (&hash_iter, typeahead_indexes);
+    while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+        g_ptr_array_add (dirs, g_strdup (key));
+
+    for (guint i = 0; i < dirs->len; i++)
+        treebrowser_refilter_dir (g_ptr_array_index (dirs, i));
+    g_ptr_array_unref (dirs);
+
+    search_index_update (FALSE);
+    tag_scan_update ();
+}
+
+/* Progress bar shown while files are added to a playlist */
+static GtkWidget *
+create_import_bar (void)
+{
+    GtkWidget *cancel;
+
+#if !GTK_CHECK_VERSION(3,0,0)
+    import_bar          = gtk_hbox_new (FALSE, 0);
+#else
+    import_bar          = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+#endif
+    import_progress     = gtk_progress_bar_new ();
+    cancel              = gtk_button_new_with_label (_("Cancel"));
+
+#if GTK_CHECK_VERSION(3,0,0)
+    gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (import_progress), TRUE);
+#endif
+    gtk_widget_set_tooltip_text (cancel, _("Stop adding files"));
+
+    gtk_box_pack_start (GTK_BOX (import_bar), import_progress, TRUE, TRUE, 1);
+    gtk_box_pack_start (GTK_BOX (import_bar), cancel, FALSE, FALSE, 1);
+
+    g_signal_connect (cancel,           "clicked",  G_CALLBACK (on_button_import_cancel),   NULL);
+    g_signal_connect (import_bar,       "destroy",  G_CALLBACK (gtk_widget_destroyed),      &import_bar);
+    g_signal_connect (import_progress,  "destroy",  G_CALLBACK (gtk_widget_destroyed),      &import_progress);
+
+    /* Stays hidden until an import starts */
+    gtk_widget_show_all (import_bar);
+    gtk_widget_hide (import_bar);
+    gtk_widget_set_no_show_all (import_bar, TRUE);
+
+    return import_bar;
+}
+
+/* Search entry and result list, the list replaces the tree while searching */
+static void
+create_search (void)
+{
+    GtkCellRenderer *render;
+    GtkWidget *item;
+
+    search_entry        = gtk_entry_new ();
+    search_store        = gtk_list_store_new (SEARCH_COLUMNC,
+                                G_TYPE_STRING,      // name
+                                G_TYPE_STRING,      // uri
+                                G_TYPE_STRING);     // tooltip
+    search_view         = gtk_tree_view_new_with_model (GTK_TREE_MODEL (search_store));
+    search_scrollwin    = gtk_scrolled_window_new (NULL, NULL);
+    render              = gtk_cell_renderer_text_new ();
+    g_object_unref (search_store);  // owned by the view
+
+#if GTK_CHECK_VERSION(3,2,0)
+    gtk_entry_set_placeholder_text (GTK_ENTRY (search_entry), _("Search library"));
+#endif
+    gtk_widget_set_tooltip_text (search_entry, _("Search all files and folders below the root directory.\n"
+                            "Tags can be queried too, e.g. genre:jazz year:1955..1965 "
+                            "format:flac duration>20m -artist:\"miles davis\""));
+
+    gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (search_view), FALSE);
+    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (search_view), -1, NULL,
+                                render, "text", SEARCH_COLUMN_NAME, NULL);
+    g_object_set (search_view, "has-tooltip", TRUE, "tooltip-column", SEARCH_COLUMN_TOOLTIP, NULL);
+
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (search_scrollwin),
+                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add (GTK_CONTAINER (search_scrollwin), search_view);
+
+    /* Popup menu for query results, it adds all matches and not just the shown ones */
+    search_menu = gtk_menu_new ();
+    gtk_menu_attach_to_widget (GTK_MENU (search_menu), search_view, NULL);  // destroyed with the view
+
+    item = gtk_menu_item_new_with_mnemonic (_("_Add all results to current playlist"));
+    gtk_container_add (GTK_CONTAINER (search_menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_search_menu_add_current), NULL);
+
+    item = gtk_menu_item_new_with_mnemonic (_("Add all results to _new playlist"));
+    gtk_container_add (GTK_CONTAINER (search_menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_search_menu_add_new), NULL);
+
+    item = gtk_separator_menu_item_new ();
+    gtk_container_add (GTK_CONTAINER (search_menu), item);
+
+    item = gtk_menu_item_new_with_mnemonic (_("_Save as smart folder"));
+    gtk_container_add (GTK_CONTAINER (search_menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_search_menu_save), NULL);
+    gtk_widget_show_all (search_menu);
+
+    g_signal_connect (search_entry,     "changed",          G_CALLBACK (on_search_changed),         NULL);
+    g_signal_connect (search_entry,     "activate",         G_CALLBACK (on_search_activate),        NULL);
+    g_signal_connect (search_view,      "row-activated",    G_CALLBACK (on_search_row_activated),   NULL);
+    g_signal_connect (search_view,      "button-press-event", G_CALLBACK (on_search_button_press),  NULL);
+    g_signal_connect (search_entry,     "destroy",          G_CALLBACK (gtk_widget_destroyed),      &search_entry);
+    g_signal_connect (search_scrollwin, "destroy",          G_CALLBACK (gtk_widget_destroyed),      &search_scrollwin);
+    g_signal_connect (search_view,      "destroy",          G_CALLBACK (gtk_widget_destroyed),      &search_view);
+
+    /* Results stay hidden until something is typed */
+    gtk_widget_show_all (search_scrollwin);
+    gtk_widget_hide (search_scrollwin);
+    gtk_widget_set_no_show_all (search_scrollwin, TRUE);
+}
+
+/* Switch between the folder tree and the tag views */
+static GtkWidget *
+create_view_selector (void)
+{
+    view_selector = gtk_combo_box_text_new ();
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (view_selector), _("Folders"));
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (view_selector), _("Artists"));
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (view_selector), _("Genres"));
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (view_selector), _("Years"));
+    gtk_combo_box_set_active (GTK_COMBO_BOX (view_selector), CONFIG_VIEW_MODE);
+
+    g_signal_connect (view_selector, "changed", G_CALLBACK (on_view_mode_changed),   NULL);
+    g_signal_connect (view_selector, "destroy", G_CALLBACK (gtk_widget_destroyed),   &view_selector);
+
+    return view_selector;
+}
+
+/* Library grouped by tags, shown instead of the tree */
+static void
+create_tag_view (void)
+{
+    GtkCellRenderer *render;
+    GtkWidget       *item;
+
+    tag_model           = gtk_tree_store_new (TAGVIEW_COLUMNC,
+                                G_TYPE_STRING,      // name
+                                G_TYPE_STRING,      // tooltip
+                                G_TYPE_UINT,        // first track
+                                G_TYPE_UINT,        // last track + 1
+                                G_TYPE_INT);        // level
+    tag_view            = gtk_tree_view_new_with_model (GTK_TREE_MODEL (tag_model));
+    tag_scrollwin       = gtk_scrolled_window_new (NULL, NULL);
+    render              = gtk_cell_renderer_text_new ();
+    g_object_unref (tag_model);  // owned by the view
+
+    if (CONFIG_FONT_SIZE > 0)
+        g_object_set (render, "size", CONFIG_FONT_SIZE*1024, NULL);
+
+    gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (tag_view), FALSE);
+    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (tag_view), -1, NULL,
+                                render, "text", TAGVIEW_COLUMN_NAME, NULL);
+    gtk_tree_view_set_search_column (GTK_TREE_VIEW (tag_view), TAGVIEW_COLUMN_NAME);
+    g_object_set (tag_view, "has-tooltip", TRUE, "tooltip-column", TAGVIEW_COLUMN_TOOLTIP, NULL);
+
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (tag_scrollwin),
+                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add (GTK_CONTAINER (tag_scrollwin), tag_view);
+
+    /* Popup menu is built once, the handlers work on the selected row */
+    tag_menu = gtk_menu_new ();
+    gtk_menu_attach_to_widget (GTK_MENU (tag_menu), tag_view, NULL);  // destroyed with the view
+
+    item = gtk_menu_item_new_with_mnemonic (_("_Add to current playlist"));
+    gtk_container_add (GTK_CONTAINER (tag_menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_tag_menu_add_current), NULL);
+
+    item = gtk_menu_item_new_with_mnemonic (_("Add to _new playlist"));
+    gtk_container_add (GTK_CONTAINER (tag_menu), item);
+    g_signal_connect (item, "activate", G_CALLBACK (on_tag_menu_add_new), NULL);
+    gtk_widget_show_all (tag_menu);
+
+    g_signal_connect (tag_view,         "row-expanded",         G_CALLBACK (on_tag_view_row_expanded),  NULL);
+    g_signal_connect (tag_view,         "row-activated",        G_CALLBACK (on_tag_view_row_activated), NULL);
+    g_signal_connect (tag_view,         "button-press-event",   G_CALLBACK (on_tag_view_button_press),  NULL);
+    g_signal_connect (tag_view,         "destroy",              G_CALLBACK (gtk_widget_destroyed),      &tag_view);
+    g_signal_connect (tag_scrollwin,    "destroy",              G_CALLBACK (gtk_widget_destroyed),      &tag_scrollwin);
+
+    /* Shown instead of the tree when a tag view is selected */
+    gtk_widget_show_all (tag_scrollwin);
+    gtk_widget_hide (tag_scrollwin);
+    gtk_widget_set_no_show_all (tag_scrollwin, TRUE);
+}
+
+static void
+create_sidebar (void)
+{
+    trace("create sidebar\n");
+    GtkWidget           *scrollwin;
+    GtkTreeSelection    *selection;
+
+    treeview            = create_view_and_model ();
+    treeview_apply_style ();
+#if !GTK_CHECK_VERSION(3,0,0)
+    sidebar_vbox        = gtk_vbox_new (FALSE, 0);
+    sidebar_vbox_bars   = gtk_vbox_new (FALSE, 0);
+#else
+    sidebar_vbox        = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+    sidebar_vbox_bars   = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+#endif
+    selection           = gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview));
+    scrollwin           = gtk_scrolled_window_new (NULL, NULL);
+    tree_scrollwin      = scrollwin;
+
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrollwin),
+                                    GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+
+
+    gtk_container_add(GTK_CONTAINER (scrollwin), treeview);
+
+    create_search ();
+    create_tag_view ();
+    gtk_box_pack_start (GTK_BOX (sidebar_vbox_bars), create_view_selector (), FALSE, TRUE, 1);
+    gtk_box_pack_start (GTK_BOX (sidebar_vbox_bars), search_entry, FALSE, TRUE, 1);
 
     gtk_box_pack_start (GTK_BOX (sidebar_vbox), sidebar_vbox_bars, FALSE, TRUE, 1);
     gtk_box_pack_start (GTK_BOX (sidebar_vbox), scrollwin, TRUE, TRUE, 1);
+    gtk_box_pack_start (GTK_BOX (sidebar_vbox), tag_scrollwin, TRUE, TRUE, 1);
+    gtk_box_pack_start (GTK_BOX (sidebar_vbox), search_scrollwin, TRUE, TRUE, 1);
+    gtk_box_pack_end (GTK_BOX (sidebar_vbox), create_import_bar (), FALSE, TRUE, 1);
 
     g_signal_connect (treeview,     "button-press-event",   G_CALLBACK (on_treeview_mouseclick_press),      selection);
     g_signal_connect (treeview,     "button-release-event", G_CALLBACK (on_treeview_mouseclick_release),    selection);
@@ -831,8 +1795,17 @@ create_sidebar (void)
     //g_signal_connect (treeview,     "row-activated",        G_CALLBACK (on_treeview_row_activated),         NULL);
     g_signal_connect (treeview,     "row-collapsed",        G_CALLBACK (on_treeview_row_collapsed),         NULL);
     g_signal_connect (treeview,     "row-expanded",         G_CALLBACK (on_treeview_row_expanded),          NULL);
+    g_signal_connect (treeview,     "cursor-changed",       G_CALLBACK (on_treeview_state_changed),         NULL);
+    g_signal_connect (treeview,     "key-press-event",      G_CALLBACK (on_treeview_key_press),             NULL);
+    g_signal_connect (treeview,     "destroy",              G_CALLBACK (gtk_widget_destroyed),              &treeview);
+    g_signal_connect (sidebar_vbox, "map",                  G_CALLBACK (on_sidebar_map),                    NULL);
+    g_signal_connect (sidebar_vbox, "unmap",                G_CALLBACK (on_sidebar_unmap),                  NULL);
+    g_signal_connect (scrollwin,    "destroy",              G_CALLBACK (gtk_widget_destroyed),              &tree_scrollwin);
+    g_signal_connect (gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (scrollwin)),
+                                    "value-changed",        G_CALLBACK (on_treeview_state_changed),         NULL);
 
     gtk_widget_show_all (sidebar_vbox);
+    update_sidebar_view ();
 }
 
 
@@ -845,14 +1818,76 @@ gtk_tree_store_iter_clear_nodes (gpointer iter, gboolean delete_root)
 {
     GtkTreeIter i;
     while (gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &i, iter))
-    {
-        if (gtk_tree_model_iter_has_child (GTK_TREE_MODEL (treestore), &i))
-            gtk_tree_store_iter_clear_nodes (&i, TRUE);
-        if (gtk_tree_store_iter_is_valid (GTK_TREE_STORE (treestore), &i))
-            gtk_tree_store_remove (GTK_TREE_STORE (treestore), &i);
-    }
-    if (delete_root)
+        gtk_tree_store_iter_clear_nodes (&i, TRUE);
+    if (delete_root) {
+        row_index_remove (iter);
         gtk_tree_store_remove (GTK_TREE_STORE (treestore), iter);
+    }
+}
+
+/* Whether iter is below a smart folder or the recently added albums, whose
+ * rows can show directories of the folder tree a second time */
+static gboolean
+row_is_virtual (GtkTreeIter *iter)
+{
+    GtkTreeIter top = *iter, parent;
+    while (gtk_tree_model_iter_parent (GTK_TREE_MODEL (treestore), &parent, &top))
+        top = parent;
+
+    gint flag;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), &top, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    return (flag == TREEBROWSER_FLAGS_SMART_FOLDER || flag == TREEBROWSER_FLAGS_RECENT);
+}
+
+/* Key of the fill and type-ahead state of a directory row: its URI, prefixed
+ * with the number of the top-level row below a virtual one, so the same
+ * directory shown there doesn't share the state of the folder tree */
+static gchar *
+row_state_key (GtkTreeIter *iter)
+{
+    gchar *uri;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter, TREEBROWSER_COLUMN_URI, &uri, -1);
+    if (! uri || ! row_is_virtual (iter))
+        return uri;
+
+    GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), iter);
+    gchar *key = g_strdup_printf ("%d:%s", gtk_tree_path_get_indices (path)[0], uri);
+    gtk_tree_path_free (path);
+    g_free (uri);
+    return key;
+}
+
+/* Remember the row of uri in the folder tree; rows of a GtkTreeStore keep
+ * their iters until they are removed */
+static void
+row_index_add (const gchar *uri, GtkTreeIter *iter)
+{
+    if (row_is_virtual (iter))
+        return;
+    if (! row_index)
+        row_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                        (GDestroyNotify) gtk_tree_iter_free);
+    g_hash_table_replace (row_index, g_strdup (uri), gtk_tree_iter_copy (iter));
+}
+
+/* Forget row before it is removed, rows of virtual subtrees aren't indexed */
+static void
+row_index_remove (GtkTreeIter *iter)
+{
+    gchar *uri;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter, TREEBROWSER_COLUMN_URI, &uri, -1);
+
+    GtkTreeIter *indexed = (uri && row_index) ? g_hash_table_lookup (row_index, uri) : NULL;
+    if (indexed && indexed->user_data == iter->user_data)
+        g_hash_table_remove (row_index, uri);
+    g_free (uri);
+}
+
+static void
+row_index_clear (void)
+{
+    if (row_index)
+        g_hash_table_remove_all (row_index);
 }
 
 /* Add given URI to DeaDBeeF's current playlist */
@@ -906,94 +1941,61 @@ add_uri_to_playlist (GList *uri_list, int index)
         plt = deadbeef->plt_get_for_idx (index);
     }
 
+    deadbeef->pl_unlock ();
+
     if (plt == NULL) {
         fprintf (stderr, _("could not get playlist\n"));
-        deadbeef->pl_unlock ();
         return;
     }
 
-    if (deadbeef->plt_add_files_begin (plt, 0) >= 0)  // -1 means error
-    {
-        GList *node;
-        for (node = uri_list->next; node; node = node->next)
-        {
-            gchar *uri = node->data;
-            trace("trying to add file/folder %s\n", uri);
-            if (g_file_test (uri, G_FILE_TEST_IS_DIR)) {
-                if (deadbeef->plt_add_dir (plt, uri, NULL, NULL) < 0)
-                    fprintf (stderr, _("failed to add folder %s\n"), uri);
-            }
-            else {
-                if (deadbeef->plt_add_file (plt, uri, NULL, NULL) < 0)
-                    fprintf (stderr, _("failed to add file %s\n"), uri);
-            }
-        }
-        deadbeef->plt_modified (plt);
-    }
-    else
-    {
-        fprintf (stderr, _("could not add files to playlist (lock failed)\n"));
-    }
-
-    deadbeef->plt_add_files_end (plt, 0);
-    deadbeef->pl_unlock ();
+    /* Folders are expanded and files added on a worker thread, reusing the
+     * listings already shown in the browser */
+    import_add (plt, uri_list->next, current_view->filter);  // first item is always NULL
 }
 
-/* Check if file is filtered (return FALSE if file is filtered and not shown) */
-static gboolean
-check_filtered (const gchar *base_name)
+/* Import progress reported from worker thread */
+static void
+on_import_progress (guint done, guint total, gboolean finished, gpointer user_data)
 {
-    if (! CONFIG_FILTER_ENABLED)
-        return TRUE;
+    if (! import_bar || ! import_progress)
+        return;
 
-    const gchar *filter;
-    if (! CONFIG_FILTER_AUTO)
-        filter = CONFIG_FILTER;
-    else
-        filter = known_extensions;
-    if (strlen (filter) == 0)
-        return TRUE;
+    if (finished && ! import_is_running ()) {
+        gtk_widget_hide (import_bar);
+        return;
+    }
 
-    /* Use two filterstrings for upper- & lowercase matching */
-    gchar *filter_u = g_ascii_strup (filter, -1);
-    gchar **filters_u = g_strsplit (filter_u, ";", 0);
-    g_free (filter_u);
-
-    gchar *filter_d = g_ascii_strdown (filter, -1);
-    gchar **filters_d = g_strsplit (filter_d, ";", 0);
-    g_free (filter_d);
-
-    gboolean filtered = FALSE;
-    for (gint i = 0; filters_u[i] && filters_d[i]; i++) {
-        if (utils_str_equal (base_name, "*")
-                    || g_pattern_match_simple (filters_u[i], base_name)
-                    || g_pattern_match_simple (filters_d[i], base_name)) {
-            filtered = TRUE;
-            break;
-        }
+    gchar *text;
+    if (total > 0) {
+        gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (import_progress), (gdouble) done / total);
+        text = g_strdup_printf (_("Adding files: %u / %u"), done, total);
+    }
+    else {
+        gtk_progress_bar_pulse (GTK_PROGRESS_BAR (import_progress));
+        text = g_strdup (_("Adding files..."));
     }
+    gtk_progress_bar_set_text (GTK_PROGRESS_BAR (import_progress), text);
+    g_free (text);
 
-    g_strfreev (filters_u);
-    g_strfreev (filters_d);
+    gtk_widget_show (import_bar);
+}
 
-    return filtered;
+/* Check if file is filtered (return FALSE if file is filtered and not shown) */
+static gboolean
+check_filtered (const ViewConfig *config, const gchar *base_name)
+{
+    return filter_match (config->filter, base_name);
 }
 
 /* Check if file should be hidden (return TRUE if file is not shown) */
 static gboolean
-check_hidden (const gchar *filename)
+check_hidden (const ViewConfig *config, const gchar *filename)
 {
-    const gchar *base_name = g_path_get_basename (filename);
-//    if (! NZV (base_name))
-//        return FALSE;
-
-    gboolean is_hidden = (base_name[0] == '.');
-    g_free ((gpointer) base_name);
+    gchar *base_name = g_path_get_basename (filename);
+    gboolean is_hidden = filter_hidden (config->filter, base_name);
+    g_free (base_name);
 
-    if ((! CONFIG_SHOW_HIDDEN_FILES) && is_hidden)
-        return TRUE;
-
-    return FALSE;
+    return is_hidden;
 }
 
 
@@ -1010,64 +2012,53 @@ get_default_dir (void)
 
 /* Try to get icon from cache, update cache if not found or original is newer */
 static GdkPixbuf *
-get_icon_from_cache (const gchar *uri, const gchar *coverart, gint imgsize)
+get_icon_from_cache (const gchar *uri, const gchar *coverfile, gint imgsize)
 {
     GdkPixbuf *icon = NULL;
-    gchar *iconfile  = g_strconcat (uri, G_DIR_SEPARATOR_S, coverart, NULL);
     gchar *cachefile = utils_make_cache_path (uri, imgsize);
 
-    if (g_file_test (iconfile, G_FILE_TEST_EXISTS)) {
-        /* Check if original file was updated */
-        if (g_file_test (cachefile, G_FILE_TEST_EXISTS)) {
-            struct stat cache_stat, icon_stat;
-            stat (cachefile, &cache_stat);
-            stat (iconfile, &icon_stat);
-
-            if (icon_stat.st_mtime <= cache_stat.st_mtime) {
-                trace ("cached icon for %s\n", uri);
-                icon = gdk_pixbuf_new_from_file (cachefile, NULL);
-            }
-        }
+    if (utils_cache_is_fresh (cachefile, coverfile)) {
+        trace ("cached icon for %s\n", uri);
+        icon = gdk_pixbuf_new_from_file (cachefile, NULL);
+    }
 
-        if (! icon) {
-            trace ("creating new icon for %s\n", uri);
-            GError *err = NULL;
-            icon = gdk_pixbuf_new_from_file_at_size (iconfile, imgsize, imgsize, NULL);
-            if (! gdk_pixbuf_save (icon, cachefile, "png", &err, NULL)) {
-                fprintf (stderr, "Could not cache coverart image %s: %s\n", iconfile, err->message);
-                g_error_free (err);
-            }
+    if (! icon) {
+        trace ("creating new icon for %s\n", uri);
+        GError *err = NULL;
+        icon = gdk_pixbuf_new_from_file_at_size (coverfile, imgsize, imgsize, NULL);
+        if (! gdk_pixbuf_save (icon, cachefile, "png", &err, NULL)) {
+            fprintf (stderr, "Could not cache coverart image %s: %s\n", coverfile, err->message);
+            g_error_free (err);
         }
     }
 
     g_free (cachefile);
-    g_free (iconfile);
 
     return icon;
 }
 
 /* Get icon for selected URI - default icon or folder image */
 static GdkPixbuf *
-get_icon_for_uri (gchar *uri)
+get_icon_for_uri (const ViewConfig *config, gchar *uri)
 {
-    if (! CONFIG_SHOW_ICONS)
+    if (! config->show_icons)
         return NULL;
 
     if (! g_file_test (uri, G_FILE_TEST_IS_DIR)) {
         ////// TODO: handle mimetypes //////
-        return utils_pixbuf_from_stock ("gtk-file", CONFIG_ICON_SIZE);
+        return utils_pixbuf_from_stock ("gtk-file", config->icon_size);
     }
 
     /* Check for cover art in folder, otherwise use default icon */
     GdkPixbuf *icon = NULL;
-    gchar **coverart = g_strsplit (CONFIG_COVERART, ";", 0);
-    for (gint i = 0; coverart[i] && ! icon; i++)
-        icon = get_icon_from_cache (uri, coverart[i], CONFIG_COVERART_SIZE);
-    g_strfreev (coverart);
+    gchar *coverfile = utils_find_coverart (uri, config->coverart);
+    if (coverfile)
+        icon = get_icon_from_cache (uri, coverfile, config->coverart_size);
+    g_free (coverfile);
 
     /* Fallback to default icon */
     if (! icon)
-        icon =  utils_pixbuf_from_stock ("folder", CONFIG_ICON_SIZE);
+        icon =  utils_pixbuf_from_stock ("folder", config->icon_size);
 
     return icon;
 }
@@ -1086,23 +2077,14 @@ treeview_row_expanded_iter (GtkTreeView *tree_view, GtkTreeIter *iter)
     return expanded;
 }
 
-/* Check if row should be expanded, returns NULL if not */
-static GSList *
-treeview_check_expanded (gchar *uri)
+/* Check if row should be expanded */
+static gboolean
+treeview_check_expanded (const gchar *uri)
 {
     if (! expanded_rows || ! uri)
-        return NULL;
+        return FALSE;
 
-    GSList *node;
-    for (node = expanded_rows->next; node; node = node->next)  // first item is always NULL
-    {
-        gchar *enc_uri = g_filename_to_uri (uri, NULL, NULL);
-        gboolean match = utils_str_equal (enc_uri, node->data);
-        g_free (enc_uri);
-        if (match)
-            break;
-    }
-    return node;  // == NULL if last node was reached
+    return pathtrie_contains (expanded_rows, uri);
 }
 
 static void
@@ -1111,190 +2093,1154 @@ treeview_clear_expanded (void)
     if (! expanded_rows)
         return;
 
-    for (GSList *node = expanded_rows->next; node; node = node->next)  // first items is always NULL
-    {
-        if (node->data)
-            g_free (node->data);
-    }
-    g_slist_free (expanded_rows);
-    expanded_rows = g_slist_alloc ();  // make sure expanded_rows stays valid
+    pathtrie_clear (expanded_rows);
 }
 
-/* Restore previously expanded nodes */
+/* Restore previously expanded nodes
+ *
+ * Expanded rows are restored in waves: the expanded children found while
+ * filling a directory are listed concurrently by a thread pool, off the
+ * model. Each listed directory is then filled in slices by the scheduler,
+ * and once it is complete its own expanded children start the next wave.
+ * Each directory is read exactly once, and the time needed depends on the
+ * depth of the deepest expanded row rather than their total count.
+ */
 static void
-treeview_restore_expanded (gpointer parent)
+restore_wave_free (RestoreWave *wave)
 {
-    GtkTreeIter i;
-    gchar *uri;
-    gboolean valid = gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &i, parent);
-    while (valid){
-        gtk_tree_model_get (GTK_TREE_MODEL (treestore), &i,
-                        TREEBROWSER_COLUMN_URI, &uri, -1);
-        if (treeview_check_expanded (uri)) {
-            gtk_tree_view_expand_row (GTK_TREE_VIEW (treeview),
-                        gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &i),
-                        FALSE);
-            treebrowser_browse (uri, &i);
-        }
-
-        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (treestore), &i);
-    }
+    restore_waves = g_list_remove (restore_waves, wave);
+    for (guint i = 0; i < wave->paths->len; i++)
+        listing_unref (wave->listings[i]);
+    g_free (wave->listings);
+    g_free (wave->tasks);
+    g_ptr_array_unref (wave->rows);
+    g_ptr_array_unref (wave->paths);
+    g_free (wave);
 }
 
-static gboolean
-treeview_separator_func (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+static void
+restore_wave_worker (gpointer data, gpointer user_data)
 {
-    gint flag;
-    gtk_tree_model_get (model, iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
-    return (flag == TREEBROWSER_FLAGS_SEPARATOR);
+    RestoreTask *task = data;
+    RestoreWave *wave = task->wave;
+
+    wave->listings[task->index] = listing_get (g_ptr_array_index (wave->paths, task->index));
+    if (g_atomic_int_dec_and_test (&wave->pending))
+        g_idle_add (restore_wave_apply, wave);
 }
 
-/* Change root directory of treebrowser */
+/* Start listing the directories of the given rows, takes ownership of rows */
 static void
-treebrowser_chroot(gchar *directory)
+restore_wave_start (GPtrArray *rows)
 {
-    if (! directory)
-        directory = get_default_dir ();  // fallback
+    if (rows->len == 0) {
+        g_ptr_array_unref (rows);
+        return;
+    }
 
-    if (g_str_has_suffix (directory, G_DIR_SEPARATOR_S))
-        g_strlcpy(directory, directory, strlen (directory));
+    if (! restore_pool)
+        restore_pool = g_thread_pool_new (restore_wave_worker, NULL,
+                        CLAMP (g_get_num_processors (), 2, 8), FALSE, NULL);
 
-    if (! directory || (strlen (directory) == 0))
-        directory = G_DIR_SEPARATOR_S;
+    RestoreWave *wave = g_new0 (RestoreWave, 1);
+    wave->rows = rows;
+    wave->paths = g_ptr_array_new_with_free_func (g_free);
+    wave->generation = restore_generation;
 
-    gtk_tree_store_clear (treestore);
+    for (guint i = 0; i < rows->len; i++) {
+        GtkTreePath *path = gtk_tree_row_reference_get_path (g_ptr_array_index (rows, i));
+        GtkTreeIter iter;
+        gchar *uri = NULL;
+        if (path && gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path))
+            gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                            TREEBROWSER_COLUMN_URI, &uri, -1);
+        g_ptr_array_add (wave->paths, uri ? uri : g_strdup (""));
+        if (path)
+            gtk_tree_path_free (path);
+    }
 
-    treebrowser_browse (NULL, NULL);
+    wave->listings = g_new0 (DirListing *, rows->len);
+    wave->tasks = g_new (RestoreTask, rows->len);
+    wave->pending = rows->len;
+    restore_waves_active++;
+    restore_waves = g_list_prepend (restore_waves, wave);
+
+    for (guint i = 0; i < rows->len; i++) {
+        wave->tasks[i].wave = wave;
+        wave->tasks[i].index = i;
+        g_thread_pool_push (restore_pool, &wave->tasks[i], NULL);
+    }
 }
 
-/* Browse given directory - update contents and fill in the treeview */
+/* Start filling the listed directories of a wave */
 static gboolean
-treebrowser_browse (gchar *directory, gpointer parent)
+restore_wave_apply (gpointer data)
 {
-    GtkTreeIter     iter, iter_empty, *last_dir_iter = NULL;
-    gboolean        is_dir;
-    gboolean        expanded = FALSE;
-    gboolean        has_parent;
-    gchar           *utf8_name;
-    GSList          *list, *node;
+    RestoreWave *wave = data;
 
-    gchar           *fname;
-    gchar           *uri;
-    gchar           *tooltip;
+    if (wave->generation != restore_generation || ! treeview) {
+        restore_wave_free (wave);  // tree was rebuilt in the meantime
+        return FALSE;
+    }
+    restore_waves_active--;
+
+    /* Each directory is filled in slices, its expanded children are
+     * restored once it's complete */
+    for (guint i = 0; i < wave->rows->len; i++) {
+        GtkTreePath *path = gtk_tree_row_reference_get_path (g_ptr_array_index (wave->rows, i));
+        GtkTreeIter iter;
+        if (! path)
+            continue;
+
+        if (gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path)) {
+            GPtrArray *next = g_ptr_array_new_with_free_func ((GDestroyNotify) gtk_tree_row_reference_free);
+            treebrowser_fill_async (wave->listings[i], &iter, next, TRUE, SCHEDULER_PRIORITY_RESTORE);
+        }
+        gtk_tree_path_free (path);
+    }
+    restore_wave_free (wave);
+
+    treeview_restore_finished ();
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+/* Forget about restores in progress, e.g. because the model was cleared */
+static void
+treeview_restore_cancel (void)
+{
+    restore_generation++;
+    restore_waves_active = 0;
+}
+
+/* Apply pending cursor and scroll position once all levels are restored */
+static void
+treeview_restore_finished (void)
+{
+    if (restore_waves_active > 0 || ! restore_position)
+        return;
+
+    if (treeview)
+        treeview_restore_position (restore_position);
+    session_state_clear (restore_position);
+    g_free (restore_position);
+    restore_position = NULL;
+}
+
+static gboolean
+treeview_separator_func (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+    gint flag;
+    gtk_tree_model_get (model, iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    return (flag == TREEBROWSER_FLAGS_SEPARATOR);
+}
+
+/* Change root directory of treebrowser */
+static void
+treebrowser_chroot(gchar *directory)
+{
+    if (dormant)
+        return;  // tree is filled when the sidebar is shown again
 
     if (! directory)
         directory = get_default_dir ();  // fallback
 
-    directory = g_strconcat (directory, G_DIR_SEPARATOR_S, NULL);
+    if (g_str_has_suffix (directory, G_DIR_SEPARATOR_S))
+        g_strlcpy(directory, directory, strlen (directory));
+
+    if (! directory || (strlen (directory) == 0))
+        directory = G_DIR_SEPARATOR_S;
+
+    treeview_restore_cancel ();
+    gtk_tree_store_clear (treestore);
+    row_index_clear ();
+    unload_queue_clear ();
+
+    treebrowser_browse (NULL, NULL);
+    search_index_update (FALSE);
+    tag_scan_update ();
+}
+
+/* Add a placeholder row below parent */
+static void
+treebrowser_add_placeholder (GtkTreeIter *parent, const gchar *name, const gchar *tooltip)
+{
+    GtkTreeIter iter;
+    gtk_tree_store_append (treestore, &iter, parent);
+    gtk_tree_store_set (treestore, &iter,
+                    TREEBROWSER_COLUMN_ICON,    NULL,
+                    TREEBROWSER_COLUMN_NAME,    name,
+                    TREEBROWSER_COLUMN_URI,     NULL,
+                    TREEBROWSER_COLUMN_TOOLTIP, tooltip,
+                    -1);
+}
+
+/* Add row for a listing entry below parent */
+static void
+treebrowser_add_entry (FillJob *job, GtkTreeIter *parent, GtkTreeIter *sibling,
+                            const ListingEntry *entry)
+{
+    GtkTreeIter     iter;
+    GdkPixbuf       *icon;
+    gchar           *uri, *tooltip;
+
+    uri         = listing_entry_path (job->listing, entry);
+    tooltip     = entry->is_dir ? NULL : metacache_describe (uri);
+    if (! tooltip)
+        tooltip = utils_tooltip_from_uri (uri);
+    icon        = get_icon_for_uri (job->config, uri);
+
+    gtk_tree_store_insert_before (treestore, &iter, parent, sibling);
+    gtk_tree_store_set (treestore, &iter,
+                    TREEBROWSER_COLUMN_ICON,    icon,
+                    TREEBROWSER_COLUMN_NAME,    entry->name,
+                    TREEBROWSER_COLUMN_URI,     uri,
+                    TREEBROWSER_COLUMN_TOOLTIP, tooltip,
+                    -1);
+    row_index_add (uri, &iter);
+    typeahead_index_add (job->index, entry);
+
+    if (entry->is_dir) {
+        treebrowser_add_placeholder (&iter, _("(Empty)"), NULL);
+
+        if (job->restore && treeview_check_expanded (uri)) {
+            GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &iter);
+            g_ptr_array_add (job->restore, gtk_tree_row_reference_new (GTK_TREE_MODEL (treestore), path));
+            gtk_tree_path_free (path);
+        }
+    }
+
+    if (icon)
+        g_object_unref (icon);
+    g_free (uri);
+    g_free (tooltip);
+}
+
+/* Prepare filling rows below parent with the contents of listing. Rows shown
+ * below parent before are replaced once the first new rows are added, so an
+ * expanded row stays expanded. Rows of child directories that should be
+ * expanded are collected in restore. */
+static FillJob *
+fill_job_new (DirListing *listing, GtkTreeIter *parent, GPtrArray *restore, gboolean expand)
+{
+    FillJob *job = g_new0 (FillJob, 1);
+    job->listing = listing_ref (listing);
+    job->generation = restore_generation;
+    job->n_old = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (treestore), parent);
+    job->expand = expand;
+    job->all_hidden = TRUE;
+    job->restore = restore;
+    job->dir = g_strdup ("");
+    job->config = view_config_ref (current_view);
+
+    if (parent) {
+        GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), parent);
+        job->parent = gtk_tree_row_reference_new (GTK_TREE_MODEL (treestore), path);
+        gtk_tree_path_free (path);
+
+        g_free (job->dir);
+        job->dir = row_state_key (parent);
+
+        /* Expanding the row while it's filled must not list it again */
+        gtk_tree_store_set (treestore, parent, TREEBROWSER_COLUMN_FLAG, TREEBROWSER_FLAGS_FILLING, -1);
+    }
+
+    /* Remember what is shown, so adding it to a playlist needs no rescan,
+     * and read the tags of shown tracks in the background */
+    if (listing) {
+        listing_cache_store (listing);
+        metacache_prewarm (listing, job->config->filter);
+        job->index = typeahead_index_new (listing);
+    }
+
+    if (restore)
+        restore_waves_active++;
+
+    return job;
+}
+
+static void
+fill_job_free (FillJob *job)
+{
+    if (job->restore) {
+        if (job->generation == restore_generation) {
+            restore_waves_active--;
+            treeview_restore_finished ();
+        }
+        g_ptr_array_unref (job->restore);
+    }
+    if (fill_jobs && job->id && job->dir && g_hash_table_lookup (fill_jobs, job->dir) == job)
+        g_hash_table_remove (fill_jobs, job->dir);
+
+    if (job->parent)
+        gtk_tree_row_reference_free (job->parent);
+    typeahead_index_free (job->index);
+    listing_unref (job->listing);
+    view_config_unref (job->config);
+    g_free (job->dir);
+    g_free (job);
+}
+
+/* Rows are complete, remember them for type-ahead and restore their
+ * expanded children */
+static void
+fill_job_finish (FillJob *job, GtkTreeIter *parent)
+{
+    if (parent)
+        gtk_tree_store_set (treestore, parent, TREEBROWSER_COLUMN_FLAG, TREEBROWSER_FLAGS_LOADED, -1);
+
+    if (! job->listing || job->listing->n_entries == 0)
+        treebrowser_add_placeholder (parent, _("(Empty)"), _("This directory has nothing in it"));
+    else if (job->all_hidden)
+        treebrowser_add_placeholder (parent, _("(Contents hidden)"),
+                        _("This directory has files in it, but they are filtered out"));
+
+    /* Rows of a directory are only replaced together */
+    if (! typeahead_indexes)
+        typeahead_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                            (GDestroyNotify) typeahead_index_free);
+    if (job->index && job->dir)
+        g_hash_table_replace (typeahead_indexes, g_strdup (job->dir), job->index);
+    else if (job->dir)
+        g_hash_table_remove (typeahead_indexes, job->dir);
+    else
+        typeahead_index_free (job->index);
+    job->index = NULL;
+
+    if (job->restore && job->generation == restore_generation) {
+        restore_wave_start (job->restore);
+        job->restore = NULL;
+        restore_waves_active--;
+        treeview_restore_finished ();
+    }
+}
+
+/* Add the next rows of a fill job, returns FALSE once it is done */
+static gboolean
+fill_job_step (gpointer data)
+{
+    FillJob         *job = data;
+    GtkTreeIter     parent_iter, old;
+    GtkTreeIter     *parent = NULL;
+
+    if (job->generation != restore_generation)
+        return FALSE;  // tree was rebuilt in the meantime
+    if (job->parent) {
+        GtkTreePath *path = gtk_tree_row_reference_get_path (job->parent);
+        gboolean valid = path && gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &parent_iter, path);
+        if (path)
+            gtk_tree_path_free (path);
+        if (! valid)
+            return FALSE;  // row was removed
+        parent = &parent_iter;
+    }
+
+    guint n_entries = job->listing ? job->listing->n_entries : 0;
+    guint end = MIN (job->next + FILL_CHUNK_ROWS, n_entries);
+    for (; job->next < end; job->next++) {
+        ListingEntry *entry = &job->listing->entries[job->next];
+        if (check_hidden (job->config, entry->name))
+            continue;
+        if (! entry->is_dir && ! check_filtered (job->config, entry->display))
+            continue;
+        treebrowser_add_entry (job, parent, NULL, entry);
+        job->all_hidden = FALSE;
+    }
+
+    gboolean done = (job->next >= n_entries);
+    if (done)
+        fill_job_finish (job, parent);
+
+    for (; job->n_old > 0; job->n_old--) {
+        if (gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &old, parent))
+            gtk_tree_store_iter_clear_nodes (&old, TRUE);
+    }
+
+    if (job->expand && parent) {
+        GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), parent);
+        gtk_tree_view_expand_row (GTK_TREE_VIEW (treeview), path, FALSE);
+        gtk_tree_path_free (path);
+    }
+    job->expand = FALSE;
+
+    return ! done;
+}
+
+/* Fill rows below parent with the contents of listing right away */
+static void
+treebrowser_fill (DirListing *listing, GtkTreeIter *parent, GPtrArray *restore)
+{
+    FillJob *job = fill_job_new (listing, parent, restore, FALSE);
+    while (fill_job_step (job))
+        ;
+    fill_job_free (job);
+}
+
+/* Fill rows below parent in slices, replacing a fill of the same directory
+ * that is still running. The first rows are added right away if the user
+ * is waiting for them. */
+static void
+treebrowser_fill_async (DirListing *listing, GtkTreeIter *parent, GPtrArray *restore,
+                            gboolean expand, SchedulerPriority priority)
+{
+    FillJob *job = fill_job_new (listing, parent, restore, expand);
+    if (! job->dir) {
+        fill_job_free (job);
+        return;
+    }
+
+    if (! fill_jobs)
+        fill_jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    FillJob *previous = g_hash_table_lookup (fill_jobs, job->dir);
+    if (previous)
+        scheduler_remove (previous->id);
+
+    if (priority == SCHEDULER_PRIORITY_USER && ! fill_job_step (job)) {
+        fill_job_free (job);
+        return;
+    }
+    job->id = scheduler_add (priority, fill_job_step, job, (GDestroyNotify) fill_job_free);
+    g_hash_table_replace (fill_jobs, g_strdup (job->dir), job);
+}
+
+/* Add the rows of dir that are still scheduled right away, for callers
+ * that look up rows below it next */
+static void
+treebrowser_fill_complete (const gchar *dir)
+{
+    FillJob *job = fill_jobs ? g_hash_table_lookup (fill_jobs, dir) : NULL;
+    if (! job)
+        return;
+
+    while (fill_job_step (job))
+        ;
+    scheduler_remove (job->id);
+}
+
+/* Replace the rows below a collapsed directory with a placeholder; its
+ * listing stays cached, so expanding it again is quick */
+static void
+treebrowser_unload (const gchar *uri)
+{
+    GtkTreeIter iter;
+    if (! treeview_find_iter (uri, &iter)
+                || treeview_row_expanded_iter (GTK_TREE_VIEW (treeview), &iter))
+        return;
+
+    FillJob *job = fill_jobs ? g_hash_table_lookup (fill_jobs, uri) : NULL;
+    if (job)
+        scheduler_remove (job->id);
+
+    gtk_tree_store_iter_clear_nodes (&iter, FALSE);
+    treebrowser_add_placeholder (&iter, _("(Empty)"), NULL);
+    gtk_tree_store_set (treestore, &iter, TREEBROWSER_COLUMN_FLAG, 0, -1);
+
+    /* Type-ahead indexes keep listings of the removed rows */
+    if (typeahead_indexes) {
+        GHashTableIter hash_iter;
+        gpointer key;
+        gsize len = strlen (uri);
+        g_hash_table_iter_init (&hash_iter, typeahead_indexes);
+        while (g_hash_table_iter_next (&hash_iter, &key, NULL)) {
+            const gchar *dir = key;
+            if (strncmp (dir, uri, len) == 0 && (dir[len] == '\0' || dir[len] == G_DIR_SEPARATOR))
+                g_hash_table_iter_remove (&hash_iter);
+        }
+    }
+}
+
+static void
+unload_entry_free (UnloadEntry *entry)
+{
+    g_free (entry->uri);
+    g_free (entry);
+}
+
+/* Check if the least recently collapsed directory should be unloaded */
+static gboolean
+unload_due (const UnloadEntry *entry)
+{
+    if (! entry)
+        return FALSE;
+    if (CONFIG_UNLOAD_AFTER > 0
+                && g_get_monotonic_time () - entry->collapsed >= (gint64) CONFIG_UNLOAD_AFTER * 60 * G_USEC_PER_SEC)
+        return TRUE;
+    return CONFIG_MAX_ROWS > 0 && row_index && g_hash_table_size (row_index) > (guint) CONFIG_MAX_ROWS;
+}
+
+/* Unload the least recently collapsed directory */
+static void
+unload_oldest (void)
+{
+    UnloadEntry *entry = g_queue_pop_tail (&unload_queue);
+    g_hash_table_remove (unload_links, entry->uri);
+    treebrowser_unload (entry->uri);
+    unload_entry_free (entry);
+}
+
+/* Unload one directory per step while the oldest one is due */
+static gboolean
+unload_step (gpointer data)
+{
+    if (! unload_due (g_queue_peek_tail (&unload_queue))) {
+        unload_job = 0;
+        return FALSE;
+    }
+
+    unload_oldest ();
+    return TRUE;
+}
+
+static void
+unload_schedule (void)
+{
+    if (! unload_job && unload_due (g_queue_peek_tail (&unload_queue)))
+        unload_job = scheduler_add (SCHEDULER_PRIORITY_PREFETCH, unload_step, NULL, NULL);
+}
+
+static gboolean
+unload_timeout_cb (gpointer data)
+{
+    unload_schedule ();
+    if (! g_queue_is_empty (&unload_queue))
+        return TRUE;
+
+    unload_timeout = 0;
+    /* This function MUST return false when it's done because it's called from g_timeout_add() */
+    return FALSE;
+}
+
+/* Directory was collapsed, its rows may be unloaded later */
+static void
+unload_queue_add (const gchar *uri)
+{
+    if (! unload_links)
+        unload_links = g_hash_table_new (g_str_hash, g_str_equal);
+    unload_queue_remove (uri);
+
+    UnloadEntry *entry = g_new (UnloadEntry, 1);
+    entry->uri = g_strdup (uri);
+    entry->collapsed = g_get_monotonic_time ();
+    g_queue_push_head (&unload_queue, entry);
+    g_hash_table_insert (unload_links, entry->uri, unload_queue.head);
+
+    if (! unload_timeout)
+        unload_timeout = g_timeout_add_seconds (UNLOAD_CHECK_INTERVAL, unload_timeout_cb, NULL);
+    unload_schedule ();
+}
+
+/* Directory was expanded, keep its rows */
+static void
+unload_queue_remove (const gchar *uri)
+{
+    GList *link = unload_links ? g_hash_table_lookup (unload_links, uri) : NULL;
+    if (! link)
+        return;
+
+    g_hash_table_remove (unload_links, uri);
+    unload_entry_free (link->data);
+    g_queue_delete_link (&unload_queue, link);
+}
+
+static void
+unload_queue_clear (void)
+{
+    if (unload_job)
+        scheduler_remove (unload_job);
+    if (unload_timeout)
+        g_source_remove (unload_timeout);
+    unload_job = 0;
+    unload_timeout = 0;
+
+    if (unload_links)
+        g_hash_table_remove_all (unload_links);
+    g_queue_foreach (&unload_queue, (GFunc) unload_entry_free, NULL);
+    g_queue_clear (&unload_queue);
+}
+
+/* Drop what can be read again when memory gets low; collapsed directories
+ * are unloaded too if unload_all is set */
+static void
+treebrowser_trim (gboolean unload_all)
+{
+    trace ("trim caches\n");
+    listing_cache_clear ();
+    metacache_trim (0);
+
+    while (unload_all && ! g_queue_is_empty (&unload_queue))
+        unload_oldest ();
+}
+
+/* Free the tree and stop background work while the sidebar isn't shown;
+ * its position is kept for showing it again */
+static void
+treeview_sleep (void)
+{
+    if (dormant || ! treeview)
+        return;
+    trace ("sleep\n");
+
+    /* A pending restore still has the position to show */
+    if (! restore_position) {
+        restore_position = g_new0 (SessionState, 1);
+        session_collect (restore_position);
+    }
+    session_flush ();
+
+    dormant = TRUE;
+    treeview_restore_cancel ();
+    reveal_generation++;
+    unload_queue_clear ();
+    if (fill_jobs) {
+        GList *jobs = g_hash_table_get_values (fill_jobs);
+        for (GList *job = jobs; job; job = job->next)
+            scheduler_remove (((FillJob *) job->data)->id);
+        g_list_free (jobs);
+    }
+
+    gtk_tree_store_clear (treestore);
+    row_index_clear ();
+    if (typeahead_indexes)
+        g_hash_table_remove_all (typeahead_indexes);
+
+    metacache_cancel ();
+    treebrowser_trim (FALSE);
+
+    if (search_index_target) {
+        searchindex_cancel ();
+        g_free (search_index_target);
+        search_index_target = NULL;
+        dormant_search_pending = TRUE;
+    }
+    if (tag_scan_running) {
+        tagscan_cancel ();
+        tag_scan_running = FALSE;
+        g_free (tag_scan_target);
+        tag_scan_target = NULL;  // scan again after waking up
+    }
+}
+
+/* Fill the tree again and restore its position */
+static void
+treeview_wake (void)
+{
+    if (! dormant)
+        return;
+    trace ("wake\n");
+
+    dormant = FALSE;
+    treebrowser_chroot (NULL);
+    treeview_restore_finished ();
+    search_index_update (dormant_search_pending);
+    dormant_search_pending = FALSE;
+}
+
+static gboolean
+dormant_timeout_cb (gpointer data)
+{
+    dormant_timeout = 0;
+    if (sidebar_vbox && ! gtk_widget_get_mapped (sidebar_vbox))
+        treeview_sleep ();
+
+    /* This function MUST return false because it's called from g_timeout_add() */
+    return FALSE;
+}
+
+/* Sidebar was hidden, or the layout stopped showing it */
+static void
+on_sidebar_unmap (GtkWidget *widget, gpointer user_data)
+{
+    if (! dormant_timeout)
+        dormant_timeout = g_timeout_add_seconds (DORMANT_DELAY, dormant_timeout_cb, NULL);
+}
+
+static void
+on_sidebar_map (GtkWidget *widget, gpointer user_data)
+{
+    if (dormant_timeout)
+        g_source_remove (dormant_timeout);
+    dormant_timeout = 0;
+    treeview_wake ();
+}
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+static void
+on_low_memory_warning (GMemoryMonitor *monitor, GMemoryMonitorWarningLevel level, gpointer user_data)
+{
+    treebrowser_trim (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM);
+    if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL
+                && sidebar_vbox && ! gtk_widget_get_mapped (sidebar_vbox))
+        treeview_sleep ();
+}
+#endif
+
+/* Check if the name of row starts with prefix, ignoring case */
+static gboolean
+treeview_row_has_prefix (GtkTreeIter *iter, const gchar *prefix)
+{
+    gchar *name, *uri;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
+                    TREEBROWSER_COLUMN_NAME, &name, TREEBROWSER_COLUMN_URI, &uri, -1);
+
+    gboolean result = FALSE;
+    if (name && uri) {  // no placeholders
+        gchar *display = utils_get_utf8_from_locale (name);
+        gchar *key = g_utf8_strdown (display, -1);
+        result = g_str_has_prefix (key, prefix);
+        g_free (key);
+        g_free (display);
+    }
+    g_free (name);
+    g_free (uri);
+
+    return result;
+}
+
+/* Move cursor to the first row starting with text among the rows next to
+ * it. Rows of listed directories are found in their index, other rows are
+ * compared one by one. */
+static gboolean
+treeview_typeahead (const gchar *text)
+{
+    GtkTreeModel    *model = GTK_TREE_MODEL (treestore);
+    GtkTreePath     *path;
+    GtkTreeIter     parent, iter;
+    gboolean        has_parent = FALSE, found = FALSE, indexed = FALSE;
+    gchar           *dir = NULL;
+
+    gtk_tree_view_get_cursor (GTK_TREE_VIEW (treeview), &path, NULL);
+    if (path && gtk_tree_path_get_depth (path) > 1 && gtk_tree_path_up (path))
+        has_parent = gtk_tree_model_get_iter (model, &parent, path);
+    if (path)
+        gtk_tree_path_free (path);
+    if (has_parent)
+        dir = row_state_key (&parent);
+
+    gchar *prefix = g_utf8_strdown (text, -1);
+    gint n_rows = gtk_tree_model_iter_n_children (model, has_parent ? &parent : NULL);
+
+    /* Listed rows come last, after smart folders at the top level */
+    TypeAheadIndex *index = typeahead_indexes && (dir || ! has_parent)
+                    ? g_hash_table_lookup (typeahead_indexes, dir ? dir : "") : NULL;
+    if (index && typeahead_index_size (index) <= (guint) n_rows) {
+        gint row = typeahead_index_find (index, prefix);
+        gint offset = n_rows - typeahead_index_size (index);
+        if (row < 0)
+            indexed = TRUE;
+        else if (gtk_tree_model_iter_nth_child (model, &iter, has_parent ? &parent : NULL, offset + row))
+            indexed = found = treeview_row_has_prefix (&iter, prefix);
+    }
+
+    if (! indexed) {
+        gboolean valid = gtk_tree_model_iter_children (model, &iter, has_parent ? &parent : NULL);
+        while (valid && ! found) {
+            found = treeview_row_has_prefix (&iter, prefix);
+            if (! found)
+                valid = gtk_tree_model_iter_next (model, &iter);
+        }
+    }
+
+    if (found) {
+        path = gtk_tree_model_get_path (model, &iter);
+        gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, NULL, FALSE);
+        gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (treeview), path, NULL, TRUE, 0.5, 0.0);
+        gtk_tree_path_free (path);
+    }
+
+    g_free (prefix);
+    g_free (dir);
+
+    return found;
+}
+
+/* Browse given directory - update contents and fill in the treeview */
+static gboolean
+treebrowser_browse (gchar *directory, gpointer parent)
+{
+    gboolean        expanded = FALSE;
+    gboolean        has_parent;
+    gchar           *default_dir = NULL;
+    DirListing      *listing;
+    GPtrArray       *restore;
+
+    if (! directory)
+        directory = default_dir = get_default_dir ();  // fallback
 
     has_parent = parent ? gtk_tree_store_iter_is_valid (treestore, parent) : FALSE;
     if (!has_parent)    {
         parent = NULL;
     }
-    
 
     if (has_parent && treeview_row_expanded_iter (GTK_TREE_VIEW (treeview), parent)) {
         expanded = TRUE;
     }
 
-    gtk_tree_store_iter_clear_nodes (parent, FALSE);
+    /* Rows below parent are replaced by the fill, so it stays expanded */
+    if (! has_parent) {
+        gtk_tree_store_iter_clear_nodes (NULL, FALSE);
+        if (typeahead_indexes)
+            g_hash_table_remove_all (typeahead_indexes);
+    }
 
-    list = utils_get_file_list (directory, NULL, NULL);
-    if (list != NULL) {
-        gboolean all_hidden = TRUE;  // show "contents hidden" note if all files are hidden
-        foreach_slist_free (node, list) {
-            fname       = node->data;
-            uri         = g_strconcat (directory, fname, NULL);
-            is_dir      = g_file_test (uri, G_FILE_TEST_IS_DIR);
-            utf8_name   = utils_get_utf8_from_locale (fname);
-            tooltip     = utils_tooltip_from_uri (uri);
+    /* Expanded subdirectories are restored in the background once all rows
+     * are added */
+    restore = g_ptr_array_new_with_free_func ((GDestroyNotify) gtk_tree_row_reference_free);
+    listing = listing_get (directory);  // cached listings are still valid if the directory wasn't modified
+    treebrowser_fill_async (listing, parent, restore, expanded, SCHEDULER_PRIORITY_USER);
+    listing_unref (listing);
 
-            if (! check_hidden (uri)) {
-                GdkPixbuf *icon = NULL;
+    if (! has_parent)
+        virtual_rows_show ();
 
-                if (is_dir) {
-                    if (last_dir_iter == NULL)
-                        gtk_tree_store_prepend (treestore, &iter, parent);
-                    else {
-                        gtk_tree_store_insert_after (treestore, &iter, parent, last_dir_iter);
-                        gtk_tree_iter_free (last_dir_iter);
-                    }
-                    last_dir_iter = gtk_tree_iter_copy (&iter);
-
-                    icon = get_icon_for_uri (uri);
-                    gtk_tree_store_set (treestore, &iter,
-                                    TREEBROWSER_COLUMN_ICON,    icon,
-                                    TREEBROWSER_COLUMN_NAME,    fname,
-                                    TREEBROWSER_COLUMN_URI,     uri,
-                                    TREEBROWSER_COLUMN_TOOLTIP, tooltip,
-                                    -1);
-                    gtk_tree_store_prepend (treestore, &iter_empty, &iter);
-                    gtk_tree_store_set (treestore, &iter_empty,
-                                    TREEBROWSER_COLUMN_ICON,    NULL,
-                                    TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
-                                    TREEBROWSER_COLUMN_URI,     NULL,
-                                    TREEBROWSER_COLUMN_TOOLTIP, NULL,
-                                    -1);
-                    all_hidden = FALSE;
-                }
-                else {
-                    if (check_filtered (utf8_name)) {
-                        icon = get_icon_for_uri (uri);
-                        gtk_tree_store_append (treestore, &iter, parent);
-                        gtk_tree_store_set (treestore, &iter,
-                                        TREEBROWSER_COLUMN_ICON,    icon,
-                                        TREEBROWSER_COLUMN_NAME,    fname,
-                                        TREEBROWSER_COLUMN_URI,     uri,
-                                        TREEBROWSER_COLUMN_TOOLTIP, tooltip,
-                                        -1);
-                        all_hidden = FALSE;
-                    }
-                }
+    g_free (default_dir);
 
-                if (icon)
-                    g_object_unref (icon);
-            }
+    return FALSE;
+}
 
-            g_free (utf8_name);
-            g_free (uri);
-            g_free (fname);
-            g_free (tooltip);
+/* Saved queries from the config, their results are taken from the tag store */
+static void
+smart_folders_load (void)
+{
+    if (smart_folders)
+        g_ptr_array_unref (smart_folders);
+    smart_folders = g_ptr_array_new_with_free_func ((GDestroyNotify) smartfolder_free);
+
+    deadbeef->conf_lock ();
+    gchar **texts = g_strsplit (deadbeef->conf_get_str_fast (CONFSTR_FB_SMART_FOLDERS, ""), ";", 0);
+    deadbeef->conf_unlock ();
+
+    for (gint i = 0; texts[i]; i++) {
+        gchar *error = NULL;
+        SmartFolder *folder = NZV (texts[i]) ? smartfolder_new (texts[i], &error) : NULL;
+        if (! folder) {
+            if (error)
+                fprintf (stderr, "filebrowser: ignoring smart folder %s: %s\n", texts[i], error);
+            g_free (error);
+            continue;
+        }
+        smartfolder_reset (folder, tag_store);
+        g_ptr_array_add (smart_folders, folder);
+    }
+    g_strfreev (texts);
+
+    /* Keep the results up to date */
+    if (smart_folders->len > 0)
+        tag_scan_wanted = TRUE;
+}
+
+static void
+smart_folders_save (void)
+{
+    GString *texts = g_string_new (NULL);
+    for (guint i = 0; i < smart_folders->len; i++) {
+        if (i > 0)
+            g_string_append_c (texts, ';');
+        g_string_append (texts, smartfolder_get_text (g_ptr_array_index (smart_folders, i)));
+    }
+    deadbeef->conf_set_str (CONFSTR_FB_SMART_FOLDERS, texts->str);
+    g_string_free (texts, TRUE);
+}
+
+/* Put smart folders and recently added albums above the contents of the
+ * root directory, separated by a line; rows shown before are replaced */
+static void
+virtual_rows_show (void)
+{
+    GtkTreeIter iter, child;
+
+    while (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (treestore), &iter)) {
+        gint flag;
+        gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+        if (flag != TREEBROWSER_FLAGS_SMART_FOLDER && flag != TREEBROWSER_FLAGS_RECENT
+                    && flag != TREEBROWSER_FLAGS_SEPARATOR)
+            break;
+        gtk_tree_store_iter_clear_nodes (&iter, TRUE);
+    }
+
+    guint n_rows = 0;
+    if (smart_folders && smart_folders->len > 0) {
+        GdkPixbuf *icon = NULL;
+        if (CONFIG_SHOW_ICONS) {
+            icon = utils_pixbuf_from_stock ("folder-saved-search", CONFIG_ICON_SIZE);
+            if (! icon)
+                icon = utils_pixbuf_from_stock ("folder", CONFIG_ICON_SIZE);
         }
 
-        if (all_hidden) {
-            /*  Directory with all contents hidden */
-            gtk_tree_store_prepend (treestore, &iter_empty, parent);
-            gtk_tree_store_set (treestore, &iter_empty,
-                            TREEBROWSER_COLUMN_ICON,    NULL,
-                            TREEBROWSER_COLUMN_NAME,    _("(Contents hidden)"),
+        for (; n_rows < smart_folders->len; n_rows++) {
+            SmartFolder *folder = g_ptr_array_index (smart_folders, n_rows);
+            gtk_tree_store_insert (treestore, &iter, NULL, n_rows);
+            gtk_tree_store_set (treestore, &iter,
+                            TREEBROWSER_COLUMN_ICON,    icon,
+                            TREEBROWSER_COLUMN_NAME,    smartfolder_get_text (folder),
                             TREEBROWSER_COLUMN_URI,     NULL,
-                            TREEBROWSER_COLUMN_TOOLTIP, _("This directory has files in it, but they are filtered out"),
+                            TREEBROWSER_COLUMN_FLAG,    TREEBROWSER_FLAGS_SMART_FOLDER,
+                            -1);
+            smart_folder_refresh_row (n_rows);
+
+            /* Filled when expanded */
+            gtk_tree_store_prepend (treestore, &child, &iter);
+            gtk_tree_store_set (treestore, &child,
+                            TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
                             -1);
         }
+
+        if (icon)
+            g_object_unref (icon);
     }
-    else {
-        /*  Empty directory */
-        gtk_tree_store_prepend (treestore, &iter_empty, parent);
-        gtk_tree_store_set (treestore, &iter_empty,
-                        TREEBROWSER_COLUMN_ICON,    NULL,
-                        TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
+
+    if (CONFIG_SHOW_RECENT) {
+        GdkPixbuf *icon = CONFIG_SHOW_ICONS ? utils_pixbuf_from_stock ("document-open-recent", CONFIG_ICON_SIZE) : NULL;
+        gtk_tree_store_insert (treestore, &iter, NULL, n_rows++);
+        gtk_tree_store_set (treestore, &iter,
+                        TREEBROWSER_COLUMN_ICON,    icon,
+                        TREEBROWSER_COLUMN_NAME,    _("Recently added"),
                         TREEBROWSER_COLUMN_URI,     NULL,
-                        TREEBROWSER_COLUMN_TOOLTIP, _("This directory has nothing in it"),
+                        TREEBROWSER_COLUMN_TOOLTIP, _("Albums whose files were modified last"),
+                        TREEBROWSER_COLUMN_FLAG,    TREEBROWSER_FLAGS_RECENT,
+                        -1);
+        gtk_tree_store_prepend (treestore, &child, &iter);
+        gtk_tree_store_set (treestore, &child,
+                        TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
                         -1);
+        if (icon)
+            g_object_unref (icon);
     }
 
-    if (has_parent) {
-        if (expanded)
-            gtk_tree_view_expand_row (GTK_TREE_VIEW(treeview),
-                            gtk_tree_model_get_path (GTK_TREE_MODEL(treestore), parent),
-                                FALSE);
+    if (n_rows > 0) {
+        gtk_tree_store_insert (treestore, &iter, NULL, n_rows);
+        gtk_tree_store_set (treestore, &iter,
+                        TREEBROWSER_COLUMN_FLAG,    TREEBROWSER_FLAGS_SEPARATOR,
+                        -1);
     }
+}
+
+/* Apply changes from a tag scan to the smart folders */
+static void
+smart_folders_update (const GArray *read, const GPtrArray *removed, gboolean finished)
+{
+    if (! smart_folders)
+        return;
 
-    g_free (directory);
+    for (guint i = 0; i < smart_folders->len; i++) {
+        SmartFolder *folder = g_ptr_array_index (smart_folders, i);
+        gboolean modified = TRUE;
+        if (smart_folders_stale && finished)
+            smartfolder_reset (folder, tag_store);
+        else
+            modified = smartfolder_update (folder, tag_store, read, removed);
 
-    treeview_restore_expanded (parent);
+        if (modified)
+            smart_folder_refresh_row (i);
+    }
 
-    return FALSE;
+    if (finished)
+        smart_folders_stale = FALSE;
+}
+
+/* Save query as a smart folder shown at the top of the tree */
+static void
+smart_folder_add (const gchar *text)
+{
+    gchar *error = NULL;
+    gchar *query = g_strdelimit (g_strstrip (g_strdup (text)), ";", ' ');  // separates queries in the config
+    SmartFolder *folder = smartfolder_new (query, &error);
+    g_free (query);
+    if (! folder) {
+        fprintf (stderr, "filebrowser: invalid smart folder query: %s\n", error);
+        g_free (error);
+        return;
+    }
+
+    smartfolder_reset (folder, tag_store);
+    g_ptr_array_add (smart_folders, folder);
+    smart_folders_save ();
+    virtual_rows_show ();
+
+    tag_scan_wanted = TRUE;
+    tag_scan_update ();
+}
+
+/* Smart folder shown in the row, or NULL for other rows */
+static SmartFolder *
+smart_folder_for_iter (GtkTreeIter *iter)
+{
+    gint flag;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    if (flag != TREEBROWSER_FLAGS_SMART_FOLDER || ! smart_folders)
+        return NULL;
+
+    /* Smart folders are the first rows, in the same order */
+    GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), iter);
+    guint index = gtk_tree_path_get_indices (path)[0];
+    gtk_tree_path_free (path);
+
+    return (index < smart_folders->len) ? g_ptr_array_index (smart_folders, index) : NULL;
+}
+
+typedef struct
+{
+    GtkTreeIter     *parent;
+    GdkPixbuf       *icon;
+} SmartFolderFill;
+
+static void
+smart_folder_append_file (gpointer data, gpointer user_data)
+{
+    const gchar *uri = data;
+    SmartFolderFill *fill = user_data;
+    GtkTreeIter iter;
+
+    gchar *name = g_path_get_basename (uri);
+    gchar *tooltip = metacache_describe (uri);
+    if (! tooltip)
+        tooltip = utils_tooltip_from_uri (uri);
+
+    gtk_tree_store_insert_with_values (treestore, &iter, fill->parent, -1,
+                    TREEBROWSER_COLUMN_ICON,    fill->icon,
+                    TREEBROWSER_COLUMN_NAME,    name,
+                    TREEBROWSER_COLUMN_URI,     uri,
+                    TREEBROWSER_COLUMN_TOOLTIP, tooltip,
+                    -1);
+    g_free (name);
+    g_free (tooltip);
+}
+
+/* Show the files of folder below its row. New rows are added before the
+ * old ones are removed, so an expanded row stays expanded. */
+static void
+smart_folder_fill_row (GtkTreeIter *parent, SmartFolder *folder)
+{
+    GtkTreeIter iter;
+    gint n_old = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (treestore), parent);
+
+    SmartFolderFill fill;
+    fill.parent = parent;
+    fill.icon = CONFIG_SHOW_ICONS ? utils_pixbuf_from_stock ("gtk-file", CONFIG_ICON_SIZE) : NULL;
+    smartfolder_foreach (folder, smart_folder_append_file, &fill);
+    if (fill.icon)
+        g_object_unref (fill.icon);
+
+    if (smartfolder_size (folder) == 0)
+        gtk_tree_store_insert_with_values (treestore, &iter, parent, -1,
+                        TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
+                        TREEBROWSER_COLUMN_TOOLTIP, _("No tracks match this query"),
+                        -1);
+
+    while (n_old-- > 0 && gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &iter, parent))
+        gtk_tree_store_iter_clear_nodes (&iter, TRUE);
+}
+
+/* Results of the smart folder at index changed */
+static void
+smart_folder_refresh_row (guint index)
+{
+    GtkTreeIter iter;
+    if (! treestore || ! gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (treestore), &iter, NULL, index))
+        return;
+    SmartFolder *folder = smart_folder_for_iter (&iter);
+    if (! folder)
+        return;
+
+    gchar *tooltip = g_markup_printf_escaped (_("Smart folder: %s\nFiles: %u"),
+                    smartfolder_get_text (folder), smartfolder_size (folder));
+    gtk_tree_store_set (treestore, &iter, TREEBROWSER_COLUMN_TOOLTIP, tooltip, -1);
+    g_free (tooltip);
+
+    if (treeview && treeview_row_expanded_iter (GTK_TREE_VIEW (treeview), &iter))
+        smart_folder_fill_row (&iter, folder);
+}
+
+/* Row of recently added albums, it comes after the smart folders */
+static gboolean
+recent_row_get_iter (GtkTreeIter *iter)
+{
+    if (! treestore || ! CONFIG_SHOW_RECENT)
+        return FALSE;
+
+    gint flag;
+    guint index = smart_folders ? smart_folders->len : 0;
+    if (! gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (treestore), iter, NULL, index))
+        return FALSE;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    return (flag == TREEBROWSER_FLAGS_RECENT);
+}
+
+/* Show the directories modified last below parent, newest first. They are
+ * taken from the tag store, so nothing is read from disk except covers. */
+static void
+recent_row_fill (GtkTreeIter *parent)
+{
+    GtkTreeIter iter, child;
+    gint n_old = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (treestore), parent);
+
+    const guint32 *tracks = NULL;
+    guint n_recent = tag_store ? MIN (tagstore_get_recent (tag_store, &tracks), RECENT_ALBUMS_MAX) : 0;
+
+    for (guint i = 0; i < n_recent; i++) {
+        const gchar *path = tagstore_get_path (tag_store, tracks[i]);
+        const gchar *artist = tagstore_get_string (tag_store, TAG_FIELD_ALBUM_ARTIST, tracks[i]);
+        const gchar *album = tagstore_get_string (tag_store, TAG_FIELD_ALBUM, tracks[i]);
+
+        gchar *uri = g_path_get_dirname (path);
+        gchar *name = ! NZV (album) ? g_path_get_basename (uri)
+                    : NZV (artist) ? g_strdup_printf ("%s - %s", artist, album) : g_strdup (album);
+        GDateTime *mtime = g_date_time_new_from_unix_local (tagstore_get_mtime (tag_store, tracks[i]));
+        gchar *date = mtime ? g_date_time_format (mtime, "%x %X") : g_strdup ("");
+        gchar *tooltip = g_markup_printf_escaped (_("%s\nModified: %s"), uri, date);
+        GdkPixbuf *icon = get_icon_for_uri (current_view, uri);
+
+        gtk_tree_store_insert_with_values (treestore, &iter, parent, -1,
+                        TREEBROWSER_COLUMN_ICON,    icon,
+                        TREEBROWSER_COLUMN_NAME,    name,
+                        TREEBROWSER_COLUMN_URI,     uri,
+                        TREEBROWSER_COLUMN_TOOLTIP, tooltip,
+                        -1);
+
+        /* Listed when expanded, like other directories */
+        gtk_tree_store_prepend (treestore, &child, &iter);
+        gtk_tree_store_set (treestore, &child,
+                        TREEBROWSER_COLUMN_NAME,    _("(Empty)"),
+                        -1);
+
+        if (icon)
+            g_object_unref (icon);
+        if (mtime)
+            g_date_time_unref (mtime);
+        g_free (date);
+        g_free (tooltip);
+        g_free (name);
+        g_free (uri);
+    }
+
+    if (n_recent == 0)
+        gtk_tree_store_insert_with_values (treestore, &iter, parent, -1,
+                        TREEBROWSER_COLUMN_NAME,    tag_scan_running ? _("(Reading tags...)") : _("(Empty)"),
+                        -1);
+
+    /* New rows were added first, so an expanded row stays expanded */
+    while (n_old-- > 0 && gtk_tree_model_iter_children (GTK_TREE_MODEL (treestore), &iter, parent))
+        gtk_tree_store_iter_clear_nodes (&iter, TRUE);
+}
+
+/* Tag store changed, update the row if it is open */
+static void
+recent_row_refresh (void)
+{
+    GtkTreeIter iter;
+    if (recent_row_get_iter (&iter) && treeview
+                && treeview_row_expanded_iter (GTK_TREE_VIEW (treeview), &iter))
+        recent_row_fill (&iter);
+}
+
+/* Recently added albums stand for all their files */
+static void
+get_uris_from_recent_row (GList **files)
+{
+    const guint32 *tracks = NULL;
+    guint n_recent = tag_store ? MIN (tagstore_get_recent (tag_store, &tracks), RECENT_ALBUMS_MAX) : 0;
+    for (guint i = n_recent; i-- > 0; )
+        *files = g_list_prepend (*files, g_path_get_dirname (tagstore_get_path (tag_store, tracks[i])));
 }
 
 /*  RIGHTCLICK MENU EVENTS */
@@ -1335,6 +3281,7 @@ static void
 on_menu_refresh (GtkMenuItem *menuitem, gpointer *user_data)
 {
     treebrowser_browse (NULL, NULL);
+    search_index_update (TRUE);  // pick up changes made on disk since the index was built
 }
 
 static void
@@ -1396,12 +3343,25 @@ on_menu_collapse_all(GtkMenuItem *menuitem, gpointer *user_data)
         gtk_tree_model_get_iter_first (GTK_TREE_MODEL (treestore), &iter);
 
         path = gtk_tree_model_get_path (GTK_TREE_MODEL (treestore), &iter);
-        while (tree_view_expand_rows_recursive (GTK_TREE_MODEL (treestore), GTK_TREE_VIEW (treeview), path, 0))
+        while (tree_view_collapse_rows_recursive (GTK_TREE_MODEL (treestore), GTK_TREE_VIEW (treeview), path, 0))
             gtk_tree_path_next (path);
+
+        treeview_clear_expanded ();
     }
     else
     {
         tree_view_collapse_rows_recursive (GTK_TREE_MODEL (treestore), GTK_TREE_VIEW (treeview), path, 0);
+
+        /* Forget about all expanded rows below, not only those that are visible */
+        GtkTreeIter iter;
+        if (gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path)) {
+            gchar *uri;
+            gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                            TREEBROWSER_COLUMN_URI, &uri, -1);
+            if (uri && expanded_rows)
+                pathtrie_remove_subtree (expanded_rows, uri);
+            g_free (uri);
+        }
     }
 
     gtk_tree_path_free (path);
@@ -1428,23 +3388,77 @@ on_menu_copy_uri(GtkMenuItem *menuitem, GList *uri_list)
     g_free (uri);
 }
 
+static void
+on_menu_remove_smart_folder (GtkMenuItem *menuitem, GtkTreePath *path)
+{
+    GtkTreeIter iter;
+    if (! gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path)
+                || ! smart_folder_for_iter (&iter))
+        return;
+
+    g_ptr_array_remove_index (smart_folders, gtk_tree_path_get_indices (path)[0]);
+    smart_folders_save ();
+    virtual_rows_show ();
+}
+
+static void
+on_menu_show_recent (GtkMenuItem *menuitem, gpointer *user_data)
+{
+    CONFIG_SHOW_RECENT = gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (menuitem));
+    deadbeef->conf_set_int (CONFSTR_FB_SHOW_RECENT, CONFIG_SHOW_RECENT);
+    virtual_rows_show ();
+    tag_scan_update ();
+}
+
+static void
+on_menu_reveal_playing (GtkMenuItem *menuitem, gpointer *user_data)
+{
+    DB_playItem_t *track = deadbeef->streamer_get_playing_track ();
+    if (! track)
+        return;
+
+    gchar *uri = get_track_uri (track);
+    deadbeef->pl_item_unref (track);
+    if (uri)
+        treeview_reveal_async (uri);
+    g_free (uri);
+}
+
+static void
+on_menu_follow_playing (GtkMenuItem *menuitem, gpointer *user_data)
+{
+    CONFIG_FOLLOW_PLAYING = gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (menuitem));
+    deadbeef->conf_set_int (CONFSTR_FB_FOLLOW_PLAYING, CONFIG_FOLLOW_PLAYING);
+}
+
 static void
 on_menu_show_hidden_files(GtkMenuItem *menuitem, gpointer *user_data)
 {
     CONFIG_SHOW_HIDDEN_FILES = gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (menuitem));
-    treebrowser_chroot (NULL);   // update tree
+    deadbeef->conf_set_int (CONFSTR_FB_SHOW_HIDDEN_FILES, CONFIG_SHOW_HIDDEN_FILES);
+    update_view_config ();
+    treeview_refilter ();
 }
 
 static void
 on_menu_use_filter(GtkMenuItem *menuitem, gpointer *user_data)
 {
     CONFIG_FILTER_ENABLED = gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (menuitem));
-    treebrowser_chroot (NULL);   // update tree
+    deadbeef->conf_set_int (CONFSTR_FB_FILTER_ENABLED, CONFIG_FILTER_ENABLED);
+    update_view_config ();
+    treeview_refilter ();
 }
 
 
 /* TREEVIEW EVENTS */
 
+static void
+get_uris_from_smart_folder (gpointer data, gpointer userdata)
+{
+    GList **files = userdata;
+    *files = g_list_prepend (*files, g_strdup (data));
+}
+
 static void
 get_uris_from_selection (gpointer data, gpointer userdata)
 {
@@ -1456,6 +3470,23 @@ get_uris_from_selection (gpointer data, gpointer userdata)
     if (! gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path))
         return;
 
+    /* Smart folders stand for all their files */
+    SmartFolder *folder = smart_folder_for_iter (&iter);
+    if (folder) {
+        GList *files = NULL;
+        smartfolder_foreach (folder, (GFunc) get_uris_from_smart_folder, &files);
+        uri_list = g_list_concat (uri_list, g_list_reverse (files));
+        return;
+    }
+    gint flag;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    if (flag == TREEBROWSER_FLAGS_RECENT) {
+        GList *files = NULL;
+        get_uris_from_recent_row (&files);
+        uri_list = g_list_concat (uri_list, files);
+        return;
+    }
+
     gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
                     TREEBROWSER_COLUMN_URI, &uri, -1);
     uri_list = g_list_append (uri_list, g_strdup (uri));
@@ -1576,186 +3607,875 @@ on_treeview_mouseclick_press (GtkWidget *widget, GdkEventButton *event,
                     gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, column, FALSE);
             }
 
-            GList *rows, *uri_list;
-            uri_list = g_list_alloc ();
-            rows = gtk_tree_selection_get_selected_rows (selection, NULL);
-            g_list_foreach (rows, (GFunc)get_uris_from_selection, uri_list);
-            g_list_foreach (rows, (GFunc)gtk_tree_path_free, NULL);
-            g_list_free (rows);
+            GList *rows, *uri_list;
+            uri_list = g_list_alloc ();
+            rows = gtk_tree_selection_get_selected_rows (selection, NULL);
+            g_list_foreach (rows, (GFunc)get_uris_from_selection, uri_list);
+            g_list_foreach (rows, (GFunc)gtk_tree_path_free, NULL);
+            g_list_free (rows);
+
+            gtk_menu_popup (GTK_MENU (create_popup_menu (path, "", uri_list)),
+                            NULL, NULL, NULL, NULL, event->button, event->time);
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+on_treeview_mouseclick_release (GtkWidget *widget, GdkEventButton *event,
+                GtkTreeSelection *selection)
+{
+    if (gtkui_plugin->w_get_design_mode ()) {
+        return FALSE;
+    }
+
+    GtkTreePath         *path;
+    GtkTreeViewColumn   *column;
+    gtk_tree_view_get_path_at_pos (GTK_TREE_VIEW (treeview), event->x, event->y,
+                    &path, &column, NULL, NULL);
+
+    //gint selected_rows = gtk_tree_selection_count_selected_rows (selection);
+
+    if (event->button == 1)
+    {
+        if (! path)
+        {
+            mouseclick_lastpath = NULL;
+            gtk_tree_selection_unselect_all (selection);
+            return TRUE;
+        }
+
+        if (mouseclick_dragwait)
+        {
+            mouseclick_lastpath = path;
+            mouseclick_dragwait = FALSE;
+            if (! (event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)))
+            {
+                // select row (abort drag)
+                gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, column, FALSE);
+            }
+        }
+        /*
+        else if (mouseclick_areaselect)
+        {
+        }
+        */
+    }
+
+    return TRUE;
+}
+
+static gboolean
+on_treeview_mousemove (GtkWidget *widget, GdkEventButton *event)
+{
+    if (gtkui_plugin->w_get_design_mode ()) {
+        return FALSE;
+    }
+
+    if (mouseclick_dragwait)
+    {
+        if (gtk_drag_check_threshold (widget, mouseclick_lastpos[0], event->x, mouseclick_lastpos[1], event->y))
+        {
+            mouseclick_dragwait = FALSE;
+            GtkTargetEntry entry = {
+                .target = "text/uri-list",
+                .flags = GTK_TARGET_SAME_APP,
+                .info = 0
+            };
+            GtkTargetList *target = gtk_target_list_new (&entry, 1);
+#if !GTK_CHECK_VERSION(3,0,0)
+            gtk_drag_begin (widget, target, GDK_ACTION_COPY | GDK_ACTION_MOVE, 1, (GdkEvent *)event);
+#else
+            gtk_drag_begin_with_coordinates (widget, target, GDK_ACTION_COPY | GDK_ACTION_MOVE, 1, (GdkEvent *)event, -1, -1);
+#endif
+        }
+    }
+    /*
+    else if (mouseclick_areaselect)
+    {
+    }
+    */
+
+    return TRUE;
+}
+
+/*
+static void
+on_treeview_row_activated (GtkWidget *widget, GtkTreePath *path,
+                GtkTreeViewColumn *column, gpointer user_data)
+{
+    GtkTreeIter     iter;
+    gchar           *uri;
+
+    gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path);
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                    TREEBROWSER_COLUMN_URI, &uri, -1);
+
+    if (uri == NULL)
+        return;
+
+    if (g_file_test (uri, G_FILE_TEST_IS_DIR)) {
+        if (CONFIG_CHROOT_ON_DCLICK)
+            treebrowser_chroot (uri);
+        else {
+            if (gtk_tree_view_row_expanded (GTK_TREE_VIEW (widget), path))
+                gtk_tree_view_collapse_row (GTK_TREE_VIEW (widget), path);
+            else
+                gtk_tree_view_expand_row (GTK_TREE_VIEW (widget), path, FALSE);
+        }
+    }
+
+    g_free(uri);
+}
+*/
+static void
+on_treeview_row_expanded (GtkWidget *widget, GtkTreeIter *iter,
+                GtkTreePath *path, gpointer user_data)
+{
+    gchar *uri;
+
+    /* Smart folders and recently added albums are filled every time */
+    SmartFolder *folder = smart_folder_for_iter (iter);
+    if (folder) {
+        smart_folder_fill_row (iter, folder);
+        return;
+    }
+    gint flag;
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter, TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    if (flag == TREEBROWSER_FLAGS_RECENT) {
+        recent_row_fill (iter);
+        return;
+    }
+
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
+                    TREEBROWSER_COLUMN_URI, &uri, -1);
+    if (uri == NULL)
+        return;
+
+    /* Rows filled by treebrowser_browse() or the restore are already loaded */
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
+                    TREEBROWSER_COLUMN_FLAG, &flag, -1);
+    if (flag != TREEBROWSER_FLAGS_LOADED && flag != TREEBROWSER_FLAGS_FILLING) {
+        treebrowser_browse (uri, iter);
+        gtk_tree_view_expand_row (GTK_TREE_VIEW (treeview), path, FALSE);
+    }
+
+    if (CONFIG_SHOW_ICONS) {
+        GdkPixbuf *icon = get_icon_for_uri (current_view, uri);
+        gtk_tree_store_set (treestore, iter, TREEBROWSER_COLUMN_ICON, icon, -1);
+        g_object_unref (icon);
+    }
+
+    /* Albums below recently added are only views of their folders */
+    if (! row_is_virtual (iter)) {
+        unload_queue_remove (uri);
+        if (expanded_rows)
+            pathtrie_add (expanded_rows, uri);
+        session_changed ();
+    }
+
+    g_free (uri);
+}
+
+static void
+on_treeview_row_collapsed (GtkWidget *widget, GtkTreeIter *iter,
+                GtkTreePath *path, gpointer user_data)
+{
+    gchar *uri;
+
+    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
+                    TREEBROWSER_COLUMN_URI, &uri, -1);
+    if (! uri)
+        return;
+
+    /* List directory again when it's expanded next time */
+    gtk_tree_store_set (treestore, iter, TREEBROWSER_COLUMN_FLAG, 0, -1);
+
+    if (CONFIG_SHOW_ICONS) {
+        GdkPixbuf *icon = get_icon_for_uri (current_view, uri);
+        gtk_tree_store_set (treestore, iter, TREEBROWSER_COLUMN_ICON, icon, -1);
+        g_object_unref (icon);
+    }
+
+    if (! row_is_virtual (iter)) {
+        unload_queue_add (uri);
+        if (expanded_rows)
+            pathtrie_remove (expanded_rows, uri);
+        session_changed ();
+    }
+
+    g_free (uri);
+}
+
+static void
+on_button_import_cancel (GtkWidget *button, gpointer user_data)
+{
+    import_cancel ();
+}
+
+/* Update tooltips of the next rows of a directory, returns FALSE once done */
+static gboolean
+tooltip_job_step (gpointer data)
+{
+    TooltipJob *job = data;
+    GtkTreeIter parent, iter;
+
+    if (! treeview || ! treeview_find_iter (job->dir, &parent)
+                || ! gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (treestore), &iter, &parent, job->next))
+        return FALSE;
+
+    gboolean valid = TRUE;
+    for (guint i = 0; i < FILL_CHUNK_ROWS && valid; i++) {
+        gchar *uri;
+        gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
+                        TREEBROWSER_COLUMN_URI, &uri, -1);
+        if (uri && ! gtk_tree_model_iter_has_child (GTK_TREE_MODEL (treestore), &iter)) {
+            gchar *tooltip = metacache_describe (uri);
+            if (tooltip)
+                gtk_tree_store_set (treestore, &iter, TREEBROWSER_COLUMN_TOOLTIP, tooltip, -1);
+            g_free (tooltip);
+        }
+        g_free (uri);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (treestore), &iter);
+        job->next++;
+    }
+
+    return valid;
+}
+
+static void
+tooltip_job_free (TooltipJob *job)
+{
+    g_free (job->dir);
+    g_free (job);
+}
+
+/* Tags of the tracks in dir were read, show them in the tooltips */
+static void
+on_metacache_ready (const gchar *dir, gpointer user_data)
+{
+    if (! treeview)
+        return;
+
+    TooltipJob *job = g_new0 (TooltipJob, 1);
+    job->dir = g_strdup (dir);
+    scheduler_add (SCHEDULER_PRIORITY_PREFETCH, tooltip_job_step, job, (GDestroyNotify) tooltip_job_free);
+}
+
+/* New search index was built in the background */
+static void
+on_search_index_ready (SearchIndex *index, gpointer user_data)
+{
+    searchindex_free (search_index);
+    search_index = index;
+    g_free (search_index_target);
+    search_index_target = NULL;
+
+    if (search_entry)
+        on_search_changed (search_entry, NULL);
+}
+
+/* Show tracks matching a tag query, all matches are kept for the popup menu */
+static void
+search_show_query (const TagQuery *query)
+{
+    GtkTreeIter iter;
+
+    if (! tag_scan_wanted) {
+        tag_scan_wanted = TRUE;
+        tag_scan_update ();
+    }
+    if (! tag_store || tagstore_size (tag_store) == 0) {
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     tag_scan_running ? _("(Reading tags...)") : _("(No tracks)"),
+                        -1);
+        return;
+    }
+
+    GArray *tracks = tagquery_run (query, tag_store);
+    search_query_results = g_ptr_array_new_with_free_func (g_free);
+    for (guint i = 0; i < tracks->len; i++) {
+        guint32 track = g_array_index (tracks, guint32, i);
+        const gchar *path = tagstore_get_path (tag_store, track);
+
+        /* Tracks of a file are stored next to each other */
+        if (search_query_results->len == 0 || ! utils_str_equal (path,
+                    g_ptr_array_index (search_query_results, search_query_results->len - 1)))
+            g_ptr_array_add (search_query_results, g_strdup (path));
+
+        if (i >= SEARCH_RESULTS_MAX)
+            continue;
+
+        const gchar *artist = tagstore_get_string (tag_store, TAG_FIELD_ARTIST, track);
+        const gchar *title = tagstore_get_string (tag_store, TAG_FIELD_TITLE, track);
+        gchar *name = ! NZV (title) ? g_path_get_basename (path)
+                    : NZV (artist) ? g_strdup_printf ("%s - %s", artist, title) : g_strdup (title);
+        gchar *tooltip = utils_tooltip_from_uri (path);
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     name,
+                        SEARCH_COLUMN_URI,      path,
+                        SEARCH_COLUMN_TOOLTIP,  tooltip,
+                        -1);
+        g_free (name);
+        g_free (tooltip);
+    }
+
+    if (tracks->len == 0) {
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     _("(No matches)"), -1);
+    }
+    else if (tracks->len > SEARCH_RESULTS_MAX) {
+        gchar *more = g_strdup_printf (_("(%u more matches)"), tracks->len - SEARCH_RESULTS_MAX);
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     more, -1);
+        g_free (more);
+    }
+    g_array_free (tracks, TRUE);
+}
+
+/* Search text changed, show matching files instead of the tree */
+static void
+on_search_changed (GtkWidget *entry, gpointer user_data)
+{
+    if (! search_scrollwin || ! tree_scrollwin)
+        return;
+
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (entry));
+    gtk_list_store_clear (search_store);
+    if (search_query_results)
+        g_ptr_array_unref (search_query_results);
+    search_query_results = NULL;
+
+    if (! NZV (text)) {
+        update_sidebar_view ();
+        return;
+    }
+
+    /* Text with field names is a tag query, anything else searches filenames */
+    GtkTreeIter iter;
+    gchar *error = NULL;
+    TagQuery *query = tagquery_parse (text, &error);
+    if (! query) {
+        gchar *message = g_strdup_printf (_("(Invalid query: %s)"), error);
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     message, -1);
+        g_free (message);
+        g_free (error);
+    }
+    else if (tagquery_is_structured (query)) {
+        search_show_query (query);
+    }
+    else if (search_index) {
+        GPtrArray *results = searchindex_query_fuzzy (search_index, text, SEARCH_RESULTS_MAX);
+        for (guint i = 0; i < results->len; i++) {
+            const gchar *uri = g_ptr_array_index (results, i);
+            gchar *name = g_path_get_basename (uri);
+            gchar *tooltip = utils_tooltip_from_uri (uri);
+            gtk_list_store_insert_with_values (search_store, &iter, -1,
+                            SEARCH_COLUMN_NAME,     name,
+                            SEARCH_COLUMN_URI,      uri,
+                            SEARCH_COLUMN_TOOLTIP,  tooltip,
+                            -1);
+            g_free (name);
+            g_free (tooltip);
+        }
+        if (results->len == 0)
+            gtk_list_store_insert_with_values (search_store, &iter, -1,
+                            SEARCH_COLUMN_NAME,     _("(No matches)"), -1);
+        g_ptr_array_unref (results);
+    }
+    else {
+        gtk_list_store_insert_with_values (search_store, &iter, -1,
+                        SEARCH_COLUMN_NAME,     _("(Indexing library...)"), -1);
+    }
+    tagquery_free (query);
+
+    update_sidebar_view ();
+}
+
+/* Show search result in the tree */
+static void
+search_reveal_result (GtkTreeIter *iter)
+{
+    gchar *uri;
+    gtk_tree_model_get (GTK_TREE_MODEL (search_store), iter,
+                    SEARCH_COLUMN_URI, &uri, -1);
+    if (uri) {
+        if (view_selector)
+            gtk_combo_box_set_active (GTK_COMBO_BOX (view_selector), VIEW_MODE_FOLDERS);
+        gtk_entry_set_text (GTK_ENTRY (search_entry), "");  // switches back to the tree
+        treeview_reveal (uri);
+        gtk_widget_grab_focus (treeview);
+    }
+    g_free (uri);
+}
+
+/* Enter in search entry reveals first result */
+static void
+on_search_activate (GtkWidget *entry, gpointer user_data)
+{
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (search_store), &iter))
+        search_reveal_result (&iter);
+}
+
+static void
+on_search_row_activated (GtkWidget *widget, GtkTreePath *path,
+                GtkTreeViewColumn *column, gpointer user_data)
+{
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter (GTK_TREE_MODEL (search_store), &iter, path))
+        search_reveal_result (&iter);
+}
 
-            gtk_menu_popup (GTK_MENU (create_popup_menu (path, "", uri_list)),
-                            NULL, NULL, NULL, NULL, event->button, event->time);
-        }
-    }
+/* Add all files matching the current query */
+static void
+search_add_results (int plt)
+{
+    if (! search_query_results || search_query_results->len == 0)
+        return;
 
-    return TRUE;
+    GList *uri_list = NULL;
+    for (guint i = search_query_results->len; i-- > 0; )
+        uri_list = g_list_prepend (uri_list, g_strdup (g_ptr_array_index (search_query_results, i)));
+    uri_list = g_list_prepend (uri_list, NULL);  // first item is always NULL
+
+    add_uri_to_playlist (uri_list, plt);
+    g_list_free_full (uri_list, g_free);
 }
 
 static gboolean
-on_treeview_mouseclick_release (GtkWidget *widget, GdkEventButton *event,
-                GtkTreeSelection *selection)
+on_search_button_press (GtkWidget *widget, GdkEventButton *event, gpointer user_data)
 {
-    if (gtkui_plugin->w_get_design_mode ()) {
+    if (event->type != GDK_BUTTON_PRESS || event->button != 3)
+        return FALSE;
+    if (! search_query_results || search_query_results->len == 0)
         return FALSE;
-    }
 
-    GtkTreePath         *path;
-    GtkTreeViewColumn   *column;
-    gtk_tree_view_get_path_at_pos (GTK_TREE_VIEW (treeview), event->x, event->y,
-                    &path, &column, NULL, NULL);
+    gtk_menu_popup (GTK_MENU (search_menu), NULL, NULL, NULL, NULL, event->button, event->time);
+    return TRUE;
+}
 
-    //gint selected_rows = gtk_tree_selection_count_selected_rows (selection);
+static void
+on_search_menu_add_current (GtkMenuItem *menuitem, gpointer user_data)
+{
+    search_add_results (PLT_CURRENT);
+}
 
-    if (event->button == 1)
-    {
-        if (! path)
-        {
-            mouseclick_lastpath = NULL;
-            gtk_tree_selection_unselect_all (selection);
-            return TRUE;
-        }
+static void
+on_search_menu_add_new (GtkMenuItem *menuitem, gpointer user_data)
+{
+    search_add_results (PLT_NEW);
+}
 
-        if (mouseclick_dragwait)
-        {
-            mouseclick_lastpath = path;
-            mouseclick_dragwait = FALSE;
-            if (! (event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)))
-            {
-                // select row (abort drag)
-                gtk_tree_view_set_cursor (GTK_TREE_VIEW (treeview), path, column, FALSE);
-            }
-        }
-        /*
-        else if (mouseclick_areaselect)
-        {
-        }
-        */
-    }
+static void
+on_search_menu_save (GtkMenuItem *menuitem, gpointer user_data)
+{
+    smart_folder_add (gtk_entry_get_text (GTK_ENTRY (search_entry)));
+}
 
-    return TRUE;
+/* Show search results while searching, otherwise the selected view */
+static void
+update_sidebar_view (void)
+{
+    if (! tree_scrollwin || ! tag_scrollwin || ! search_scrollwin)
+        return;
+
+    gboolean searching = search_entry && NZV (gtk_entry_get_text (GTK_ENTRY (search_entry)));
+    GtkWidget *shown = searching ? search_scrollwin
+                : (CONFIG_VIEW_MODE == VIEW_MODE_FOLDERS) ? tree_scrollwin : tag_scrollwin;
+
+    if (shown != tree_scrollwin)
+        gtk_widget_hide (tree_scrollwin);
+    if (shown != tag_scrollwin)
+        gtk_widget_hide (tag_scrollwin);
+    if (shown != search_scrollwin)
+        gtk_widget_hide (search_scrollwin);
+    gtk_widget_show (shown);
 }
 
-static gboolean
-on_treeview_mousemove (GtkWidget *widget, GdkEventButton *event)
+/* Label of the group starting with track */
+static gchar *
+tag_view_group_name (TagField field, guint track)
 {
-    if (gtkui_plugin->w_get_design_mode ()) {
-        return FALSE;
+    if (field == TAG_FIELD_YEAR) {
+        guint32 year = tagstore_get (tag_store, TAG_FIELD_YEAR, track);
+        return year ? g_strdup_printf ("%u", year) : g_strdup (_("(Unknown)"));
     }
 
-    if (mouseclick_dragwait)
-    {
-        if (gtk_drag_check_threshold (widget, mouseclick_lastpos[0], event->x, mouseclick_lastpos[1], event->y))
-        {
-            mouseclick_dragwait = FALSE;
-            GtkTargetEntry entry = {
-                .target = "text/uri-list",
-                .flags = GTK_TARGET_SAME_APP,
-                .info = 0
-            };
-            GtkTargetList *target = gtk_target_list_new (&entry, 1);
-#if !GTK_CHECK_VERSION(3,0,0)
-            gtk_drag_begin (widget, target, GDK_ACTION_COPY | GDK_ACTION_MOVE, 1, (GdkEvent *)event);
-#else
-            gtk_drag_begin_with_coordinates (widget, target, GDK_ACTION_COPY | GDK_ACTION_MOVE, 1, (GdkEvent *)event, -1, -1);
-#endif
+    const gchar *name = tagstore_get_string (tag_store, field, track);
+    if (! NZV (name))
+        return g_strdup (_("(Unknown)"));
+
+    /* Albums show their year unless the view is grouped by year */
+    guint32 year = tagstore_get (tag_store, TAG_FIELD_YEAR, track);
+    if (field == TAG_FIELD_ALBUM && year && CONFIG_VIEW_MODE != VIEW_MODE_YEARS)
+        return g_strdup_printf ("%s (%u)", name, year);
+    return g_strdup (name);
+}
+
+/* Number and total length of the sorted tracks in [start, end) */
+static gchar *
+tag_view_range_tooltip (guint start, guint end)
+{
+    guint64 duration = 0;
+    for (guint i = start; i < end; i++)
+        duration += tagstore_get (tag_store, TAG_FIELD_DURATION, tag_order[i]);
+
+    guint seconds = duration / 1000;
+    gchar *length = (seconds >= 3600)
+                ? g_strdup_printf ("%u:%02u:%02u", seconds / 3600, seconds / 60 % 60, seconds % 60)
+                : g_strdup_printf ("%u:%02u", seconds / 60, seconds % 60);
+    gchar *tooltip = g_strdup_printf (_("Tracks: %u\nLength: %s"), end - start, length);
+    g_free (length);
+
+    return tooltip;
+}
+
+/* Add rows for the sorted tracks in [start, end) below parent, grouped by
+ * the given level of the current view. Groups get a placeholder child and
+ * are filled when expanded. */
+static void
+tag_view_fill (GtkTreeIter *parent, guint start, guint end, gint level)
+{
+    GtkTreeIter iter, placeholder;
+
+    if (level >= tag_view_n_levels[CONFIG_VIEW_MODE]) {
+        for (guint i = start; i < end; i++) {
+            guint track = tag_order[i];
+            const gchar *path = tagstore_get_path (tag_store, track);
+            const gchar *title = tagstore_get_string (tag_store, TAG_FIELD_TITLE, track);
+            guint number = tagstore_get (tag_store, TAG_FIELD_NUMBER, track) & 0xffff;
+            guint seconds = tagstore_get (tag_store, TAG_FIELD_DURATION, track) / 1000;
+
+            gchar *basename = NZV (title) ? NULL : g_filename_display_basename (path);
+            gchar *name = number ? g_strdup_printf ("%02u. %s", number, basename ? basename : title)
+                                 : g_strdup (basename ? basename : title);
+            gchar *tooltip = g_markup_printf_escaped ("%s\n%s\n%u:%02u", path,
+                            tagstore_get_string (tag_store, TAG_FIELD_ARTIST, track),
+                            seconds / 60, seconds % 60);
+
+            gtk_tree_store_insert_with_values (tag_model, &iter, parent, -1,
+                            TAGVIEW_COLUMN_NAME,    name,
+                            TAGVIEW_COLUMN_TOOLTIP, tooltip,
+                            TAGVIEW_COLUMN_START,   i,
+                            TAGVIEW_COLUMN_END,     i + 1,
+                            TAGVIEW_COLUMN_LEVEL,   level,
+                            -1);
+            g_free (basename);
+            g_free (name);
+            g_free (tooltip);
         }
+        return;
     }
-    /*
-    else if (mouseclick_areaselect)
-    {
+
+    /* Tracks are sorted by the grouping fields, so groups are consecutive */
+    TagField field = tag_view_levels[CONFIG_VIEW_MODE][level];
+    guint i = start;
+    while (i < end) {
+        guint32 value = tagstore_get (tag_store, field, tag_order[i]);
+        guint j = i + 1;
+        while (j < end && tagstore_get (tag_store, field, tag_order[j]) == value)
+            j++;
+
+        gchar *name = tag_view_group_name (field, tag_order[i]);
+        gchar *tooltip = tag_view_range_tooltip (i, j);
+        gtk_tree_store_insert_with_values (tag_model, &iter, parent, -1,
+                        TAGVIEW_COLUMN_NAME,    name,
+                        TAGVIEW_COLUMN_TOOLTIP, tooltip,
+                        TAGVIEW_COLUMN_START,   i,
+                        TAGVIEW_COLUMN_END,     j,
+                        TAGVIEW_COLUMN_LEVEL,   level,
+                        -1);
+        gtk_tree_store_insert_with_values (tag_model, &placeholder, &iter, -1,
+                        TAGVIEW_COLUMN_LEVEL,   -1,
+                        -1);
+        g_free (name);
+        g_free (tooltip);
+        i = j;
     }
-    */
+}
 
-    return TRUE;
+/* Names of row and its parents, identifies a group across refreshes */
+static gchar *
+tag_view_row_key (GtkTreeIter *iter)
+{
+    GString *key = g_string_new (NULL);
+    GtkTreeIter child = *iter, parent;
+    gboolean valid = TRUE;
+
+    while (valid) {
+        gchar *name;
+        gtk_tree_model_get (GTK_TREE_MODEL (tag_model), &child, TAGVIEW_COLUMN_NAME, &name, -1);
+        if (key->len > 0)
+            g_string_prepend_c (key, '\n');
+        g_string_prepend (key, name ? name : "");
+        g_free (name);
+
+        valid = gtk_tree_model_iter_parent (GTK_TREE_MODEL (tag_model), &parent, &child);
+        child = parent;
+    }
+    return g_string_free (key, FALSE);
 }
 
-/*
 static void
-on_treeview_row_activated (GtkWidget *widget, GtkTreePath *path,
-                GtkTreeViewColumn *column, gpointer user_data)
+tag_view_collect_expanded (GtkTreeView *tree_view, GtkTreePath *path, gpointer user_data)
 {
-    GtkTreeIter     iter;
-    gchar           *uri;
+    GHashTable *expanded = user_data;
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter (GTK_TREE_MODEL (tag_model), &iter, path))
+        g_hash_table_add (expanded, tag_view_row_key (&iter));
+}
 
-    gtk_tree_model_get_iter (GTK_TREE_MODEL (treestore), &iter, path);
-    gtk_tree_model_get (GTK_TREE_MODEL (treestore), &iter,
-                    TREEBROWSER_COLUMN_URI, &uri, -1);
+/* Expand the rows below parent that were expanded before a refresh */
+static void
+tag_view_expand_saved (GtkTreeIter *parent, const gchar *prefix, GHashTable *expanded)
+{
+    GtkTreeIter iter;
+    gboolean valid = gtk_tree_model_iter_children (GTK_TREE_MODEL (tag_model), &iter, parent);
+    while (valid) {
+        gchar *name;
+        gtk_tree_model_get (GTK_TREE_MODEL (tag_model), &iter, TAGVIEW_COLUMN_NAME, &name, -1);
+        gchar *key = prefix ? g_strconcat (prefix, "\n", name, NULL) : g_strdup (name);
+
+        if (name && g_hash_table_contains (expanded, key)) {
+            GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (tag_model), &iter);
+            gtk_tree_view_expand_row (GTK_TREE_VIEW (tag_view), path, FALSE);  // fills the children
+            gtk_tree_path_free (path);
+            tag_view_expand_saved (&iter, key, expanded);
+        }
+        g_free (key);
+        g_free (name);
 
-    if (uri == NULL)
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (tag_model), &iter);
+    }
+}
+
+/* Sort tracks for the current view and show the top level groups, keeping
+ * expanded groups open */
+static void
+tag_view_refresh (void)
+{
+    if (! tag_view)
         return;
 
-    if (g_file_test (uri, G_FILE_TEST_IS_DIR)) {
-        if (CONFIG_CHROOT_ON_DCLICK)
-            treebrowser_chroot (uri);
-        else {
-            if (gtk_tree_view_row_expanded (GTK_TREE_VIEW (widget), path))
-                gtk_tree_view_collapse_row (GTK_TREE_VIEW (widget), path);
-            else
-                gtk_tree_view_expand_row (GTK_TREE_VIEW (widget), path, FALSE);
-        }
+    GHashTable *expanded = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    gtk_tree_view_map_expanded_rows (GTK_TREE_VIEW (tag_view), tag_view_collect_expanded, expanded);
+    gtk_tree_store_clear (tag_model);
+
+    g_free (tag_order);
+    tag_order = NULL;
+
+    if (CONFIG_VIEW_MODE != VIEW_MODE_FOLDERS && tag_store) {
+        TagField keys[TAGVIEW_MAX_LEVELS + 1];
+        gint n_levels = tag_view_n_levels[CONFIG_VIEW_MODE];
+        for (gint i = 0; i < n_levels; i++)
+            keys[i] = tag_view_levels[CONFIG_VIEW_MODE][i];
+        keys[n_levels] = TAG_FIELD_NUMBER;
+
+        tag_order = tagstore_sort (tag_store, keys, n_levels + 1);
+        tag_view_fill (NULL, 0, tagstore_size (tag_store), 0);
+        tag_view_expand_saved (NULL, NULL, expanded);
     }
 
-    g_free(uri);
+    if (tagstore_size (tag_store) == 0) {
+        GtkTreeIter iter;
+        gtk_tree_store_insert_with_values (tag_model, &iter, NULL, -1,
+                        TAGVIEW_COLUMN_NAME,    tag_scan_running ? _("(Reading tags...)") : _("(No tracks)"),
+                        TAGVIEW_COLUMN_LEVEL,   -1,
+                        -1);
+    }
+
+    g_hash_table_destroy (expanded);
 }
-*/
+
+/* Add the tracks of the selected row to a playlist */
 static void
-on_treeview_row_expanded (GtkWidget *widget, GtkTreeIter *iter,
-                GtkTreePath *path, gpointer user_data)
+tag_view_add_selected (int plt)
 {
-    gchar *uri;
+    GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (tag_view));
+    GtkTreeIter iter;
+    guint start, end;
+    gint level;
 
-    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
-                    TREEBROWSER_COLUMN_URI, &uri, -1);
-    if (uri == NULL)
+    if (! tag_order || ! gtk_tree_selection_get_selected (selection, NULL, &iter))
+        return;
+    gtk_tree_model_get (GTK_TREE_MODEL (tag_model), &iter,
+                    TAGVIEW_COLUMN_START,   &start,
+                    TAGVIEW_COLUMN_END,     &end,
+                    TAGVIEW_COLUMN_LEVEL,   &level,
+                    -1);
+    if (level < 0)
         return;
 
-    if (flag_on_expand_refresh == FALSE) {
-        flag_on_expand_refresh = TRUE;
-        treebrowser_browse(uri, iter);
-        gtk_tree_view_expand_row (GTK_TREE_VIEW(treeview), path, FALSE);
-        flag_on_expand_refresh = FALSE;
+    /* Files with several tracks (e.g. cue sheets) are added once */
+    GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+    GList *files = NULL;
+    for (guint i = start; i < end; i++) {
+        const gchar *path = tagstore_get_path (tag_store, tag_order[i]);
+        if (g_hash_table_contains (seen, path))
+            continue;
+        g_hash_table_add (seen, (gpointer) path);
+        files = g_list_prepend (files, g_strdup (path));
     }
+    g_hash_table_destroy (seen);
 
-    if (CONFIG_SHOW_ICONS) {
-        GdkPixbuf *icon = get_icon_for_uri (uri);
-        gtk_tree_store_set (treestore, iter, TREEBROWSER_COLUMN_ICON, icon, -1);
-        g_object_unref (icon);
-    }
+    GList *uri_list = g_list_prepend (g_list_reverse (files), NULL);  // first item is always NULL
 
-    GSList *node = treeview_check_expanded (uri);
-    if (! node)
-    {
-        gchar *enc_uri = g_filename_to_uri (uri, NULL, NULL);
-        expanded_rows = g_slist_append (expanded_rows, enc_uri);
-    }
+    add_uri_to_playlist (uri_list, plt);
+    g_list_free_full (uri_list, g_free);
+}
 
-    g_free (uri);
+static void
+on_view_mode_changed (GtkComboBox *combo, gpointer user_data)
+{
+    gint mode = gtk_combo_box_get_active (combo);
+    if (mode < 0 || mode == CONFIG_VIEW_MODE)
+        return;
+
+    CONFIG_VIEW_MODE = mode;
+    deadbeef->conf_set_int (CONFSTR_FB_VIEW_MODE, CONFIG_VIEW_MODE);
+
+    tag_scan_update ();
+    tag_view_refresh ();
+    update_sidebar_view ();
 }
 
+/* Tags were scanned in the background; called repeatedly during a scan */
 static void
-on_treeview_row_collapsed (GtkWidget *widget, GtkTreeIter *iter,
+on_tag_scan_ready (TagStore *store, const GArray *read, const GPtrArray *removed,
+                gboolean finished, gpointer user_data)
+{
+    gboolean changed = (store != tag_store);
+    if (finished)
+        tag_scan_running = FALSE;
+
+    if (changed) {
+        tagstore_unref (tag_store);
+        tag_store = store;
+    }
+    else
+        tagstore_unref (store);  // nothing changed since the last session
+
+    if (changed || tagstore_size (tag_store) == 0)
+        tag_view_refresh ();
+    smart_folders_update (read, removed, finished);
+    if (changed || finished)
+        recent_row_refresh ();
+
+    /* Query results follow the scan */
+    if ((changed || finished) && tag_scan_wanted
+                && search_entry && NZV (gtk_entry_get_text (GTK_ENTRY (search_entry))))
+        on_search_changed (search_entry, NULL);
+}
+
+static void
+on_tag_view_row_expanded (GtkWidget *widget, GtkTreeIter *iter,
                 GtkTreePath *path, gpointer user_data)
 {
-    gchar *uri;
+    GtkTreeIter child;
+    guint start, end;
+    gint level, child_level;
 
-    gtk_tree_model_get (GTK_TREE_MODEL (treestore), iter,
-                    TREEBROWSER_COLUMN_URI, &uri, -1);
-    if (! uri)
+    if (! gtk_tree_model_iter_children (GTK_TREE_MODEL (tag_model), &child, iter))
         return;
+    gtk_tree_model_get (GTK_TREE_MODEL (tag_model), &child, TAGVIEW_COLUMN_LEVEL, &child_level, -1);
+    if (child_level >= 0)
+        return;  // already filled
+
+    gtk_tree_model_get (GTK_TREE_MODEL (tag_model), iter,
+                    TAGVIEW_COLUMN_START,   &start,
+                    TAGVIEW_COLUMN_END,     &end,
+                    TAGVIEW_COLUMN_LEVEL,   &level,
+                    -1);
+    tag_view_fill (iter, start, end, level + 1);
+    gtk_tree_store_remove (tag_model, &child);  // placeholder
+}
 
-    if (CONFIG_SHOW_ICONS) {
-        GdkPixbuf *icon = get_icon_for_uri (uri);
-        gtk_tree_store_set (treestore, iter, TREEBROWSER_COLUMN_ICON, icon, -1);
-        g_object_unref (icon);
-    }
+/* Enter or double click adds the row to the current playlist */
+static void
+on_tag_view_row_activated (GtkWidget *widget, GtkTreePath *path,
+                GtkTreeViewColumn *column, gpointer user_data)
+{
+    tag_view_add_selected (PLT_CURRENT);
+}
+
+static gboolean
+on_tag_view_button_press (GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+    if (event->type != GDK_BUTTON_PRESS || (event->button != 2 && event->button != 3))
+        return FALSE;
+
+    GtkTreePath *path;
+    if (! gtk_tree_view_get_path_at_pos (GTK_TREE_VIEW (tag_view), event->x, event->y,
+                    &path, NULL, NULL, NULL))
+        return FALSE;
+    gtk_tree_view_set_cursor (GTK_TREE_VIEW (tag_view), path, NULL, FALSE);
+    gtk_tree_path_free (path);
+
+    /* Same as in the tree: middle click adds, shift + middle click adds to a new playlist */
+    if (event->button == 2)
+        tag_view_add_selected ((event->state & GDK_SHIFT_MASK) ? PLT_NEW : PLT_CURRENT);
+    else
+        gtk_menu_popup (GTK_MENU (tag_menu), NULL, NULL, NULL, NULL, event->button, event->time);
+
+    return TRUE;
+}
+
+static void
+on_tag_menu_add_current (GtkMenuItem *menuitem, gpointer user_data)
+{
+    tag_view_add_selected (PLT_CURRENT);
+}
+
+static void
+on_tag_menu_add_new (GtkMenuItem *menuitem, gpointer user_data)
+{
+    tag_view_add_selected (PLT_NEW);
+}
+
+/* Cursor moved or view scrolled */
+static void
+on_treeview_state_changed (gpointer object, gpointer user_data)
+{
+    session_changed ();
+}
+
+/* Typing selects the first row next to the cursor starting with the typed
+ * text; the interactive search is still available with Ctrl+F. Keys bound
+ * by the tree view, like '+', '-', '*', '/' and space, keep their meaning
+ * unless they continue the typed text. */
+static gboolean
+on_treeview_key_press (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
+{
+    if (event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK | GDK_SUPER_MASK | GDK_META_MASK))
+        return FALSE;
+
+    gunichar c = gdk_keyval_to_unicode (event->keyval);
+    if (! c || ! g_unichar_isprint (c))
+        return FALSE;
+
+    gint64 now = g_get_monotonic_time ();
+    if (! typeahead_text)
+        typeahead_text = g_string_new (NULL);
+    if (now - typeahead_last > TYPEAHEAD_TIMEOUT_MS * 1000)
+        g_string_truncate (typeahead_text, 0);
 
-    GSList *node = treeview_check_expanded (uri);
-    if (node) {
-        g_free (node->data);
-        expanded_rows = g_slist_delete_link (expanded_rows, node);
+    if (typeahead_text->len == 0) {
+#if GTK_CHECK_VERSION(3,0,0)
+        if (gtk_bindings_activate_event (G_OBJECT (widget), event))
+#else
+        if (gtk_bindings_activate_event (GTK_OBJECT (widget), event))
+#endif
+            return TRUE;
     }
+    typeahead_last = now;
 
-    g_free (uri);
+    g_string_append_unichar (typeahead_text, c);
+    treeview_typeahead (typeahead_text->str);
+
+    return TRUE;
 }
 
 
@@ -1765,11 +4485,32 @@ static int
 plugin_init (void)
 {
     trace ("init\n");
-    if (! expanded_rows)
-        expanded_rows = g_slist_alloc ();
+    import_init (deadbeef, on_import_progress, NULL);
+    metacache_init (deadbeef, on_metacache_ready, NULL);
+    tagscan_init (deadbeef);
+
+    restore_position = g_new0 (SessionState, 1);
+    session_restore (restore_position);
+
     create_autofilter ();
-    treebrowser_chroot (NULL);
-    treeview_restore_expanded (NULL);
+    search_index_load ();
+    tag_store_load ();
+    smart_folders_load ();
+    tag_view_refresh ();
+
+    /* A hidden sidebar is filled when it's shown */
+    if (CONFIG_HIDDEN)
+        dormant = TRUE;
+    else {
+        treebrowser_chroot (NULL);
+        treeview_restore_finished ();  // apply position now if nothing needs to be expanded
+        search_index_update (FALSE);   // saved index is kept if root and filter are the same
+    }
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+    memory_monitor = g_memory_monitor_dup_default ();
+    g_signal_connect (memory_monitor, "low-memory-warning", G_CALLBACK (on_low_memory_warning), NULL);
+#endif
 
     utils_construct_style (treeview, CONFIG_COLOR_BG, CONFIG_COLOR_FG, CONFIG_COLOR_BG_SEL, CONFIG_COLOR_FG_SEL);
 
@@ -1780,12 +4521,90 @@ static int
 plugin_cleanup (void)
 {
     trace ("cleanup\n");
+    import_shutdown ();
+    metacache_shutdown ();
+    searchindex_shutdown ();
+    tagscan_shutdown ();
+    tagquery_shutdown ();
+    session_flush ();
+    treeview_restore_cancel ();
     treeview_clear_expanded ();
 
-    if (expanded_rows)
-        g_slist_free (expanded_rows);
+    if (restore_position) {
+        session_state_clear (restore_position);
+        g_free (restore_position);
+        restore_position = NULL;
+    }
+    if (restore_pool) {
+        g_thread_pool_free (restore_pool, TRUE, TRUE);  // drops queued listings, waits for running ones
+        restore_pool = NULL;
+    }
+    while (restore_waves) {
+        g_source_remove_by_user_data (restore_waves->data);  // level listed but not applied yet
+        restore_wave_free (restore_waves->data);
+    }
+    if (reveal_pool) {
+        g_thread_pool_free (reveal_pool, TRUE, TRUE);
+        reveal_pool = NULL;
+    }
+    reveal_generation++;
+    while (reveal_jobs) {
+        g_source_remove_by_user_data (reveal_jobs->data);
+        reveal_job_free (reveal_jobs->data);
+    }
+
+    unload_queue_clear ();
+    scheduler_shutdown ();
+    icon_job = 0;
+    if (dormant_timeout)
+        g_source_remove (dormant_timeout);
+    dormant_timeout = 0;
+    dormant = FALSE;
+    dormant_search_pending = FALSE;
+#if GLIB_CHECK_VERSION(2, 64, 0)
+    if (memory_monitor) {
+        g_signal_handlers_disconnect_by_func (memory_monitor, on_low_memory_warning, NULL);
+        g_object_unref (memory_monitor);
+    }
+    memory_monitor = NULL;
+#endif
+    if (unload_links)
+        g_hash_table_destroy (unload_links);
+    if (fill_jobs)
+        g_hash_table_destroy (fill_jobs);
+    if (row_index)
+        g_hash_table_destroy (row_index);
+    if (typeahead_indexes)
+        g_hash_table_destroy (typeahead_indexes);
+    if (typeahead_text)
+        g_string_free (typeahead_text, TRUE);
+    listing_cache_clear ();
+    searchindex_free (search_index);
+    g_free (search_index_target);
+    tagstore_unref (tag_store);
+    g_free (tag_order);
+    g_free (tag_scan_target);
+    if (search_query_results)
+        g_ptr_array_unref (search_query_results);
+    if (smart_folders)
+        g_ptr_array_unref (smart_folders);
+    view_config_unref (current_view);
+    pathtrie_free (expanded_rows);
     g_free (known_extensions);
 
+    search_index = NULL;
+    search_index_target = NULL;
+    tag_store = NULL;
+    tag_order = NULL;
+    tag_scan_target = NULL;
+    search_query_results = NULL;
+    smart_folders = NULL;
+    unload_links = NULL;
+    fill_jobs = NULL;
+    row_index = NULL;
+    typeahead_indexes = NULL;
+    typeahead_text = NULL;
+    current_view = NULL;
     expanded_rows = NULL;
     known_extensions = NULL;
 
@@ -1808,14 +4627,19 @@ int
 filebrowser_stop (void)
 {
     trace("stop\n");
+    session_flush ();
     save_config ();
 
-    if (CONFIG_DEFAULT_PATH)
-        g_free ((gchar*) CONFIG_DEFAULT_PATH);
-    if (CONFIG_FILTER)
-        g_free ((gchar*) CONFIG_FILTER);
-    if (CONFIG_COVERART)
-        g_free ((gchar*) CONFIG_COVERART);
+    g_source_remove_by_user_data (&config_change_pending);
+    config_snapshot_free (config_snapshot);
+    config_snapshot = NULL;
+    CONFIG_DEFAULT_PATH = NULL;
+    CONFIG_FILTER = NULL;
+    CONFIG_COVERART = NULL;
+    CONFIG_COLOR_BG = NULL;
+    CONFIG_COLOR_FG = NULL;
+    CONFIG_COLOR_BG_SEL = NULL;
+    CONFIG_COLOR_FG_SEL = NULL;
 
     return 0;
 }
@@ -1947,9 +4771,15 @@ static const char settings_dlg[] =
     "property \"Icon size (non-coverart): \"    spinbtn[16,32,2] "      CONFSTR_FB_ICON_SIZE            " 24 ;\n"
     "property \"Font size: \"                   spinbtn[0,32,1] "       CONFSTR_FB_FONT_SIZE            " 0 ;\n"
     "property \"Show hidden files\"             checkbox "              CONFSTR_FB_SHOW_HIDDEN_FILES    " 0 ;\n"
+    "property \"Show recently added albums\"    checkbox "              CONFSTR_FB_SHOW_RECENT          " 0 ;\n"
+    "property \"Follow playing track\"          checkbox "              CONFSTR_FB_FOLLOW_PLAYING       " 0 ;\n"
     "property \"Sidebar width: \"               spinbtn[150,300,1] "    CONFSTR_FB_WIDTH                " 200 ;\n"
     "property \"Save treeview over sessions (restore previously expanded items)\" "
                                                "checkbox "              CONFSTR_FB_SAVE_TREEVIEW        " 1 ;\n"
+    "property \"Unload collapsed folders after (minutes, 0 = never): \" "
+                                               "spinbtn[0,1440,1] "     CONFSTR_FB_UNLOAD_AFTER         " 10 ;\n"
+    "property \"Maximum rows kept in the tree (0 = no limit): \" "
+                                               "spinbtn[0,1000000,1000] " CONFSTR_FB_MAX_ROWS           " 50000 ;\n"
     "property \"Background color: \"            entry "                 CONFSTR_FB_COLOR_BG             " \"\" ;\n"
     "property \"Foreground color: \"            entry "                 CONFSTR_FB_COLOR_FG             " \"\" ;\n"
     "property \"Background color (selected): \" entry "                 CONFSTR_FB_COLOR_BG_SEL         " \"\" ;\n"
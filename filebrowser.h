@@ -24,6 +24,15 @@
 */
 
 #include <gtk/gtk.h>
+#include "session.h"
+#include "listing.h"
+#include "searchindex.h"
+#include "tagstore.h"
+#include "tagquery.h"
+#include "smartfolder.h"
+#include "typeahead.h"
+#include "scheduler.h"
+#include "settings.h"
 
 
 /* Config options */
@@ -42,7 +51,9 @@
 #define     CONFSTR_FB_COVERART             "filebrowser.coverart_files"
 #define     CONFSTR_FB_COVERART_SIZE        "filebrowser.coverart_size"
 #define     CONFSTR_FB_SAVE_TREEVIEW        "filebrowser.save_treeview"
-#define     CONFSTR_FB_EXPANDED_ROWS        "filebrowser.expanded_rows"
+#define     CONFSTR_FB_UNLOAD_AFTER         "filebrowser.unload_after"
+#define     CONFSTR_FB_MAX_ROWS             "filebrowser.max_rows"
+#define     CONFSTR_FB_EXPANDED_ROWS        "filebrowser.expanded_rows"     // legacy, moved to session file
 #define     CONFSTR_FB_COLOR_BG             "filebrowser.bgcolor"
 #define     CONFSTR_FB_COLOR_FG             "filebrowser.fgcolor"
 #define     CONFSTR_FB_COLOR_BG_SEL         "filebrowser.bgcolor_selected"
@@ -50,12 +61,77 @@
 #define     CONFSTR_FB_COLOR_FG             "filebrowser.fgcolor"
 #define     CONFSTR_FB_FONT_SIZE            "filebrowser.font_size"
 #define     CONFSTR_FB_ICON_SIZE            "filebrowser.icon_size"
+#define     CONFSTR_FB_VIEW_MODE            "filebrowser.view_mode"
+#define     CONFSTR_FB_SMART_FOLDERS        "filebrowser.smart_folders"     // queries separated by ';'
+#define     CONFSTR_FB_SHOW_RECENT          "filebrowser.show_recent"
+#define     CONFSTR_FB_FOLLOW_PLAYING       "filebrowser.follow_playing"
 
 #define     DEFAULT_FB_DEFAULT_PATH         ""
 #define     DEFAULT_FB_FILTER               ""  // auto-filter enabled by default
 #define     DEFAULT_FB_COVERART             "cover.jpg;folder.jpg;front.jpg"
 
 
+/* Settings read into config snapshots, in the order of config_keys */
+enum
+{
+    CONFIG_KEY_ENABLED                  = 0,
+    CONFIG_KEY_HIDDEN,
+    CONFIG_KEY_DEFAULT_PATH,
+    CONFIG_KEY_SHOW_HIDDEN_FILES,
+    CONFIG_KEY_SHOW_RECENT,
+    CONFIG_KEY_FOLLOW_PLAYING,
+    CONFIG_KEY_FILTER_ENABLED,
+    CONFIG_KEY_FILTER,
+    CONFIG_KEY_FILTER_AUTO,
+    CONFIG_KEY_SHOW_ICONS,
+    CONFIG_KEY_SHOW_TREE_LINES,
+    CONFIG_KEY_WIDTH,
+    CONFIG_KEY_COVERART,
+    CONFIG_KEY_COVERART_SIZE,
+    CONFIG_KEY_SAVE_TREEVIEW,
+    CONFIG_KEY_UNLOAD_AFTER,
+    CONFIG_KEY_MAX_ROWS,
+    CONFIG_KEY_COLOR_BG,
+    CONFIG_KEY_COLOR_FG,
+    CONFIG_KEY_COLOR_BG_SEL,
+    CONFIG_KEY_COLOR_FG_SEL,
+    CONFIG_KEY_ICON_SIZE,
+    CONFIG_KEY_FONT_SIZE,
+    CONFIG_KEY_VIEW_MODE,
+    CONFIG_KEYC
+};
+
+#define     CONFIG_KEYS_FILTER              (CONFIG_KEY_BIT (CONFIG_KEY_SHOW_HIDDEN_FILES) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_FILTER_ENABLED) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_FILTER) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_FILTER_AUTO))
+#define     CONFIG_KEYS_VIEW                (CONFIG_KEYS_FILTER | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_SHOW_ICONS) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_COVERART) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_COVERART_SIZE) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_ICON_SIZE))
+#define     CONFIG_KEYS_COLORS              (CONFIG_KEY_BIT (CONFIG_KEY_COLOR_BG) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_COLOR_FG) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_COLOR_BG_SEL) | \
+                                             CONFIG_KEY_BIT (CONFIG_KEY_COLOR_FG_SEL))
+
+/* Seconds without changes to the tree state before the session file is written */
+#define     SESSION_SAVE_DELAY              2
+
+/* Config change events arriving within this time are handled together */
+#define     CONFIG_CHANGE_DELAY_MS          100
+
+/* Parts of the view to update after settings changed */
+enum
+{
+    CONFIG_CHANGED_STYLE                = 1 << 0,   // tree lines and font, rows are only drawn again
+    CONFIG_CHANGED_ICONS                = 1 << 1,   // icons of the shown rows are looked up again
+    CONFIG_CHANGED_FILTER               = 1 << 2,   // shown rows are filtered again
+    CONFIG_CHANGED_RECENT               = 1 << 3,   // recently added row is shown or hidden
+    CONFIG_CHANGED_ROOT                 = 1 << 4    // tree is read again from the new root
+};
+
+
 /* Treebrowser setup */
 enum
 {
@@ -69,7 +145,133 @@ enum
     TREEBROWSER_RENDER_ICON             = 0,
     TREEBROWSER_RENDER_TEXT             = 1,
 
-    TREEBROWSER_FLAGS_SEPARATOR         = -1
+    TREEBROWSER_FLAGS_SEPARATOR         = -1,
+    TREEBROWSER_FLAGS_LOADED            = 1,        // directory contents are in the model
+    TREEBROWSER_FLAGS_SMART_FOLDER      = 2,        // saved query, kept when collapsed
+    TREEBROWSER_FLAGS_RECENT            = 3,        // recently added albums
+    TREEBROWSER_FLAGS_FILLING           = 4         // directory rows are still being added
+};
+
+/* Search results */
+enum
+{
+    SEARCH_COLUMN_NAME                  = 0,
+    SEARCH_COLUMN_URI                   = 1,
+    SEARCH_COLUMN_TOOLTIP               = 2,
+    SEARCH_COLUMNC
+};
+
+#define     SEARCH_RESULTS_MAX              200
+#define     RECENT_ALBUMS_MAX               50
+
+/* Keys typed within this time are searched together */
+#define     TYPEAHEAD_TIMEOUT_MS            1000
+
+/* Sidebar views, in the order they appear in the view selector */
+enum
+{
+    VIEW_MODE_FOLDERS                   = 0,
+    VIEW_MODE_ARTISTS                   = 1,        // album artist / album / track
+    VIEW_MODE_GENRES                    = 2,        // genre / album artist / album / track
+    VIEW_MODE_YEARS                     = 3,        // year / album / track
+    VIEW_MODEC
+};
+
+/* Tag view, rows refer to a range of the sorted tracks */
+enum
+{
+    TAGVIEW_COLUMN_NAME                 = 0,
+    TAGVIEW_COLUMN_TOOLTIP              = 1,
+    TAGVIEW_COLUMN_START                = 2,
+    TAGVIEW_COLUMN_END                  = 3,
+    TAGVIEW_COLUMN_LEVEL                = 4,        // grouping level, -1 for placeholders
+    TAGVIEW_COLUMNC
+};
+
+#define     TAGVIEW_MAX_LEVELS              3
+
+
+/* Restoring expanded rows, one level of the tree at a time */
+typedef struct _RestoreWave RestoreWave;
+
+typedef struct
+{
+    RestoreWave         *wave;
+    guint               index;
+} RestoreTask;
+
+struct _RestoreWave
+{
+    GPtrArray           *rows;          // GtkTreeRowReference of the directories of this level
+    GPtrArray           *paths;         // paths of these directories
+    DirListing          **listings;     // contents, filled in by worker threads
+    RestoreTask         *tasks;         // one per directory, pushed to the thread pool
+    gint                pending;        // number of listings not read yet
+    guint               generation;     // restore_generation when the level was started
+};
+
+/* Filling the rows of a directory, a few rows at a time */
+#define     FILL_CHUNK_ROWS                 32
+
+typedef struct
+{
+    DirListing          *listing;
+    GtkTreeRowReference *parent;        // NULL for the top level
+    gchar               *dir;           // row_state_key() of parent, "" for the top level
+    guint               id;             // scheduler job, 0 if filled right away
+    guint               generation;     // restore_generation when the fill was started
+    guint               next;           // next entry of listing
+    gint                n_old;          // rows shown before, removed after the first new ones
+    gboolean            expand;         // expand parent once it has rows
+    gboolean            all_hidden;
+    GPtrArray           *restore;       // child directories to expand, NULL if none are restored
+    TypeAheadIndex      *index;
+    ViewConfig          *config;        // settings the rows are filled with
+} FillJob;
+
+/* Showing tags read in the background in the tooltips of a directory */
+typedef struct
+{
+    gchar               *dir;
+    guint               next;           // next row below dir
+} TooltipJob;
+
+/* Looking up the icons of shown rows again */
+typedef struct
+{
+    gchar               **uris;
+    guint               next;
+} IconJob;
+
+/* Seconds the sidebar must stay hidden before its tree is freed */
+#define     DORMANT_DELAY                   30
+
+/* Collapsed directory whose rows may be unloaded */
+#define     UNLOAD_CHECK_INTERVAL           10      // seconds
+
+typedef struct
+{
+    gchar               *uri;
+    gint64              collapsed;      // monotonic time
+} UnloadEntry;
+
+/* Loading the parent directories of a revealed file */
+typedef struct _RevealJob RevealJob;
+
+typedef struct
+{
+    RevealJob           *job;
+    guint               index;
+} RevealTask;
+
+struct _RevealJob
+{
+    gchar               *target;
+    GPtrArray           *paths;         // directories below the root down to the target
+    DirListing          **listings;     // contents, filled in by worker threads
+    RevealTask          *tasks;         // one per directory, pushed to the thread pool
+    gint                pending;
+    guint               generation;     // reveal_generation when the reveal was started
 };
 
 
@@ -84,14 +286,31 @@ enum
 static void         gtkui_update_listview_headers (void);
 static void         setup_dragdrop (void);
 static void         create_autofilter (void);
+static void         update_view_config (void);
 static void         save_config (void);
-static void         load_config (void);
+static guint64      load_config (void);
+static void         session_collect (SessionState *state);
+static void         session_changed (void);
+static void         session_flush (void);
+static void         session_restore (SessionState *state);
+static void         search_index_load (void);
+static void         search_index_update (gboolean force);
+static void         tag_store_load (void);
+static void         tag_scan_update (void);
 static gboolean     treeview_update (void *ctx);
+static void         treeview_apply_style (void);
+static gboolean     icon_job_step (gpointer data);
+static void         treeview_refresh_icons (void);
+static gboolean     treebrowser_row_is_entry (GtkTreeIter *iter, const ListingEntry *entry);
+static gboolean     treebrowser_remove_row (GtkTreeIter *iter);
+static void         treebrowser_refilter_dir (const gchar *dir);
+static void         treeview_refilter (void);
 static gboolean     filebrowser_init (void *ctx);
 static int          handle_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
 
 static void         on_menu_toggle (GtkMenuItem *menuitem, gpointer *user_data);
-static int          on_config_changed (uintptr_t data);
+static gboolean     on_config_changed (gpointer data);
+static void         on_drag_data_get_smart_folder (gpointer data, gpointer userdata);
 static void         on_drag_data_get (GtkWidget *widget, GdkDragContext *drag_context,
                             GtkSelectionData *sdata, guint info, guint time,
                             gpointer user_data);
@@ -101,26 +320,87 @@ static int          create_interface (GtkWidget *cont);
 static int          restore_interface (GtkWidget *cont);
 static GtkWidget *  create_popup_menu (GtkTreePath *path, gchar *name, GList *uri_list);
 static GtkWidget *  create_view_and_model (void);
+static GtkWidget *  create_import_bar (void);
+static void         create_search (void);
+static GtkWidget *  create_view_selector (void);
+static void         create_tag_view (void);
 static void         create_sidebar (void);
 
 static void         gtk_tree_store_iter_clear_nodes (gpointer iter, gboolean delete_root);
+static gboolean     row_is_virtual (GtkTreeIter *iter);
+static gchar *      row_state_key (GtkTreeIter *iter);
+static void         row_index_add (const gchar *uri, GtkTreeIter *iter);
+static void         row_index_remove (GtkTreeIter *iter);
+static void         row_index_clear (void);
 //static void         add_single_uri_to_playlist (gchar *uri, int plt);
 static void         add_uri_to_playlist (GList *uri_list, int plt);
-static gboolean     check_filtered (const gchar *base_name);
-static gboolean     check_hidden (const gchar *filename);
+static void         on_import_progress (guint done, guint total, gboolean finished,
+                            gpointer user_data);
+static gboolean     check_filtered (const ViewConfig *config, const gchar *base_name);
+static gboolean     check_hidden (const ViewConfig *config, const gchar *filename);
 static gchar *      get_default_dir (void);
-static GdkPixbuf *  get_icon_from_cache (const gchar *uri, const gchar *coverart,
+static GdkPixbuf *  get_icon_from_cache (const gchar *uri, const gchar *coverfile,
                             gint imgsize);
-static GdkPixbuf *  get_icon_for_uri (gchar *uri);
+static GdkPixbuf *  get_icon_for_uri (const ViewConfig *config, gchar *uri);
+static void         get_uris_from_smart_folder (gpointer data, gpointer userdata);
 static void         get_uris_from_selection (gpointer data, gpointer userdata);
 static gboolean     treeview_row_expanded_iter (GtkTreeView *tree_view, GtkTreeIter *iter);
-static GSList *     treeview_check_expanded (gchar *uri);
+static gboolean     treeview_find_iter (const gchar *target, GtkTreeIter *result);
+static gboolean     treeview_reveal (const gchar *target);
+static void         treeview_reveal_async (const gchar *target);
+static gboolean     reveal_job_apply (gpointer data);
+static gchar *      get_track_uri (DB_playItem_t *track);
+static gboolean     reveal_playing (gpointer data);
+static void         treeview_restore_position (SessionState *state);
+static gboolean     treeview_check_expanded (const gchar *uri);
 static void         treeview_clear_expanded (void);
-static void         treeview_restore_expanded (gpointer parent);
+static void         treeview_restore_cancel (void);
+static void         treeview_restore_finished (void);
+static void         restore_wave_start (GPtrArray *rows);
+static gboolean     restore_wave_apply (gpointer data);
 static gboolean     treeview_separator_func (GtkTreeModel *model, GtkTreeIter *iter,
                             gpointer data);
 static void         treebrowser_chroot(gchar *directory);
+static void         treebrowser_add_placeholder (GtkTreeIter *parent, const gchar *name,
+                            const gchar *tooltip);
+static void         treebrowser_add_entry (FillJob *job, GtkTreeIter *parent,
+                            GtkTreeIter *sibling, const ListingEntry *entry);
+static FillJob *    fill_job_new (DirListing *listing, GtkTreeIter *parent, GPtrArray *restore,
+                            gboolean expand);
+static void         fill_job_free (FillJob *job);
+static void         fill_job_finish (FillJob *job, GtkTreeIter *parent);
+static gboolean     fill_job_step (gpointer data);
+static void         treebrowser_fill (DirListing *listing, GtkTreeIter *parent, GPtrArray *restore);
+static void         treebrowser_fill_async (DirListing *listing, GtkTreeIter *parent,
+                            GPtrArray *restore, gboolean expand, SchedulerPriority priority);
+static void         treebrowser_fill_complete (const gchar *dir);
+static void         treebrowser_unload (const gchar *uri);
+static gboolean     unload_step (gpointer data);
+static void         unload_queue_add (const gchar *uri);
+static void         unload_queue_remove (const gchar *uri);
+static void         unload_queue_clear (void);
+static void         unload_oldest (void);
+static void         treebrowser_trim (gboolean unload_all);
+static void         treeview_sleep (void);
+static void         treeview_wake (void);
+static void         on_sidebar_map (GtkWidget *widget, gpointer user_data);
+static void         on_sidebar_unmap (GtkWidget *widget, gpointer user_data);
+static gboolean     treeview_typeahead (const gchar *text);
 static gboolean     treebrowser_browse (gchar *directory, gpointer parent);
+static void         smart_folders_load (void);
+static void         smart_folders_save (void);
+static void         virtual_rows_show (void);
+static void         smart_folders_update (const GArray *read, const GPtrArray *removed,
+                            gboolean finished);
+static void         smart_folder_add (const gchar *text);
+static SmartFolder *smart_folder_for_iter (GtkTreeIter *iter);
+static void         smart_folder_append_file (gpointer data, gpointer user_data);
+static void         smart_folder_fill_row (GtkTreeIter *parent, SmartFolder *folder);
+static void         smart_folder_refresh_row (guint index);
+static gboolean     recent_row_get_iter (GtkTreeIter *iter);
+static void         recent_row_fill (GtkTreeIter *parent);
+static void         recent_row_refresh (void);
+static void         get_uris_from_recent_row (GList **files);
 
 static void         on_menu_add (GtkMenuItem *menuitem, GList *uri_list);
 static void         on_menu_add_current (GtkMenuItem *menuitem, GList *uri_list);
@@ -132,6 +412,10 @@ static void         on_menu_collapse_all(GtkMenuItem *menuitem, gpointer *user_d
 static void         on_menu_copy_uri(GtkMenuItem *menuitem, GList *uri_list);
 static void         on_menu_show_hidden_files(GtkMenuItem *menuitem, gpointer *user_data);
 static void         on_menu_use_filter(GtkMenuItem *menuitem, gpointer *user_data);
+static void         on_menu_remove_smart_folder (GtkMenuItem *menuitem, GtkTreePath *path);
+static void         on_menu_show_recent (GtkMenuItem *menuitem, gpointer *user_data);
+static void         on_menu_reveal_playing (GtkMenuItem *menuitem, gpointer *user_data);
+static void         on_menu_follow_playing (GtkMenuItem *menuitem, gpointer *user_data);
 
 static gboolean     on_treeview_mouseclick_press (GtkWidget *widget, GdkEventButton *event,
                             GtkTreeSelection *selection);
@@ -144,6 +428,48 @@ static void         on_treeview_row_expanded (GtkWidget *widget, GtkTreeIter *it
                         GtkTreePath *path, gpointer user_data);
 static void         on_treeview_row_collapsed (GtkWidget *widget, GtkTreeIter *iter,
                             GtkTreePath *path, gpointer user_data);
+static void         on_treeview_state_changed (gpointer object, gpointer user_data);
+static gboolean     on_treeview_key_press (GtkWidget *widget, GdkEventKey *event,
+                            gpointer user_data);
+static void         on_button_import_cancel (GtkWidget *button, gpointer user_data);
+static gboolean     tooltip_job_step (gpointer data);
+static void         tooltip_job_free (TooltipJob *job);
+static void         on_metacache_ready (const gchar *dir, gpointer user_data);
+static void         on_search_index_ready (SearchIndex *index, gpointer user_data);
+static void         on_search_changed (GtkWidget *entry, gpointer user_data);
+static void         on_search_activate (GtkWidget *entry, gpointer user_data);
+static void         on_search_row_activated (GtkWidget *widget, GtkTreePath *path,
+                            GtkTreeViewColumn *column, gpointer user_data);
+static void         search_show_query (const TagQuery *query);
+static void         search_reveal_result (GtkTreeIter *iter);
+static void         search_add_results (int plt);
+static gboolean     on_search_button_press (GtkWidget *widget, GdkEventButton *event,
+                            gpointer user_data);
+static void         on_search_menu_add_current (GtkMenuItem *menuitem, gpointer user_data);
+static void         on_search_menu_add_new (GtkMenuItem *menuitem, gpointer user_data);
+static void         on_search_menu_save (GtkMenuItem *menuitem, gpointer user_data);
+static void         update_sidebar_view (void);
+static gchar *      tag_view_group_name (TagField field, guint track);
+static gchar *      tag_view_range_tooltip (guint start, guint end);
+static void         tag_view_fill (GtkTreeIter *parent, guint start, guint end, gint level);
+static gchar *      tag_view_row_key (GtkTreeIter *iter);
+static void         tag_view_collect_expanded (GtkTreeView *tree_view, GtkTreePath *path,
+                            gpointer user_data);
+static void         tag_view_expand_saved (GtkTreeIter *parent, const gchar *prefix,
+                            GHashTable *expanded);
+static void         tag_view_refresh (void);
+static void         tag_view_add_selected (int plt);
+static void         on_view_mode_changed (GtkComboBox *combo, gpointer user_data);
+static void         on_tag_scan_ready (TagStore *store, const GArray *read, const GPtrArray *removed,
+                            gboolean finished, gpointer user_data);
+static void         on_tag_view_row_expanded (GtkWidget *widget, GtkTreeIter *iter,
+                            GtkTreePath *path, gpointer user_data);
+static void         on_tag_view_row_activated (GtkWidget *widget, GtkTreePath *path,
+                            GtkTreeViewColumn *column, gpointer user_data);
+static gboolean     on_tag_view_button_press (GtkWidget *widget, GdkEventButton *event,
+                            gpointer user_data);
+static void         on_tag_menu_add_current (GtkMenuItem *menuitem, gpointer user_data);
+static void         on_tag_menu_add_new (GtkMenuItem *menuitem, gpointer user_data);
 
 static int          plugin_init (void);
 static int          plugin_cleanup (void);
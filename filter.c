@@ -0,0 +1,95 @@
+/* FILE FILTER */
+
+#include <string.h>
+#include <glib.h>
+#include "filter.h"
+
+
+/* Compile filter from a list of patterns separated by ';', files are not
+ * filtered if patterns is NULL or empty */
+FbFilter *
+filter_new (gboolean show_hidden, const gchar *patterns)
+{
+    FbFilter *filter = g_new0 (FbFilter, 1);
+    filter->ref_count = 1;
+    filter->show_hidden = show_hidden;
+    filter->signature = g_strdup_printf ("%d:%s", show_hidden, patterns ? patterns : "");
+
+    if (! patterns || ! *patterns)
+        return filter;
+
+    /* Use two patterns for upper- & lowercase matching */
+    gchar **split = g_strsplit (patterns, ";", 0);
+    GPtrArray *specs = g_ptr_array_new ();
+    for (gint i = 0; split[i]; i++) {
+        if (! *split[i])
+            continue;
+
+        gchar *pattern_u = g_ascii_strup (split[i], -1);
+        gchar *pattern_d = g_ascii_strdown (split[i], -1);
+        g_ptr_array_add (specs, g_pattern_spec_new (pattern_u));
+        g_ptr_array_add (specs, g_pattern_spec_new (pattern_d));
+        g_free (pattern_u);
+        g_free (pattern_d);
+    }
+    g_strfreev (split);
+
+    if (specs->len > 0) {
+        g_ptr_array_add (specs, NULL);
+        filter->patterns = (GPatternSpec **) g_ptr_array_free (specs, FALSE);
+    }
+    else
+        g_ptr_array_free (specs, TRUE);
+
+    return filter;
+}
+
+FbFilter *
+filter_ref (FbFilter *filter)
+{
+    if (filter)
+        g_atomic_int_inc (&filter->ref_count);
+    return filter;
+}
+
+void
+filter_unref (FbFilter *filter)
+{
+    if (! filter || ! g_atomic_int_dec_and_test (&filter->ref_count))
+        return;
+
+    if (filter->patterns) {
+        for (gint i = 0; filter->patterns[i]; i++)
+            g_pattern_spec_free (filter->patterns[i]);
+        g_free (filter->patterns);
+    }
+    g_free (filter->signature);
+    g_free (filter);
+}
+
+/* Check if file should be hidden (return TRUE if file is not shown) */
+gboolean
+filter_hidden (const FbFilter *filter, const gchar *name)
+{
+    return (! filter->show_hidden) && (name[0] == '.');
+}
+
+/* Check if file is filtered (return FALSE if file is filtered and not shown) */
+gboolean
+filter_match (const FbFilter *filter, const gchar *name)
+{
+    if (! filter->patterns || strcmp (name, "*") == 0)
+        return TRUE;
+
+    guint length = strlen (name);
+    for (gint i = 0; filter->patterns[i]; i++) {
+#if GLIB_CHECK_VERSION(2,70,0)
+        if (g_pattern_spec_match (filter->patterns[i], length, name, NULL))
+#else
+        if (g_pattern_match (filter->patterns[i], length, name, NULL))
+#endif
+            return TRUE;
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,33 @@
+#ifndef __FILTER_H
+#define __FILTER_H
+
+#include <glib.h>
+
+/* Compiled snapshot of the file filter settings. Snapshots are immutable
+ * once created and can be shared with worker threads.
+ */
+typedef struct
+{
+    gboolean        show_hidden;
+    GPatternSpec    **patterns;     // NULL-terminated, NULL if all files are shown
+    gchar           *signature;     // equal for filters that show the same files
+    gint            ref_count;
+} FbFilter;
+
+
+FbFilter *
+filter_new (gboolean show_hidden, const gchar *patterns);
+
+FbFilter *
+filter_ref (FbFilter *filter);
+
+void
+filter_unref (FbFilter *filter);
+
+gboolean
+filter_hidden (const FbFilter *filter, const gchar *name);
+
+gboolean
+filter_match (const FbFilter *filter, const gchar *name);
+
+#endif  /* __FILTER_H */
@@ -0,0 +1,320 @@
+/* FUZZY MATCHING - subsequence matcher with fzf-style scoring */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "fuzzy.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define FUZZY_X86
+#endif
+
+
+/* Scores as used by fzf: matches on word boundaries and runs of consecutive
+ * characters are preferred, gaps are penalized */
+#define SCORE_MATCH             16
+#define SCORE_GAP_START         -3
+#define SCORE_GAP_EXTENSION     -1
+#define BONUS_BOUNDARY          (SCORE_MATCH / 2)
+#define BONUS_NON_WORD          (SCORE_MATCH / 2)
+#define BONUS_DIGIT             (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+#define BONUS_CONSECUTIVE       (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR        2
+
+enum
+{
+    CHAR_NON_WORD,
+    CHAR_LETTER,
+    CHAR_DIGIT
+};
+
+
+static gint
+char_class (guchar c)
+{
+    if (c >= '0' && c <= '9')
+        return CHAR_DIGIT;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80)
+        return CHAR_LETTER;
+    return CHAR_NON_WORD;
+}
+
+static gint
+char_bonus (gint prev, gint class)
+{
+    if (prev == CHAR_NON_WORD && class != CHAR_NON_WORD)
+        return BONUS_BOUNDARY;
+    if (prev == CHAR_LETTER && class == CHAR_DIGIT)
+        return BONUS_DIGIT;
+    if (class == CHAR_NON_WORD)
+        return BONUS_NON_WORD;
+    return 0;
+}
+
+/* Letters and digits get a bit each, other bytes share the remaining bits */
+static guint
+char_bit (guchar c)
+{
+    if (c >= 'a' && c <= 'z')
+        return c - 'a';
+    if (c >= '0' && c <= '9')
+        return 26 + c - '0';
+    return 36 + c % 28;
+}
+
+/* Set of characters in str, a name can only match a pattern if its set
+ * contains all characters of the pattern */
+guint64
+fuzzy_charset (const gchar *str)
+{
+    guint64 mask = 0;
+    for (const guchar *p = (const guchar *) str; *p; p++)
+        mask |= G_GUINT64_CONSTANT (1) << char_bit (*p);
+    return mask;
+}
+
+/* Score the match of pattern in text[start..end], which starts and ends
+ * with a matched character */
+static gint
+score_window (const gchar *text, const gchar *pattern, gsize start, gsize end)
+{
+    gint score = 0, consecutive = 0, first_bonus = 0;
+    gboolean in_gap = FALSE;
+    gint prev = start > 0 ? char_class (text[start-1]) : CHAR_NON_WORD;
+    gsize pidx = 0;
+    for (gsize i = start; i <= end; i++) {
+        gint class = char_class (text[i]);
+        if (text[i] == pattern[pidx]) {
+            gint bonus = char_bonus (prev, class);
+            if (consecutive == 0)
+                first_bonus = bonus;
+            else {
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus)
+                    first_bonus = bonus;
+                bonus = MAX (MAX (bonus, first_bonus), BONUS_CONSECUTIVE);
+            }
+            score += SCORE_MATCH + (pidx == 0 ? bonus * BONUS_FIRST_CHAR : bonus);
+            in_gap = FALSE;
+            consecutive++;
+            pidx++;
+        }
+        else {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = TRUE;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+        prev = class;
+    }
+    return score;
+}
+
+/* Score text against pattern, both must be lowercase. Every shortest window
+ * containing the pattern is scored and the best one counts, so a match can
+ * score below zero when its gaps are long. Returns FUZZY_NO_MATCH if pattern
+ * is not a subsequence of text. */
+gint
+fuzzy_score (const gchar *text, const gchar *pattern)
+{
+    gsize plen = strlen (pattern);
+    if (plen == 0)
+        return 0;
+
+    gint best = FUZZY_NO_MATCH;
+    for (gsize from = 0; text[from]; ) {
+        /* Find the next window containing the pattern, then shrink it from the left */
+        gsize pidx = 0, end = 0;
+        for (gsize i = from; text[i]; i++) {
+            if (text[i] == pattern[pidx] && ++pidx == plen) {
+                end = i;
+                break;
+            }
+        }
+        if (pidx < plen)
+            break;
+
+        gsize start = end;
+        pidx = plen;
+        for (gsize i = end + 1; i-- > from; ) {
+            if (text[i] == pattern[pidx-1] && --pidx == 0) {
+                start = i;
+                break;
+            }
+        }
+
+        best = MAX (best, score_window (text, pattern, start, end));
+        from = start + 1;
+    }
+
+    return best;
+}
+
+static guint
+prefilter_scalar (const guint64 *masks, guint32 start, guint32 end, guint64 required,
+                            guint32 *out)
+{
+    guint n = 0;
+    for (guint32 i = start; i < end; i++) {
+        out[n] = i;
+        n += ((masks[i] & required) == required);  // branchless, out has room for all
+    }
+    return n;
+}
+
+#ifdef FUZZY_X86
+__attribute__ ((target ("sse4.1")))
+static guint
+prefilter_sse (const guint64 *masks, guint32 start, guint32 end, guint64 required,
+                            guint32 *out)
+{
+    const __m128i req = _mm_set1_epi64x ((gint64) required);
+    guint n = 0;
+    guint32 i = start;
+    for (; i + 2 <= end; i += 2) {
+        __m128i m = _mm_loadu_si128 ((const __m128i *) (masks + i));
+        __m128i hit = _mm_cmpeq_epi64 (_mm_and_si128 (m, req), req);
+        gint bits = _mm_movemask_pd (_mm_castsi128_pd (hit));
+        if (bits) {
+            out[n] = i;
+            n += bits & 1;
+            out[n] = i + 1;
+            n += (bits >> 1) & 1;
+        }
+    }
+    return n + prefilter_scalar (masks, i, end, required, out + n);
+}
+
+__attribute__ ((target ("avx2")))
+static guint
+prefilter_avx2 (const guint64 *masks, guint32 start, guint32 end, guint64 required,
+                            guint32 *out)
+{
+    const __m256i req = _mm256_set1_epi64x ((gint64) required);
+    guint n = 0;
+    guint32 i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m256i m = _mm256_loadu_si256 ((const __m256i *) (masks + i));
+        __m256i hit = _mm256_cmpeq_epi64 (_mm256_and_si256 (m, req), req);
+        gint bits = _mm256_movemask_pd (_mm256_castsi256_pd (hit));
+        while (bits) {
+            gint bit = __builtin_ctz (bits);
+            out[n++] = i + bit;
+            bits &= bits - 1;
+        }
+    }
+    return n + prefilter_scalar (masks, i, end, required, out + n);
+}
+#endif
+
+/* Collect ids in [start, end) whose charset contains required into out,
+ * which must have room for end - start ids. Returns number of ids. */
+guint
+fuzzy_prefilter (const guint64 *masks, guint32 start, guint32 end, guint64 required,
+                            guint32 *out)
+{
+#ifdef FUZZY_X86
+    static gint level = -1;
+    if (g_atomic_int_get (&level) < 0) {
+        __builtin_cpu_init ();
+        g_atomic_int_set (&level, __builtin_cpu_supports ("avx2") ? 2
+                                : __builtin_cpu_supports ("sse4.1") ? 1 : 0);
+    }
+    switch (level) {
+        case 2:
+            return prefilter_avx2 (masks, start, end, required, out);
+        case 1:
+            return prefilter_sse (masks, start, end, required, out);
+    }
+#endif
+    return prefilter_scalar (masks, start, end, required, out);
+}
+
+/* Order by score, shorter names and earlier entries win ties */
+static gboolean
+match_better (const FuzzyMatch *a, const FuzzyMatch *b)
+{
+    if (a->score != b->score)
+        return a->score > b->score;
+    if (a->length != b->length)
+        return a->length < b->length;
+    return a->id < b->id;
+}
+
+static void
+heap_sift_down (FuzzyHeap *heap, guint i)
+{
+    FuzzyMatch *items = heap->items;
+    for (;;) {
+        guint worst = i, l = 2*i + 1, r = 2*i + 2;
+        if (l < heap->len && match_better (&items[worst], &items[l]))
+            worst = l;
+        if (r < heap->len && match_better (&items[worst], &items[r]))
+            worst = r;
+        if (worst == i)
+            return;
+        FuzzyMatch tmp = items[i];
+        items[i] = items[worst];
+        items[worst] = tmp;
+        i = worst;
+    }
+}
+
+void
+fuzzy_heap_init (FuzzyHeap *heap, guint size)
+{
+    heap->items = g_new (FuzzyMatch, MAX (size, 1));
+    heap->len = 0;
+    heap->size = size;
+}
+
+void
+fuzzy_heap_clear (FuzzyHeap *heap)
+{
+    g_free (heap->items);
+    heap->items = NULL;
+    heap->len = heap->size = 0;
+}
+
+/* Add match if it is better than the worst match kept so far */
+void
+fuzzy_heap_push (FuzzyHeap *heap, const FuzzyMatch *match)
+{
+    if (heap->size == 0)
+        return;
+
+    if (heap->len == heap->size) {
+        if (! match_better (match, &heap->items[0]))
+            return;
+        heap->items[0] = *match;
+        heap_sift_down (heap, 0);
+        return;
+    }
+
+    guint i = heap->len++;
+    heap->items[i] = *match;
+    while (i > 0) {
+        guint parent = (i - 1) / 2;
+        if (! match_better (&heap->items[parent], &heap->items[i]))
+            break;
+        FuzzyMatch tmp = heap->items[i];
+        heap->items[i] = heap->items[parent];
+        heap->items[parent] = tmp;
+        i = parent;
+    }
+}
+
+static gint
+compare_matches (gconstpointer a, gconstpointer b)
+{
+    if (match_better (a, b))
+        return -1;
+    return match_better (b, a) ? 1 : 0;
+}
+
+/* Sort kept matches from best to worst; the heap can't be pushed to afterwards */
+void
+fuzzy_heap_sort (FuzzyHeap *heap)
+{
+    qsort (heap->items, heap->len, sizeof (FuzzyMatch), compare_matches);
+}
@@ -0,0 +1,49 @@
+#ifndef __FUZZY_H
+#define __FUZZY_H
+
+#include <glib.h>
+
+/* Score of a text that doesn't contain the pattern, real matches can score
+ * below zero */
+#define FUZZY_NO_MATCH      G_MININT
+
+/* Single ranked match */
+typedef struct
+{
+    gint            score;
+    guint32         length;         // shorter names win ties
+    guint32         id;
+} FuzzyMatch;
+
+/* Bounded min-heap keeping the best matches seen so far */
+typedef struct
+{
+    FuzzyMatch      *items;
+    guint           len;
+    guint           size;
+} FuzzyHeap;
+
+
+guint64
+fuzzy_charset (const gchar *str);
+
+gint
+fuzzy_score (const gchar *text, const gchar *pattern);
+
+guint
+fuzzy_prefilter (const guint64 *masks, guint32 start, guint32 end, guint64 required,
+                            guint32 *out);
+
+void
+fuzzy_heap_init (FuzzyHeap *heap, guint size);
+
+void
+fuzzy_heap_clear (FuzzyHeap *heap);
+
+void
+fuzzy_heap_push (FuzzyHeap *heap, const FuzzyMatch *match);
+
+void
+fuzzy_heap_sort (FuzzyHeap *heap);
+
+#endif  /* __FUZZY_H */
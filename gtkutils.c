@@ -0,0 +1,118 @@
+/* GTK UTILITY FUNCTIONS */
+
+#include <stdio.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include "gtkutils.h"
+
+
+/* Get pixbuf icon from current icon theme */
+GdkPixbuf *
+utils_pixbuf_from_stock (const gchar *icon_name, gint size)
+{
+    GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
+    if (icon_theme)
+        return gtk_icon_theme_load_icon (icon_theme, icon_name, size, 0, NULL);
+
+    return NULL;
+}
+
+void
+utils_construct_style (GtkWidget *widget, const gchar *bgcolor, const gchar *fgcolor, const gchar *bgcolor_sel, const gchar *fgcolor_sel)
+{
+    if (! widget)
+        return;
+
+    GString *style = g_string_new ("");
+#if !GTK_CHECK_VERSION(3,0,0)
+    style = g_string_append (style, "style \"deadbeef-filebrowser\" { \n");
+    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    base[NORMAL]   = \"%s\" \n", bgcolor);
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    base[SELECTED] = \"%s\" \n", bgcolor_sel);
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    base[ACTIVE]   = \"%s\" \n", bgcolor_sel);
+    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    text[NORMAL]   = \"%s\" \n", fgcolor);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    text[SELECTED] = \"%s\" \n", fgcolor_sel);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    text[ACTIVE]   = \"%s\" \n", fgcolor_sel);
+    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    bg[NORMAL]     = \"%s\" \n", bgcolor);
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    bg[SELECTED]   = \"%s\" \n", bgcolor_sel);
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    bg[ACTIVE]     = \"%s\" \n", bgcolor_sel);
+    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    fg[NORMAL]     = \"%s\" \n", fgcolor);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    fg[SELECTED]   = \"%s\" \n", fgcolor_sel);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    fg[ACTIVE]     = \"%s\" \n", fgcolor_sel);
+    style = g_string_append (style, "} \n");
+    style = g_string_append (style, "widget \"*.deadbeef_filebrowser_treeview\" style \"deadbeef-filebrowser\" \n");
+#else
+    style = g_string_append (style, "* { \n");
+    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    background-color: %s; \n", bgcolor);
+    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    color:            %s; \n", fgcolor);
+    style = g_string_append (style, "} \n");
+    style = g_string_append (style, "*:selected { \n");
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    background-color: %s; \n", bgcolor_sel);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    color:            %s; \n", fgcolor_sel);
+    style = g_string_append (style, "} \n");
+    style = g_string_append (style, "*:active { \n");
+    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    background-color: %s; \n", bgcolor_sel);
+    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    color:            %s; \n", fgcolor_sel);
+    style = g_string_append (style, "} \n");
+#endif
+
+    gchar* style_str = g_string_free (style, FALSE);
+    fprintf(stderr, "gtk style: \n%s", style_str);
+#if !GTK_CHECK_VERSION(3,0,0)
+    gtk_rc_parse_string (style_str);
+#else
+    /* The widget gets its own provider, so only it is styled again */
+    GtkCssProvider *css_provider = g_object_get_data (G_OBJECT (widget), "filebrowser-css");
+    if (! css_provider) {
+        css_provider = gtk_css_provider_new ();
+        g_object_set_data_full (G_OBJECT (widget), "filebrowser-css", css_provider, g_object_unref);
+        GtkStyleContext *style_ctx = gtk_widget_get_style_context (widget);  // do NOT free!
+        gtk_style_context_add_provider (style_ctx, (GtkStyleProvider *) css_provider, GTK_STYLE_PROVIDER_PRIORITY_USER);
+    }
+    gtk_css_provider_load_from_data (css_provider, style_str, -1, NULL);
+#endif
+    g_free (style_str);
+}
+
+gboolean
+tree_view_expand_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth)
+{
+    GtkTreeIter iter;
+    if (! gtk_tree_model_get_iter(model, &iter, parent))  // check if path is valid
+        return FALSE;
+
+    if (max_depth > 0 && gtk_tree_path_get_depth (parent) >= max_depth)
+        return FALSE;
+
+    // when expanding, this should come *before* going down the tree
+    gtk_tree_view_expand_row (view, parent, TRUE);
+
+    GtkTreePath *path = gtk_tree_path_copy (parent);
+    gtk_tree_path_down (path);
+    while (tree_view_expand_rows_recursive (model, view, path, max_depth))
+        gtk_tree_path_next (path);
+    gtk_tree_path_free (path);
+
+    return TRUE;
+}
+
+gboolean
+tree_view_collapse_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth)
+{
+    GtkTreeIter iter;
+    if (! gtk_tree_model_get_iter(model, &iter, parent))  // check if path is valid
+        return FALSE;
+
+    if (max_depth > 0 && gtk_tree_path_get_depth (parent) >= max_depth)
+        return FALSE;
+
+    GtkTreePath *path = gtk_tree_path_copy (parent);
+    gtk_tree_path_down (path);
+    while (tree_view_collapse_rows_recursive (model, view, path, max_depth))
+        gtk_tree_path_next (path);
+    gtk_tree_path_free (path);
+
+    // when expanding, this should come *after* going down the tree
+    gtk_tree_view_collapse_row (view, parent);
+
+    return TRUE;
+}
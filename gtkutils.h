@@ -0,0 +1,22 @@
+#ifndef __GTKUTILS_H
+#define __GTKUTILS_H
+
+#include <gtk/gtk.h>
+
+/* Helpers that need GTK, everything else is in utils.h */
+#define GLADE_HOOKUP_OBJECT(component,widget,name)  g_object_set_data_full (G_OBJECT (component), name, gtk_widget_ref (widget), (GDestroyNotify) gtk_widget_unref)
+
+
+GdkPixbuf *
+utils_pixbuf_from_stock (const gchar *icon_name, gint size);
+
+void
+utils_construct_style (GtkWidget *widget, const gchar *bgcolor, const gchar *fgcolor, const gchar *bgcolor_sel, const gchar *fgcolor_sel);
+
+gboolean
+tree_view_expand_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth);
+
+gboolean
+tree_view_collapse_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth);
+
+#endif  /* __GTKUTILS_H */
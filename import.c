@@ -0,0 +1,369 @@
+/* PLAYLIST IMPORT - add files to playlists in the background */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "import.h"
+#include "listing.h"
+#include "filter.h"
+#include "metacache.h"
+
+
+/* Requests arriving within this time are merged into a single job */
+#define IMPORT_COALESCE_MS          300
+/* Maximum time the playlist lock is held while adding files */
+#define IMPORT_LOCK_BUDGET_US       20000
+/* Minimum time between two progress updates */
+#define IMPORT_PROGRESS_US          100000
+
+
+typedef struct
+{
+    ddb_playlist_t  *plt;           // target playlist, referenced
+    GPtrArray       *uris;          // files and folders in the order they were requested
+    GHashTable      *seen;          // same uris, used to drop duplicates
+    FbFilter        *filter;        // filter of the browser when the job was created
+    gint            cancelled;
+    guint           done;
+    guint           total;
+    gint64          last_progress;
+} ImportJob;
+
+typedef struct
+{
+    guint           done;
+    guint           total;
+    gboolean        finished;
+} ImportProgress;
+
+static DB_functions_t *     deadbeef            = NULL;
+static ImportProgressFunc   progress_func       = NULL;
+static gpointer             progress_data       = NULL;
+
+static GThreadPool *        import_pool         = NULL;
+static GHashTable *         import_extensions   = NULL;     // lowercase extensions the player can add
+static GMutex               import_mutex;
+static GList *              import_jobs         = NULL;     // queued and running jobs
+static ImportJob *          import_pending      = NULL;     // job still collecting requests
+static guint                import_timeout      = 0;
+
+
+static ImportJob *
+job_new (ddb_playlist_t *plt, FbFilter *filter)
+{
+    ImportJob *job = g_new0 (ImportJob, 1);
+    job->plt = plt;
+    job->filter = filter_ref (filter);
+    job->uris = g_ptr_array_new_with_free_func (g_free);
+    job->seen = g_hash_table_new (g_str_hash, g_str_equal);
+    return job;
+}
+
+static void
+job_free (ImportJob *job)
+{
+    if (job->plt)
+        deadbeef->plt_unref (job->plt);
+    filter_unref (job->filter);
+    g_hash_table_destroy (job->seen);
+    g_ptr_array_unref (job->uris);
+    g_free (job);
+}
+
+static gboolean
+progress_idle (gpointer data)
+{
+    ImportProgress *progress = data;
+    if (progress_func)
+        progress_func (progress->done, progress->total, progress->finished, progress_data);
+    g_free (progress);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+/* Post progress to the main thread, rate-limited unless the job finished */
+static void
+job_progress (ImportJob *job, gboolean finished)
+{
+    gint64 now = g_get_monotonic_time ();
+    if (! finished && now - job->last_progress < IMPORT_PROGRESS_US)
+        return;
+    job->last_progress = now;
+
+    ImportProgress *progress = g_new (ImportProgress, 1);
+    progress->done = job->done;
+    progress->total = job->total;
+    progress->finished = finished;
+    g_idle_add (progress_idle, progress);
+}
+
+/* Extensions of the loaded decoders and of cue sheets; NULL if a decoder
+ * takes any file */
+static GHashTable *
+get_import_extensions (void)
+{
+    GHashTable *extensions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_add (extensions, g_strdup ("cue"));
+
+    struct DB_decoder_s **decoders = deadbeef->plug_get_decoder_list ();
+    for (gint i = 0; decoders[i]; i++) {
+        const gchar **exts = decoders[i]->exts;
+        for (gint j = 0; exts && exts[j]; j++) {
+            if (strcmp (exts[j], "*") == 0) {
+                g_hash_table_destroy (extensions);
+                return NULL;
+            }
+            g_hash_table_add (extensions, g_ascii_strdown (exts[j], -1));
+        }
+    }
+    return extensions;
+}
+
+/* Whether the player can add the file, other files in folders are skipped
+ * like adding a folder without the browser does */
+static gboolean
+is_importable (const gchar *name)
+{
+    if (! import_extensions)
+        return TRUE;
+
+    const gchar *ext = strrchr (name, '.');
+    if (! ext || ! ext[1])
+        return FALSE;
+
+    gchar *lower = g_ascii_strdown (ext + 1, -1);
+    gboolean found = g_hash_table_contains (import_extensions, lower);
+    g_free (lower);
+    return found;
+}
+
+/* Append all files below listing to files, filtered and ordered the same way
+ * as the browser shows them */
+static void
+job_expand_dir (ImportJob *job, DirListing *listing, GPtrArray *files, GHashTable *visited)
+{
+    if (! listing_visit (visited, listing))
+        return;  // symlink loop
+
+    for (guint i = 0; i < listing->n_entries && ! g_atomic_int_get (&job->cancelled); i++) {
+        ListingEntry *entry = &listing->entries[i];
+        if (filter_hidden (job->filter, entry->name))
+            continue;
+        if (! entry->is_dir && (! filter_match (job->filter, entry->display)
+                    || ! is_importable (entry->name)))
+            continue;
+
+        gchar *uri = listing_entry_path (listing, entry);
+        if (entry->is_dir) {
+            DirListing *sublisting = listing_get (uri);  // shown directories aren't read again unless modified
+            if (sublisting) {
+                job_expand_dir (job, sublisting, files, visited);
+                listing_unref (sublisting);
+            }
+            g_free (uri);
+        }
+        else {
+            g_ptr_array_add (files, uri);
+            job->total = files->len;
+            job_progress (job, FALSE);
+        }
+    }
+}
+
+static int
+job_file_added (DB_playItem_t *it, void *data)
+{
+    ImportJob *job = data;
+    return g_atomic_int_get (&job->cancelled) ? -1 : 0;
+}
+
+/* Worker thread: resolve folders into an ordered list of files without holding
+ * any lock, then add the files in short batches, releasing the playlist lock
+ * in between */
+static void
+import_worker (gpointer data, gpointer user_data)
+{
+    ImportJob *job = data;
+    GPtrArray *files = g_ptr_array_new_with_free_func (g_free);
+    GHashTable *visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    for (guint i = 0; i < job->uris->len && ! g_atomic_int_get (&job->cancelled); i++) {
+        const gchar *uri = g_ptr_array_index (job->uris, i);
+        DirListing *listing = g_file_test (uri, G_FILE_TEST_IS_DIR) ? listing_get (uri) : NULL;
+
+        if (listing) {
+            job_expand_dir (job, listing, files, visited);
+            listing_unref (listing);
+        }
+        else
+            g_ptr_array_add (files, g_strdup (uri));  // explicitly selected files are never filtered
+    }
+    job->total = files->len;
+    job_progress (job, FALSE);
+
+    if (! g_atomic_int_get (&job->cancelled) && files->len > 0)
+    {
+        if (deadbeef->plt_add_files_begin (job->plt, 0) >= 0)  // -1 means error
+        {
+            guint i = 0;
+            while (i < files->len && ! g_atomic_int_get (&job->cancelled))
+            {
+                gint64 start = g_get_monotonic_time ();
+
+                deadbeef->pl_lock ();
+                do {
+                    const gchar *fname = g_ptr_array_index (files, i++);
+                    if (metacache_append (job->plt, fname))
+                        continue;  // tags were already read while browsing
+                    if (deadbeef->plt_add_file (job->plt, fname, job_file_added, job) < 0)
+                        fprintf (stderr, "failed to add file %s\n", fname);
+                } while (i < files->len && ! g_atomic_int_get (&job->cancelled)
+                            && g_get_monotonic_time () - start < IMPORT_LOCK_BUDGET_US);
+                deadbeef->pl_unlock ();
+
+                job->done = i;
+                job_progress (job, FALSE);
+            }
+            deadbeef->plt_modified (job->plt);
+            deadbeef->plt_add_files_end (job->plt, 0);
+        }
+        else
+        {
+            fprintf (stderr, "could not add files to playlist (lock failed)\n");
+        }
+    }
+
+    g_ptr_array_unref (files);
+    g_hash_table_destroy (visited);
+
+    g_mutex_lock (&import_mutex);
+    import_jobs = g_list_remove (import_jobs, job);
+    g_mutex_unlock (&import_mutex);
+
+    job_progress (job, TRUE);
+    job_free (job);
+}
+
+/* Hand pending job over to the worker thread */
+static gboolean
+import_start_pending (gpointer data)
+{
+    import_timeout = 0;
+
+    ImportJob *job = import_pending;
+    import_pending = NULL;
+    if (! job)
+        return FALSE;
+
+    if (job->uris->len == 0) {
+        job_free (job);
+        return FALSE;
+    }
+
+    g_mutex_lock (&import_mutex);
+    import_jobs = g_list_append (import_jobs, job);
+    g_mutex_unlock (&import_mutex);
+
+    job_progress (job, FALSE);
+    g_thread_pool_push (import_pool, job, NULL);
+
+    /* This function MUST return false because it's called from g_timeout_add() */
+    return FALSE;
+}
+
+
+void
+import_init (DB_functions_t *api, ImportProgressFunc func, gpointer user_data)
+{
+    deadbeef = api;
+    progress_func = func;
+    progress_data = user_data;
+
+    /* A single worker keeps jobs in the order they were requested */
+    if (! import_pool)
+        import_pool = g_thread_pool_new (import_worker, NULL, 1, FALSE, NULL);
+}
+
+void
+import_shutdown (void)
+{
+    import_cancel ();
+    progress_func = NULL;
+
+    /* Wait for the running job; queued jobs see the cancel flag and finish at once */
+    if (import_pool)
+        g_thread_pool_free (import_pool, FALSE, TRUE);
+    import_pool = NULL;
+
+    if (import_extensions)
+        g_hash_table_destroy (import_extensions);
+    import_extensions = NULL;
+}
+
+/* Queue files and folders for adding to plt, takes over the playlist reference.
+ * Folders are expanded using filter. Repeated requests for the same playlist
+ * are merged and duplicates dropped. */
+void
+import_add (ddb_playlist_t *plt, GList *uri_list, FbFilter *filter)
+{
+    g_return_if_fail (import_pool != NULL);
+
+    /* Decoders are all loaded once the user can add files */
+    if (! import_extensions)
+        import_extensions = get_import_extensions ();
+
+    if (import_pending && import_pending->plt != plt) {
+        g_source_remove (import_timeout);
+        import_start_pending (NULL);
+    }
+
+    if (! import_pending)
+        import_pending = job_new (plt, filter);
+    else
+        deadbeef->plt_unref (plt);  // pending job already holds a reference
+
+    for (GList *node = uri_list; node; node = node->next) {
+        gchar *uri = node->data;
+        if (! uri || g_hash_table_contains (import_pending->seen, uri))
+            continue;
+
+        uri = g_strdup (uri);
+        g_ptr_array_add (import_pending->uris, uri);
+        g_hash_table_add (import_pending->seen, uri);
+    }
+
+    if (import_timeout)
+        g_source_remove (import_timeout);
+    import_timeout = g_timeout_add (IMPORT_COALESCE_MS, import_start_pending, NULL);
+}
+
+/* Stop all queued and running jobs; files added so far stay in the playlist */
+void
+import_cancel (void)
+{
+    if (import_timeout)
+        g_source_remove (import_timeout);
+    import_timeout = 0;
+    if (import_pending)
+        job_free (import_pending);
+    import_pending = NULL;
+
+    g_mutex_lock (&import_mutex);
+    for (GList *node = import_jobs; node; node = node->next) {
+        ImportJob *job = node->data;
+        g_atomic_int_set (&job->cancelled, 1);
+    }
+    g_mutex_unlock (&import_mutex);
+}
+
+gboolean
+import_is_running (void)
+{
+    g_mutex_lock (&import_mutex);
+    gboolean running = (import_jobs != NULL);
+    g_mutex_unlock (&import_mutex);
+
+    return running || import_pending;
+}
@@ -0,0 +1,27 @@
+#ifndef __IMPORT_H
+#define __IMPORT_H
+
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "filter.h"
+
+/* Called on the main thread while files are added to a playlist */
+typedef void (*ImportProgressFunc) (guint done, guint total, gboolean finished, gpointer user_data);
+
+
+void
+import_init (DB_functions_t *api, ImportProgressFunc func, gpointer user_data);
+
+void
+import_shutdown (void);
+
+void
+import_add (ddb_playlist_t *plt, GList *uri_list, FbFilter *filter);
+
+void
+import_cancel (void);
+
+gboolean
+import_is_running (void);
+
+#endif  /* __IMPORT_H */
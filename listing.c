@@ -0,0 +1,228 @@
+/* DIRECTORY LISTINGS */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <glib.h>
+#include "listing.h"
+#include "utils.h"
+
+
+/* Maximum number of listings kept in the cache */
+#define LISTING_CACHE_SIZE      1024
+
+static GMutex           cache_mutex;
+static GHashTable *     cache_table     = NULL;     // path -> link in cache_lru
+static GQueue           cache_lru       = G_QUEUE_INIT;  // most recently used first
+
+
+static gint
+compare_entries (gconstpointer a, gconstpointer b)
+{
+    const ListingEntry *e1 = a;
+    const ListingEntry *e2 = b;
+
+    if (e1->is_dir != e2->is_dir)
+        return e1->is_dir ? -1 : 1;
+    return strcmp (e1->key, e2->key);
+}
+
+/* Read contents of directory, returns NULL if it can't be opened */
+DirListing *
+listing_read (const gchar *path)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    GDir *dir = g_dir_open (path, 0, NULL);
+    if (dir == NULL)
+        return NULL;
+
+    DirListing *listing = g_new0 (DirListing, 1);
+    listing->ref_count = 1;
+
+    gsize len = strlen (path);
+    while (len > 1 && path[len-1] == G_DIR_SEPARATOR)
+        len--;
+    listing->path = g_strndup (path, len);
+
+    struct stat dir_stat;
+    if (stat (listing->path, &dir_stat) == 0) {
+        listing->mtime = dir_stat.st_mtime;
+        listing->dev = dir_stat.st_dev;
+        listing->ino = dir_stat.st_ino;
+    }
+
+    GArray *entries = g_array_sized_new (FALSE, FALSE, sizeof (ListingEntry), 64);
+    GString *fullpath = g_string_new (listing->path);
+    if (len > 1)
+        g_string_append_c (fullpath, G_DIR_SEPARATOR);
+    gsize dirlen = fullpath->len;
+
+    const gchar *filename;
+    foreach_dir (filename, dir) {
+        ListingEntry entry;
+        struct stat file_stat;
+
+        g_string_truncate (fullpath, dirlen);
+        g_string_append (fullpath, filename);
+
+        entry.name      = g_strdup (filename);
+        entry.display   = utils_get_utf8_from_locale (filename);
+        entry.key       = g_utf8_strdown (entry.display, -1);
+        entry.is_dir    = (stat (fullpath->str, &file_stat) == 0) && S_ISDIR (file_stat.st_mode);
+
+        if (entry.is_dir)
+            listing->n_dirs++;
+        g_array_append_val (entries, entry);
+    }
+    g_dir_close (dir);
+    g_string_free (fullpath, TRUE);
+
+    /* Sort keys are computed once per entry instead of once per comparison */
+    g_array_sort (entries, compare_entries);
+
+    listing->n_entries = entries->len;
+    listing->entries = (ListingEntry *) g_array_free (entries, FALSE);
+
+    return listing;
+}
+
+DirListing *
+listing_ref (DirListing *listing)
+{
+    if (listing)
+        g_atomic_int_inc (&listing->ref_count);
+    return listing;
+}
+
+void
+listing_unref (DirListing *listing)
+{
+    if (! listing || ! g_atomic_int_dec_and_test (&listing->ref_count))
+        return;
+
+    for (guint i = 0; i < listing->n_entries; i++) {
+        g_free (listing->entries[i].name);
+        g_free (listing->entries[i].display);
+        g_free (listing->entries[i].key);
+    }
+    g_free (listing->entries);
+    g_free (listing->path);
+    g_free (listing);
+}
+
+/* Get full path of an entry */
+gchar *
+listing_entry_path (const DirListing *listing, const ListingEntry *entry)
+{
+    if (listing->path[0] == G_DIR_SEPARATOR && listing->path[1] == '\0')
+        return g_strconcat (G_DIR_SEPARATOR_S, entry->name, NULL);
+    return g_strconcat (listing->path, G_DIR_SEPARATOR_S, entry->name, NULL);
+}
+
+
+/* Remember listing in visited, a set created with g_str_hash and g_free as key
+ * destructor. Returns FALSE if the directory was visited before, which
+ * happens when symlinks point back to a parent directory. */
+gboolean
+listing_visit (GHashTable *visited, const DirListing *listing)
+{
+    return listing_visit_stat (visited, listing->dev, listing->ino);
+}
+
+/* Same as listing_visit() for a directory that wasn't listed */
+gboolean
+listing_visit_stat (GHashTable *visited, dev_t dev, ino_t ino)
+{
+    gchar *key = g_strdup_printf ("%lx:%lx", (gulong) dev, (gulong) ino);
+    if (g_hash_table_contains (visited, key)) {
+        g_free (key);
+        return FALSE;
+    }
+    g_hash_table_add (visited, key);
+    return TRUE;
+}
+
+/* Drop a cached listing, cache_mutex must be held */
+static void
+cache_remove_link (GList *link)
+{
+    DirListing *listing = link->data;
+    g_hash_table_remove (cache_table, listing->path);
+    g_queue_delete_link (&cache_lru, link);
+    listing_unref (listing);
+}
+
+/* Get cached listing of path, returns a new reference or NULL if the
+ * directory wasn't listed yet */
+DirListing *
+listing_cache_lookup (const gchar *path)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    gsize len = strlen (path);
+    while (len > 1 && path[len-1] == G_DIR_SEPARATOR)
+        len--;
+    gchar *key = g_strndup (path, len);
+
+    DirListing *listing = NULL;
+    g_mutex_lock (&cache_mutex);
+    GList *link = cache_table ? g_hash_table_lookup (cache_table, key) : NULL;
+    if (link) {
+        g_queue_unlink (&cache_lru, link);
+        g_queue_push_head_link (&cache_lru, link);
+        listing = listing_ref (link->data);
+    }
+    g_mutex_unlock (&cache_mutex);
+
+    g_free (key);
+    return listing;
+}
+
+/* Get listing of path from the cache if the directory wasn't modified since
+ * it was read, otherwise read it again. Returns a new reference. */
+DirListing *
+listing_get (const gchar *path)
+{
+    struct stat dir_stat;
+    DirListing *listing = listing_cache_lookup (path);
+    if (listing && (stat (listing->path, &dir_stat) != 0 || dir_stat.st_mtime != listing->mtime)) {
+        listing_unref (listing);
+        listing = NULL;
+    }
+    return listing ? listing : listing_read (path);
+}
+
+/* Add listing to the cache, replacing an older listing of the same directory */
+void
+listing_cache_store (DirListing *listing)
+{
+    g_return_if_fail (listing != NULL);
+
+    g_mutex_lock (&cache_mutex);
+    if (! cache_table)
+        cache_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+    GList *link = g_hash_table_lookup (cache_table, listing->path);
+    if (link)
+        cache_remove_link (link);
+
+    g_queue_push_head (&cache_lru, listing_ref (listing));
+    g_hash_table_insert (cache_table, listing->path, cache_lru.head);
+
+    while (cache_lru.length > LISTING_CACHE_SIZE)
+        cache_remove_link (cache_lru.tail);
+    g_mutex_unlock (&cache_mutex);
+}
+
+void
+listing_cache_clear (void)
+{
+    g_mutex_lock (&cache_mutex);
+    while (cache_lru.head)
+        cache_remove_link (cache_lru.head);
+    if (cache_table)
+        g_hash_table_destroy (cache_table);
+    cache_table = NULL;
+    g_mutex_unlock (&cache_mutex);
+}
@@ -0,0 +1,63 @@
+#ifndef __LISTING_H
+#define __LISTING_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <glib.h>
+
+/* Single directory entry */
+typedef struct
+{
+    gchar       *name;              // filename as found on disk
+    gchar       *display;           // filename converted to UTF-8
+    gchar       *key;               // case-insensitive sort key
+    gboolean    is_dir;
+} ListingEntry;
+
+/* Sorted, unfiltered contents of a directory. Listings are immutable once
+ * read and can be shared between threads.
+ */
+typedef struct
+{
+    gchar           *path;          // directory path without trailing separator
+    ListingEntry    *entries;       // directories first, then files
+    guint           n_entries;
+    guint           n_dirs;
+    time_t          mtime;
+    dev_t           dev;            // identify the directory behind symlinks
+    ino_t           ino;
+    gint            ref_count;
+} DirListing;
+
+
+DirListing *
+listing_read (const gchar *path);
+
+DirListing *
+listing_ref (DirListing *listing);
+
+void
+listing_unref (DirListing *listing);
+
+gchar *
+listing_entry_path (const DirListing *listing, const ListingEntry *entry);
+
+DirListing *
+listing_cache_lookup (const gchar *path);
+
+DirListing *
+listing_get (const gchar *path);
+
+void
+listing_cache_store (DirListing *listing);
+
+void
+listing_cache_clear (void);
+
+gboolean
+listing_visit (GHashTable *visited, const DirListing *listing);
+
+gboolean
+listing_visit_stat (GHashTable *visited, dev_t dev, ino_t ino);
+
+#endif  /* __LISTING_H */
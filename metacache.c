@@ -0,0 +1,385 @@
+/* METADATA CACHE - read tags of visible tracks before they are added to a playlist */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "metacache.h"
+
+
+/* Maximum number of files kept in the cache */
+#define METACACHE_SIZE          20000
+
+/* Private playlists that are not shown to the user were added with API 1.9 */
+#if (DDB_API_LEVEL >= 9)
+#define METACACHE_SUPPORTED
+#endif
+
+
+typedef struct
+{
+    gchar           *path;
+    time_t          mtime;
+    off_t           size;
+    GPtrArray       *items;         // tracks read from the file, referenced
+    gchar           *description;   // tooltip markup
+} MetaEntry;
+
+typedef struct
+{
+    DirListing      *listing;
+    FbFilter        *filter;
+    guint           serial;
+} PrewarmTask;
+
+static DB_functions_t *     deadbeef            = NULL;
+static MetaCacheReadyFunc   ready_func          = NULL;
+static gpointer             ready_data          = NULL;
+
+static GThreadPool *        prewarm_pool        = NULL;
+static guint                prewarm_serial      = 0;
+static gint                 prewarm_abort       = 0;
+static gint                 prewarm_cancelled   = 0;        // tasks up to this serial are skipped
+static GMutex               cache_mutex;
+static GHashTable *         cache_table         = NULL;     // path -> link in cache_lru
+static GQueue               cache_lru           = G_QUEUE_INIT;  // most recently used first
+
+
+static void
+entry_free (MetaEntry *entry)
+{
+    for (guint i = 0; i < entry->items->len; i++)
+        deadbeef->pl_item_unref (g_ptr_array_index (entry->items, i));
+    g_ptr_array_free (entry->items, TRUE);
+    g_free (entry->description);
+    g_free (entry->path);
+    g_free (entry);
+}
+
+/* Unlink a cached entry, cache_mutex must be held. The entry is moved to
+ * dropped and must be freed after the mutex was released, because releasing
+ * tracks may need the playlist lock. */
+static void
+cache_remove_link (GList *link, GSList **dropped)
+{
+    MetaEntry *entry = link->data;
+    g_hash_table_remove (cache_table, entry->path);
+    g_queue_delete_link (&cache_lru, link);
+    *dropped = g_slist_prepend (*dropped, entry);
+}
+
+static void
+cache_free_dropped (GSList *dropped)
+{
+    g_slist_free_full (dropped, (GDestroyNotify) entry_free);
+}
+
+/* Get entry for path if the file didn't change since it was read,
+ * cache_mutex must be held */
+static MetaEntry *
+cache_lookup (const gchar *path, GSList **dropped)
+{
+    GList *link = cache_table ? g_hash_table_lookup (cache_table, path) : NULL;
+    if (! link)
+        return NULL;
+
+    MetaEntry *entry = link->data;
+    struct stat file_stat;
+    if (stat (path, &file_stat) != 0
+                || entry->mtime != file_stat.st_mtime || entry->size != file_stat.st_size) {
+        cache_remove_link (link, dropped);
+        return NULL;
+    }
+
+    g_queue_unlink (&cache_lru, link);
+    g_queue_push_head_link (&cache_lru, link);
+    return entry;
+}
+
+#ifdef METACACHE_SUPPORTED
+static void
+cache_store (MetaEntry *entry)
+{
+    GSList *dropped = NULL;
+
+    g_mutex_lock (&cache_mutex);
+    if (! cache_table)
+        cache_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+    GList *link = g_hash_table_lookup (cache_table, entry->path);
+    if (link)
+        cache_remove_link (link, &dropped);
+
+    g_queue_push_head (&cache_lru, entry);
+    g_hash_table_insert (cache_table, entry->path, cache_lru.head);
+
+    while (cache_lru.length > METACACHE_SIZE)
+        cache_remove_link (cache_lru.tail, &dropped);
+    g_mutex_unlock (&cache_mutex);
+
+    cache_free_dropped (dropped);
+}
+
+/* Build tooltip for the tracks of a file, pl_lock must be held */
+static gchar *
+describe_items (const gchar *path, GPtrArray *items)
+{
+    GString *text = g_string_new (NULL);
+    gchar *escaped = g_markup_escape_text (path, -1);
+    g_string_append (text, escaped);
+    g_free (escaped);
+
+    if (items->len == 1) {
+        DB_playItem_t *it = g_ptr_array_index (items, 0);
+        const gchar *artist = deadbeef->pl_find_meta (it, "artist");
+        const gchar *title  = deadbeef->pl_find_meta (it, "title");
+        const gchar *album  = deadbeef->pl_find_meta (it, "album");
+
+        if (title) {
+            escaped = g_markup_escape_text (title, -1);
+            g_string_append_printf (text, "\n<b>%s</b>", escaped);
+            g_free (escaped);
+        }
+        if (artist || album) {
+            escaped = g_markup_escape_text (artist ? artist : album, -1);
+            g_string_append_printf (text, "\n%s", escaped);
+            g_free (escaped);
+            if (artist && album) {
+                escaped = g_markup_escape_text (album, -1);
+                g_string_append_printf (text, " - %s", escaped);
+                g_free (escaped);
+            }
+        }
+    }
+    else if (items->len > 1) {
+        g_string_append_printf (text, "\n%u tracks", items->len);
+    }
+
+    gint seconds = 0;
+    for (guint i = 0; i < items->len; i++)
+        seconds += (gint) deadbeef->pl_get_item_duration (g_ptr_array_index (items, i));
+    if (seconds > 0)
+        g_string_append_printf (text, "\n%d:%02d", seconds / 60, seconds % 60);
+
+    return g_string_free (text, FALSE);
+}
+
+/* Read tracks of a single file by letting the decoders insert them into
+ * scratch, an empty private playlist. Returns the referenced tracks. */
+GPtrArray *
+metacache_read_items (ddb_playlist_t *scratch, const gchar *path, int *abort)
+{
+    GPtrArray *items = g_ptr_array_new ();
+    deadbeef->plt_insert_file2 (0, scratch, NULL, path, abort, NULL, NULL);
+
+    deadbeef->pl_lock ();
+    DB_playItem_t *it = deadbeef->plt_get_first (scratch, PL_MAIN);
+    while (it) {
+        g_ptr_array_add (items, it);  // keeps reference from plt_get_first / pl_get_next
+        it = deadbeef->pl_get_next (it, PL_MAIN);
+    }
+    for (guint i = 0; i < items->len; i++)
+        deadbeef->plt_remove_item (scratch, g_ptr_array_index (items, i));
+    deadbeef->pl_unlock ();
+
+    return items;
+}
+
+static gboolean
+prewarm_ready (gpointer data)
+{
+    gchar *dir = data;
+    if (ready_func)
+        ready_func (dir, ready_data);
+    g_free (dir);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+static MetaEntry *
+prewarm_file (ddb_playlist_t *scratch, const gchar *path, const struct stat *file_stat)
+{
+    MetaEntry *entry = g_new0 (MetaEntry, 1);
+    entry->path = g_strdup (path);
+    entry->mtime = file_stat->st_mtime;
+    entry->size = file_stat->st_size;
+    entry->items = metacache_read_items (scratch, path, &prewarm_abort);
+
+    deadbeef->pl_lock ();
+    entry->description = describe_items (path, entry->items);
+    deadbeef->pl_unlock ();
+
+    return entry;
+}
+
+/* Worker thread: read the tracks of all shown files of a directory */
+static void
+prewarm_worker (gpointer data, gpointer user_data)
+{
+    PrewarmTask *task = data;
+    DirListing *listing = task->listing;
+    gboolean changed = FALSE;
+
+    ddb_playlist_t *scratch = deadbeef->plt_alloc ("filebrowser-prewarm");
+    for (guint i = listing->n_dirs; i < listing->n_entries && ! g_atomic_int_get (&prewarm_abort)
+                && task->serial > (guint) g_atomic_int_get (&prewarm_cancelled); i++) {
+        ListingEntry *entry = &listing->entries[i];
+        if (filter_hidden (task->filter, entry->name) || ! filter_match (task->filter, entry->display))
+            continue;
+
+        gchar *path = listing_entry_path (listing, entry);
+        struct stat file_stat;
+        if (stat (path, &file_stat) == 0 && S_ISREG (file_stat.st_mode)) {
+            GSList *dropped = NULL;
+            g_mutex_lock (&cache_mutex);
+            gboolean cached = (cache_lookup (path, &dropped) != NULL);
+            g_mutex_unlock (&cache_mutex);
+            cache_free_dropped (dropped);
+
+            if (! cached) {
+                cache_store (prewarm_file (scratch, path, &file_stat));
+                changed = TRUE;
+            }
+        }
+        g_free (path);
+
+        /* Stay in the background, the user is waiting for other things */
+        g_thread_yield ();
+    }
+    deadbeef->plt_free (scratch);
+
+    if (changed && ! g_atomic_int_get (&prewarm_abort))
+        g_idle_add (prewarm_ready, g_strdup (listing->path));
+
+    listing_unref (task->listing);
+    filter_unref (task->filter);
+    g_free (task);
+}
+
+/* Most recently expanded directories are read first */
+static gint
+compare_tasks (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const PrewarmTask *t1 = a;
+    const PrewarmTask *t2 = b;
+    return (t1->serial < t2->serial) - (t1->serial > t2->serial);
+}
+#endif  /* METACACHE_SUPPORTED */
+
+
+void
+metacache_init (DB_functions_t *api, MetaCacheReadyFunc func, gpointer user_data)
+{
+    deadbeef = api;
+    ready_func = func;
+    ready_data = user_data;
+    g_atomic_int_set (&prewarm_abort, 0);
+
+#ifdef METACACHE_SUPPORTED
+    /* A single worker keeps the load on the disk and the playlist lock low */
+    if (! prewarm_pool) {
+        prewarm_pool = g_thread_pool_new (prewarm_worker, NULL, 1, FALSE, NULL);
+        g_thread_pool_set_sort_function (prewarm_pool, compare_tasks, NULL);
+    }
+#endif
+}
+
+void
+metacache_shutdown (void)
+{
+    ready_func = NULL;
+    g_atomic_int_set (&prewarm_abort, 1);
+
+    if (prewarm_pool)
+        g_thread_pool_free (prewarm_pool, FALSE, TRUE);
+    prewarm_pool = NULL;
+
+    GSList *dropped = NULL;
+    g_mutex_lock (&cache_mutex);
+    while (cache_lru.head)
+        cache_remove_link (cache_lru.head, &dropped);
+    if (cache_table)
+        g_hash_table_destroy (cache_table);
+    cache_table = NULL;
+    g_mutex_unlock (&cache_mutex);
+    cache_free_dropped (dropped);
+}
+
+/* Queue the shown files of listing for reading at low priority */
+void
+metacache_prewarm (DirListing *listing, FbFilter *filter)
+{
+    if (! prewarm_pool || ! listing || listing->n_entries == listing->n_dirs)
+        return;
+
+    PrewarmTask *task = g_new (PrewarmTask, 1);
+    task->listing = listing_ref (listing);
+    task->filter = filter_ref (filter);
+    task->serial = ++prewarm_serial;
+    g_thread_pool_push (prewarm_pool, task, NULL);
+}
+
+/* Skip the directories queued so far */
+void
+metacache_cancel (void)
+{
+    g_atomic_int_set (&prewarm_cancelled, prewarm_serial);
+}
+
+/* Drop least recently used files until at most max_files are cached */
+void
+metacache_trim (guint max_files)
+{
+    GSList *dropped = NULL;
+    g_mutex_lock (&cache_mutex);
+    while (cache_lru.length > max_files)
+        cache_remove_link (cache_lru.tail, &dropped);
+    g_mutex_unlock (&cache_mutex);
+    cache_free_dropped (dropped);
+}
+
+/* Get tooltip markup for path, returns NULL if the file wasn't read yet */
+gchar *
+metacache_describe (const gchar *path)
+{
+    GSList *dropped = NULL;
+
+    g_mutex_lock (&cache_mutex);
+    MetaEntry *entry = cache_lookup (path, &dropped);
+    gchar *description = entry ? g_strdup (entry->description) : NULL;
+    g_mutex_unlock (&cache_mutex);
+    cache_free_dropped (dropped);
+
+    return description;
+}
+
+/* Append copies of the cached tracks of path to plt without opening the file,
+ * returns FALSE if the file wasn't read yet. pl_lock must be held. */
+gboolean
+metacache_append (ddb_playlist_t *plt, const gchar *path)
+{
+    GSList *dropped = NULL;
+
+    g_mutex_lock (&cache_mutex);
+    MetaEntry *entry = cache_lookup (path, &dropped);
+    gboolean found = (entry && entry->items->len > 0);
+    if (found) {
+        DB_playItem_t *after = deadbeef->plt_get_last (plt, PL_MAIN);
+        for (guint i = 0; i < entry->items->len; i++) {
+            DB_playItem_t *it = deadbeef->pl_item_alloc ();
+            deadbeef->pl_item_copy (it, g_ptr_array_index (entry->items, i));
+            deadbeef->plt_insert_item (plt, after, it);
+            if (after)
+                deadbeef->pl_item_unref (after);
+            after = it;
+        }
+        deadbeef->pl_item_unref (after);
+    }
+    g_mutex_unlock (&cache_mutex);
+    cache_free_dropped (dropped);
+
+    return found;
+}
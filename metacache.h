@@ -0,0 +1,39 @@
+#ifndef __METACACHE_H
+#define __METACACHE_H
+
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "listing.h"
+#include "filter.h"
+
+/* Called on the main thread after the tracks of a directory were read */
+typedef void (*MetaCacheReadyFunc) (const gchar *dir, gpointer user_data);
+
+
+void
+metacache_init (DB_functions_t *api, MetaCacheReadyFunc func, gpointer user_data);
+
+void
+metacache_shutdown (void);
+
+void
+metacache_prewarm (DirListing *listing, FbFilter *filter);
+
+void
+metacache_cancel (void);
+
+void
+metacache_trim (guint max_files);
+
+gchar *
+metacache_describe (const gchar *path);
+
+gboolean
+metacache_append (ddb_playlist_t *plt, const gchar *path);
+
+#if (DDB_API_LEVEL >= 9)
+GPtrArray *
+metacache_read_items (ddb_playlist_t *scratch, const gchar *path, int *abort);
+#endif
+
+#endif  /* __METACACHE_H */
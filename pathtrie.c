@@ -0,0 +1,249 @@
+/* PATH TRIE - set of paths indexed by path component */
+
+#include <string.h>
+#include <glib.h>
+#include "pathtrie.h"
+
+
+typedef struct _PathTrieNode PathTrieNode;
+
+struct _PathTrieNode
+{
+    gchar           *name;          // single path component, owned by node
+    PathTrieNode    *parent;
+    GHashTable      *children;      // component name -> PathTrieNode, created on demand
+    gboolean        marked;         // path ending at this node is part of the set
+};
+
+struct _PathTrie
+{
+    PathTrieNode    *root;
+    guint           size;
+};
+
+
+static void
+node_free (gpointer data)
+{
+    PathTrieNode *node = data;
+    if (node->children)
+        g_hash_table_destroy (node->children);
+    g_free (node->name);
+    g_free (node);
+}
+
+static PathTrieNode *
+node_new (PathTrieNode *parent, const gchar *name)
+{
+    PathTrieNode *node = g_new0 (PathTrieNode, 1);
+    node->name = g_strdup (name);
+    node->parent = parent;
+    if (parent) {
+        if (! parent->children)
+            parent->children = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, node_free);
+        g_hash_table_insert (parent->children, node->name, node);
+    }
+    return node;
+}
+
+/* Count marked nodes below (and including) node */
+static guint
+node_count_marked (PathTrieNode *node)
+{
+    guint count = node->marked ? 1 : 0;
+    if (node->children) {
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init (&iter, node->children);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            count += node_count_marked (value);
+    }
+    return count;
+}
+
+/* Remove unmarked leaf nodes, walking up towards the root */
+static void
+node_prune (PathTrieNode *node)
+{
+    while (node->parent && ! node->marked
+                && (! node->children || g_hash_table_size (node->children) == 0)) {
+        PathTrieNode *parent = node->parent;
+        g_hash_table_remove (parent->children, node->name);  // frees node
+        node = parent;
+    }
+}
+
+/* Walk the trie along the components of path, optionally creating missing nodes */
+static PathTrieNode *
+node_lookup (PathTrie *trie, const gchar *path, gboolean create)
+{
+    if (! trie || ! path)
+        return NULL;
+
+    /* Split into components in a scratch buffer; paths are short, so the
+     * stack is used unless the path is unusually long */
+    gchar stackbuf[1024];
+    gsize len = strlen (path);
+    gchar *buf = (len < sizeof (stackbuf)) ? stackbuf : g_malloc (len + 1);
+    memcpy (buf, path, len + 1);
+
+    PathTrieNode *node = trie->root;
+    gchar *p = buf;
+    while (node && *p) {
+        while (*p == G_DIR_SEPARATOR)
+            p++;
+        if (! *p)
+            break;
+
+        gchar *component = p;
+        while (*p && *p != G_DIR_SEPARATOR)
+            p++;
+        if (*p)
+            *p++ = '\0';
+
+        PathTrieNode *child = node->children ? g_hash_table_lookup (node->children, component) : NULL;
+        if (! child && create)
+            child = node_new (node, component);
+        node = child;
+    }
+
+    if (buf != stackbuf)
+        g_free (buf);
+
+    return node;
+}
+
+static void
+node_foreach (PathTrieNode *node, GString *path, PathTrieFunc func, gpointer user_data)
+{
+    gsize len = path->len;
+    if (node->parent) {
+        g_string_append_c (path, G_DIR_SEPARATOR);
+        g_string_append (path, node->name);
+    }
+
+    if (node->marked)
+        func (path->len ? path->str : G_DIR_SEPARATOR_S, user_data);
+
+    if (node->children) {
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init (&iter, node->children);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            node_foreach (value, path, func, user_data);
+    }
+
+    g_string_truncate (path, len);
+}
+
+
+PathTrie *
+pathtrie_new (void)
+{
+    PathTrie *trie = g_new0 (PathTrie, 1);
+    trie->root = node_new (NULL, "");
+    return trie;
+}
+
+void
+pathtrie_free (PathTrie *trie)
+{
+    if (! trie)
+        return;
+    node_free (trie->root);
+    g_free (trie);
+}
+
+void
+pathtrie_clear (PathTrie *trie)
+{
+    if (! trie)
+        return;
+    node_free (trie->root);
+    trie->root = node_new (NULL, "");
+    trie->size = 0;
+}
+
+guint
+pathtrie_size (PathTrie *trie)
+{
+    return trie ? trie->size : 0;
+}
+
+/* Add path to the set, returns TRUE if it was not contained before */
+gboolean
+pathtrie_add (PathTrie *trie, const gchar *path)
+{
+    PathTrieNode *node = node_lookup (trie, path, TRUE);
+    if (! node || node->marked)
+        return FALSE;
+
+    node->marked = TRUE;
+    trie->size++;
+    return TRUE;
+}
+
+/* Remove path from the set, descendants are kept */
+gboolean
+pathtrie_remove (PathTrie *trie, const gchar *path)
+{
+    PathTrieNode *node = node_lookup (trie, path, FALSE);
+    if (! node || ! node->marked)
+        return FALSE;
+
+    node->marked = FALSE;
+    trie->size--;
+    node_prune (node);
+    return TRUE;
+}
+
+gboolean
+pathtrie_contains (PathTrie *trie, const gchar *path)
+{
+    PathTrieNode *node = node_lookup (trie, path, FALSE);
+    return node && node->marked;
+}
+
+/* Check if any path below the given one is part of the set */
+gboolean
+pathtrie_has_descendants (PathTrie *trie, const gchar *path)
+{
+    PathTrieNode *node = node_lookup (trie, path, FALSE);
+    return node && node->children && g_hash_table_size (node->children) > 0;
+}
+
+/* Remove path and everything below it, returns number of removed paths */
+guint
+pathtrie_remove_subtree (PathTrie *trie, const gchar *path)
+{
+    PathTrieNode *node = node_lookup (trie, path, FALSE);
+    if (! node)
+        return 0;
+
+    guint removed = node_count_marked (node);
+    trie->size -= removed;
+
+    if (node == trie->root) {
+        pathtrie_clear (trie);
+        return removed;
+    }
+
+    if (node->children)
+        g_hash_table_remove_all (node->children);
+    node->marked = FALSE;
+    node_prune (node);
+
+    return removed;
+}
+
+/* Call func for every path in the set; paths of parents come before their children */
+void
+pathtrie_foreach (PathTrie *trie, PathTrieFunc func, gpointer user_data)
+{
+    if (! trie || ! func)
+        return;
+
+    GString *path = g_string_sized_new (256);
+    node_foreach (trie->root, path, func, user_data);
+    g_string_free (path, TRUE);
+}
@@ -0,0 +1,45 @@
+#ifndef __PATHTRIE_H
+#define __PATHTRIE_H
+
+#include <glib.h>
+
+/* Set of filesystem paths stored as a trie of path components.
+ * Membership tests walk one node per component, and whole subtrees can be
+ * dropped at once (e.g. when collapsing everything below a folder).
+ */
+typedef struct _PathTrie PathTrie;
+
+typedef void (*PathTrieFunc) (const gchar *path, gpointer user_data);
+
+
+PathTrie *
+pathtrie_new (void);
+
+void
+pathtrie_free (PathTrie *trie);
+
+void
+pathtrie_clear (PathTrie *trie);
+
+guint
+pathtrie_size (PathTrie *trie);
+
+gboolean
+pathtrie_add (PathTrie *trie, const gchar *path);
+
+gboolean
+pathtrie_remove (PathTrie *trie, const gchar *path);
+
+gboolean
+pathtrie_contains (PathTrie *trie, const gchar *path);
+
+gboolean
+pathtrie_has_descendants (PathTrie *trie, const gchar *path);
+
+guint
+pathtrie_remove_subtree (PathTrie *trie, const gchar *path);
+
+void
+pathtrie_foreach (PathTrie *trie, PathTrieFunc func, gpointer user_data);
+
+#endif  /* __PATHTRIE_H */
@@ -0,0 +1,118 @@
+/* SCHEDULER - run main thread work in slices between frames */
+
+#include <glib.h>
+#include "scheduler.h"
+
+
+typedef struct
+{
+    guint               id;
+    SchedulerFunc       func;
+    gpointer            data;
+    GDestroyNotify      destroy;
+    gboolean            removed;        // removed while it was running
+} Job;
+
+static GQueue           queues[SCHEDULER_N_PRIORITIES];     // FIFO of Job per priority
+static guint            dispatch_source     = 0;
+static guint            last_id             = 0;
+static Job *            running             = NULL;
+
+
+static void
+job_free (Job *job)
+{
+    if (job->destroy)
+        job->destroy (job->data);
+    g_free (job);
+}
+
+static gboolean
+scheduler_dispatch (gpointer user_data)
+{
+    gint64 deadline = g_get_monotonic_time () + SCHEDULER_BUDGET_US;
+
+    do {
+        GQueue *queue = NULL;
+        for (guint p = 0; p < SCHEDULER_N_PRIORITIES && ! queue; p++)
+            if (! g_queue_is_empty (&queues[p]))
+                queue = &queues[p];
+        if (! queue) {
+            dispatch_source = 0;
+            return FALSE;
+        }
+
+        /* The job may add or remove jobs, including itself */
+        Job *job = running = g_queue_peek_head (queue);
+        gboolean more = job->func (job->data);
+        running = NULL;
+
+        if (! more || job->removed) {
+            g_queue_remove (queue, job);
+            job_free (job);
+        }
+    } while (g_get_monotonic_time () < deadline);
+
+    return TRUE;
+}
+
+/* Queue func to be called until it returns FALSE; destroy is called with
+ * data when the job is done or removed. Returns an ID for scheduler_remove() */
+guint
+scheduler_add (SchedulerPriority priority, SchedulerFunc func, gpointer data,
+                            GDestroyNotify destroy)
+{
+    g_return_val_if_fail (priority < SCHEDULER_N_PRIORITIES, 0);
+
+    if (++last_id == 0)  // 0 is never a valid ID
+        last_id++;
+
+    Job *job = g_new0 (Job, 1);
+    job->id = last_id;
+    job->func = func;
+    job->data = data;
+    job->destroy = destroy;
+    g_queue_push_tail (&queues[priority], job);
+
+    /* Below drawing and input, so these are never held back by jobs */
+    if (! dispatch_source)
+        dispatch_source = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, scheduler_dispatch, NULL, NULL);
+
+    return job->id;
+}
+
+/* Drop a job that isn't done yet, returns FALSE if it wasn't found */
+gboolean
+scheduler_remove (guint id)
+{
+    if (running && running->id == id) {
+        running->removed = TRUE;
+        return TRUE;
+    }
+
+    for (guint p = 0; p < SCHEDULER_N_PRIORITIES; p++) {
+        for (GList *link = queues[p].head; link; link = link->next) {
+            Job *job = link->data;
+            if (job->id == id) {
+                g_queue_delete_link (&queues[p], link);
+                job_free (job);
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/* Drop all jobs */
+void
+scheduler_shutdown (void)
+{
+    for (guint p = 0; p < SCHEDULER_N_PRIORITIES; p++) {
+        Job *job;
+        while ((job = g_queue_pop_head (&queues[p])))
+            job_free (job);
+    }
+    if (dispatch_source)
+        g_source_remove (dispatch_source);
+    dispatch_source = 0;
+}
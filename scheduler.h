@@ -0,0 +1,37 @@
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <glib.h>
+
+/* Cooperative scheduler for work on the main thread. Jobs do a small step
+ * per call; steps are run until the frame budget is used up, then GTK gets
+ * to draw and handle input before the next slice. Jobs of a higher
+ * priority always run first. Must only be used from the main thread.
+ */
+
+/* Time spent on jobs before yielding to the main loop */
+#define SCHEDULER_BUDGET_US     4000
+
+typedef enum
+{
+    SCHEDULER_PRIORITY_USER     = 0,    // expanding or refreshing rows
+    SCHEDULER_PRIORITY_RESTORE  = 1,    // restoring expanded rows
+    SCHEDULER_PRIORITY_PREFETCH = 2,    // showing results of background work
+    SCHEDULER_N_PRIORITIES
+} SchedulerPriority;
+
+/* Do one step, return TRUE if there is more to do */
+typedef gboolean (*SchedulerFunc) (gpointer data);
+
+
+guint
+scheduler_add (SchedulerPriority priority, SchedulerFunc func, gpointer data,
+                            GDestroyNotify destroy);
+
+gboolean
+scheduler_remove (guint id);
+
+void
+scheduler_shutdown (void);
+
+#endif  /* __SCHEDULER_H */
@@ -0,0 +1,846 @@
+/* SEARCH INDEX - trigram index over all file and folder names below the root */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "searchindex.h"
+#include "listing.h"
+#include "binio.h"
+#include "fuzzy.h"
+
+
+/* File layout (all integers are unsigned LEB128 varints):
+ *     magic           8 bytes "DBFBSIDX"
+ *     version         varint
+ *     root            string (varint length + bytes)
+ *     signature       string, filter the index was built with
+ *     count           varint, number of entries
+ *     entries         count * ((parent + 1) << 1 | is_dir, name, key),
+ *                     key is empty if it equals the name
+ *     trigrams        varint, number of trigrams
+ *     postings        trigrams * (key delta, length, entry id deltas)
+ *     checksum        4 bytes little-endian FNV-1a over everything above
+ */
+#define SEARCHINDEX_MAGIC       "DBFBSIDX"
+#define SEARCHINDEX_VERSION     1
+
+#define NO_PARENT               G_MAXUINT32
+
+struct _SearchIndex
+{
+    gchar       *root;
+    gchar       *signature;
+
+    guint32     n_entries;
+    guint32     *parents;           // parent entry, NO_PARENT for entries in root
+    guint32     *names;             // offset of filename in strings
+    guint32     *keys;              // offset of lowercase UTF-8 name in strings
+    guint8      *is_dir;
+    gchar       *strings;
+    gsize       strings_len;
+    guint64     *charsets;          // characters in each key, for rejecting fuzzy matches early
+
+    guint32     n_trigrams;
+    guint32     *trigrams;          // sorted
+    guint32     *offsets;           // n_trigrams + 1 offsets into postings
+    guint8      *postings;          // ascending entry ids, delta + varint encoded
+    gsize       postings_len;
+};
+
+typedef struct
+{
+    GArray      *parents;
+    GArray      *names;
+    GArray      *keys;
+    GByteArray  *is_dir;
+    GString     *strings;
+    GHashTable  *trigrams;          // trigram -> GArray of entry ids
+    GHashTable  *visited;           // directories already added
+} Builder;
+
+typedef struct
+{
+    gchar                   *root;
+    FbFilter                *filter;
+    gchar                   *filename;
+    SearchIndexReadyFunc    func;
+    gpointer                user_data;
+    gint                    generation;
+    SearchIndex             *index;
+} BuildTask;
+
+/* Fuzzy queries over more entries than this are split across threads */
+#define FUZZY_CHUNK_SIZE        65536
+/* Ids are prefiltered in blocks of this size */
+#define FUZZY_BLOCK_SIZE        4096
+/* Names containing every word as typed rank before all other matches; more
+ * than any name can score otherwise */
+#define SUBSTRING_BONUS         (1 << 20)
+
+typedef struct
+{
+    const SearchIndex   *index;
+    gchar               **words;
+    guint64             required;   // characters of all words
+    guint32             start;
+    guint32             end;
+    FuzzyHeap           heap;
+    gint                *pending;
+    GMutex              *mutex;
+    GCond               *cond;
+} FuzzyTask;
+
+static GThreadPool *    build_pool          = NULL;
+static gint             build_generation    = 0;
+static GThreadPool *    fuzzy_pool          = NULL;
+
+
+static guint32
+make_trigram (const gchar *s)
+{
+    return ((guint8) s[0] << 16) | ((guint8) s[1] << 8) | (guint8) s[2];
+}
+
+static guint32
+add_string (GString *strings, const gchar *str)
+{
+    guint32 offset = strings->len;
+    g_string_append_len (strings, str, strlen (str) + 1);
+    return offset;
+}
+
+static void
+builder_add (Builder *b, guint32 parent, const gchar *name, const gchar *key, gboolean is_dir)
+{
+    guint32 id = b->parents->len;
+    guint32 name_offset = add_string (b->strings, name);
+    guint32 key_offset = strcmp (name, key) == 0 ? name_offset : add_string (b->strings, key);
+    guint8 dir = is_dir ? 1 : 0;
+
+    g_array_append_val (b->parents, parent);
+    g_array_append_val (b->names, name_offset);
+    g_array_append_val (b->keys, key_offset);
+    g_byte_array_append (b->is_dir, &dir, 1);
+
+    gsize len = strlen (key);
+    for (gsize i = 0; i + 3 <= len; i++) {
+        gpointer tri = GUINT_TO_POINTER (make_trigram (key + i));
+        GArray *ids = g_hash_table_lookup (b->trigrams, tri);
+        if (! ids) {
+            ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+            g_hash_table_insert (b->trigrams, tri, ids);
+        }
+        if (ids->len == 0 || g_array_index (ids, guint32, ids->len - 1) != id)
+            g_array_append_val (ids, id);
+    }
+}
+
+/* Add contents of path in the same order and with the same filter as the tree */
+static gboolean
+builder_add_dir (Builder *b, const gchar *path, guint32 parent, FbFilter *filter, gint generation)
+{
+    if (g_atomic_int_get (&build_generation) != generation)
+        return FALSE;
+
+    DirListing *listing = listing_get (path);
+    if (! listing)
+        return TRUE;
+    if (! listing_visit (b->visited, listing)) {
+        listing_unref (listing);
+        return TRUE;
+    }
+
+    gboolean ok = TRUE;
+    for (guint i = 0; i < listing->n_entries && ok; i++) {
+        ListingEntry *entry = &listing->entries[i];
+        if (filter_hidden (filter, entry->name))
+            continue;
+        if (! entry->is_dir && ! filter_match (filter, entry->display))
+            continue;
+
+        guint32 id = b->parents->len;
+        builder_add (b, parent, entry->name, entry->key, entry->is_dir);
+        if (entry->is_dir) {
+            gchar *subdir = listing_entry_path (listing, entry);
+            ok = builder_add_dir (b, subdir, id, filter, generation);
+            g_free (subdir);
+        }
+    }
+    listing_unref (listing);
+
+    return ok;
+}
+
+static gint
+compare_trigrams (gconstpointer a, gconstpointer b)
+{
+    guint32 t1 = GPOINTER_TO_UINT (*(gconstpointer *) a);
+    guint32 t2 = GPOINTER_TO_UINT (*(gconstpointer *) b);
+    return (t1 > t2) - (t1 < t2);
+}
+
+/* Move the collected entries into a new index */
+static SearchIndex *
+builder_take_entries (Builder *b, const gchar *root, const gchar *signature)
+{
+    SearchIndex *index = g_new0 (SearchIndex, 1);
+    index->root = g_strdup (root);
+    index->signature = g_strdup (signature);
+
+    index->n_entries = b->parents->len;
+    index->parents = (guint32 *) g_array_free (b->parents, FALSE);
+    index->names = (guint32 *) g_array_free (b->names, FALSE);
+    index->keys = (guint32 *) g_array_free (b->keys, FALSE);
+    index->is_dir = g_byte_array_free (b->is_dir, FALSE);
+    index->strings_len = b->strings->len;
+    index->strings = g_string_free (b->strings, FALSE);
+
+    index->charsets = g_new (guint64, MAX (index->n_entries, 1));
+    for (guint32 i = 0; i < index->n_entries; i++)
+        index->charsets[i] = fuzzy_charset (index->strings + index->keys[i]);
+
+    g_hash_table_destroy (b->trigrams);
+    g_hash_table_destroy (b->visited);
+    g_free (b);
+
+    return index;
+}
+
+/* Turn collected data into an index, frees the builder */
+static SearchIndex *
+builder_finish (Builder *b, const gchar *root, const gchar *signature)
+{
+    GHashTable *trigrams = b->trigrams;
+    b->trigrams = g_hash_table_new (g_direct_hash, g_direct_equal);
+    SearchIndex *index = builder_take_entries (b, root, signature);
+
+    GPtrArray *sorted = g_ptr_array_sized_new (g_hash_table_size (trigrams));
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init (&iter, trigrams);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_ptr_array_add (sorted, key);
+    g_ptr_array_sort (sorted, compare_trigrams);
+
+    index->n_trigrams = sorted->len;
+    index->trigrams = g_new (guint32, sorted->len);
+    index->offsets = g_new (guint32, sorted->len + 1);
+    GByteArray *postings = g_byte_array_new ();
+    for (guint i = 0; i < sorted->len; i++) {
+        GArray *ids = g_hash_table_lookup (trigrams, g_ptr_array_index (sorted, i));
+        index->trigrams[i] = GPOINTER_TO_UINT (g_ptr_array_index (sorted, i));
+        index->offsets[i] = postings->len;
+
+        guint32 prev = 0;
+        for (guint j = 0; j < ids->len; j++) {
+            guint32 id = g_array_index (ids, guint32, j);
+            binio_put_varint (postings, id - prev);
+            prev = id;
+        }
+    }
+    index->offsets[sorted->len] = postings->len;
+    index->postings_len = postings->len;
+    index->postings = g_byte_array_free (postings, FALSE);
+
+    g_ptr_array_free (sorted, TRUE);
+    g_hash_table_destroy (trigrams);
+
+    return index;
+}
+
+static Builder *
+builder_new (void)
+{
+    Builder *b = g_new0 (Builder, 1);
+    b->parents = g_array_new (FALSE, FALSE, sizeof (guint32));
+    b->names = g_array_new (FALSE, FALSE, sizeof (guint32));
+    b->keys = g_array_new (FALSE, FALSE, sizeof (guint32));
+    b->is_dir = g_byte_array_new ();
+    b->strings = g_string_sized_new (65536);
+    b->trigrams = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                            (GDestroyNotify) g_array_unref);
+    b->visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    return b;
+}
+
+static void
+builder_free (Builder *b)
+{
+    g_array_free (b->parents, TRUE);
+    g_array_free (b->names, TRUE);
+    g_array_free (b->keys, TRUE);
+    g_byte_array_free (b->is_dir, TRUE);
+    g_string_free (b->strings, TRUE);
+    g_hash_table_destroy (b->trigrams);
+    g_hash_table_destroy (b->visited);
+    g_free (b);
+}
+
+/* Find posting list of a trigram, returns FALSE if no name contains it */
+static gboolean
+find_postings (const SearchIndex *index, guint32 trigram, BinReader *r)
+{
+    guint lo = 0, hi = index->n_trigrams;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (index->trigrams[mid] < trigram)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo >= index->n_trigrams || index->trigrams[lo] != trigram)
+        return FALSE;
+
+    r->data = index->postings + index->offsets[lo];
+    r->length = index->offsets[lo+1] - index->offsets[lo];
+    r->pos = 0;
+    return TRUE;
+}
+
+/* Keep only the candidates that also appear in the posting list */
+static void
+intersect_postings (GArray *candidates, BinReader *r)
+{
+    guint kept = 0;
+    guint64 delta;
+    guint32 id = 0;
+    gboolean have = binio_get_varint (r, &delta);
+    if (have)
+        id = delta;
+
+    for (guint i = 0; i < candidates->len && have; i++) {
+        guint32 candidate = g_array_index (candidates, guint32, i);
+        while (have && id < candidate) {
+            have = binio_get_varint (r, &delta);
+            id += delta;
+        }
+        if (have && id == candidate)
+            g_array_index (candidates, guint32, kept++) = candidate;
+    }
+    g_array_set_size (candidates, kept);
+}
+
+/* Entries whose key may contain every word, from the posting lists of the
+ * words' trigrams; words shorter than a trigram don't narrow them down.
+ * Returns NULL if no word has a trigram, i.e. every entry is a candidate. */
+static GArray *
+find_candidates (const SearchIndex *index, gchar **words)
+{
+    GPtrArray *lists = g_ptr_array_new_with_free_func (g_free);
+    gboolean empty = FALSE;
+    for (gint w = 0; words[w] && ! empty; w++) {
+        gsize len = strlen (words[w]);
+        for (gsize i = 0; i + 3 <= len && ! empty; i++) {
+            BinReader *r = g_new (BinReader, 1);
+            g_ptr_array_add (lists, r);
+            empty = ! find_postings (index, make_trigram (words[w] + i), r);
+        }
+    }
+
+    GArray *candidates = NULL;
+    if (empty)
+        candidates = g_array_new (FALSE, FALSE, sizeof (guint32));
+    else if (lists->len > 0) {
+        /* Start with the shortest posting list */
+        guint shortest = 0;
+        for (guint i = 1; i < lists->len; i++)
+            if (((BinReader *) lists->pdata[i])->length < ((BinReader *) lists->pdata[shortest])->length)
+                shortest = i;
+
+        BinReader *r = lists->pdata[shortest];
+        candidates = g_array_new (FALSE, FALSE, sizeof (guint32));
+        guint64 delta;
+        guint32 id = 0;
+        while (binio_get_varint (r, &delta)) {
+            id += delta;
+            g_array_append_val (candidates, id);
+        }
+
+        for (guint i = 0; i < lists->len && candidates->len > 0; i++)
+            if (i != shortest)
+                intersect_postings (candidates, lists->pdata[i]);
+    }
+    g_ptr_array_free (lists, TRUE);
+
+    return candidates;
+}
+
+/* Trigrams only narrow down the candidates, check the actual name */
+static gboolean
+contains_words (const gchar *key, gchar **words)
+{
+    for (gint w = 0; words[w]; w++)
+        if (! strstr (key, words[w]))
+            return FALSE;
+    return TRUE;
+}
+
+static gchar *
+entry_path (const SearchIndex *index, guint32 id)
+{
+    GPtrArray *parts = g_ptr_array_new ();
+    for (guint32 i = id; i != NO_PARENT; i = index->parents[i])
+        g_ptr_array_add (parts, index->strings + index->names[i]);
+
+    GString *path = g_string_new (index->root);
+    for (guint i = parts->len; i > 0; i--) {
+        if (path->len == 0 || path->str[path->len-1] != G_DIR_SEPARATOR)
+            g_string_append_c (path, G_DIR_SEPARATOR);
+        g_string_append (path, g_ptr_array_index (parts, i-1));
+    }
+    g_ptr_array_free (parts, TRUE);
+
+    return g_string_free (path, FALSE);
+}
+
+
+SearchIndex *
+searchindex_load (const gchar *filename)
+{
+    gchar *contents;
+    gsize length;
+    if (! g_file_get_contents (filename, &contents, &length, NULL))
+        return NULL;
+
+    BinReader r;
+    guint64 version, count, value;
+    gchar *root = NULL, *signature = NULL;
+    Builder *b = NULL;
+    SearchIndex *index = NULL;
+
+    if (! binio_open (&r, (const guint8 *) contents, length, SEARCHINDEX_MAGIC)
+            || ! binio_get_varint (&r, &version) || version != SEARCHINDEX_VERSION
+            || ! binio_get_string (&r, &root) || ! root
+            || ! binio_get_string (&r, &signature)
+            || ! binio_get_varint (&r, &count) || count >= NO_PARENT)
+        goto out;
+
+    b = builder_new ();
+    for (guint64 i = 0; i < count; i++) {
+        gchar *name, *key;
+        if (! binio_get_varint (&r, &value) || (value >> 1) > i
+                || ! binio_get_string (&r, &name) || ! name)
+            goto out;
+        if (! binio_get_string (&r, &key)) {
+            g_free (name);
+            goto out;
+        }
+
+        guint32 parent = (value >> 1) ? (guint32) (value >> 1) - 1 : NO_PARENT;
+        guint32 name_offset = add_string (b->strings, name);
+        guint32 key_offset = key ? add_string (b->strings, key) : name_offset;
+        guint8 dir = value & 1;
+        g_array_append_val (b->parents, parent);
+        g_array_append_val (b->names, name_offset);
+        g_array_append_val (b->keys, key_offset);
+        g_byte_array_append (b->is_dir, &dir, 1);
+        g_free (name);
+        g_free (key);
+    }
+
+    guint64 n_trigrams;
+    if (! binio_get_varint (&r, &n_trigrams) || n_trigrams > r.length - r.pos)
+        goto out;
+
+    GByteArray *postings = g_byte_array_new ();
+    guint32 *trigrams = g_new (guint32, n_trigrams);
+    guint32 *offsets = g_new (guint32, n_trigrams + 1);
+    guint32 trigram = 0;
+    gboolean ok = TRUE;
+    for (guint64 i = 0; i < n_trigrams && ok; i++) {
+        guint64 delta, size;
+        ok = binio_get_varint (&r, &delta) && binio_get_varint (&r, &size)
+            && size <= r.length - r.pos;
+        if (ok) {
+            trigram += delta;
+            trigrams[i] = trigram;
+            offsets[i] = postings->len;
+            g_byte_array_append (postings, r.data + r.pos, size);
+            r.pos += size;
+        }
+    }
+    offsets[n_trigrams] = postings->len;
+    if (! ok) {
+        g_byte_array_free (postings, TRUE);
+        g_free (trigrams);
+        g_free (offsets);
+        goto out;
+    }
+
+    index = builder_take_entries (b, root, signature ? signature : "");
+    b = NULL;
+
+    index->n_trigrams = n_trigrams;
+    index->trigrams = trigrams;
+    index->offsets = offsets;
+    index->postings_len = postings->len;
+    index->postings = g_byte_array_free (postings, FALSE);
+
+out:
+    if (b)
+        builder_free (b);
+    if (! index)
+        fprintf (stderr, "filebrowser: ignoring invalid search index %s\n", filename);
+    g_free (root);
+    g_free (signature);
+    g_free (contents);
+    return index;
+}
+
+gboolean
+searchindex_save (const SearchIndex *index, const gchar *filename)
+{
+    GByteArray *buf = g_byte_array_sized_new (index->strings_len + index->postings_len + 4096);
+    g_byte_array_append (buf, (const guint8 *) SEARCHINDEX_MAGIC, strlen (SEARCHINDEX_MAGIC));
+    binio_put_varint (buf, SEARCHINDEX_VERSION);
+    binio_put_string (buf, index->root, strlen (index->root));
+    binio_put_string (buf, index->signature, strlen (index->signature));
+
+    binio_put_varint (buf, index->n_entries);
+    for (guint32 i = 0; i < index->n_entries; i++) {
+        guint64 parent = (index->parents[i] == NO_PARENT) ? 0 : (guint64) index->parents[i] + 1;
+        const gchar *name = index->strings + index->names[i];
+        const gchar *key = index->strings + index->keys[i];
+        binio_put_varint (buf, parent << 1 | index->is_dir[i]);
+        binio_put_string (buf, name, strlen (name));
+        binio_put_string (buf, key, (key == name) ? 0 : strlen (key));
+    }
+
+    binio_put_varint (buf, index->n_trigrams);
+    guint32 prev = 0;
+    for (guint32 i = 0; i < index->n_trigrams; i++) {
+        guint32 size = index->offsets[i+1] - index->offsets[i];
+        binio_put_varint (buf, index->trigrams[i] - prev);
+        binio_put_varint (buf, size);
+        g_byte_array_append (buf, index->postings + index->offsets[i], size);
+        prev = index->trigrams[i];
+    }
+    binio_seal (buf);
+
+    GError *error = NULL;
+    gboolean ok = g_file_set_contents (filename, (const gchar *) buf->data, buf->len, &error);
+    if (! ok) {
+        fprintf (stderr, "filebrowser: could not write search index: %s\n", error->message);
+        g_error_free (error);
+    }
+    g_byte_array_free (buf, TRUE);
+
+    return ok;
+}
+
+void
+searchindex_free (SearchIndex *index)
+{
+    if (! index)
+        return;
+
+    g_free (index->root);
+    g_free (index->signature);
+    g_free (index->parents);
+    g_free (index->names);
+    g_free (index->keys);
+    g_free (index->is_dir);
+    g_free (index->strings);
+    g_free (index->charsets);
+    g_free (index->trigrams);
+    g_free (index->offsets);
+    g_free (index->postings);
+    g_free (index);
+}
+
+const gchar *
+searchindex_get_root (const SearchIndex *index)
+{
+    return index->root;
+}
+
+const gchar *
+searchindex_get_signature (const SearchIndex *index)
+{
+    return index->signature;
+}
+
+guint
+searchindex_size (const SearchIndex *index)
+{
+    return index->n_entries;
+}
+
+/* Find entries whose name contains all words of query, ignoring case.
+ * Returns at most limit full paths in tree order. */
+GPtrArray *
+searchindex_query (const SearchIndex *index, const gchar *query, guint limit)
+{
+    GPtrArray *results = g_ptr_array_new_with_free_func (g_free);
+
+    gchar *lower = g_utf8_strdown (query, -1);
+    gchar **words = g_strsplit_set (lower, " \t", 0);
+    g_free (lower);
+
+    gboolean has_words = FALSE;
+    for (gint w = 0; words[w]; w++)
+        has_words |= (words[w][0] != '\0');
+    if (! has_words) {
+        g_strfreev (words);
+        return results;
+    }
+
+    GArray *candidates = find_candidates (index, words);
+    guint n = candidates ? candidates->len : index->n_entries;
+    for (guint i = 0; i < n && results->len < limit; i++) {
+        guint32 id = candidates ? g_array_index (candidates, guint32, i) : i;
+        if (contains_words (index->strings + index->keys[id], words))
+            g_ptr_array_add (results, entry_path (index, id));
+    }
+
+    if (candidates)
+        g_array_free (candidates, TRUE);
+    g_strfreev (words);
+
+    return results;
+}
+
+
+/* Score of key for all words, FUZZY_NO_MATCH if one of them doesn't match */
+static gint
+fuzzy_score_words (const gchar *key, gchar **words)
+{
+    gint total = 0;
+    for (gint w = 0; words[w]; w++) {
+        gint score = fuzzy_score (key, words[w]);
+        if (score == FUZZY_NO_MATCH)
+            return FUZZY_NO_MATCH;
+        total += score;
+    }
+    return contains_words (key, words) ? total + SUBSTRING_BONUS : total;
+}
+
+/* Score the entries of one chunk, keeping the best in the task's heap */
+static void
+fuzzy_run (FuzzyTask *task)
+{
+    const SearchIndex *index = task->index;
+    guint32 *ids = g_new (guint32, FUZZY_BLOCK_SIZE);
+
+    for (guint32 block = task->start; block < task->end; block += FUZZY_BLOCK_SIZE) {
+        guint32 block_end = MIN (block + FUZZY_BLOCK_SIZE, task->end);
+        guint n = fuzzy_prefilter (index->charsets, block, block_end, task->required, ids);
+
+        for (guint i = 0; i < n; i++) {
+            const gchar *key = index->strings + index->keys[ids[i]];
+            FuzzyMatch match = { fuzzy_score_words (key, task->words), 0, ids[i] };
+            if (match.score != FUZZY_NO_MATCH) {
+                match.length = strlen (key);
+                fuzzy_heap_push (&task->heap, &match);
+            }
+        }
+    }
+
+    g_free (ids);
+}
+
+static void
+fuzzy_worker (gpointer data, gpointer user_data)
+{
+    FuzzyTask *task = data;
+    fuzzy_run (task);
+
+    g_mutex_lock (task->mutex);
+    if (--(*task->pending) == 0)
+        g_cond_signal (task->cond);
+    g_mutex_unlock (task->mutex);
+}
+
+/* Find entries whose name contains the letters of every word of query in
+ * order, e.g. "pnkfld" matches "Pink Floyd". Names containing the words as
+ * typed come first. Returns at most limit full paths, best matches first. */
+GPtrArray *
+searchindex_query_fuzzy (const SearchIndex *index, const gchar *query, guint limit)
+{
+    GPtrArray *results = g_ptr_array_new_with_free_func (g_free);
+
+    gchar *lower = g_utf8_strdown (query, -1);
+    gchar **split = g_strsplit_set (lower, " \t", 0);
+    g_free (lower);
+
+    /* Drop empty words left by repeated spaces */
+    GPtrArray *words = g_ptr_array_new_with_free_func (g_free);
+    guint64 required = 0;
+    for (gint w = 0; split[w]; w++) {
+        if (*split[w]) {
+            required |= fuzzy_charset (split[w]);
+            g_ptr_array_add (words, g_strdup (split[w]));
+        }
+    }
+    g_strfreev (split);
+
+    if (words->len == 0 || index->n_entries == 0 || limit == 0) {
+        g_ptr_array_unref (words);
+        return results;
+    }
+    g_ptr_array_add (words, NULL);
+
+    /* If enough names contain the words, the best matches are among them and
+     * only the candidates of the trigram index need to be scored */
+    GArray *candidates = find_candidates (index, (gchar **) words->pdata);
+    if (candidates) {
+        FuzzyHeap best;
+        fuzzy_heap_init (&best, limit);
+        guint found = 0;
+        for (guint i = 0; i < candidates->len; i++) {
+            guint32 id = g_array_index (candidates, guint32, i);
+            const gchar *key = index->strings + index->keys[id];
+            if (! contains_words (key, (gchar **) words->pdata))
+                continue;
+
+            FuzzyMatch match = { fuzzy_score_words (key, (gchar **) words->pdata), strlen (key), id };
+            if (match.score >= SUBSTRING_BONUS) {
+                fuzzy_heap_push (&best, &match);
+                found++;
+            }
+        }
+        g_array_free (candidates, TRUE);
+
+        if (found >= limit) {
+            fuzzy_heap_sort (&best);
+            for (guint i = 0; i < best.len; i++)
+                g_ptr_array_add (results, entry_path (index, best.items[i].id));
+            fuzzy_heap_clear (&best);
+            g_ptr_array_unref (words);
+            return results;
+        }
+        fuzzy_heap_clear (&best);
+    }
+
+    /* Split the entries into chunks, the calling thread takes the first one */
+    guint n_chunks = MIN ((index->n_entries + FUZZY_CHUNK_SIZE - 1) / FUZZY_CHUNK_SIZE,
+                            (guint) g_get_num_processors ());
+    n_chunks = MAX (n_chunks, 1);
+    guint32 chunk_size = (index->n_entries + n_chunks - 1) / n_chunks;
+
+    GMutex mutex;
+    GCond cond;
+    gint pending = n_chunks - 1;
+    g_mutex_init (&mutex);
+    g_cond_init (&cond);
+
+    if (n_chunks > 1 && ! fuzzy_pool)
+        fuzzy_pool = g_thread_pool_new (fuzzy_worker, NULL, g_get_num_processors () - 1, FALSE, NULL);
+
+    FuzzyTask *tasks = g_new0 (FuzzyTask, n_chunks);
+    for (guint c = 0; c < n_chunks; c++) {
+        FuzzyTask *task = &tasks[c];
+        task->index = index;
+        task->words = (gchar **) words->pdata;
+        task->required = required;
+        task->start = c * chunk_size;
+        task->end = MIN (task->start + chunk_size, index->n_entries);
+        task->pending = &pending;
+        task->mutex = &mutex;
+        task->cond = &cond;
+        fuzzy_heap_init (&task->heap, limit);
+        if (c > 0)
+            g_thread_pool_push (fuzzy_pool, task, NULL);
+    }
+    fuzzy_run (&tasks[0]);
+
+    g_mutex_lock (&mutex);
+    while (pending > 0)
+        g_cond_wait (&cond, &mutex);
+    g_mutex_unlock (&mutex);
+
+    /* Merge the best matches of all chunks */
+    FuzzyHeap best;
+    fuzzy_heap_init (&best, limit);
+    for (guint c = 0; c < n_chunks; c++) {
+        for (guint i = 0; i < tasks[c].heap.len; i++)
+            fuzzy_heap_push (&best, &tasks[c].heap.items[i]);
+        fuzzy_heap_clear (&tasks[c].heap);
+    }
+    fuzzy_heap_sort (&best);
+
+    for (guint i = 0; i < best.len; i++)
+        g_ptr_array_add (results, entry_path (index, best.items[i].id));
+
+    fuzzy_heap_clear (&best);
+    g_free (tasks);
+    g_mutex_clear (&mutex);
+    g_cond_clear (&cond);
+    g_ptr_array_unref (words);
+
+    return results;
+}
+
+static gboolean
+build_ready (gpointer data)
+{
+    BuildTask *task = data;
+
+    if (task->index && task->generation == g_atomic_int_get (&build_generation))
+        task->func (task->index, task->user_data);
+    else
+        searchindex_free (task->index);
+
+    g_free (task->root);
+    g_free (task->filename);
+    filter_unref (task->filter);
+    g_free (task);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+static void
+build_worker (gpointer data, gpointer user_data)
+{
+    BuildTask *task = data;
+    Builder *b = builder_new ();
+
+    if (builder_add_dir (b, task->root, NO_PARENT, task->filter, task->generation)) {
+        task->index = builder_finish (b, task->root, task->filter->signature);
+        if (task->filename)
+            searchindex_save (task->index, task->filename);
+    }
+    else
+        builder_free (b);
+
+    g_idle_add (build_ready, task);
+}
+
+/* Index root in the background and save it to filename; a build that is
+ * still running is cancelled */
+void
+searchindex_build_async (const gchar *root, FbFilter *filter, const gchar *filename,
+                            SearchIndexReadyFunc func, gpointer user_data)
+{
+    if (! build_pool)
+        build_pool = g_thread_pool_new (build_worker, NULL, 1, FALSE, NULL);
+
+    BuildTask *task = g_new0 (BuildTask, 1);
+    task->root = g_strdup (root);
+    task->filter = filter_ref (filter);
+    task->filename = g_strdup (filename);
+    task->func = func;
+    task->user_data = user_data;
+    task->generation = g_atomic_int_add (&build_generation, 1) + 1;
+
+    g_thread_pool_push (build_pool, task, NULL);
+}
+
+void
+searchindex_cancel (void)
+{
+    g_atomic_int_inc (&build_generation);
+}
+
+void
+searchindex_shutdown (void)
+{
+    searchindex_cancel ();
+    if (build_pool)
+        g_thread_pool_free (build_pool, FALSE, TRUE);
+    if (fuzzy_pool)
+        g_thread_pool_free (fuzzy_pool, FALSE, TRUE);
+    build_pool = NULL;
+    fuzzy_pool = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef __SEARCHINDEX_H
+#define __SEARCHINDEX_H
+
+#include <glib.h>
+#include "filter.h"
+
+/* Filename index of everything below a root directory. Indices are
+ * immutable once built and only used from the main thread.
+ */
+typedef struct _SearchIndex SearchIndex;
+
+/* Called on the main thread with a new index, which is owned by the callee */
+typedef void (*SearchIndexReadyFunc) (SearchIndex *index, gpointer user_data);
+
+
+SearchIndex *
+searchindex_load (const gchar *filename);
+
+gboolean
+searchindex_save (const SearchIndex *index, const gchar *filename);
+
+void
+searchindex_free (SearchIndex *index);
+
+const gchar *
+searchindex_get_root (const SearchIndex *index);
+
+const gchar *
+searchindex_get_signature (const SearchIndex *index);
+
+guint
+searchindex_size (const SearchIndex *index);
+
+GPtrArray *
+searchindex_query (const SearchIndex *index, const gchar *query, guint limit);
+
+GPtrArray *
+searchindex_query_fuzzy (const SearchIndex *index, const gchar *query, guint limit);
+
+void
+searchindex_build_async (const gchar *root, FbFilter *filter, const gchar *filename,
+                            SearchIndexReadyFunc func, gpointer user_data);
+
+void
+searchindex_cancel (void);
+
+void
+searchindex_shutdown (void);
+
+#endif  /* __SEARCHINDEX_H */
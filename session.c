@@ -0,0 +1,236 @@
+/* SESSION FILE - compact binary snapshot of the tree state */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "session.h"
+#include "binio.h"
+
+
+/* File layout (all integers are unsigned LEB128 varints unless noted):
+ *     magic           8 bytes "DBFBSESS"
+ *     version         varint
+ *     root            string (varint length + bytes)
+ *     selected        string
+ *     scroll_anchor   string
+ *     count           varint, number of expanded rows
+ *     rows            count * (shared prefix length, suffix string),
+ *                     sorted so that neighbours share long prefixes
+ *     checksum        4 bytes little-endian FNV-1a over everything above
+ */
+#define SESSION_MAGIC           "DBFBSESS"
+#define SESSION_VERSION         1
+
+
+static void
+collect_path (const gchar *path, gpointer user_data)
+{
+    g_ptr_array_add (user_data, g_strdup (path));
+}
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+
+void
+session_state_clear (SessionState *state)
+{
+    g_free (state->root);
+    g_free (state->selected);
+    g_free (state->scroll_anchor);
+    state->root = NULL;
+    state->selected = NULL;
+    state->scroll_anchor = NULL;
+}
+
+/* Serialize state into a new byte array */
+GByteArray *
+session_encode (const SessionState *state)
+{
+    GByteArray *buf = g_byte_array_sized_new (4096);
+    g_byte_array_append (buf, (const guint8 *) SESSION_MAGIC, strlen (SESSION_MAGIC));
+    binio_put_varint (buf, SESSION_VERSION);
+
+    binio_put_string (buf, state->root, state->root ? strlen (state->root) : 0);
+    binio_put_string (buf, state->selected, state->selected ? strlen (state->selected) : 0);
+    binio_put_string (buf, state->scroll_anchor, state->scroll_anchor ? strlen (state->scroll_anchor) : 0);
+
+    GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+    pathtrie_foreach (state->expanded, collect_path, paths);
+    g_ptr_array_sort (paths, compare_paths);
+
+    binio_put_varint (buf, paths->len);
+    const gchar *prev = "";
+    for (guint i = 0; i < paths->len; i++) {
+        const gchar *path = g_ptr_array_index (paths, i);
+        gsize shared = 0;
+        while (prev[shared] && prev[shared] == path[shared])
+            shared++;
+        binio_put_varint (buf, shared);
+        binio_put_string (buf, path + shared, strlen (path + shared));
+        prev = path;
+    }
+    g_ptr_array_unref (paths);
+
+    binio_seal (buf);
+
+    return buf;
+}
+
+/* Parse serialized state; expanded rows are added to state->expanded */
+gboolean
+session_decode (const guint8 *data, gsize length, SessionState *state)
+{
+    BinReader r;
+    guint64 version, count;
+    if (! binio_open (&r, data, length, SESSION_MAGIC))
+        return FALSE;
+
+    if (! binio_get_varint (&r, &version) || version != SESSION_VERSION)
+        return FALSE;
+
+    session_state_clear (state);
+    if (! binio_get_string (&r, &state->root)
+            || ! binio_get_string (&r, &state->selected)
+            || ! binio_get_string (&r, &state->scroll_anchor)
+            || ! binio_get_varint (&r, &count)) {
+        session_state_clear (state);
+        return FALSE;
+    }
+
+    GString *path = g_string_sized_new (256);
+    gboolean ok = TRUE;
+    for (guint64 i = 0; i < count && ok; i++) {
+        guint64 shared, suffix_len;
+        ok = binio_get_varint (&r, &shared) && shared <= path->len
+            && binio_get_varint (&r, &suffix_len) && suffix_len <= r.length - r.pos;
+        if (ok) {
+            g_string_truncate (path, shared);
+            g_string_append_len (path, (const gchar *) r.data + r.pos, suffix_len);
+            r.pos += suffix_len;
+            if (state->expanded)
+                pathtrie_add (state->expanded, path->str);
+        }
+    }
+    g_string_free (path, TRUE);
+
+    if (! ok)
+        session_state_clear (state);
+    return ok;
+}
+
+gboolean
+session_load (const gchar *filename, SessionState *state)
+{
+    gchar *contents;
+    gsize length;
+    if (! g_file_get_contents (filename, &contents, &length, NULL))
+        return FALSE;
+
+    gboolean ok = session_decode ((const guint8 *) contents, length, state);
+    g_free (contents);
+    return ok;
+}
+
+
+/* Background writer: only the most recent snapshot is kept pending, and a
+ * generation counter makes sure an older snapshot never overwrites a newer one */
+static GMutex       writer_mutex;
+static GMutex       write_lock;
+static GByteArray * writer_pending          = NULL;
+static gchar *      writer_filename         = NULL;
+static guint64      writer_generation       = 0;
+static guint64      writer_pending_gen      = 0;
+static guint64      writer_written_gen      = 0;
+static gboolean     writer_running          = FALSE;
+
+static gboolean
+write_snapshot (const gchar *filename, GByteArray *buf, guint64 generation)
+{
+    gboolean ok = TRUE;
+
+    g_mutex_lock (&write_lock);
+    if (generation > writer_written_gen) {
+        GError *err = NULL;
+        /* g_file_set_contents writes to a temporary file and renames it */
+        ok = g_file_set_contents (filename, (const gchar *) buf->data, buf->len, &err);
+        if (! ok) {
+            fprintf (stderr, "Could not write session file %s: %s\n", filename, err->message);
+            g_error_free (err);
+        }
+        writer_written_gen = generation;
+    }
+    g_mutex_unlock (&write_lock);
+
+    return ok;
+}
+
+static gpointer
+writer_thread (gpointer data)
+{
+    for (;;) {
+        g_mutex_lock (&writer_mutex);
+        GByteArray *buf = writer_pending;
+        gchar *filename = writer_filename;
+        guint64 generation = writer_pending_gen;
+        writer_pending = NULL;
+        writer_filename = NULL;
+        if (! buf) {
+            writer_running = FALSE;
+            g_mutex_unlock (&writer_mutex);
+            break;
+        }
+        g_mutex_unlock (&writer_mutex);
+
+        write_snapshot (filename, buf, generation);
+        g_byte_array_unref (buf);
+        g_free (filename);
+    }
+    return NULL;
+}
+
+/* Write state synchronously, superseding any pending background write */
+gboolean
+session_save (const gchar *filename, const SessionState *state)
+{
+    GByteArray *buf = session_encode (state);
+
+    g_mutex_lock (&writer_mutex);
+    guint64 generation = ++writer_generation;
+    if (writer_pending) {
+        g_byte_array_unref (writer_pending);
+        g_free (writer_filename);
+        writer_pending = NULL;
+        writer_filename = NULL;
+    }
+    g_mutex_unlock (&writer_mutex);
+
+    gboolean ok = write_snapshot (filename, buf, generation);
+    g_byte_array_unref (buf);
+    return ok;
+}
+
+/* Encode state now and write it from a background thread */
+void
+session_save_async (const gchar *filename, const SessionState *state)
+{
+    GByteArray *buf = session_encode (state);
+
+    g_mutex_lock (&writer_mutex);
+    if (writer_pending) {
+        g_byte_array_unref (writer_pending);
+        g_free (writer_filename);
+    }
+    writer_pending = buf;
+    writer_filename = g_strdup (filename);
+    writer_pending_gen = ++writer_generation;
+
+    if (! writer_running) {
+        writer_running = TRUE;
+        g_thread_unref (g_thread_new ("fb-session", writer_thread, NULL));
+    }
+    g_mutex_unlock (&writer_mutex);
+}
@@ -0,0 +1,35 @@
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include <glib.h>
+#include "pathtrie.h"
+
+/* Tree state that is kept across sessions */
+typedef struct
+{
+    gchar       *root;              // root directory the state belongs to
+    gchar       *selected;          // path of the cursor row
+    gchar       *scroll_anchor;     // path of the topmost visible row
+    PathTrie    *expanded;          // expanded rows, not owned by the state
+} SessionState;
+
+
+void
+session_state_clear (SessionState *state);
+
+GByteArray *
+session_encode (const SessionState *state);
+
+gboolean
+session_decode (const guint8 *data, gsize length, SessionState *state);
+
+gboolean
+session_load (const gchar *filename, SessionState *state);
+
+gboolean
+session_save (const gchar *filename, const SessionState *state);
+
+void
+session_save_async (const gchar *filename, const SessionState *state);
+
+#endif  /* __SESSION_H */
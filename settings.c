@@ -0,0 +1,150 @@
+/* SETTINGS SNAPSHOTS - settings read together and compared key by key */
+
+#include <string.h>
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "settings.h"
+#include "filter.h"
+
+
+typedef struct
+{
+    gint            number;
+    gchar           *str;           // NULL for integer settings
+} ConfigValue;
+
+struct _ConfigSnapshot
+{
+    guint           version;
+    guint           n_values;
+    ConfigValue     values[];
+};
+
+
+/* Read all keys under the config lock, so a snapshot never mixes old and
+ * new values of a change that sets several keys */
+ConfigSnapshot *
+config_snapshot_read (DB_functions_t *api, const ConfigKey *keys, guint n_keys, guint version)
+{
+    g_return_val_if_fail (n_keys <= CONFIG_MAX_KEYS, NULL);
+
+    ConfigSnapshot *snapshot = g_malloc0 (sizeof (ConfigSnapshot) + n_keys * sizeof (ConfigValue));
+    snapshot->version = version;
+    snapshot->n_values = n_keys;
+
+    api->conf_lock ();
+    for (guint i = 0; i < n_keys; i++) {
+        if (keys[i].default_str)
+            snapshot->values[i].str = g_strdup (api->conf_get_str_fast (keys[i].key, keys[i].default_str));
+        else
+            snapshot->values[i].number = api->conf_get_int (keys[i].key, keys[i].default_int);
+    }
+    api->conf_unlock ();
+
+    return snapshot;
+}
+
+void
+config_snapshot_free (ConfigSnapshot *snapshot)
+{
+    if (! snapshot)
+        return;
+    for (guint i = 0; i < snapshot->n_values; i++)
+        g_free (snapshot->values[i].str);
+    g_free (snapshot);
+}
+
+guint
+config_snapshot_get_version (const ConfigSnapshot *snapshot)
+{
+    return snapshot->version;
+}
+
+gint
+config_snapshot_get_int (const ConfigSnapshot *snapshot, guint key)
+{
+    g_return_val_if_fail (key < snapshot->n_values, 0);
+    return snapshot->values[key].number;
+}
+
+const gchar *
+config_snapshot_get_str (const ConfigSnapshot *snapshot, guint key)
+{
+    g_return_val_if_fail (key < snapshot->n_values, NULL);
+    return snapshot->values[key].str;
+}
+
+/* Get bit mask of the keys whose values differ, snapshots must be read
+ * with the same keys */
+guint64
+config_snapshot_diff (const ConfigSnapshot *a, const ConfigSnapshot *b)
+{
+    g_return_val_if_fail (a->n_values == b->n_values, ~G_GUINT64_CONSTANT (0));
+
+    guint64 changed = 0;
+    for (guint i = 0; i < a->n_values; i++) {
+        if (a->values[i].number != b->values[i].number
+                    || g_strcmp0 (a->values[i].str, b->values[i].str) != 0)
+            changed |= CONFIG_KEY_BIT (i);
+    }
+    return changed;
+}
+
+/* Build view settings, takes a reference to filter; coverart is a list of
+ * file names separated by ';' */
+ViewConfig *
+view_config_new (guint version, FbFilter *filter, gboolean show_icons, const gchar *coverart,
+                            gint coverart_size, gint icon_size)
+{
+    ViewConfig *config = g_new0 (ViewConfig, 1);
+    config->ref_count = 1;
+    config->version = version;
+    config->filter = filter_ref (filter);
+    config->show_icons = show_icons;
+    config->coverart_size = coverart_size;
+    config->icon_size = icon_size;
+
+    /* Split once here instead of for every folder icon */
+    gchar **split = g_strsplit (coverart ? coverart : "", ";", 0);
+    GPtrArray *names = g_ptr_array_new ();
+    for (gint i = 0; split[i]; i++) {
+        if (*split[i])
+            g_ptr_array_add (names, g_strdup (split[i]));
+    }
+    g_ptr_array_add (names, NULL);
+    config->coverart = (gchar **) g_ptr_array_free (names, FALSE);
+    g_strfreev (split);
+
+    return config;
+}
+
+ViewConfig *
+view_config_ref (ViewConfig *config)
+{
+    if (config)
+        g_atomic_int_inc (&config->ref_count);
+    return config;
+}
+
+void
+view_config_unref (ViewConfig *config)
+{
+    if (! config || ! g_atomic_int_dec_and_test (&config->ref_count))
+        return;
+
+    filter_unref (config->filter);
+    g_strfreev (config->coverart);
+    g_free (config);
+}
+
+/* Replace the current settings with config, taking over its reference.
+ * Must be called from the thread that owns *current; readers elsewhere
+ * hold their own reference, so the old version is freed once the last of
+ * them is done with it. */
+void
+view_config_publish (ViewConfig **current, ViewConfig *config)
+{
+    ViewConfig *old = g_atomic_pointer_get (current);
+    g_atomic_pointer_set (current, config);
+    view_config_unref (old);
+}
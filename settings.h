@@ -0,0 +1,74 @@
+#ifndef __SETTINGS_H
+#define __SETTINGS_H
+
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "filter.h"
+
+/* Settings of the plugin, read together from the player's config. A
+ * snapshot is never modified once it was read; it is compared with the
+ * previous one key by key, so a config change event that didn't touch any
+ * of these keys costs a few lookups and nothing else.
+ */
+typedef struct _ConfigSnapshot ConfigSnapshot;
+
+typedef struct
+{
+    const gchar     *key;
+    const gchar     *default_str;   // NULL for integer settings
+    gint            default_int;
+} ConfigKey;
+
+/* Settings that decide which files are shown and how they look, taken
+ * from a snapshot on the main thread. Like the filter it carries, it is
+ * never modified once built; a worker is given its own reference with
+ * its job and keeps using that version while newer ones are published.
+ */
+typedef struct
+{
+    guint           version;        // of the snapshot it was built from
+    FbFilter        *filter;        // also has the hidden files flag
+    gboolean        show_icons;
+    gchar           **coverart;     // names of cover images in order of preference
+    gint            coverart_size;
+    gint            icon_size;
+    gint            ref_count;
+} ViewConfig;
+
+/* At most this many keys, changed keys are returned as a bit mask */
+#define CONFIG_MAX_KEYS         64
+#define CONFIG_KEY_BIT(k)       (G_GUINT64_CONSTANT (1) << (k))
+
+
+ConfigSnapshot *
+config_snapshot_read (DB_functions_t *api, const ConfigKey *keys, guint n_keys, guint version);
+
+void
+config_snapshot_free (ConfigSnapshot *snapshot);
+
+guint
+config_snapshot_get_version (const ConfigSnapshot *snapshot);
+
+gint
+config_snapshot_get_int (const ConfigSnapshot *snapshot, guint key);
+
+const gchar *
+config_snapshot_get_str (const ConfigSnapshot *snapshot, guint key);
+
+guint64
+config_snapshot_diff (const ConfigSnapshot *a, const ConfigSnapshot *b);
+
+ViewConfig *
+view_config_new (guint version, FbFilter *filter, gboolean show_icons, const gchar *coverart,
+                            gint coverart_size, gint icon_size);
+
+ViewConfig *
+view_config_ref (ViewConfig *config);
+
+void
+view_config_unref (ViewConfig *config);
+
+void
+view_config_publish (ViewConfig **current, ViewConfig *config);
+
+#endif  /* __SETTINGS_H */
@@ -0,0 +1,137 @@
+/* SMART FOLDERS - saved tag queries with their results kept up to date */
+
+#include <string.h>
+#include <glib.h>
+#include "smartfolder.h"
+#include "tagquery.h"
+
+
+struct _SmartFolder
+{
+    gchar           *text;
+    TagQuery        *query;
+    GTree           *files;         // sorted paths of matching files
+};
+
+typedef struct
+{
+    GFunc           func;
+    gpointer        user_data;
+} ForeachData;
+
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    return strcmp (a, b);
+}
+
+/* Parse query text, returns NULL and sets error if it is invalid */
+SmartFolder *
+smartfolder_new (const gchar *text, gchar **error)
+{
+    TagQuery *query = tagquery_parse (text, error);
+    if (! query)
+        return NULL;
+
+    SmartFolder *folder = g_new0 (SmartFolder, 1);
+    folder->text = g_strdup (text);
+    folder->query = query;
+    folder->files = g_tree_new_full (compare_paths, NULL, g_free, NULL);
+    return folder;
+}
+
+void
+smartfolder_free (SmartFolder *folder)
+{
+    if (! folder)
+        return;
+    g_tree_destroy (folder->files);
+    tagquery_free (folder->query);
+    g_free (folder->text);
+    g_free (folder);
+}
+
+const gchar *
+smartfolder_get_text (const SmartFolder *folder)
+{
+    return folder->text;
+}
+
+guint
+smartfolder_size (const SmartFolder *folder)
+{
+    return g_tree_nnodes (folder->files);
+}
+
+/* Run the query on all tracks of store */
+void
+smartfolder_reset (SmartFolder *folder, const TagStore *store)
+{
+    g_tree_destroy (folder->files);
+    folder->files = g_tree_new_full (compare_paths, NULL, g_free, NULL);
+    if (! store)
+        return;
+
+    GArray *tracks = tagquery_run (folder->query, store);
+    for (guint i = 0; i < tracks->len; i++) {
+        const gchar *path = tagstore_get_path (store, g_array_index (tracks, guint32, i));
+        if (! g_tree_lookup_extended (folder->files, path, NULL, NULL))
+            g_tree_insert (folder->files, g_strdup (path), NULL);
+    }
+    g_array_free (tracks, TRUE);
+}
+
+/* Apply changes found by a tag scan: files of the read tracks are checked
+ * again, removed files are dropped. Returns TRUE if the folder changed. */
+gboolean
+smartfolder_update (SmartFolder *folder, const TagStore *store, const GArray *read,
+                            const GPtrArray *removed)
+{
+    gboolean changed = FALSE;
+
+    for (guint i = 0; removed && i < removed->len; i++)
+        changed |= g_tree_remove (folder->files, g_ptr_array_index (removed, i));
+
+    /* Tracks of a file are read together, the file matches if any of them does */
+    const gchar *file = NULL;
+    gboolean was_member = FALSE, is_member = FALSE;
+    for (guint i = 0; read && i <= read->len; i++) {
+        guint32 track = (i < read->len) ? g_array_index (read, guint32, i) : 0;
+        const gchar *path = (i < read->len) ? tagstore_get_path (store, track) : NULL;
+
+        if (! file || ! path || strcmp (path, file) != 0) {
+            if (file && is_member && ! was_member)
+                g_tree_insert (folder->files, g_strdup (file), NULL);
+            else if (file && was_member && ! is_member)
+                g_tree_remove (folder->files, file);
+            changed |= file && (is_member != was_member);
+
+            if (! path)
+                break;
+            file = path;
+            was_member = g_tree_lookup_extended (folder->files, file, NULL, NULL);
+            is_member = FALSE;
+        }
+        if (! is_member)
+            is_member = tagquery_match (folder->query, store, track);
+    }
+
+    return changed;
+}
+
+static gboolean
+foreach_file (gpointer key, gpointer value, gpointer data)
+{
+    ForeachData *foreach = data;
+    foreach->func (key, foreach->user_data);
+    return FALSE;
+}
+
+/* Call func with each matching path, in sorted order */
+void
+smartfolder_foreach (const SmartFolder *folder, GFunc func, gpointer user_data)
+{
+    ForeachData data = { func, user_data };
+    g_tree_foreach (folder->files, foreach_file, &data);
+}
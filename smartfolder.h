@@ -0,0 +1,36 @@
+#ifndef __SMARTFOLDER_H
+#define __SMARTFOLDER_H
+
+#include <glib.h>
+#include "tagstore.h"
+
+/* Saved tag query shown as a folder. The matching files are kept sorted
+ * and updated with the changes found by tag scans, so showing a folder
+ * doesn't run its query again.
+ */
+typedef struct _SmartFolder SmartFolder;
+
+
+SmartFolder *
+smartfolder_new (const gchar *text, gchar **error);
+
+void
+smartfolder_free (SmartFolder *folder);
+
+const gchar *
+smartfolder_get_text (const SmartFolder *folder);
+
+guint
+smartfolder_size (const SmartFolder *folder);
+
+void
+smartfolder_reset (SmartFolder *folder, const TagStore *store);
+
+gboolean
+smartfolder_update (SmartFolder *folder, const TagStore *store, const GArray *read,
+                            const GPtrArray *removed);
+
+void
+smartfolder_foreach (const SmartFolder *folder, GFunc func, gpointer user_data);
+
+#endif  /* __SMARTFOLDER_H */
@@ -0,0 +1,568 @@
+/* TAG QUERIES - filter the tag store with field predicates */
+
+#include <string.h>
+#include <glib.h>
+#include "tagquery.h"
+
+
+/* Queries over more tracks or strings than this are split across threads,
+ * must be a multiple of 64 so chunks cover whole bitmap words */
+#define QUERY_CHUNK_SIZE        65536
+
+typedef enum
+{
+    PREDICATE_TEXT,                 // substring of a string field
+    PREDICATE_EXACT,                // whole string field
+    PREDICATE_RANGE,                // numeric field within [min, max]
+    PREDICATE_FORMAT                // file extension
+} PredicateKind;
+
+typedef struct
+{
+    PredicateKind   kind;
+    gboolean        negate;
+    guint           fields;         // text predicates: bit for each TagField searched
+    gchar           *text;          // lowercase
+    TagField        field;          // range predicates: value is (field >> shift) & mask
+    guint           shift;
+    guint32         mask;
+    guint32         min;
+    guint32         max;
+    gboolean        empty;          // range no value is in, e.g. track<0
+} Predicate;
+
+struct _TagQuery
+{
+    GArray          *predicates;
+    gboolean        structured;     // uses fields, not just words
+};
+
+typedef struct
+{
+    const gchar     *name;
+    PredicateKind   kind;
+    TagField        field;
+    guint           shift;
+    guint32         mask;
+} QueryField;
+
+static const QueryField query_fields[] = {
+    { "artist",         PREDICATE_TEXT,     TAG_FIELD_ARTIST,       0,  0 },
+    { "albumartist",    PREDICATE_TEXT,     TAG_FIELD_ALBUM_ARTIST, 0,  0 },
+    { "album",          PREDICATE_TEXT,     TAG_FIELD_ALBUM,        0,  0 },
+    { "title",          PREDICATE_TEXT,     TAG_FIELD_TITLE,        0,  0 },
+    { "genre",          PREDICATE_TEXT,     TAG_FIELD_GENRE,        0,  0 },
+    { "year",           PREDICATE_RANGE,    TAG_FIELD_YEAR,         0,  G_MAXUINT32 },
+    { "track",          PREDICATE_RANGE,    TAG_FIELD_NUMBER,       0,  0xffff },
+    { "disc",           PREDICATE_RANGE,    TAG_FIELD_NUMBER,       16, 0xffff },
+    { "duration",       PREDICATE_RANGE,    TAG_FIELD_DURATION,     0,  G_MAXUINT32 },
+    { "length",         PREDICATE_RANGE,    TAG_FIELD_DURATION,     0,  G_MAXUINT32 },
+    { "format",         PREDICATE_FORMAT,   0,                      0,  0 },
+    { "ext",            PREDICATE_FORMAT,   0,                      0,  0 },
+};
+
+#define WORD_FIELDS     (1 << TAG_FIELD_TITLE | 1 << TAG_FIELD_ARTIST \
+                            | 1 << TAG_FIELD_ALBUM_ARTIST | 1 << TAG_FIELD_ALBUM)
+
+typedef void (*QueryChunkFunc) (gpointer data, guint32 start, guint32 end);
+
+typedef struct
+{
+    QueryChunkFunc  func;
+    gpointer        data;
+    guint32         start;
+    guint32         end;
+    gint            *pending;
+    GMutex          *mutex;
+    GCond           *cond;
+} QueryTask;
+
+typedef struct
+{
+    const TagQuery  *query;
+    const TagStore  *store;
+    guint8          **matches;      // per text predicate: string id -> matches
+    guint64         *selection;     // bit per track
+} QueryRun;
+
+static GThreadPool *    query_pool          = NULL;
+
+
+static void
+predicate_clear (Predicate *p)
+{
+    g_free (p->text);
+}
+
+/* Split text into terms; double quotes group words, e.g. artist:"miles davis" */
+static GPtrArray *
+query_tokenize (const gchar *text)
+{
+    GPtrArray *terms = g_ptr_array_new_with_free_func (g_free);
+    const gchar *p = text;
+
+    while (*p) {
+        while (g_ascii_isspace (*p))
+            p++;
+        if (! *p)
+            break;
+
+        GString *term = g_string_new (NULL);
+        gboolean quoted = FALSE;
+        for (; *p && (quoted || ! g_ascii_isspace (*p)); p++) {
+            if (*p == '"')
+                quoted = ! quoted;
+            else
+                g_string_append_c (term, *p);
+        }
+        g_ptr_array_add (terms, g_string_free (term, FALSE));
+    }
+    return terms;
+}
+
+/* Parse a duration like "20m", "1h30m", "90s", "3:30" or "90" (seconds)
+ * into milliseconds */
+static gboolean
+parse_duration (const gchar *str, guint32 *value)
+{
+    guint64 total = 0, number = 0;
+    gboolean digits = FALSE;
+
+    for (const gchar *p = str; *p; p++) {
+        if (g_ascii_isdigit (*p)) {
+            number = number * 10 + (*p - '0');
+            digits = TRUE;
+            if (number > G_MAXUINT32)
+                return FALSE;
+            continue;
+        }
+        if (! digits)
+            return FALSE;
+        switch (g_ascii_tolower (*p)) {
+            case 'h':   total += number * 3600; break;
+            case 'm':   total += number * 60;   break;
+            case 's':   total += number;        break;
+            case ':':   total = (total + number) * 60; break;
+            default:    return FALSE;
+        }
+        number = 0;
+        digits = FALSE;
+    }
+
+    total = (total + number) * 1000;
+    if (total > G_MAXUINT32)
+        return FALSE;
+    *value = total;
+    return TRUE;
+}
+
+static gboolean
+parse_number (const QueryField *field, const gchar *str, guint32 *value)
+{
+    if (field->field == TAG_FIELD_DURATION)
+        return parse_duration (str, value);
+
+    gchar *end;
+    guint64 number = g_ascii_strtoull (str, &end, 10);
+    if (end == str || *end || number > field->mask)
+        return FALSE;
+    *value = number;
+    return TRUE;
+}
+
+/* Parse the value of a numeric field given with operator op: "a..b", "a..",
+ * "..b" or "a" after ':' or '=', a single number after '<', '<=', '>' and '>=' */
+static gboolean
+parse_range (const QueryField *field, const gchar *op, const gchar *value, Predicate *p)
+{
+    p->min = 0;
+    p->max = field->mask;
+
+    if (*op == ':' || *op == '=') {
+        const gchar *dots = strstr (value, "..");
+        if (! dots) {
+            if (! parse_number (field, value, &p->min))
+                return FALSE;
+            p->max = p->min;
+            return TRUE;
+        }
+
+        gchar *from = g_strndup (value, dots - value);
+        gboolean ok = (! *from || parse_number (field, from, &p->min))
+                    && (! dots[2] || parse_number (field, dots + 2, &p->max));
+        g_free (from);
+        p->empty = (p->min > p->max);  // reversed range
+        return ok;
+    }
+
+    guint32 number;
+    if (! parse_number (field, value, &number))
+        return FALSE;
+
+    gboolean inclusive = (op[1] == '=');
+    if (*op == '>') {
+        if (! inclusive && number == field->mask)
+            p->empty = TRUE;  // nothing is greater
+        else
+            p->min = inclusive ? number : number + 1;
+    }
+    else {
+        if (! inclusive && number == 0)
+            p->empty = TRUE;  // nothing is smaller
+        else
+            p->max = inclusive ? number : number - 1;
+    }
+    return TRUE;
+}
+
+static const QueryField *
+find_field (const gchar *name, gsize length)
+{
+    for (guint i = 0; i < G_N_ELEMENTS (query_fields); i++)
+        if (strlen (query_fields[i].name) == length
+                    && g_ascii_strncasecmp (query_fields[i].name, name, length) == 0)
+            return &query_fields[i];
+    return NULL;
+}
+
+/* Parse a single term into p; terms that don't start with a known field
+ * name are searched as words */
+static gboolean
+parse_term (TagQuery *query, const gchar *term, Predicate *p, gchar **error)
+{
+    memset (p, 0, sizeof (Predicate));
+    if (term[0] == '-' && term[1]) {
+        p->negate = TRUE;
+        term++;
+    }
+
+    gsize name_length = strcspn (term, ":=<>");
+    const QueryField *field = term[name_length] ? find_field (term, name_length) : NULL;
+    if (! field) {
+        p->kind = PREDICATE_TEXT;
+        p->fields = WORD_FIELDS;
+        p->text = g_utf8_casefold (term, -1);
+        return TRUE;
+    }
+
+    query->structured = TRUE;
+    const gchar *op = term + name_length;
+    const gchar *value = op + ((op[1] == '=') ? 2 : 1);
+
+    p->kind = field->kind;
+    p->field = field->field;
+    p->shift = field->shift;
+    p->mask = field->mask;
+
+    switch (field->kind) {
+        case PREDICATE_TEXT:
+        case PREDICATE_FORMAT:
+            if (*op != ':' && *op != '=')
+                break;
+            if (*op == '=' && field->kind == PREDICATE_TEXT)
+                p->kind = PREDICATE_EXACT;
+            p->fields = 1 << field->field;
+            p->text = g_utf8_casefold (value[0] == '.' ? value + 1 : value, -1);
+            return TRUE;
+
+        case PREDICATE_RANGE:
+        case PREDICATE_EXACT:
+            if (parse_range (field, op, value, p))
+                return TRUE;
+            break;
+    }
+
+    *error = g_strdup_printf ("invalid value for %s: %s", field->name, value);
+    return FALSE;
+}
+
+/* Parse text, returns NULL and sets error if a field has an invalid value */
+TagQuery *
+tagquery_parse (const gchar *text, gchar **error)
+{
+    TagQuery *query = g_new0 (TagQuery, 1);
+    query->predicates = g_array_new (FALSE, FALSE, sizeof (Predicate));
+    g_array_set_clear_func (query->predicates, (GDestroyNotify) predicate_clear);
+
+    GPtrArray *terms = query_tokenize (text);
+    for (guint i = 0; i < terms->len; i++) {
+        Predicate p;
+        if (! parse_term (query, g_ptr_array_index (terms, i), &p, error)) {
+            tagquery_free (query);
+            query = NULL;
+            break;
+        }
+        if (p.kind == PREDICATE_TEXT && ! *p.text)
+            predicate_clear (&p);  // e.g. a lone "-"
+        else
+            g_array_append_val (query->predicates, p);
+    }
+    g_ptr_array_unref (terms);
+
+    return query;
+}
+
+void
+tagquery_free (TagQuery *query)
+{
+    if (! query)
+        return;
+    g_array_free (query->predicates, TRUE);
+    g_free (query);
+}
+
+gboolean
+tagquery_is_structured (const TagQuery *query)
+{
+    return query->structured;
+}
+
+
+static void
+query_worker (gpointer data, gpointer user_data)
+{
+    QueryTask *task = data;
+    task->func (task->data, task->start, task->end);
+
+    g_mutex_lock (task->mutex);
+    if (--(*task->pending) == 0)
+        g_cond_signal (task->cond);
+    g_mutex_unlock (task->mutex);
+}
+
+/* Call func for chunks of [0, n) in parallel, the calling thread takes the
+ * first chunk. Chunk boundaries are multiples of 64. */
+static void
+query_parallel (QueryChunkFunc func, gpointer data, guint32 n)
+{
+    guint n_chunks = MIN ((n + QUERY_CHUNK_SIZE - 1) / QUERY_CHUNK_SIZE,
+                            (guint) g_get_num_processors ());
+    n_chunks = MAX (n_chunks, 1);
+    guint32 chunk_size = ((n + n_chunks - 1) / n_chunks + 63) & ~63u;
+
+    GMutex mutex;
+    GCond cond;
+    gint pending = n_chunks - 1;
+    g_mutex_init (&mutex);
+    g_cond_init (&cond);
+
+    if (n_chunks > 1 && ! query_pool)
+        query_pool = g_thread_pool_new (query_worker, NULL, g_get_num_processors () - 1, FALSE, NULL);
+
+    QueryTask *tasks = g_new0 (QueryTask, n_chunks);
+    for (guint c = 0; c < n_chunks; c++) {
+        QueryTask *task = &tasks[c];
+        task->func = func;
+        task->data = data;
+        task->start = MIN (c * chunk_size, n);
+        task->end = MIN (task->start + chunk_size, n);
+        task->pending = &pending;
+        task->mutex = &mutex;
+        task->cond = &cond;
+        if (c > 0)
+            g_thread_pool_push (query_pool, task, NULL);
+    }
+    func (data, tasks[0].start, tasks[0].end);
+
+    g_mutex_lock (&mutex);
+    while (pending > 0)
+        g_cond_wait (&cond, &mutex);
+    g_mutex_unlock (&mutex);
+
+    g_free (tasks);
+    g_mutex_clear (&mutex);
+    g_cond_clear (&cond);
+}
+
+/* Evaluate the text predicates once for each distinct string */
+static void
+match_strings (gpointer data, guint32 start, guint32 end)
+{
+    QueryRun *run = data;
+    for (guint i = 0; i < run->query->predicates->len; i++) {
+        const Predicate *p = &g_array_index (run->query->predicates, Predicate, i);
+        guint8 *matches = run->matches[i];
+        if (p->kind == PREDICATE_TEXT) {
+            for (guint32 id = start; id < end; id++)
+                matches[id] = strstr (tagstore_get_folded (run->store, id), p->text) != NULL;
+        }
+        else if (p->kind == PREDICATE_EXACT) {
+            for (guint32 id = start; id < end; id++)
+                matches[id] = strcmp (tagstore_get_folded (run->store, id), p->text) == 0;
+        }
+    }
+}
+
+/* Selection bits of the tracks in [start, start + 64) whose field matches */
+static guint64
+select_strings (const guint32 *column, const guint8 *matches, guint32 start, guint32 end)
+{
+    guint64 word = 0;
+    for (guint32 i = start; i < end; i++)
+        word |= (guint64) matches[column[i]] << (i - start);
+    return word;
+}
+
+static guint64
+select_range (const guint32 *column, const Predicate *p, guint32 start, guint32 end)
+{
+    guint64 word = 0;
+    guint32 width = p->max - p->min;
+    for (guint32 i = start; i < end; i++) {
+        guint32 value = (column[i] >> p->shift) & p->mask;
+        word |= (guint64) (value - p->min <= width) << (i - start);
+    }
+    return word;
+}
+
+static gboolean
+match_format (const gchar *path, const gchar *format)
+{
+    const gchar *dot = strrchr (path, '.');
+    return dot && ! strchr (dot, G_DIR_SEPARATOR) && g_ascii_strcasecmp (dot + 1, format) == 0;
+}
+
+/* Evaluate all predicates on the tracks of one chunk, one column at a time.
+ * Each predicate narrows the selection bitmap; words without any selected
+ * track are skipped. */
+static void
+select_tracks (gpointer data, guint32 start, guint32 end)
+{
+    QueryRun *run = data;
+    guint64 *selection = run->selection;
+    guint32 first_word = start / 64, last_word = (end + 63) / 64;
+
+    for (guint32 w = first_word; w < last_word; w++) {
+        guint32 bits = MIN (end - w * 64, 64);
+        selection[w] = (bits == 64) ? G_MAXUINT64 : (G_GUINT64_CONSTANT (1) << bits) - 1;
+    }
+
+    for (guint i = 0; i < run->query->predicates->len; i++) {
+        const Predicate *p = &g_array_index (run->query->predicates, Predicate, i);
+        const guint32 *column = (p->kind == PREDICATE_FORMAT) ? NULL
+                    : tagstore_get_column (run->store, p->field);
+
+        for (guint32 w = first_word; w < last_word; w++) {
+            guint64 selected = selection[w];
+            if (! selected)
+                continue;
+
+            guint32 word_start = w * 64, word_end = MIN (word_start + 64, end);
+            guint64 word = 0;
+            switch (p->kind) {
+                case PREDICATE_TEXT:
+                case PREDICATE_EXACT:
+                    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+                        if (p->fields & (1 << f))
+                            word |= select_strings (tagstore_get_column (run->store, f),
+                                            run->matches[i], word_start, word_end);
+                    break;
+
+                case PREDICATE_RANGE:
+                    if (! p->empty)
+                        word = select_range (column, p, word_start, word_end);
+                    break;
+
+                case PREDICATE_FORMAT:
+                    for (guint64 bits = selected; bits; bits &= bits - 1) {
+                        guint32 track = word_start + __builtin_ctzll (bits);
+                        if (match_format (tagstore_get_path (run->store, track), p->text))
+                            word |= G_GUINT64_CONSTANT (1) << (track - word_start);
+                    }
+                    break;
+            }
+            selection[w] = p->negate ? selected & ~word : selected & word;
+        }
+    }
+}
+
+static gboolean
+predicate_match (const Predicate *p, const TagStore *store, guint32 track)
+{
+    switch (p->kind) {
+        case PREDICATE_TEXT:
+        case PREDICATE_EXACT:
+            for (guint f = 0; f < TAG_N_STRING_FIELDS; f++) {
+                if (! (p->fields & (1 << f)))
+                    continue;
+                const gchar *folded = tagstore_get_folded (store, tagstore_get (store, f, track));
+                if (p->kind == PREDICATE_TEXT ? strstr (folded, p->text) != NULL
+                                              : strcmp (folded, p->text) == 0)
+                    return TRUE;
+            }
+            return FALSE;
+
+        case PREDICATE_RANGE:
+            return ! p->empty && ((tagstore_get (store, p->field, track) >> p->shift) & p->mask) - p->min
+                        <= p->max - p->min;
+
+        case PREDICATE_FORMAT:
+            return match_format (tagstore_get_path (store, track), p->text);
+    }
+    return FALSE;
+}
+
+/* Check a single track, for queries over a few tracks only */
+gboolean
+tagquery_match (const TagQuery *query, const TagStore *store, guint32 track)
+{
+    for (guint i = 0; i < query->predicates->len; i++) {
+        const Predicate *p = &g_array_index (query->predicates, Predicate, i);
+        if (predicate_match (p, store, track) == p->negate)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Find tracks matching query. Returns their numbers in store order. */
+GArray *
+tagquery_run (const TagQuery *query, const TagStore *store)
+{
+    GArray *result = g_array_new (FALSE, FALSE, sizeof (guint32));
+    guint32 n = tagstore_size (store);
+    if (n == 0)
+        return result;
+
+    QueryRun run;
+    run.query = query;
+    run.store = store;
+    run.matches = g_new0 (guint8 *, MAX (query->predicates->len, 1));
+    run.selection = g_new (guint64, (n + 63) / 64);
+
+    gboolean has_text = FALSE;
+    for (guint i = 0; i < query->predicates->len; i++) {
+        const Predicate *p = &g_array_index (query->predicates, Predicate, i);
+        if (p->kind == PREDICATE_TEXT || p->kind == PREDICATE_EXACT) {
+            run.matches[i] = g_new (guint8, tagstore_n_strings (store));
+            has_text = TRUE;
+        }
+    }
+
+    if (has_text) {
+        tagstore_get_folded (store, 0);  // build lowercase strings before going parallel
+        query_parallel (match_strings, &run, tagstore_n_strings (store));
+    }
+    query_parallel (select_tracks, &run, n);
+
+    for (guint32 w = 0; w < (n + 63) / 64; w++) {
+        for (guint64 bits = run.selection[w]; bits; bits &= bits - 1) {
+            guint32 track = w * 64 + __builtin_ctzll (bits);
+            g_array_append_val (result, track);
+        }
+    }
+
+    for (guint i = 0; i < query->predicates->len; i++)
+        g_free (run.matches[i]);
+    g_free (run.matches);
+    g_free (run.selection);
+
+    return result;
+}
+
+void
+tagquery_shutdown (void)
+{
+    if (query_pool)
+        g_thread_pool_free (query_pool, FALSE, TRUE);
+    query_pool = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef __TAGQUERY_H
+#define __TAGQUERY_H
+
+#include <glib.h>
+#include "tagstore.h"
+
+/* Parsed query over the tag store, e.g.
+ *     genre:jazz year:1955..1965 format:flac duration>20m -artist:"miles davis"
+ * Terms are combined with AND, a leading "-" negates a term. Words without
+ * a field match title, artist, album artist or album.
+ */
+typedef struct _TagQuery TagQuery;
+
+
+TagQuery *
+tagquery_parse (const gchar *text, gchar **error);
+
+void
+tagquery_free (TagQuery *query);
+
+gboolean
+tagquery_is_structured (const TagQuery *query);
+
+GArray *
+tagquery_run (const TagQuery *query, const TagStore *store);
+
+gboolean
+tagquery_match (const TagQuery *query, const TagStore *store, guint32 track);
+
+void
+tagquery_shutdown (void);
+
+#endif  /* __TAGQUERY_H */
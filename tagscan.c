@@ -0,0 +1,462 @@
+/* TAG SCANNER - read the tags of all tracks below the root in the background */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "tagscan.h"
+#include "listing.h"
+#include "dirstate.h"
+#include "metacache.h"
+
+
+/* Minimum time between two partial results */
+#define TAGSCAN_PUBLISH_US      5000000
+
+/* Private playlists that are not shown to the user were added with API 1.9 */
+#if (DDB_API_LEVEL >= 9)
+#define TAGSCAN_SUPPORTED
+#endif
+
+
+typedef struct
+{
+    gchar               *root;
+    FbFilter            *filter;
+    TagStore            *previous;      // tracks of files that didn't change are copied
+    gchar               *filename;
+    gchar               *dirs_filename; // directory state of the last scan
+    TagScanReadyFunc    func;
+    gpointer            user_data;
+    gint                generation;
+    int                 abort;          // also stops decoders reading a file
+} ScanTask;
+
+typedef struct
+{
+    TagStore            *store;
+    GArray              *read;
+    GPtrArray           *removed;
+    gboolean            finished;
+    gint                generation;
+    TagScanReadyFunc    func;
+    gpointer            user_data;
+} ScanResult;
+
+static DB_functions_t *     deadbeef            = NULL;
+static GThreadPool *        scan_pool           = NULL;
+static gint                 scan_generation     = 0;
+static GMutex               scan_mutex;
+static ScanTask *           scan_running        = NULL;
+
+
+#ifdef TAGSCAN_SUPPORTED
+static void
+task_free (ScanTask *task)
+{
+    g_free (task->root);
+    g_free (task->filename);
+    g_free (task->dirs_filename);
+    filter_unref (task->filter);
+    tagstore_unref (task->previous);
+    g_free (task);
+}
+
+typedef struct
+{
+    ScanTask            *task;
+    TagStoreBuilder     *builder;
+    GHashTable          *previous;      // path -> first track in task->previous + 1, until seen
+    GHashTable          *visited;
+    DirState            *dirs;          // directories of the last scan, NULL to list all
+    DirState            *new_dirs;
+    time_t              start;
+    ddb_playlist_t      *scratch;
+    GArray              *read;          // tracks read since the last result
+    gboolean            modified;       // result differs from the previous store
+    gint64              last_publish;
+} Scanner;
+
+static gboolean
+scan_cancelled (const ScanTask *task)
+{
+    return g_atomic_int_get (&task->abort)
+        || g_atomic_int_get (&scan_generation) != task->generation;
+}
+
+static gboolean
+scan_ready (gpointer data)
+{
+    ScanResult *result = data;
+
+    if (result->generation == g_atomic_int_get (&scan_generation))
+        result->func (result->store, result->read, result->removed, result->finished, result->user_data);
+    else
+        tagstore_unref (result->store);
+    g_array_free (result->read, TRUE);
+    g_ptr_array_unref (result->removed);
+    g_free (result);
+
+    /* This function MUST return false because it's called from g_idle_add() */
+    return FALSE;
+}
+
+static void
+scan_publish (Scanner *s, TagStore *store, GPtrArray *removed, gboolean finished)
+{
+    tagstore_get_recent (store, NULL);  // build it here rather than on the main thread
+
+    ScanResult *result = g_new (ScanResult, 1);
+    result->store = store;
+    result->read = s->read;
+    result->removed = removed ? removed : g_ptr_array_new ();
+    result->finished = finished;
+    result->generation = s->task->generation;
+    result->func = s->task->func;
+    result->user_data = s->task->user_data;
+    g_idle_add (scan_ready, result);
+
+    s->read = g_array_new (FALSE, FALSE, sizeof (guint32));
+    s->last_publish = g_get_monotonic_time ();
+}
+
+/* First value of a tag, multiple values are separated by newlines */
+static gchar *
+scan_meta (DB_playItem_t *it, const gchar *key)
+{
+    const gchar *value = deadbeef->pl_find_meta (it, key);
+    if (! value)
+        return NULL;
+    const gchar *end = strchr (value, '\n');
+    return end ? g_strndup (value, end - value) : g_strdup (value);
+}
+
+static guint32
+scan_number (DB_playItem_t *it, const gchar *key, guint32 max)
+{
+    const gchar *value = deadbeef->pl_find_meta (it, key);
+    gint number = value ? atoi (value) : 0;
+    return CLAMP (number, 0, (gint) max);
+}
+
+/* Add tags of a track read from path, pl_lock must be held */
+static void
+scan_add_item (Scanner *s, DB_playItem_t *it, const gchar *path, const struct stat *file_stat)
+{
+    TagRecord record;
+    gchar *strings[TAG_N_STRING_FIELDS];
+
+    strings[TAG_FIELD_ALBUM_ARTIST] = scan_meta (it, "album artist");
+    if (! strings[TAG_FIELD_ALBUM_ARTIST])
+        strings[TAG_FIELD_ALBUM_ARTIST] = scan_meta (it, "band");
+    strings[TAG_FIELD_ALBUM]    = scan_meta (it, "album");
+    strings[TAG_FIELD_ARTIST]   = scan_meta (it, "artist");
+    strings[TAG_FIELD_TITLE]    = scan_meta (it, "title");
+    strings[TAG_FIELD_GENRE]    = scan_meta (it, "genre");
+
+    record.path = path;
+    record.mtime = file_stat->st_mtime;
+    record.size = file_stat->st_size;
+    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+        record.strings[f] = strings[f];
+    record.year = scan_number (it, "year", 9999);
+    record.number = scan_number (it, "disc", 0xffff) << 16 | scan_number (it, "track", 0xffff);
+    record.duration = MAX (deadbeef->pl_get_item_duration (it), 0.0f) * 1000;
+
+    tagstore_builder_add (s->builder, &record);
+
+    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+        g_free (strings[f]);
+}
+
+/* Copy tracks of path from the previous store, tracks of a file are stored
+ * next to each other */
+static void
+scan_copy (Scanner *s, guint first, const gchar *path)
+{
+    TagStore *previous = s->task->previous;
+    for (guint i = first; i < tagstore_size (previous)
+                && strcmp (tagstore_get_path (previous, i), path) == 0; i++)
+        tagstore_builder_copy (s->builder, previous, i);
+}
+
+/* Copy tracks of a file in an unmodified directory without checking it,
+ * returns FALSE if the previous store doesn't have it */
+static gboolean
+scan_known_file (Scanner *s, const gchar *path)
+{
+    guint first = GPOINTER_TO_UINT (g_hash_table_lookup (s->previous, path));
+    if (! first)
+        return FALSE;
+    g_hash_table_remove (s->previous, path);
+    scan_copy (s, first - 1, path);
+    return TRUE;
+}
+
+static void
+scan_file (Scanner *s, const gchar *path)
+{
+    struct stat file_stat;
+    if (stat (path, &file_stat) != 0 || ! S_ISREG (file_stat.st_mode))
+        return;
+
+    TagStore *previous = s->task->previous;
+    guint first = GPOINTER_TO_UINT (g_hash_table_lookup (s->previous, path));
+    g_hash_table_remove (s->previous, path);  // what is left at the end is gone
+    if (first && tagstore_get_mtime (previous, first - 1) == file_stat.st_mtime
+                && tagstore_get_filesize (previous, first - 1) == file_stat.st_size) {
+        scan_copy (s, first - 1, path);
+        return;
+    }
+
+    GPtrArray *items = metacache_read_items (s->scratch, path, &s->task->abort);
+    deadbeef->pl_lock ();
+    for (guint i = 0; i < items->len; i++) {
+        guint32 track = tagstore_builder_size (s->builder);
+        g_array_append_val (s->read, track);
+        scan_add_item (s, g_ptr_array_index (items, i), path, &file_stat);
+    }
+    deadbeef->pl_unlock ();
+
+    for (guint i = 0; i < items->len; i++)
+        deadbeef->pl_item_unref (g_ptr_array_index (items, i));
+    g_ptr_array_free (items, TRUE);
+
+    s->modified = TRUE;
+}
+
+/* Entries of listing shown with the scan filter, directories get a trailing
+ * separator */
+static gchar **
+scan_filter_listing (Scanner *s, const DirListing *listing)
+{
+    GPtrArray *entries = g_ptr_array_sized_new (listing->n_entries + 1);
+    for (guint i = 0; i < listing->n_entries; i++) {
+        ListingEntry *entry = &listing->entries[i];
+        if (filter_hidden (s->task->filter, entry->name))
+            continue;
+        if (! entry->is_dir && ! filter_match (s->task->filter, entry->display))
+            continue;
+        g_ptr_array_add (entries, entry->is_dir
+                            ? g_strconcat (entry->name, G_DIR_SEPARATOR_S, NULL)
+                            : g_strdup (entry->name));
+    }
+    g_ptr_array_add (entries, NULL);
+    return (gchar **) g_ptr_array_free (entries, FALSE);
+}
+
+/* Scan path in the same order and with the same filter as the tree. The
+ * entries of directories that weren't modified since the last scan are
+ * known, only their subdirectories are checked then. Sets fingerprint to a
+ * hash over the directory and everything below it. */
+static gboolean
+scan_dir (Scanner *s, const gchar *path, guint64 *fingerprint)
+{
+    *fingerprint = 0;
+    if (scan_cancelled (s->task))
+        return FALSE;
+
+    struct stat dir_stat;
+    if (stat (path, &dir_stat) != 0 || ! S_ISDIR (dir_stat.st_mode))
+        return TRUE;
+    if (! listing_visit_stat (s->visited, dir_stat.st_dev, dir_stat.st_ino))
+        return TRUE;
+
+    const DirRecord *record = s->dirs ? dirstate_lookup (s->dirs, path) : NULL;
+    gboolean known = record && record->mtime == (gint64) dir_stat.st_mtime;
+    gchar **entries;
+    if (known)
+        entries = g_strdupv (record->entries);
+    else {
+        DirListing *listing = listing_cache_lookup (path);
+        if (listing && listing->mtime != dir_stat.st_mtime) {
+            listing_unref (listing);
+            listing = NULL;
+        }
+        if (! listing)
+            listing = listing_read (path);
+        if (! listing)
+            return TRUE;
+        entries = scan_filter_listing (s, listing);
+        listing_unref (listing);
+    }
+
+    /* Changes in the second the scan started may not show in the time, such
+     * directories are listed again next time */
+    gint64 mtime = (dir_stat.st_mtime >= s->start - 1) ? -1 : (gint64) dir_stat.st_mtime;
+    guint64 hash = dirstate_hash (DIRSTATE_HASH_INIT, &mtime, sizeof (mtime));
+
+    gsize dirlen = strlen (path);
+    gboolean ok = TRUE;
+    for (gchar **entry = entries; *entry && ok; entry++) {
+        gsize len = strlen (*entry);
+        hash = dirstate_hash (hash, *entry, len + 1);
+
+        gchar *subpath = (dirlen > 0 && path[dirlen-1] == G_DIR_SEPARATOR)
+                            ? g_strconcat (path, *entry, NULL)
+                            : g_strconcat (path, G_DIR_SEPARATOR_S, *entry, NULL);
+        if ((*entry)[len-1] == G_DIR_SEPARATOR) {
+            guint64 subhash;
+            subpath[strlen (subpath) - 1] = '\0';
+            ok = scan_dir (s, subpath, &subhash);
+            hash = dirstate_hash (hash, &subhash, sizeof (subhash));
+        }
+        else if (! known || ! scan_known_file (s, subpath)) {
+            scan_file (s, subpath);
+            ok = ! scan_cancelled (s->task);
+
+            if (s->read->len > 0 && g_get_monotonic_time () - s->last_publish > TAGSCAN_PUBLISH_US)
+                scan_publish (s, tagstore_builder_build (s->builder), NULL, FALSE);
+
+            /* Stay in the background, the user is waiting for other things */
+            g_thread_yield ();
+        }
+        g_free (subpath);
+    }
+
+    if (ok)
+        dirstate_insert (s->new_dirs, path, mtime, hash, entries);
+    else
+        g_strfreev (entries);
+    *fingerprint = hash;
+
+    return ok;
+}
+
+/* Worker thread: scan the whole tree, tracks of unchanged files are taken
+ * from the previous store. Partial results are published regularly, the
+ * final store and the directory state are saved to disk. */
+static void
+scan_worker (gpointer data, gpointer user_data)
+{
+    ScanTask *task = data;
+
+    g_mutex_lock (&scan_mutex);
+    scan_running = task;
+    g_mutex_unlock (&scan_mutex);
+
+    Scanner s = { 0 };
+    s.task = task;
+    s.builder = tagstore_builder_new ();
+    s.previous = g_hash_table_new (g_str_hash, g_str_equal);
+    s.visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    s.read = g_array_new (FALSE, FALSE, sizeof (guint32));
+    s.scratch = deadbeef->plt_alloc ("filebrowser-tagscan");
+    s.last_publish = g_get_monotonic_time ();
+    s.start = time (NULL);
+
+    /* Without the previous store the files of unmodified directories are unknown */
+    gchar *signature = g_strconcat (task->root, "\n", task->filter->signature, NULL);
+    if (task->previous && task->dirs_filename
+                && g_file_test (task->dirs_filename, G_FILE_TEST_EXISTS)) {
+        s.dirs = dirstate_load (task->dirs_filename);
+        if (s.dirs && g_strcmp0 (dirstate_get_signature (s.dirs), signature) != 0) {
+            dirstate_free (s.dirs);
+            s.dirs = NULL;
+        }
+    }
+    s.new_dirs = dirstate_new (signature);
+    g_free (signature);
+
+    for (guint i = tagstore_size (task->previous); i-- > 0; )  // backwards to keep the first track
+        g_hash_table_insert (s.previous, (gpointer) tagstore_get_path (task->previous, i),
+                            GUINT_TO_POINTER (i + 1));
+
+    guint64 fingerprint;
+    if (scan_dir (&s, task->root, &fingerprint)) {
+        GPtrArray *removed = g_ptr_array_new_with_free_func (g_free);
+        GHashTableIter iter;
+        gpointer path;
+        g_hash_table_iter_init (&iter, s.previous);
+        while (g_hash_table_iter_next (&iter, &path, NULL))
+            g_ptr_array_add (removed, g_strdup (path));
+
+        if (removed->len > 0 || tagstore_builder_size (s.builder) != tagstore_size (task->previous))
+            s.modified = TRUE;
+
+        if (s.modified) {
+            TagStore *store = tagstore_builder_build (s.builder);
+            if (task->filename)
+                tagstore_save (store, task->filename);
+            scan_publish (&s, store, removed, TRUE);
+        }
+        else
+            scan_publish (&s, tagstore_ref (task->previous), removed, TRUE);
+
+        const DirRecord *root = s.dirs ? dirstate_lookup (s.dirs, task->root) : NULL;
+        if (task->dirs_filename && (s.modified || ! root || root->fingerprint != fingerprint))
+            dirstate_save (s.new_dirs, task->dirs_filename);
+    }
+
+    deadbeef->plt_free (s.scratch);
+    dirstate_free (s.new_dirs);
+    dirstate_free (s.dirs);
+    g_array_free (s.read, TRUE);
+    g_hash_table_destroy (s.visited);
+    g_hash_table_destroy (s.previous);
+    tagstore_builder_free (s.builder);
+
+    g_mutex_lock (&scan_mutex);
+    scan_running = NULL;
+    g_mutex_unlock (&scan_mutex);
+
+    task_free (task);
+}
+#endif  /* TAGSCAN_SUPPORTED */
+
+
+void
+tagscan_init (DB_functions_t *api)
+{
+    deadbeef = api;
+}
+
+/* Scan root in the background and save the result to filename, directories
+ * are remembered in dirs_filename to skip unmodified ones next time; a scan
+ * that is still running is cancelled */
+void
+tagscan_start (const gchar *root, FbFilter *filter, TagStore *previous, const gchar *filename,
+                            const gchar *dirs_filename, TagScanReadyFunc func, gpointer user_data)
+{
+#ifdef TAGSCAN_SUPPORTED
+    tagscan_cancel ();
+    if (! scan_pool)
+        scan_pool = g_thread_pool_new (scan_worker, NULL, 1, FALSE, NULL);
+
+    ScanTask *task = g_new0 (ScanTask, 1);
+    task->root = g_strdup (root);
+    task->filter = filter_ref (filter);
+    task->previous = tagstore_ref (previous);
+    task->filename = g_strdup (filename);
+    task->dirs_filename = g_strdup (dirs_filename);
+    task->func = func;
+    task->user_data = user_data;
+    task->generation = g_atomic_int_get (&scan_generation);
+
+    g_thread_pool_push (scan_pool, task, NULL);
+#endif
+}
+
+void
+tagscan_cancel (void)
+{
+    g_atomic_int_inc (&scan_generation);
+
+    g_mutex_lock (&scan_mutex);
+    if (scan_running)
+        g_atomic_int_set (&scan_running->abort, 1);
+    g_mutex_unlock (&scan_mutex);
+}
+
+void
+tagscan_shutdown (void)
+{
+    tagscan_cancel ();
+    if (scan_pool)
+        g_thread_pool_free (scan_pool, FALSE, TRUE);
+    scan_pool = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef __TAGSCAN_H
+#define __TAGSCAN_H
+
+#include <glib.h>
+#include <deadbeef/deadbeef.h>
+#include "filter.h"
+#include "tagstore.h"
+
+/* Called on the main thread with the tracks scanned so far, finished is set
+ * for the last call of a scan. The store reference is owned by the callee.
+ * Changes relative to the previous call (or the previous store for the first
+ * one) are passed along: read holds the numbers of tracks in store that were
+ * read from their files, removed the paths of files from the previous store
+ * that are gone. Files are only known to be gone once the scan finished. */
+typedef void (*TagScanReadyFunc) (TagStore *store, const GArray *read, const GPtrArray *removed,
+                            gboolean finished, gpointer user_data);
+
+
+void
+tagscan_init (DB_functions_t *api);
+
+void
+tagscan_start (const gchar *root, FbFilter *filter, TagStore *previous, const gchar *filename,
+                            const gchar *dirs_filename, TagScanReadyFunc func, gpointer user_data);
+
+void
+tagscan_cancel (void);
+
+void
+tagscan_shutdown (void);
+
+#endif  /* __TAGSCAN_H */
@@ -0,0 +1,616 @@
+/* TAG STORE - columnar store of the tags of all tracks in the library */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tagstore.h"
+
+
+/* File layout, all integers in host byte order so the file can be used
+ * directly after mapping it into memory:
+ *     header          TagStoreHeader
+ *     mtimes          n_tracks * gint64
+ *     sizes           n_tracks * gint64
+ *     paths           n_tracks * guint32, offsets into pool
+ *     fields          TAG_N_FIELDS * n_tracks * guint32, string ids or values
+ *     strings         n_strings * guint32, offsets into pool in collation order
+ *     pool            pool_size bytes of NUL-terminated UTF-8 strings
+ * String id 0 is always the empty string.
+ */
+#define TAGSTORE_MAGIC          "DBFBTAGS"
+#define TAGSTORE_VERSION        1
+#define TAGSTORE_BYTE_ORDER     0x01020304
+
+/* Number of directories in the recently modified list */
+#define TAGSTORE_RECENT_MAX     100
+
+typedef struct
+{
+    gchar           magic[8];
+    guint32         version;
+    guint32         byte_order;     // files from other architectures are rejected
+    guint32         n_tracks;
+    guint32         n_strings;
+    guint64         pool_size;
+} TagStoreHeader;
+
+struct _TagStore
+{
+    GMappedFile     *file;          // NULL if data was built in memory
+    guint8          *data;
+    gsize           length;
+    gint            ref_count;
+
+    guint32         n_tracks;
+    guint32         n_strings;
+    const gint64    *mtimes;
+    const gint64    *sizes;
+    const guint32   *paths;
+    const guint32   *fields[TAG_N_FIELDS];
+    const guint32   *strings;
+    const gchar     *pool;
+    gsize           pool_size;
+
+    gsize           folded_init;
+    guint32         *folded;        // offsets of lowercase strings in folded_pool, built on demand
+    gchar           *folded_pool;
+
+    gsize           recent_init;
+    guint32         *recent;        // newest track of the most recently modified directories
+    guint           n_recent;
+};
+
+struct _TagStoreBuilder
+{
+    GArray          *mtimes;
+    GArray          *sizes;
+    GArray          *paths;
+    GArray          *fields[TAG_N_FIELDS];  // string fields hold ids in insertion order
+    GArray          *strings;       // id -> offset into pool
+    GString         *pool;
+    GHashTable      *ids;           // string -> id + 1
+};
+
+
+static gsize
+layout_size (guint32 n_tracks, guint32 n_strings, guint64 pool_size)
+{
+    return sizeof (TagStoreHeader)
+        + 2 * sizeof (gint64) * n_tracks
+        + (1 + TAG_N_FIELDS) * sizeof (guint32) * n_tracks
+        + sizeof (guint32) * n_strings
+        + pool_size;
+}
+
+/* Point the columns of store into its data, which starts with the header */
+static void
+layout_columns (TagStore *store)
+{
+    const TagStoreHeader *header = (const TagStoreHeader *) store->data;
+    guint32 n = header->n_tracks;
+    guint8 *p = store->data + sizeof (TagStoreHeader);
+
+    store->n_tracks = n;
+    store->n_strings = header->n_strings;
+    store->pool_size = header->pool_size;
+
+    store->mtimes = (const gint64 *) p;
+    p += sizeof (gint64) * n;
+    store->sizes = (const gint64 *) p;
+    p += sizeof (gint64) * n;
+    store->paths = (const guint32 *) p;
+    p += sizeof (guint32) * n;
+    for (guint f = 0; f < TAG_N_FIELDS; f++) {
+        store->fields[f] = (const guint32 *) p;
+        p += sizeof (guint32) * n;
+    }
+    store->strings = (const guint32 *) p;
+    p += sizeof (guint32) * store->n_strings;
+    store->pool = (const gchar *) p;
+}
+
+/* Check that all offsets and ids point inside the file, so a damaged file
+ * can't make lookups read beyond the mapping */
+static gboolean
+validate_columns (const TagStore *store)
+{
+    if (store->pool_size == 0 || store->pool[store->pool_size - 1] != '\0')
+        return FALSE;
+    if (store->n_strings == 0 || store->pool[store->strings[0]] != '\0')
+        return FALSE;
+
+    for (guint32 i = 0; i < store->n_strings; i++)
+        if (store->strings[i] >= store->pool_size)
+            return FALSE;
+    for (guint32 i = 0; i < store->n_tracks; i++)
+        if (store->paths[i] >= store->pool_size)
+            return FALSE;
+    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+        for (guint32 i = 0; i < store->n_tracks; i++)
+            if (store->fields[f][i] >= store->n_strings)
+                return FALSE;
+
+    return TRUE;
+}
+
+TagStore *
+tagstore_load (const gchar *filename)
+{
+    GMappedFile *file = g_mapped_file_new (filename, FALSE, NULL);
+    if (! file)
+        return NULL;
+
+    TagStore *store = g_new0 (TagStore, 1);
+    store->file = file;
+    store->data = (guint8 *) g_mapped_file_get_contents (file);
+    store->length = g_mapped_file_get_length (file);
+    store->ref_count = 1;
+
+    const TagStoreHeader *header = (const TagStoreHeader *) store->data;
+    gboolean ok = store->length >= sizeof (TagStoreHeader)
+                && memcmp (header->magic, TAGSTORE_MAGIC, sizeof (header->magic)) == 0
+                && header->version == TAGSTORE_VERSION
+                && header->byte_order == TAGSTORE_BYTE_ORDER
+                && header->pool_size <= store->length
+                && layout_size (header->n_tracks, header->n_strings, header->pool_size) == store->length;
+    if (ok) {
+        layout_columns (store);
+        ok = validate_columns (store);
+    }
+
+    if (! ok) {
+        fprintf (stderr, "filebrowser: ignoring invalid tag store %s\n", filename);
+        tagstore_unref (store);
+        return NULL;
+    }
+    return store;
+}
+
+gboolean
+tagstore_save (const TagStore *store, const gchar *filename)
+{
+    GError *error = NULL;
+    gboolean ok = g_file_set_contents (filename, (const gchar *) store->data, store->length, &error);
+    if (! ok) {
+        fprintf (stderr, "filebrowser: could not write tag store: %s\n", error->message);
+        g_error_free (error);
+    }
+    return ok;
+}
+
+TagStore *
+tagstore_ref (TagStore *store)
+{
+    if (store)
+        g_atomic_int_inc (&store->ref_count);
+    return store;
+}
+
+void
+tagstore_unref (TagStore *store)
+{
+    if (! store || ! g_atomic_int_dec_and_test (&store->ref_count))
+        return;
+
+    if (store->file)
+        g_mapped_file_unref (store->file);
+    else
+        g_free (store->data);
+    g_free (store->folded);
+    g_free (store->folded_pool);
+    g_free (store->recent);
+    g_free (store);
+}
+
+guint
+tagstore_size (const TagStore *store)
+{
+    return store ? store->n_tracks : 0;
+}
+
+const gchar *
+tagstore_get_path (const TagStore *store, guint track)
+{
+    return store->pool + store->paths[track];
+}
+
+gint64
+tagstore_get_mtime (const TagStore *store, guint track)
+{
+    return store->mtimes[track];
+}
+
+gint64
+tagstore_get_filesize (const TagStore *store, guint track)
+{
+    return store->sizes[track];
+}
+
+/* Get string id or numeric value of a field */
+guint32
+tagstore_get (const TagStore *store, TagField field, guint track)
+{
+    return store->fields[field][track];
+}
+
+/* Get text of a string field, empty if the tag is missing */
+const gchar *
+tagstore_get_string (const TagStore *store, TagField field, guint track)
+{
+    g_return_val_if_fail (field < TAG_N_STRING_FIELDS, "");
+    return store->pool + store->strings[store->fields[field][track]];
+}
+
+/* Get a whole column, string fields contain string ids */
+const guint32 *
+tagstore_get_column (const TagStore *store, TagField field)
+{
+    return store->fields[field];
+}
+
+guint
+tagstore_n_strings (const TagStore *store)
+{
+    return store->n_strings;
+}
+
+/* Get lowercase version of a string for case-insensitive matching. The
+ * lowercase dictionary is built when this is first called. */
+const gchar *
+tagstore_get_folded (const TagStore *store, guint32 id)
+{
+    TagStore *s = (TagStore *) store;  // built once, immutable afterwards
+
+    if (g_once_init_enter (&s->folded_init)) {
+        GString *pool = g_string_sized_new (s->pool_size);
+        s->folded = g_new (guint32, s->n_strings);
+        for (guint32 i = 0; i < s->n_strings; i++) {
+            const gchar *str = s->pool + s->strings[i];
+            s->folded[i] = pool->len;
+
+            const gchar *p = str;
+            while (*p && ! (*p & 0x80))
+                p++;
+            if (*p) {
+                gchar *folded = g_utf8_casefold (str, -1);
+                g_string_append_len (pool, folded, strlen (folded) + 1);
+                g_free (folded);
+            }
+            else {
+                for (p = str; *p; p++)  // plain ASCII
+                    g_string_append_c (pool, g_ascii_tolower (*p));
+                g_string_append_c (pool, '\0');
+            }
+        }
+        s->folded_pool = g_string_free (pool, FALSE);
+        g_once_init_leave (&s->folded_init, 1);
+    }
+
+    return s->folded_pool + s->folded[id];
+}
+
+typedef struct
+{
+    gint64          mtime;
+    guint32         track;
+} RecentDir;
+
+static gint
+compare_recent (gconstpointer a, gconstpointer b)
+{
+    const RecentDir *ra = a, *rb = b;
+    if (ra->mtime != rb->mtime)
+        return (ra->mtime < rb->mtime) ? 1 : -1;
+    return (ra->track > rb->track) - (ra->track < rb->track);
+}
+
+/* Get the directories whose files were modified last, newest first. Each
+ * directory is given by its newest track. The list is built when this is
+ * first called; returns the number of directories. */
+guint
+tagstore_get_recent (const TagStore *store, const guint32 **tracks)
+{
+    TagStore *s = (TagStore *) store;  // built once, immutable afterwards
+
+    if (g_once_init_enter (&s->recent_init)) {
+        GArray *dirs = g_array_new (FALSE, FALSE, sizeof (RecentDir));
+        GHashTable *index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        /* Files of a directory are scanned together, so the hash table is
+         * only needed when the directory changes */
+        const gchar *dir = NULL;
+        gsize dir_len = 0;
+        RecentDir *current = NULL;
+        for (guint32 i = 0; i < s->n_tracks; i++) {
+            const gchar *path = s->pool + s->paths[i];
+            const gchar *slash = strrchr (path, G_DIR_SEPARATOR);
+            gsize len = slash ? (gsize) (slash - path) : 0;
+
+            if (! current || len != dir_len || memcmp (path, dir, len) != 0) {
+                gchar *key = g_strndup (path, len);
+                gpointer value;
+                if (g_hash_table_lookup_extended (index, key, NULL, &value)) {
+                    g_free (key);
+                }
+                else {
+                    RecentDir entry = { G_MININT64, i };
+                    value = GUINT_TO_POINTER (dirs->len);
+                    g_array_append_val (dirs, entry);
+                    g_hash_table_insert (index, key, value);
+                }
+                current = &g_array_index (dirs, RecentDir, GPOINTER_TO_UINT (value));
+                dir = path;
+                dir_len = len;
+            }
+            if (s->mtimes[i] > current->mtime) {
+                current->mtime = s->mtimes[i];
+                current->track = i;
+            }
+        }
+        g_hash_table_destroy (index);
+
+        g_array_sort (dirs, compare_recent);
+        s->n_recent = MIN (dirs->len, TAGSTORE_RECENT_MAX);
+        s->recent = g_new (guint32, MAX (s->n_recent, 1));
+        for (guint i = 0; i < s->n_recent; i++)
+            s->recent[i] = g_array_index (dirs, RecentDir, i).track;
+        g_array_free (dirs, TRUE);
+
+        g_once_init_leave (&s->recent_init, 1);
+    }
+
+    if (tracks)
+        *tracks = s->recent;
+    return s->n_recent;
+}
+
+/* Order tracks by the given fields, the first field being the most significant.
+ * Tracks that compare equal keep the order they were added in. Returns the
+ * track numbers in sorted order. */
+guint32 *
+tagstore_sort (const TagStore *store, const TagField *keys, guint n_keys)
+{
+    guint32 n = store->n_tracks;
+    guint32 *order = g_new (guint32, MAX (n, 1));
+    guint32 *values = g_new (guint32, MAX (n, 1));
+    guint32 *tmp_order = g_new (guint32, MAX (n, 1));
+    guint32 *tmp_values = g_new (guint32, MAX (n, 1));
+    for (guint32 i = 0; i < n; i++)
+        order[i] = i;
+
+    /* LSD radix sort, one byte at a time starting with the least significant
+     * byte of the last key. The values of a key are gathered once and moved
+     * along with the track numbers, so the passes only read sequentially.
+     * Bytes that are equal in all tracks are skipped, which leaves one or two
+     * passes for most keys. */
+    for (guint k = n_keys; k-- > 0; ) {
+        const guint32 *column = store->fields[keys[k]];
+        guint32 counts[4][256];
+        memset (counts, 0, sizeof (counts));
+        for (guint32 i = 0; i < n; i++) {
+            guint32 value = column[order[i]];
+            values[i] = value;
+            counts[0][value & 0xff]++;
+            counts[1][(value >> 8) & 0xff]++;
+            counts[2][(value >> 16) & 0xff]++;
+            counts[3][value >> 24]++;
+        }
+
+        for (guint byte = 0; byte < 4; byte++) {
+            guint shift = byte * 8;
+            if (n == 0 || counts[byte][(values[0] >> shift) & 0xff] == n)
+                continue;
+
+            guint32 pos[256], sum = 0;
+            for (guint b = 0; b < 256; b++) {
+                pos[b] = sum;
+                sum += counts[byte][b];
+            }
+            for (guint32 i = 0; i < n; i++) {
+                guint32 dest = pos[(values[i] >> shift) & 0xff]++;
+                tmp_order[dest] = order[i];
+                tmp_values[dest] = values[i];
+            }
+
+            guint32 *swap = order;
+            order = tmp_order;
+            tmp_order = swap;
+            swap = values;
+            values = tmp_values;
+            tmp_values = swap;
+        }
+    }
+
+    g_free (values);
+    g_free (tmp_order);
+    g_free (tmp_values);
+    return order;
+}
+
+
+TagStoreBuilder *
+tagstore_builder_new (void)
+{
+    TagStoreBuilder *b = g_new0 (TagStoreBuilder, 1);
+    b->mtimes = g_array_new (FALSE, FALSE, sizeof (gint64));
+    b->sizes = g_array_new (FALSE, FALSE, sizeof (gint64));
+    b->paths = g_array_new (FALSE, FALSE, sizeof (guint32));
+    for (guint f = 0; f < TAG_N_FIELDS; f++)
+        b->fields[f] = g_array_new (FALSE, FALSE, sizeof (guint32));
+    b->strings = g_array_new (FALSE, FALSE, sizeof (guint32));
+    b->pool = g_string_sized_new (65536);
+    b->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    /* Id 0 is the empty string */
+    guint32 offset = 0;
+    g_string_append_c (b->pool, '\0');
+    g_array_append_val (b->strings, offset);
+    return b;
+}
+
+void
+tagstore_builder_free (TagStoreBuilder *b)
+{
+    if (! b)
+        return;
+
+    g_array_free (b->mtimes, TRUE);
+    g_array_free (b->sizes, TRUE);
+    g_array_free (b->paths, TRUE);
+    for (guint f = 0; f < TAG_N_FIELDS; f++)
+        g_array_free (b->fields[f], TRUE);
+    g_array_free (b->strings, TRUE);
+    g_string_free (b->pool, TRUE);
+    g_hash_table_destroy (b->ids);
+    g_free (b);
+}
+
+static guint32
+builder_add_to_pool (TagStoreBuilder *b, const gchar *str)
+{
+    guint32 offset = b->pool->len;
+    g_string_append_len (b->pool, str, strlen (str) + 1);
+    return offset;
+}
+
+/* Get id of str, adding it to the dictionary if necessary */
+static guint32
+builder_intern (TagStoreBuilder *b, const gchar *str)
+{
+    if (! str || ! *str)
+        return 0;
+
+    guint32 id = GPOINTER_TO_UINT (g_hash_table_lookup (b->ids, str));
+    if (id)
+        return id - 1;
+
+    id = b->strings->len;
+    guint32 offset = builder_add_to_pool (b, str);
+    g_array_append_val (b->strings, offset);
+    g_hash_table_insert (b->ids, g_strdup (str), GUINT_TO_POINTER (id + 1));
+    return id;
+}
+
+static void
+builder_append (TagStoreBuilder *b, const gchar *path, gint64 mtime, gint64 size,
+                            const guint32 *values)
+{
+    guint32 offset = builder_add_to_pool (b, path);
+    g_array_append_val (b->paths, offset);
+    g_array_append_val (b->mtimes, mtime);
+    g_array_append_val (b->sizes, size);
+    for (guint f = 0; f < TAG_N_FIELDS; f++)
+        g_array_append_val (b->fields[f], values[f]);
+}
+
+void
+tagstore_builder_add (TagStoreBuilder *b, const TagRecord *record)
+{
+    guint32 values[TAG_N_FIELDS];
+    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+        values[f] = builder_intern (b, record->strings[f]);
+    if (values[TAG_FIELD_ALBUM_ARTIST] == 0)
+        values[TAG_FIELD_ALBUM_ARTIST] = values[TAG_FIELD_ARTIST];
+    values[TAG_FIELD_YEAR] = record->year;
+    values[TAG_FIELD_NUMBER] = record->number;
+    values[TAG_FIELD_DURATION] = record->duration;
+
+    builder_append (b, record->path, record->mtime, record->size, values);
+}
+
+/* Add a track of an existing store without reading the file again */
+void
+tagstore_builder_copy (TagStoreBuilder *b, const TagStore *store, guint track)
+{
+    guint32 values[TAG_N_FIELDS];
+    for (guint f = 0; f < TAG_N_STRING_FIELDS; f++)
+        values[f] = builder_intern (b, tagstore_get_string (store, f, track));
+    for (guint f = TAG_N_STRING_FIELDS; f < TAG_N_FIELDS; f++)
+        values[f] = store->fields[f][track];
+
+    builder_append (b, tagstore_get_path (store, track), store->mtimes[track],
+                            store->sizes[track], values);
+}
+
+guint
+tagstore_builder_size (const TagStoreBuilder *b)
+{
+    return b->paths->len;
+}
+
+typedef struct
+{
+    gchar           *key;
+    guint32         id;
+} SortKey;
+
+static gint
+compare_sort_keys (gconstpointer a, gconstpointer b)
+{
+    const SortKey *k1 = a;
+    const SortKey *k2 = b;
+    if (k1->id == 0 || k2->id == 0)
+        return (k1->id != 0) - (k2->id != 0);  // empty string stays first
+    gint result = strcmp (k1->key, k2->key);
+    return result ? result : (k1->id > k2->id) - (k1->id < k2->id);
+}
+
+/* Create a store from the tracks added so far. The builder stays valid, so
+ * partial results can be published while tracks are still added. */
+TagStore *
+tagstore_builder_build (TagStoreBuilder *b)
+{
+    guint32 n = b->paths->len;
+    guint32 n_strings = b->strings->len;
+
+    /* Renumber strings in collation order */
+    SortKey *keys = g_new (SortKey, n_strings);
+    for (guint32 id = 0; id < n_strings; id++) {
+        gchar *folded = g_utf8_casefold (b->pool->str + g_array_index (b->strings, guint32, id), -1);
+        keys[id].key = g_utf8_collate_key (folded, -1);
+        keys[id].id = id;
+        g_free (folded);
+    }
+    qsort (keys, n_strings, sizeof (SortKey), compare_sort_keys);
+
+    guint32 *rank = g_new (guint32, n_strings);
+    for (guint32 i = 0; i < n_strings; i++) {
+        rank[keys[i].id] = i;
+        g_free (keys[i].key);
+    }
+
+    TagStore *store = g_new0 (TagStore, 1);
+    store->ref_count = 1;
+    store->length = layout_size (n, n_strings, b->pool->len);
+    store->data = g_malloc0 (store->length);
+
+    TagStoreHeader *header = (TagStoreHeader *) store->data;
+    memcpy (header->magic, TAGSTORE_MAGIC, sizeof (header->magic));
+    header->version = TAGSTORE_VERSION;
+    header->byte_order = TAGSTORE_BYTE_ORDER;
+    header->n_tracks = n;
+    header->n_strings = n_strings;
+    header->pool_size = b->pool->len;
+    layout_columns (store);
+
+    memcpy ((gint64 *) store->mtimes, b->mtimes->data, sizeof (gint64) * n);
+    memcpy ((gint64 *) store->sizes, b->sizes->data, sizeof (gint64) * n);
+    memcpy ((guint32 *) store->paths, b->paths->data, sizeof (guint32) * n);
+    for (guint f = 0; f < TAG_N_FIELDS; f++) {
+        guint32 *column = (guint32 *) store->fields[f];
+        const guint32 *values = (const guint32 *) b->fields[f]->data;
+        if (f < TAG_N_STRING_FIELDS)
+            for (guint32 i = 0; i < n; i++)
+                column[i] = rank[values[i]];
+        else
+            memcpy (column, values, sizeof (guint32) * n);
+    }
+    for (guint32 i = 0; i < n_strings; i++)
+        ((guint32 *) store->strings)[i] = g_array_index (b->strings, guint32, keys[i].id);
+    memcpy ((gchar *) store->pool, b->pool->str, b->pool->len);
+
+    g_free (rank);
+    g_free (keys);
+    return store;
+}
@@ -0,0 +1,106 @@
+#ifndef __TAGSTORE_H
+#define __TAGSTORE_H
+
+#include <glib.h>
+
+/* Tags of all tracks below the root directory, stored column by column.
+ * Strings are dictionary encoded: string fields hold ids whose order is the
+ * collation order of the strings, so tracks can be grouped and sorted by
+ * comparing integers. Stores are immutable and can be shared between
+ * threads; saved stores are mapped into memory instead of being parsed.
+ */
+typedef struct _TagStore TagStore;
+typedef struct _TagStoreBuilder TagStoreBuilder;
+
+typedef enum
+{
+    TAG_FIELD_ALBUM_ARTIST,         // falls back to the track artist
+    TAG_FIELD_ALBUM,
+    TAG_FIELD_ARTIST,
+    TAG_FIELD_TITLE,
+    TAG_FIELD_GENRE,
+    TAG_FIELD_YEAR,
+    TAG_FIELD_NUMBER,               // disc << 16 | track
+    TAG_FIELD_DURATION,             // milliseconds
+    TAG_N_FIELDS
+} TagField;
+
+#define TAG_N_STRING_FIELDS     (TAG_FIELD_GENRE + 1)
+
+/* Single track as passed to the builder */
+typedef struct
+{
+    const gchar     *path;
+    gint64          mtime;
+    gint64          size;
+    const gchar     *strings[TAG_N_STRING_FIELDS];  // NULL for missing tags
+    guint32         year;
+    guint32         number;
+    guint32         duration;
+} TagRecord;
+
+
+TagStore *
+tagstore_load (const gchar *filename);
+
+gboolean
+tagstore_save (const TagStore *store, const gchar *filename);
+
+TagStore *
+tagstore_ref (TagStore *store);
+
+void
+tagstore_unref (TagStore *store);
+
+guint
+tagstore_size (const TagStore *store);
+
+const gchar *
+tagstore_get_path (const TagStore *store, guint track);
+
+gint64
+tagstore_get_mtime (const TagStore *store, guint track);
+
+gint64
+tagstore_get_filesize (const TagStore *store, guint track);
+
+guint32
+tagstore_get (const TagStore *store, TagField field, guint track);
+
+const gchar *
+tagstore_get_string (const TagStore *store, TagField field, guint track);
+
+const guint32 *
+tagstore_get_column (const TagStore *store, TagField field);
+
+guint
+tagstore_n_strings (const TagStore *store);
+
+const gchar *
+tagstore_get_folded (const TagStore *store, guint32 id);
+
+guint
+tagstore_get_recent (const TagStore *store, const guint32 **tracks);
+
+guint32 *
+tagstore_sort (const TagStore *store, const TagField *keys, guint n_keys);
+
+TagStoreBuilder *
+tagstore_builder_new (void);
+
+void
+tagstore_builder_free (TagStoreBuilder *b);
+
+void
+tagstore_builder_add (TagStoreBuilder *b, const TagRecord *record);
+
+void
+tagstore_builder_copy (TagStoreBuilder *b, const TagStore *store, guint track);
+
+guint
+tagstore_builder_size (const TagStoreBuilder *b);
+
+TagStore *
+tagstore_builder_build (TagStoreBuilder *b);
+
+#endif  /* __TAGSTORE_H */
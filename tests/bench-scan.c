@@ -0,0 +1,495 @@
+/* End-to-end benchmark of the core on a music library, usually one made
+ * by tests/genlib:
+ *     tests/bench-scan [--rounds N] [--expanded PERCENT] [--queries N] [--json] DIR
+ * The phases do what the plugin does for the same directories:
+ *     scan      list every shown directory below DIR (read, stat and sort)
+ *     filter    decide which entries are shown, with the autofilter
+ *     icon      look for cover images of shown folders and their cached icons
+ *     session   save and load the expanded rows
+ *     restore   list, filter and index the expanded rows after a restart
+ *     index     build the search index of DIR
+ *     search    substring queries on the search index
+ *     fuzzy     fuzzy queries on the search index
+ * For each phase the latency of single operations (one directory, one
+ * query) is reported as percentiles, together with the read and write
+ * system calls, page faults and peak memory of the process.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "filter.h"
+#include "listing.h"
+#include "pathtrie.h"
+#include "searchindex.h"
+#include "session.h"
+#include "typeahead.h"
+#include "utils.h"
+#include "testutil.h"
+
+
+typedef struct
+{
+    gint64          syscr;          // read system calls, -1 if /proc/self/io can't be read
+    gint64          syscw;
+    struct rusage   usage;
+} ProcessCounters;
+
+typedef struct
+{
+    const gchar     *name;
+    GArray          *samples;       // gdouble, seconds of each operation
+    GTimer          *timer;
+    gdouble         wall;
+    ProcessCounters start;
+    ProcessCounters end;
+} Phase;
+
+typedef struct
+{
+    gchar           *root;
+    FbFilter        *filter;
+    GPtrArray       *listings;      // DirListing of all shown directories, parents first
+    guint64         n_files;
+    PathTrie        *expanded;
+    GByteArray      *session;
+    SearchIndex     *index;
+    GPtrArray       *queries;
+} BenchRun;
+
+static gint         n_rounds        = 1;
+static gint         expanded_percent = 10;
+static gint         n_queries       = 200;
+static gboolean     json            = FALSE;
+static gint         current_round   = 0;
+
+/* Same as the plugin's default cover art setting and an autofilter with many decoders */
+static gchar        *coverart[]     = { "cover.jpg", "folder.jpg", "front.jpg", NULL };
+#define AUTOFILTER  "*.mp3;*.mp2;*.mp1;*.flac;*.oga;*.ogg;*.opus;*.wav;*.aif;*.aiff;*.wv;*.ape;*.mpc;" \
+                    "*.mpp;*.mp+;*.tta;*.m4a;*.m4b;*.mp4;*.aac;*.wma;*.ac3;*.dts;*.mod;*.s3m;*.xm;*.it;" \
+                    "*.sid;*.nsf;*.spc;*.vgm;*.vgz;*.cue;*.shn;*.tak;*.dsf;*.dff;*.mid;*.midi"
+
+
+static void
+counters_read (ProcessCounters *counters)
+{
+    getrusage (RUSAGE_SELF, &counters->usage);
+    counters->syscr = counters->syscw = -1;
+
+    gchar *contents;
+    if (! g_file_get_contents ("/proc/self/io", &contents, NULL, NULL))
+        return;
+    gchar **lines = g_strsplit (contents, "\n", 0);
+    for (gint i = 0; lines[i]; i++) {
+        if (g_str_has_prefix (lines[i], "syscr: "))
+            counters->syscr = g_ascii_strtoll (lines[i] + 7, NULL, 10);
+        else if (g_str_has_prefix (lines[i], "syscw: "))
+            counters->syscw = g_ascii_strtoll (lines[i] + 7, NULL, 10);
+    }
+    g_strfreev (lines);
+    g_free (contents);
+}
+
+static gdouble
+timeval_seconds (const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+
+static Phase *
+phase_begin (const gchar *name)
+{
+    Phase *phase = g_new0 (Phase, 1);
+    phase->name = name;
+    phase->samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    phase->timer = g_timer_new ();
+    counters_read (&phase->start);
+    g_timer_start (phase->timer);
+    return phase;
+}
+
+static void
+phase_op_start (Phase *phase)
+{
+    phase->wall += g_timer_elapsed (phase->timer, NULL);
+    g_timer_start (phase->timer);
+}
+
+static void
+phase_op_end (Phase *phase)
+{
+    gdouble elapsed = g_timer_elapsed (phase->timer, NULL);
+    g_array_append_val (phase->samples, elapsed);
+    phase->wall += elapsed;
+    g_timer_start (phase->timer);
+}
+
+static gint
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+    gdouble d1 = *(const gdouble *) a, d2 = *(const gdouble *) b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+/* Nearest-rank percentile of sorted samples, in microseconds */
+static gdouble
+percentile (GArray *sorted, gdouble p)
+{
+    if (sorted->len == 0)
+        return 0;
+    guint rank = (guint) (p / 100 * sorted->len + 0.999999);
+    return g_array_index (sorted, gdouble, CLAMP (rank, 1, sorted->len) - 1) * 1e6;
+}
+
+static void
+phase_end (Phase *phase)
+{
+    phase->wall += g_timer_elapsed (phase->timer, NULL);
+    counters_read (&phase->end);
+    g_array_sort (phase->samples, compare_doubles);
+
+    const struct rusage *u0 = &phase->start.usage, *u1 = &phase->end.usage;
+    gdouble user = timeval_seconds (&u1->ru_utime) - timeval_seconds (&u0->ru_utime);
+    gdouble sys = timeval_seconds (&u1->ru_stime) - timeval_seconds (&u0->ru_stime);
+    gint64 syscr = (phase->start.syscr < 0) ? -1 : phase->end.syscr - phase->start.syscr;
+    gint64 syscw = (phase->start.syscw < 0) ? -1 : phase->end.syscw - phase->start.syscw;
+    GArray *s = phase->samples;
+
+    if (json)
+        printf ("{\"type\":\"phase\",\"phase\":\"%s\",\"round\":%d,\"ops\":%u,\"wall_ms\":%.3f,\"user_ms\":%.3f,"
+                    "\"sys_ms\":%.3f,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,"
+                    "\"syscr\":%" G_GINT64_FORMAT ",\"syscw\":%" G_GINT64_FORMAT ",\"minflt\":%ld,"
+                    "\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"peak_rss_kb\":%ld}\n",
+                    phase->name, current_round, s->len, phase->wall * 1e3, user * 1e3, sys * 1e3,
+                    percentile (s, 50), percentile (s, 90), percentile (s, 99), percentile (s, 100),
+                    syscr, syscw, u1->ru_minflt - u0->ru_minflt, u1->ru_majflt - u0->ru_majflt,
+                    u1->ru_nvcsw - u0->ru_nvcsw, u1->ru_nivcsw - u0->ru_nivcsw, u1->ru_maxrss);
+    else
+        printf ("%-8s %8u %10.1f %9.1f %9.1f %9.1f %9.1f %10" G_GINT64_FORMAT " %8ld %10ld\n",
+                    phase->name, s->len, phase->wall * 1e3,
+                    percentile (s, 50), percentile (s, 90), percentile (s, 99), percentile (s, 100),
+                    syscr, u1->ru_majflt - u0->ru_majflt, u1->ru_maxrss);
+    fflush (stdout);
+
+    g_timer_destroy (phase->timer);
+    g_array_free (phase->samples, TRUE);
+    g_free (phase);
+}
+
+
+/* List the root and every shown directory below it, breadth first */
+static void
+run_scan (BenchRun *run)
+{
+    Phase *phase = phase_begin ("scan");
+    GHashTable *visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    GQueue queue = G_QUEUE_INIT;
+    g_queue_push_tail (&queue, g_strdup (run->root));
+    g_ptr_array_set_size (run->listings, 0);
+    run->n_files = 0;
+
+    gchar *path;
+    while ((path = g_queue_pop_head (&queue))) {
+        phase_op_start (phase);
+        DirListing *listing = listing_read (path);
+        phase_op_end (phase);
+        g_free (path);
+
+        if (! listing || ! listing_visit (visited, listing)) {
+            listing_unref (listing);
+            continue;  // unreadable or symlink loop
+        }
+        g_ptr_array_add (run->listings, listing);
+        run->n_files += listing->n_entries - listing->n_dirs;
+
+        for (guint i = 0; i < listing->n_dirs; i++) {
+            if (! filter_hidden (run->filter, listing->entries[i].name))
+                g_queue_push_tail (&queue, listing_entry_path (listing, &listing->entries[i]));
+        }
+    }
+
+    g_hash_table_destroy (visited);
+    phase_end (phase);
+}
+
+static guint
+filter_listing (const FbFilter *filter, const DirListing *listing)
+{
+    guint shown = 0;
+    for (guint i = 0; i < listing->n_entries; i++) {
+        const ListingEntry *entry = &listing->entries[i];
+        if (! filter_hidden (filter, entry->name) && (entry->is_dir || filter_match (filter, entry->display)))
+            shown++;
+    }
+    return shown;
+}
+
+static void
+run_filter (BenchRun *run)
+{
+    Phase *phase = phase_begin ("filter");
+    guint shown = 0;
+    for (guint i = 0; i < run->listings->len; i++) {
+        phase_op_start (phase);
+        shown += filter_listing (run->filter, g_ptr_array_index (run->listings, i));
+        phase_op_end (phase);
+    }
+    if (shown == 0)
+        fprintf (stderr, "bench-scan: no files are shown, is this a music library?\n");
+    phase_end (phase);
+}
+
+/* Icons of the shown folders of each directory, as when filling its rows */
+static void
+run_icon (BenchRun *run)
+{
+    Phase *phase = phase_begin ("icon");
+    for (guint i = 0; i < run->listings->len; i++) {
+        const DirListing *listing = g_ptr_array_index (run->listings, i);
+        phase_op_start (phase);
+        for (guint e = 0; e < listing->n_dirs; e++) {
+            if (filter_hidden (run->filter, listing->entries[e].name))
+                continue;
+            gchar *uri = listing_entry_path (listing, &listing->entries[e]);
+            gchar *coverfile = g_file_test (uri, G_FILE_TEST_IS_DIR) ? utils_find_coverart (uri, coverart) : NULL;
+            if (coverfile) {
+                gchar *cachefile = utils_make_cache_path (uri, 24);
+                utils_cache_is_fresh (cachefile, coverfile);
+                g_free (cachefile);
+            }
+            g_free (coverfile);
+            g_free (uri);
+        }
+        phase_op_end (phase);
+    }
+    phase_end (phase);
+}
+
+/* Expand the given share of directories, with their parents */
+static void
+run_session (BenchRun *run)
+{
+    pathtrie_clear (run->expanded);
+    gint step = (expanded_percent > 0) ? MAX (100 / expanded_percent, 1) : 0;
+    for (guint i = 0; step && i < run->listings->len; i += step) {
+        const DirListing *listing = g_ptr_array_index (run->listings, i);
+        /* Parents that are already expanded have their own parents expanded too */
+        gchar *path = g_strdup (listing->path);
+        while (pathtrie_add (run->expanded, path) && ! g_str_equal (path, run->root)) {
+            gchar *parent = g_path_get_dirname (path);
+            g_free (path);
+            path = parent;
+        }
+        g_free (path);
+    }
+
+    Phase *phase = phase_begin ("session");
+    SessionState state = { .root = run->root, .expanded = run->expanded };
+    phase_op_start (phase);
+    GByteArray *data = session_encode (&state);
+    phase_op_end (phase);
+
+    SessionState loaded = { .expanded = pathtrie_new () };
+    phase_op_start (phase);
+    if (! session_decode (data->data, data->len, &loaded))
+        fprintf (stderr, "bench-scan: could not decode the session\n");
+    phase_op_end (phase);
+
+    if (pathtrie_size (loaded.expanded) != pathtrie_size (run->expanded))
+        fprintf (stderr, "bench-scan: session lost expanded rows\n");
+    pathtrie_free (loaded.expanded);
+    session_state_clear (&loaded);
+    if (run->session)
+        g_byte_array_unref (run->session);
+    run->session = data;
+    phase_end (phase);
+}
+
+static void
+collect_path (const gchar *path, gpointer user_data)
+{
+    g_ptr_array_add (user_data, g_strdup (path));
+}
+
+/* Fill the expanded rows after a restart, parents first and without cached listings */
+static void
+run_restore (BenchRun *run)
+{
+    GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+    pathtrie_foreach (run->expanded, collect_path, paths);
+    listing_cache_clear ();
+
+    Phase *phase = phase_begin ("restore");
+    for (guint i = 0; i < paths->len; i++) {
+        phase_op_start (phase);
+        DirListing *listing = listing_get (g_ptr_array_index (paths, i));
+        if (listing) {
+            listing_cache_store (listing);
+            TypeAheadIndex *index = typeahead_index_new (listing);
+            for (guint e = 0; e < listing->n_entries; e++) {
+                const ListingEntry *entry = &listing->entries[e];
+                if (! filter_hidden (run->filter, entry->name)
+                            && (entry->is_dir || filter_match (run->filter, entry->display)))
+                    typeahead_index_add (index, entry);
+            }
+            typeahead_index_free (index);
+            listing_unref (listing);
+        }
+        phase_op_end (phase);
+    }
+    phase_end (phase);
+
+    listing_cache_clear ();
+    g_ptr_array_unref (paths);
+}
+
+static void
+on_index_ready (SearchIndex *index, gpointer user_data)
+{
+    BenchRun *run = ((gpointer *) user_data)[0];
+    GMainLoop *loop = ((gpointer *) user_data)[1];
+    searchindex_free (run->index);
+    run->index = index;
+    g_main_loop_quit (loop);
+}
+
+static void
+run_index (BenchRun *run)
+{
+    searchindex_free (run->index);
+    run->index = NULL;
+
+    Phase *phase = phase_begin ("index");
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    gpointer data[] = { run, loop };
+    phase_op_start (phase);
+    searchindex_build_async (run->root, run->filter, NULL, on_index_ready, data);
+    g_main_loop_run (loop);
+    phase_op_end (phase);
+    g_main_loop_unref (loop);
+    phase_end (phase);
+}
+
+/* Queries are parts of names found in the library, some with typos */
+static void
+make_queries (BenchRun *run)
+{
+    GRand *rng = g_rand_new_with_seed (7);
+    run->queries = g_ptr_array_new_with_free_func (g_free);
+    for (gint q = 0; q < n_queries && run->listings->len > 0; q++) {
+        const DirListing *listing = g_ptr_array_index (run->listings,
+                        g_rand_int_range (rng, 0, run->listings->len));
+        if (listing->n_entries == 0)
+            continue;
+        const gchar *name = listing->entries[g_rand_int_range (rng, 0, listing->n_entries)].key;
+        glong length = g_utf8_strlen (name, -1);
+        glong start = g_rand_int_range (rng, 0, MAX (length - 3, 1));
+        glong count = MIN (g_rand_int_range (rng, 3, 9), length - start);
+        const gchar *begin = g_utf8_offset_to_pointer (name, start);
+        gchar *query = g_strndup (begin, g_utf8_offset_to_pointer (begin, count) - begin);
+        if (q % 4 == 3 && strlen (query) > 3 && (guchar) query[1] < 0x80 && (guchar) query[2] < 0x80)
+            query[1] = query[2];  // typo, only where it keeps the query valid UTF-8
+        g_ptr_array_add (run->queries, query);
+    }
+    g_rand_free (rng);
+}
+
+static void
+run_search (BenchRun *run)
+{
+    if (! run->queries)
+        make_queries (run);
+
+    const gchar *names[] = { "search", "fuzzy" };
+    for (gint fuzzy = 0; fuzzy < 2; fuzzy++) {
+        Phase *phase = phase_begin (names[fuzzy]);
+        for (guint i = 0; run->index && i < run->queries->len; i++) {
+            const gchar *query = g_ptr_array_index (run->queries, i);
+            phase_op_start (phase);
+            GPtrArray *results = fuzzy ? searchindex_query_fuzzy (run->index, query, 100)
+                                       : searchindex_query (run->index, query, 100);
+            phase_op_end (phase);
+            g_ptr_array_unref (results);
+        }
+        phase_end (phase);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionEntry options[] = {
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Number of rounds (default 1)", "N" },
+        { "expanded", 'e', 0, G_OPTION_ARG_INT, &expanded_percent, "Percentage of expanded directories (default 10)", "PERCENT" },
+        { "queries", 'q', 0, G_OPTION_ARG_INT, &n_queries, "Number of search queries (default 200)", "N" },
+        { "json", 0, 0, G_OPTION_ARG_NONE, &json, "Print JSON lines instead of a table", NULL },
+        { NULL }
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new ("DIR - benchmark the filebrowser core on a library");
+    g_option_context_add_main_entries (context, options, NULL);
+    if (! g_option_context_parse (context, &argc, &argv, &error) || argc != 2
+                || n_rounds < 1 || expanded_percent < 0 || expanded_percent > 100 || n_queries < 0) {
+        fprintf (stderr, "bench-scan: %s\n", error ? error->message : "invalid arguments, see --help");
+        g_clear_error (&error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    BenchRun run = { 0 };
+    run.root = g_canonicalize_filename (argv[1], NULL);
+    run.filter = filter_new (FALSE, AUTOFILTER);
+    run.listings = g_ptr_array_new_with_free_func ((GDestroyNotify) listing_unref);
+    run.expanded = pathtrie_new ();
+
+    /* Icons are cached in a directory of their own */
+    gchar *cache = g_dir_make_tmp ("fb-bench-cache-XXXXXX", NULL);
+    g_setenv ("XDG_CACHE_HOME", cache, TRUE);
+
+    if (! json)
+        printf ("%-8s %8s %10s %9s %9s %9s %9s %10s %8s %10s\n", "phase", "ops", "wall ms",
+                    "p50 us", "p90 us", "p99 us", "max us", "read sysc", "majflt", "peak KiB");
+
+    for (current_round = 0; current_round < n_rounds; current_round++) {
+        run_scan (&run);
+        if (current_round == 0) {
+            gchar *root = json_quote (run.root);
+            if (json)
+                printf ("{\"type\":\"run\",\"root\":%s,\"dirs\":%u,\"files\":%" G_GUINT64_FORMAT ","
+                            "\"rounds\":%d,\"expanded_percent\":%d,\"queries\":%d,\"glib\":\"%u.%u.%u\"}\n",
+                            root, run.listings->len, run.n_files, n_rounds, expanded_percent, n_queries,
+                            glib_major_version, glib_minor_version, glib_micro_version);
+            else
+                printf ("# %s: %u directories, %" G_GUINT64_FORMAT " files\n", run.root, run.listings->len, run.n_files);
+            g_free (root);
+        }
+        run_filter (&run);
+        run_icon (&run);
+        run_session (&run);
+        run_restore (&run);
+        run_index (&run);
+        run_search (&run);
+    }
+
+    searchindex_shutdown ();
+    searchindex_free (run.index);
+    if (run.queries)
+        g_ptr_array_unref (run.queries);
+    if (run.session)
+        g_byte_array_unref (run.session);
+    pathtrie_free (run.expanded);
+    g_ptr_array_unref (run.listings);
+    filter_unref (run.filter);
+    g_free (run.root);
+
+    remove_tree (cache);
+    g_free (cache);
+
+    return 0;
+}
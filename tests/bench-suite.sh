@@ -0,0 +1,81 @@
+#!/bin/sh
+# Run tests/bench-scan on synthetic libraries of about 10k, 100k and 1M files
+# and append the results as JSON lines to OUTPUT (default bench-results.jsonl).
+#
+#   FB_BENCH_SIZES="10k 100k"   sizes to run (default "10k 100k 1m")
+#   FB_BENCH_DIR=/path          where the libraries are generated and kept
+#                               between runs (default /tmp/fb-bench)
+#   FB_BENCH_ROUNDS=3           rounds of each benchmark (default 3)
+#   FB_BENCH_COLD=1             drop the page cache before each size, needs root
+#   FB_BENCH_STRACE=1           also count all system calls with strace -c
+#
+# Every result line is tagged with the size and the commit, so runs of
+# different commits can be collected in one file and compared.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+OUTPUT=${1:-bench-results.jsonl}
+SIZES=${FB_BENCH_SIZES:-"10k 100k 1m"}
+WORKDIR=${FB_BENCH_DIR:-/tmp/fb-bench}
+ROUNDS=${FB_BENCH_ROUNDS:-3}
+COMMIT=$(git -C "$HERE" rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+for tool in genlib bench-scan; do
+    if [ ! -x "$HERE/$tool" ]; then
+        echo "bench-suite: $HERE/$tool is missing, run make check first" >&2
+        exit 1
+    fi
+done
+
+# Size: artists and folder levels above them, albums have 16 tracks and
+# about 20 files with covers, noise and hidden files
+params () {
+    case $1 in
+        10k)    echo "51 0" ;;
+        100k)   echo "510 1" ;;
+        1m)     echo "5100 2" ;;
+        *)      echo "bench-suite: unknown size $1" >&2; exit 1 ;;
+    esac
+}
+
+tag () {
+    sed "s/^{/{\"size\":\"$1\",\"commit\":\"$COMMIT\",\"date\":\"$DATE\",/"
+}
+
+mkdir -p "$WORKDIR"
+for size in $SIZES; do
+    p=$(params "$size")
+    set -- $p
+    library="$WORKDIR/library-$size"
+    if [ ! -f "$library.json" ]; then
+        rm -rf "$library"
+        "$HERE/genlib" --artists "$1" --depth "$2" --json "$library" > "$library.json"
+    fi
+    tag "$size" < "$library.json" >> "$OUTPUT"
+
+    if [ "$FB_BENCH_COLD" = 1 ]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+
+    echo "bench-suite: $size" >&2
+    if [ "$FB_BENCH_STRACE" = 1 ]; then
+        strace -c -f -o "$WORKDIR/strace-$size.txt" \
+            "$HERE/bench-scan" --rounds "$ROUNDS" --json "$library" | tag "$size" >> "$OUTPUT"
+
+        # Turn the summary table of strace into one line per system call; the
+        # columns are time, seconds, usecs/call, calls, errors (may be empty)
+        # and the name
+        awk -v size="$size" -v commit="$COMMIT" -v date="$DATE" '
+            $4 ~ /^[0-9]+$/ && $NF ~ /^[a-z_0-9]+$/ && $NF != "total" {
+                printf "{\"size\":\"%s\",\"commit\":\"%s\",\"date\":\"%s\",\"type\":\"syscall\",\"name\":\"%s\",\"calls\":%s,\"errors\":%s}\n",
+                    size, commit, date, $NF, $4, NF == 6 ? $5 : 0
+            }' "$WORKDIR/strace-$size.txt" >> "$OUTPUT"
+    else
+        "$HERE/bench-scan" --rounds "$ROUNDS" --json "$library" | tag "$size" >> "$OUTPUT"
+    fi
+done
+
+echo "bench-suite: results appended to $OUTPUT" >&2
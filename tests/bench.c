@@ -0,0 +1,221 @@
+/* Microbenchmarks of the core, run by hand:
+ *     tests/bench [--entries N] [--rounds N] [NAME...]
+ * Every benchmark runs for a number of rounds; the best round is reported,
+ * which is the least disturbed by other load on the machine.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "filter.h"
+#include "listing.h"
+#include "pathtrie.h"
+#include "typeahead.h"
+#include "utils.h"
+#include "testutil.h"
+
+
+typedef struct
+{
+    gchar           *dir;           // directory with entries files
+    gchar           **names;        // names of its files
+    gchar           **paths;        // directories three levels deep, as in a music library
+    DirListing      *listing;
+    FbFilter        *filter;
+    PathTrie        *trie;
+    TypeAheadIndex  *index;
+} BenchData;
+
+typedef struct
+{
+    const gchar     *name;
+    guint           (*func) (BenchData *data);   // returns number of operations
+} Benchmark;
+
+static gint         n_entries       = 5000;
+static gint         n_rounds        = 5;
+
+static const gchar  *extensions[]   = { "mp3", "flac", "ogg", "opus", "m4a", "wav", "wv", "ape", "mpc", "aac" };
+
+/* Pattern string of an autofilter with many decoders */
+#define AUTOFILTER  "*.mp3;*.mp2;*.mp1;*.flac;*.oga;*.ogg;*.opus;*.wav;*.aif;*.aiff;*.wv;*.ape;*.mpc;" \
+                    "*.mpp;*.mp+;*.tta;*.m4a;*.m4b;*.mp4;*.aac;*.wma;*.ac3;*.dts;*.mod;*.s3m;*.xm;*.it;" \
+                    "*.sid;*.nsf;*.spc;*.vgm;*.vgz;*.cue;*.shn;*.tak;*.dsf;*.dff;*.mid;*.midi"
+
+
+static guint
+bench_listing_read (BenchData *data)
+{
+    DirListing *listing = listing_read (data->dir);
+    guint n = listing->n_entries;
+    listing_unref (listing);
+    return n;
+}
+
+static guint
+bench_listing_get (BenchData *data)
+{
+    for (gint i = 0; i < 1000; i++)
+        listing_unref (listing_get (data->dir));
+    return 1000;
+}
+
+static guint
+bench_filter_match (BenchData *data)
+{
+    guint shown = 0;
+    for (gint i = 0; i < n_entries; i++)
+        shown += filter_match (data->filter, data->names[i]);
+    g_assert_cmpuint (shown, >, 0);
+    return n_entries;
+}
+
+static guint
+bench_pathtrie_contains (BenchData *data)
+{
+    guint found = 0;
+    for (gint i = 0; i < n_entries; i++)
+        found += pathtrie_contains (data->trie, data->paths[i]);
+    g_assert_cmpuint (found, ==, (n_entries + 1) / 2);
+    return n_entries;
+}
+
+static guint
+bench_typeahead_find (BenchData *data)
+{
+    gchar prefix[3] = { 0 };
+    for (gint i = 0; i < 26 * 26; i++) {
+        prefix[0] = 'a' + i / 26;
+        prefix[1] = 'a' + i % 26;
+        typeahead_index_find (data->index, prefix);
+    }
+    return 26 * 26;
+}
+
+static guint
+bench_cache_path (BenchData *data)
+{
+    for (gint i = 0; i < 1000; i++)
+        g_free (utils_make_cache_path (data->paths[i % n_entries], 24));
+    return 1000;
+}
+
+static const Benchmark benchmarks[] = {
+    { "listing-read",       bench_listing_read },
+    { "listing-get",        bench_listing_get },
+    { "filter-match",       bench_filter_match },
+    { "pathtrie-contains",  bench_pathtrie_contains },
+    { "typeahead-find",     bench_typeahead_find },
+    { "cache-path",         bench_cache_path },
+};
+
+
+static void
+bench_data_init (BenchData *data)
+{
+    GRand *rand = g_rand_new_with_seed (42);
+    data->dir = g_dir_make_tmp ("fb-bench-XXXXXX", NULL);
+    data->names = g_new0 (gchar *, n_entries + 1);
+    data->paths = g_new0 (gchar *, n_entries + 1);
+
+    for (gint i = 0; i < n_entries; i++) {
+        /* Names start with random letters, so type-ahead has to search */
+        data->names[i] = g_strdup_printf ("%c%c Track %05d.%s",
+                        'a' + g_rand_int_range (rand, 0, 26), 'a' + g_rand_int_range (rand, 0, 26),
+                        i, (i % 5 == 0) ? "jpg" : extensions[i % G_N_ELEMENTS (extensions)]);
+        gchar *path = g_build_filename (data->dir, data->names[i], NULL);
+        g_file_set_contents (path, "", 0, NULL);
+        g_free (path);
+
+        data->paths[i] = g_strdup_printf ("/music/Artist %03d/Album %02d/CD%d", i / 40, (i / 2) % 20, i % 2);
+    }
+
+    data->listing = listing_read (data->dir);
+    listing_cache_store (data->listing);
+    data->filter = filter_new (FALSE, AUTOFILTER);
+
+    /* Every second path is expanded */
+    data->trie = pathtrie_new ();
+    for (gint i = 0; i < n_entries; i += 2)
+        pathtrie_add (data->trie, data->paths[i]);
+
+    data->index = typeahead_index_new (data->listing);
+    for (guint i = 0; i < data->listing->n_entries; i++)
+        typeahead_index_add (data->index, &data->listing->entries[i]);
+
+    g_setenv ("XDG_CACHE_HOME", data->dir, TRUE);
+    g_rand_free (rand);
+}
+
+static void
+bench_data_free (BenchData *data)
+{
+    typeahead_index_free (data->index);
+    pathtrie_free (data->trie);
+    filter_unref (data->filter);
+    listing_cache_clear ();
+    listing_unref (data->listing);
+    remove_tree (data->dir);
+    g_strfreev (data->paths);
+    g_strfreev (data->names);
+    g_free (data->dir);
+}
+
+static gboolean
+bench_selected (const Benchmark *bench, gchar **selected)
+{
+    if (! selected || ! selected[0])
+        return TRUE;
+    for (gint i = 0; selected[i]; i++) {
+        if (strcmp (selected[i], bench->name) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+int
+main (int argc, char *argv[])
+{
+    gchar **selected = NULL;
+    GOptionEntry options[] = {
+        { "entries", 'n', 0, G_OPTION_ARG_INT, &n_entries, "Number of files and paths (default 5000)", "N" },
+        { "rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Number of rounds (default 5)", "N" },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &selected, NULL, "NAME..." },
+        { NULL }
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new ("- benchmark the filebrowser core");
+    g_option_context_add_main_entries (context, options, NULL);
+    if (! g_option_context_parse (context, &argc, &argv, &error) || n_entries < 2 || n_rounds < 1) {
+        fprintf (stderr, "bench: %s\n", error ? error->message : "invalid arguments");
+        g_clear_error (&error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    BenchData data = { 0 };
+    bench_data_init (&data);
+
+    printf ("%-20s %12s %12s\n", "benchmark", "ns/op", "ops/round");
+    GTimer *timer = g_timer_new ();
+    for (guint b = 0; b < G_N_ELEMENTS (benchmarks); b++) {
+        if (! bench_selected (&benchmarks[b], selected))
+            continue;
+
+        gdouble best = G_MAXDOUBLE;
+        guint ops = 0;
+        for (gint r = 0; r < n_rounds; r++) {
+            g_timer_start (timer);
+            ops = benchmarks[b].func (&data);
+            best = MIN (best, g_timer_elapsed (timer, NULL));
+        }
+        printf ("%-20s %12.1f %12u\n", benchmarks[b].name, best * 1e9 / MAX (ops, 1), ops);
+    }
+    g_timer_destroy (timer);
+
+    bench_data_free (&data);
+    g_strfreev (selected);
+    return 0;
+}
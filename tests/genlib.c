@@ -0,0 +1,286 @@
+/* Generator of synthetic music libraries for the benchmarks:
+ *     tests/genlib [--artists N] [--albums N] [--tracks N] [--depth N] [--seed N] DIR
+ * The same options and seed always give the same library. Audio files and
+ * cover images get realistic sizes but are written as sparse files, so a
+ * library of a million files fits on a small disk; use --dense to write
+ * the cover images for real.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "testutil.h"
+
+
+typedef struct
+{
+    guint64         files;
+    guint64         dirs;
+    guint64         audio;
+    guint64         covers;
+    guint64         hidden;
+    guint64         noise;
+    guint64         bytes;          // apparent size of all files
+} LibraryStats;
+
+static gint         n_artists       = 50;
+static gint         n_albums        = 10;
+static gint         n_tracks        = 16;
+static gint         n_depth         = 0;
+static gint         cover_kb        = 200;
+static gint         seed            = 1;
+static gboolean     dense           = FALSE;
+static gboolean     json            = FALSE;
+
+static GRand        *rng            = NULL;
+static LibraryStats stats           = { 0 };
+
+static const gchar  *syllables[]    = { "ka", "lo", "mé", "ri", "sun", "dar", "vö", "el", "tra", "no",
+                                        "zé", "bul", "qi", "ran", "ost", "wa", "ny", "ça", "pe", "hu" };
+static const gchar  *extensions[]   = { "flac", "flac", "mp3", "mp3", "mp3", "ogg", "m4a", "opus" };
+static const gint   bitrates[]      = { 900, 900, 320, 256, 192, 160, 256, 128 };  // kbit/s of extensions
+static const gchar  *noise[]        = { "album.nfo", "album.cue", "rip.log", "playlist.m3u", "md5sums.txt",
+                                        "info.txt", "Thumbs.db", "desktop.ini" };
+static const gchar  *covers[]       = { "cover.jpg", "cover.jpg", "cover.jpg", "folder.jpg", "front.jpg",
+                                        "Cover.png", NULL };
+
+
+/* Random name of a few syllables, capitalized */
+static gchar *
+make_name (gint min_syllables, gint max_syllables)
+{
+    GString *name = g_string_new (NULL);
+    gint n = g_rand_int_range (rng, min_syllables, max_syllables + 1);
+    for (gint i = 0; i < n; i++) {
+        if (i > 0 && g_rand_int_range (rng, 0, 3) == 0)
+            g_string_append_c (name, ' ');
+        g_string_append (name, syllables[g_rand_int_range (rng, 0, G_N_ELEMENTS (syllables))]);
+    }
+    name->str[0] = g_ascii_toupper (name->str[0]);
+    return g_string_free (name, FALSE);
+}
+
+static gchar *
+make_dir (const gchar *parent, const gchar *name)
+{
+    gchar *path = g_build_filename (parent, name, NULL);
+    if (g_mkdir (path, 0755) != 0 && ! g_file_test (path, G_FILE_TEST_IS_DIR)) {
+        fprintf (stderr, "genlib: could not create %s\n", path);
+        exit (1);
+    }
+    stats.dirs++;
+    return path;
+}
+
+/* Create file of the given apparent size, sparse unless write_data is set */
+static void
+make_file (const gchar *dir, const gchar *name, gsize size, gboolean write_data)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    FILE *file = fopen (path, "wb");
+    if (! file) {
+        fprintf (stderr, "genlib: could not create %s\n", path);
+        exit (1);
+    }
+
+    if (write_data) {
+        guint8 block[4096];
+        for (gsize done = 0; done < size; done += sizeof (block)) {
+            for (gsize i = 0; i < sizeof (block); i++)
+                block[i] = g_rand_int (rng);
+            fwrite (block, 1, MIN (sizeof (block), size - done), file);
+        }
+    }
+    else if (size > 0) {
+        fseek (file, size - 1, SEEK_SET);
+        fputc (0, file);
+    }
+    fclose (file);
+    g_free (path);
+
+    stats.files++;
+    stats.bytes += size;
+}
+
+/* Cover of 50% to 150% of the configured size */
+static void
+make_cover (const gchar *dir, const gchar *name)
+{
+    gsize size = (gsize) cover_kb * 1024 * g_rand_double_range (rng, 0.5, 1.5);
+    make_file (dir, name, size, dense);
+    stats.covers++;
+}
+
+static void
+make_tracks (const gchar *dir, gint first, gint count)
+{
+    gint format = g_rand_int_range (rng, 0, G_N_ELEMENTS (extensions));
+    for (gint t = first; t < first + count; t++) {
+        gchar *title = make_name (2, 5);
+        gchar *name = g_strdup_printf ("%02d - %s.%s", t + 1, title, extensions[format]);
+        gint seconds = g_rand_int_range (rng, 120, 480);
+        make_file (dir, name, (gsize) bitrates[format] * 125 * seconds, FALSE);
+        stats.audio++;
+        g_free (name);
+        g_free (title);
+    }
+}
+
+/* Album with cover, noise and hidden files, sometimes several discs and scans */
+static void
+make_album (const gchar *artist_dir, gint year)
+{
+    gchar *title = make_name (1, 4);
+    gchar *name = g_strdup_printf ("%d - %s", year, title);
+    gchar *dir = make_dir (artist_dir, name);
+
+    const gchar *cover = covers[g_rand_int_range (rng, 0, G_N_ELEMENTS (covers))];
+    if (cover)
+        make_cover (dir, cover);
+
+    if (g_rand_int_range (rng, 0, 10) == 0) {
+        gint per_disc = MAX (n_tracks / 2, 1);
+        for (gint d = 0; d < 2; d++) {
+            gchar *disc = g_strdup_printf ("CD%d", d + 1);
+            gchar *disc_dir = make_dir (dir, disc);
+            make_tracks (disc_dir, d * per_disc, per_disc);
+            g_free (disc_dir);
+            g_free (disc);
+        }
+    }
+    else
+        make_tracks (dir, 0, n_tracks);
+
+    gint first_noise = g_rand_int_range (rng, 0, G_N_ELEMENTS (noise));
+    for (gint i = g_rand_int_range (rng, 0, 4); i > 0; i--) {
+        make_file (dir, noise[(first_noise + i) % G_N_ELEMENTS (noise)], 2048, FALSE);
+        stats.noise++;
+    }
+    if (g_rand_int_range (rng, 0, 3) == 0) {
+        make_file (dir, ".DS_Store", 6148, FALSE);
+        stats.hidden++;
+    }
+    if (g_rand_int_range (rng, 0, 5) == 0) {
+        gchar *scans = make_dir (dir, "Scans");
+        for (gint i = g_rand_int_range (rng, 2, 7); i > 0; i--) {
+            gchar *scan = g_strdup_printf ("scan%02d.jpg", i);
+            make_cover (scans, scan);
+            g_free (scan);
+        }
+        g_free (scans);
+    }
+
+    g_free (dir);
+    g_free (name);
+    g_free (title);
+}
+
+static void
+make_artist (const gchar *parent, gint number)
+{
+    gchar *title = make_name (1, 3);
+    gchar *name = g_strdup_printf ("%s %04d", title, number);
+    gchar *dir = make_dir (parent, name);
+
+    /* One album a year keeps the names of an artist's albums apart */
+    gint first_year = 1960 + g_rand_int_range (rng, 0, 40);
+    for (gint a = 0; a < n_albums; a++)
+        make_album (dir, first_year + a);
+
+    if (g_rand_int_range (rng, 0, 20) == 0) {
+        gchar *thumbs = make_dir (dir, ".thumbnails");
+        for (gint i = 0; i < 8; i++) {
+            gchar *thumb = g_strdup_printf ("%08x.png", g_rand_int (rng));
+            make_file (thumbs, thumb, 4096, FALSE);
+            stats.hidden++;
+            g_free (thumb);
+        }
+        g_free (thumbs);
+    }
+
+    g_free (dir);
+    g_free (name);
+    g_free (title);
+}
+
+/* Artists are spread over n_depth levels of folders like "Level1 03" */
+static void
+make_level (const gchar *parent, gint depth, gint *next_artist, gint n_here)
+{
+    if (depth == n_depth) {
+        for (gint i = 0; i < n_here; i++)
+            make_artist (parent, (*next_artist)++);
+        return;
+    }
+
+    gint n_children = 4;
+    for (gint c = 0; c < n_children; c++) {
+        gint n_child = n_here / n_children + (c < n_here % n_children);
+        if (n_child == 0)
+            continue;
+        gchar *name = g_strdup_printf ("Level%d %02d", depth + 1, c + 1);
+        gchar *dir = make_dir (parent, name);
+        make_level (dir, depth + 1, next_artist, n_child);
+        g_free (dir);
+        g_free (name);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionEntry options[] = {
+        { "artists", 'a', 0, G_OPTION_ARG_INT, &n_artists, "Number of artists (default 50)", "N" },
+        { "albums", 'b', 0, G_OPTION_ARG_INT, &n_albums, "Albums per artist (default 10)", "N" },
+        { "tracks", 't', 0, G_OPTION_ARG_INT, &n_tracks, "Tracks per album (default 16)", "N" },
+        { "depth", 'd', 0, G_OPTION_ARG_INT, &n_depth, "Folder levels above the artists (default 0)", "N" },
+        { "cover-size", 'c', 0, G_OPTION_ARG_INT, &cover_kb, "Mean size of cover images in KiB (default 200)", "KB" },
+        { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed of the random names and sizes (default 1)", "N" },
+        { "dense", 0, 0, G_OPTION_ARG_NONE, &dense, "Write cover images instead of sparse files", NULL },
+        { "json", 0, 0, G_OPTION_ARG_NONE, &json, "Print the summary as JSON", NULL },
+        { NULL }
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new ("DIR - generate a synthetic music library");
+    g_option_context_add_main_entries (context, options, NULL);
+    if (! g_option_context_parse (context, &argc, &argv, &error) || argc != 2
+                || n_artists < 1 || n_albums < 1 || n_tracks < 1 || n_depth < 0 || cover_kb < 0) {
+        fprintf (stderr, "genlib: %s\n", error ? error->message : "invalid arguments, see --help");
+        g_clear_error (&error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    if (g_mkdir_with_parents (argv[1], 0755) != 0) {
+        fprintf (stderr, "genlib: could not create %s\n", argv[1]);
+        return 1;
+    }
+
+    rng = g_rand_new_with_seed (seed);
+    gint next_artist = 0;
+    make_level (argv[1], 0, &next_artist, n_artists);
+    g_rand_free (rng);
+
+    if (json) {
+        gchar *root = json_quote (argv[1]);
+        printf ("{\"type\":\"library\",\"root\":%s,\"artists\":%d,\"albums\":%d,\"tracks\":%d,"
+                    "\"depth\":%d,\"seed\":%d,\"files\":%" G_GUINT64_FORMAT ",\"dirs\":%" G_GUINT64_FORMAT ","
+                    "\"audio\":%" G_GUINT64_FORMAT ",\"covers\":%" G_GUINT64_FORMAT ",\"hidden\":%" G_GUINT64_FORMAT ","
+                    "\"noise\":%" G_GUINT64_FORMAT ",\"bytes\":%" G_GUINT64_FORMAT "}\n",
+                    root, n_artists, n_albums, n_tracks, n_depth, seed, stats.files, stats.dirs,
+                    stats.audio, stats.covers, stats.hidden, stats.noise, stats.bytes);
+        g_free (root);
+    }
+    else
+        printf ("%s: %" G_GUINT64_FORMAT " files in %" G_GUINT64_FORMAT " directories, %" G_GUINT64_FORMAT
+                    " audio, %" G_GUINT64_FORMAT " covers, %" G_GUINT64_FORMAT " hidden, %" G_GUINT64_FORMAT
+                    " other, %" G_GUINT64_FORMAT " MiB apparent size\n",
+                    argv[1], stats.files, stats.dirs, stats.audio, stats.covers, stats.hidden, stats.noise,
+                    stats.bytes / (1024 * 1024));
+
+    return 0;
+}
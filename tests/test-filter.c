@@ -0,0 +1,80 @@
+/* Tests for the file filter */
+
+#include <glib.h>
+#include "filter.h"
+
+
+static void
+test_hidden (void)
+{
+    FbFilter *filter = filter_new (FALSE, NULL);
+    g_assert_true (filter_hidden (filter, ".config"));
+    g_assert_false (filter_hidden (filter, "Music"));
+    filter_unref (filter);
+
+    filter = filter_new (TRUE, NULL);
+    g_assert_false (filter_hidden (filter, ".config"));
+    filter_unref (filter);
+}
+
+static void
+test_no_patterns (void)
+{
+    FbFilter *filter = filter_new (FALSE, "");
+    g_assert_null (filter->patterns);
+    g_assert_true (filter_match (filter, "cover.jpg"));
+    filter_unref (filter);
+}
+
+static void
+test_patterns (void)
+{
+    FbFilter *filter = filter_new (FALSE, "*.mp3;;*.flac;");
+    g_assert_true (filter_match (filter, "01 - Intro.mp3"));
+    g_assert_true (filter_match (filter, "01 - Intro.MP3"));
+    g_assert_true (filter_match (filter, "02 - Song.flac"));
+    g_assert_false (filter_match (filter, "cover.jpg"));
+    g_assert_false (filter_match (filter, "song.mp3.part"));
+    filter_unref (filter);
+}
+
+static void
+test_signature (void)
+{
+    FbFilter *a = filter_new (FALSE, "*.mp3");
+    FbFilter *b = filter_new (FALSE, "*.mp3");
+    FbFilter *c = filter_new (TRUE, "*.mp3");
+    g_assert_cmpstr (a->signature, ==, b->signature);
+    g_assert_cmpstr (a->signature, !=, c->signature);
+    filter_unref (a);
+    filter_unref (b);
+    filter_unref (c);
+}
+
+static void
+test_ref (void)
+{
+    FbFilter *filter = filter_new (FALSE, "*.ogg");
+    g_assert_true (filter_ref (filter) == filter);
+    g_assert_cmpint (filter->ref_count, ==, 2);
+    filter_unref (filter);
+    g_assert_true (filter_match (filter, "a.ogg"));
+    filter_unref (filter);
+
+    g_assert_null (filter_ref (NULL));
+    filter_unref (NULL);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/filter/hidden", test_hidden);
+    g_test_add_func ("/filter/no-patterns", test_no_patterns);
+    g_test_add_func ("/filter/patterns", test_patterns);
+    g_test_add_func ("/filter/signature", test_signature);
+    g_test_add_func ("/filter/ref", test_ref);
+
+    return g_test_run ();
+}
@@ -0,0 +1,79 @@
+/* Tests for fuzzy matching and scoring */
+
+#include <string.h>
+#include <glib.h>
+#include "fuzzy.h"
+
+
+static void
+test_score_match (void)
+{
+    g_assert_cmpint (fuzzy_score ("pink floyd", ""), ==, 0);
+    g_assert_cmpint (fuzzy_score ("pink floyd", "pnkfld"), !=, FUZZY_NO_MATCH);
+    g_assert_cmpint (fuzzy_score ("pink floyd", "dlyof"), ==, FUZZY_NO_MATCH);
+    g_assert_cmpint (fuzzy_score ("pink", "pinkk"), ==, FUZZY_NO_MATCH);
+
+    /* Word starts and consecutive characters are preferred */
+    g_assert_cmpint (fuzzy_score ("pink floyd", "pf"), >, fuzzy_score ("pink floyd", "pl"));
+    g_assert_cmpint (fuzzy_score ("abc", "abc"), >, fuzzy_score ("axbxc", "abc"));
+}
+
+/* A long gap before the end of the first window must not hide a better one */
+static void
+test_score_best_window (void)
+{
+    GString *text = g_string_new ("a");
+    for (guint i = 0; i < 120; i++)
+        g_string_append_c (text, 'x');
+    g_string_append (text, "b ab");
+
+    g_assert_cmpint (fuzzy_score (text->str, "ab"), ==, fuzzy_score ("ab", "ab"));
+
+    /* Spread out matches can score below zero, but still match */
+    gint spread = fuzzy_score (text->str, "axb");
+    g_assert_cmpint (spread, !=, FUZZY_NO_MATCH);
+    g_assert_cmpint (spread, <, 0);
+
+    g_string_free (text, TRUE);
+}
+
+static void
+test_charset (void)
+{
+    guint64 text = fuzzy_charset ("pink floyd");
+    guint64 pattern = fuzzy_charset ("pnk");
+    g_assert_cmpuint (text & pattern, ==, pattern);
+    pattern = fuzzy_charset ("pnq");
+    g_assert_cmpuint (text & pattern, !=, pattern);
+}
+
+static void
+test_heap (void)
+{
+    FuzzyHeap heap;
+    fuzzy_heap_init (&heap, 3);
+    for (guint i = 0; i < 10; i++) {
+        FuzzyMatch match = { (gint) (i * 7 % 10) - 5, 10, i };
+        fuzzy_heap_push (&heap, &match);
+    }
+    fuzzy_heap_sort (&heap);
+
+    g_assert_cmpuint (heap.len, ==, 3);
+    g_assert_cmpint (heap.items[0].score, ==, 4);
+    g_assert_cmpint (heap.items[1].score, ==, 3);
+    g_assert_cmpint (heap.items[2].score, ==, 2);
+    fuzzy_heap_clear (&heap);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/fuzzy/score-match", test_score_match);
+    g_test_add_func ("/fuzzy/score-best-window", test_score_best_window);
+    g_test_add_func ("/fuzzy/charset", test_charset);
+    g_test_add_func ("/fuzzy/heap", test_heap);
+
+    return g_test_run ();
+}
@@ -0,0 +1,151 @@
+/* Tests for directory listings and their cache */
+
+#include <sys/types.h>
+#include <utime.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "listing.h"
+#include "testutil.h"
+
+
+static void
+make_file (const gchar *dir, const gchar *name)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    g_assert_true (g_file_set_contents (path, "", 0, NULL));
+    g_free (path);
+}
+
+static void
+make_dir (const gchar *dir, const gchar *name)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    g_assert_cmpint (g_mkdir (path, 0755), ==, 0);
+    g_free (path);
+}
+
+/* Directory with a few entries, its time is set to the past so adding a
+ * file later always changes it */
+static gchar *
+make_test_dir (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-listing-XXXXXX", NULL);
+    g_assert_nonnull (dir);
+    make_file (dir, "b.mp3");
+    make_file (dir, "A.flac");
+    make_file (dir, ".hidden");
+    make_dir (dir, "Zeta");
+    make_dir (dir, "alpha");
+
+    struct utimbuf past = { 1000, 1000 };
+    g_assert_cmpint (utime (dir, &past), ==, 0);
+    return dir;
+}
+
+static void
+test_read (void)
+{
+    gchar *dir = make_test_dir ();
+    DirListing *listing = listing_read (dir);
+    g_assert_nonnull (listing);
+    g_assert_cmpstr (listing->path, ==, dir);
+    g_assert_cmpuint (listing->n_entries, ==, 5);
+    g_assert_cmpuint (listing->n_dirs, ==, 2);
+    g_assert_cmpint (listing->mtime, ==, 1000);
+
+    /* Directories first, then files, ignoring case */
+    const gchar *expected[] = { "alpha", "Zeta", ".hidden", "A.flac", "b.mp3" };
+    for (guint i = 0; i < G_N_ELEMENTS (expected); i++) {
+        g_assert_cmpstr (listing->entries[i].name, ==, expected[i]);
+        g_assert_cmpint (listing->entries[i].is_dir, ==, i < 2);
+    }
+
+    gchar *path = listing_entry_path (listing, &listing->entries[4]);
+    gchar *expected_path = g_build_filename (dir, "b.mp3", NULL);
+    g_assert_cmpstr (path, ==, expected_path);
+    g_free (expected_path);
+    g_free (path);
+
+    listing_unref (listing);
+    remove_tree (dir);
+    g_free (dir);
+}
+
+static void
+test_read_path (void)
+{
+    gchar *dir = make_test_dir ();
+    gchar *slashes = g_strconcat (dir, "//", NULL);
+    DirListing *listing = listing_read (slashes);
+    g_assert_cmpstr (listing->path, ==, dir);
+    listing_unref (listing);
+    g_free (slashes);
+
+    gchar *missing = g_build_filename (dir, "missing", NULL);
+    g_assert_null (listing_read (missing));
+    g_free (missing);
+
+    listing = listing_read ("/");
+    gchar *path = listing_entry_path (listing, &(ListingEntry) { .name = "tmp" });
+    g_assert_cmpstr (path, ==, "/tmp");
+    g_free (path);
+    listing_unref (listing);
+
+    remove_tree (dir);
+    g_free (dir);
+}
+
+static void
+test_cache (void)
+{
+    gchar *dir = make_test_dir ();
+    DirListing *listing = listing_read (dir);
+    listing_cache_store (listing);
+
+    DirListing *cached = listing_get (dir);
+    g_assert_true (cached == listing);
+    listing_unref (cached);
+
+    /* A modified directory is read again */
+    make_file (dir, "c.ogg");
+    DirListing *fresh = listing_get (dir);
+    g_assert_true (fresh != listing);
+    g_assert_cmpuint (fresh->n_entries, ==, 6);
+    listing_unref (fresh);
+
+    listing_cache_clear ();
+    g_assert_null (listing_cache_lookup (dir));
+
+    listing_unref (listing);
+    remove_tree (dir);
+    g_free (dir);
+}
+
+static void
+test_visit (void)
+{
+    gchar *dir = make_test_dir ();
+    DirListing *listing = listing_read (dir);
+    GHashTable *visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    g_assert_true (listing_visit (visited, listing));
+    g_assert_false (listing_visit (visited, listing));
+
+    g_hash_table_destroy (visited);
+    listing_unref (listing);
+    remove_tree (dir);
+    g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/listing/read", test_read);
+    g_test_add_func ("/listing/read-path", test_read_path);
+    g_test_add_func ("/listing/cache", test_cache);
+    g_test_add_func ("/listing/visit", test_visit);
+
+    return g_test_run ();
+}
@@ -0,0 +1,88 @@
+/* Tests for the path trie that keeps expanded rows */
+
+#include <glib.h>
+#include "pathtrie.h"
+
+
+static void
+collect_path (const gchar *path, gpointer user_data)
+{
+    g_ptr_array_add (user_data, g_strdup (path));
+}
+
+static void
+test_add_remove (void)
+{
+    PathTrie *trie = pathtrie_new ();
+    g_assert_true (pathtrie_add (trie, "/music/rock"));
+    g_assert_false (pathtrie_add (trie, "/music/rock/"));
+    g_assert_true (pathtrie_add (trie, "/music"));
+    g_assert_cmpuint (pathtrie_size (trie), ==, 2);
+
+    g_assert_true (pathtrie_contains (trie, "/music"));
+    g_assert_true (pathtrie_contains (trie, "//music//rock"));
+    g_assert_false (pathtrie_contains (trie, "/music/jazz"));
+    g_assert_false (pathtrie_contains (trie, "/mus"));
+
+    g_assert_true (pathtrie_remove (trie, "/music"));
+    g_assert_false (pathtrie_remove (trie, "/music"));
+    g_assert_true (pathtrie_contains (trie, "/music/rock"));
+    g_assert_cmpuint (pathtrie_size (trie), ==, 1);
+
+    pathtrie_free (trie);
+}
+
+static void
+test_descendants (void)
+{
+    PathTrie *trie = pathtrie_new ();
+    pathtrie_add (trie, "/music/rock/a");
+    pathtrie_add (trie, "/music/rock/b");
+    pathtrie_add (trie, "/music/jazz");
+
+    g_assert_true (pathtrie_has_descendants (trie, "/music"));
+    g_assert_false (pathtrie_has_descendants (trie, "/music/jazz"));
+
+    g_assert_cmpuint (pathtrie_remove_subtree (trie, "/music/rock"), ==, 2);
+    g_assert_false (pathtrie_contains (trie, "/music/rock/a"));
+    g_assert_true (pathtrie_contains (trie, "/music/jazz"));
+    g_assert_cmpuint (pathtrie_size (trie), ==, 1);
+
+    g_assert_cmpuint (pathtrie_remove_subtree (trie, "/"), ==, 1);
+    g_assert_cmpuint (pathtrie_size (trie), ==, 0);
+
+    pathtrie_free (trie);
+}
+
+static void
+test_foreach (void)
+{
+    PathTrie *trie = pathtrie_new ();
+    pathtrie_add (trie, "/music/rock/a");
+    pathtrie_add (trie, "/music");
+    pathtrie_add (trie, "/");
+
+    GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+    pathtrie_foreach (trie, collect_path, paths);
+    g_assert_cmpuint (paths->len, ==, 3);
+
+    /* Parents come before their children */
+    g_assert_cmpstr (g_ptr_array_index (paths, 0), ==, "/");
+    g_assert_cmpstr (g_ptr_array_index (paths, 1), ==, "/music");
+    g_assert_cmpstr (g_ptr_array_index (paths, 2), ==, "/music/rock/a");
+
+    g_ptr_array_unref (paths);
+    pathtrie_free (trie);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/pathtrie/add-remove", test_add_remove);
+    g_test_add_func ("/pathtrie/descendants", test_descendants);
+    g_test_add_func ("/pathtrie/foreach", test_foreach);
+
+    return g_test_run ();
+}
@@ -0,0 +1,129 @@
+/* Tests for the filename search index */
+
+#include <glib.h>
+#include "filter.h"
+#include "searchindex.h"
+#include "testutil.h"
+
+
+static void
+make_file (const gchar *dir, const gchar *name)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    g_assert_true (g_file_set_contents (path, "", 0, NULL));
+    g_free (path);
+}
+
+static void
+on_index_ready (SearchIndex *index, gpointer user_data)
+{
+    gpointer *data = user_data;
+    data[0] = index;
+    g_main_loop_quit (data[1]);
+}
+
+static SearchIndex *
+build_index (const gchar *root)
+{
+    FbFilter *filter = filter_new (FALSE, NULL);
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    gpointer data[] = { NULL, loop };
+    searchindex_build_async (root, filter, NULL, on_index_ready, data);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+    filter_unref (filter);
+    g_assert_nonnull (data[0]);
+    return data[0];
+}
+
+/* Whether results contains the file name below dir */
+static gboolean
+has_result (GPtrArray *results, const gchar *dir, const gchar *name)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    gboolean found = FALSE;
+    for (guint i = 0; i < results->len && ! found; i++)
+        found = g_str_equal (g_ptr_array_index (results, i), path);
+    g_free (path);
+    return found;
+}
+
+static void
+test_query_fuzzy (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-searchindex-XXXXXX", NULL);
+    g_assert_nonnull (dir);
+
+    /* The first subsequence hit of "ab" in the long name is spread out */
+    GString *spread = g_string_new ("a");
+    for (guint i = 0; i < 120; i++)
+        g_string_append_c (spread, 'x');
+    g_string_append (spread, "b ab.mp3");
+    make_file (dir, spread->str);
+    make_file (dir, "Pink Floyd.mp3");
+    make_file (dir, "Other.mp3");
+
+    SearchIndex *index = build_index (dir);
+
+    GPtrArray *results = searchindex_query_fuzzy (index, "ab", 10);
+    g_assert_true (has_result (results, dir, spread->str));
+    g_ptr_array_unref (results);
+
+    results = searchindex_query_fuzzy (index, "pnk fld", 10);
+    g_assert_cmpuint (results->len, ==, 1);
+    g_assert_true (has_result (results, dir, "Pink Floyd.mp3"));
+    g_ptr_array_unref (results);
+
+    results = searchindex_query_fuzzy (index, "zzz", 10);
+    g_assert_cmpuint (results->len, ==, 0);
+    g_ptr_array_unref (results);
+
+    /* Names containing the query as typed come first */
+    results = searchindex_query_fuzzy (index, "ab", 1);
+    g_assert_cmpuint (results->len, ==, 1);
+    g_assert_true (has_result (results, dir, spread->str));
+    g_ptr_array_unref (results);
+
+    searchindex_free (index);
+    g_string_free (spread, TRUE);
+    remove_tree (dir);
+    g_free (dir);
+}
+
+static void
+test_query (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-searchindex-XXXXXX", NULL);
+    g_assert_nonnull (dir);
+    make_file (dir, "Pink Floyd.mp3");
+    make_file (dir, "Other.mp3");
+
+    SearchIndex *index = build_index (dir);
+    g_assert_cmpstr (searchindex_get_root (index), ==, dir);
+
+    GPtrArray *results = searchindex_query (index, "floyd", 10);
+    g_assert_cmpuint (results->len, ==, 1);
+    g_assert_true (has_result (results, dir, "Pink Floyd.mp3"));
+    g_ptr_array_unref (results);
+
+    results = searchindex_query (index, "pnk", 10);
+    g_assert_cmpuint (results->len, ==, 0);
+    g_ptr_array_unref (results);
+
+    searchindex_free (index);
+    remove_tree (dir);
+    g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/searchindex/query", test_query);
+    g_test_add_func ("/searchindex/query-fuzzy", test_query_fuzzy);
+
+    gint result = g_test_run ();
+    searchindex_shutdown ();
+    return result;
+}
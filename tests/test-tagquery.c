@@ -0,0 +1,95 @@
+/* Tests for the tag query language */
+
+#include <glib.h>
+#include "tagquery.h"
+#include "tagstore.h"
+
+
+/* Three tracks of one album: track numbers 1 to 3, years 1955, 1960, 1965 */
+static TagStore *
+make_store (void)
+{
+    static const gchar *paths[] = { "/music/a/01.flac", "/music/a/02.flac", "/music/a/03.mp3" };
+    TagStoreBuilder *b = tagstore_builder_new ();
+    for (guint i = 0; i < G_N_ELEMENTS (paths); i++) {
+        TagRecord record = { 0 };
+        record.path = paths[i];
+        record.strings[TAG_FIELD_ARTIST] = "Miles Davis";
+        record.strings[TAG_FIELD_ALBUM] = "Milestones";
+        record.strings[TAG_FIELD_TITLE] = "Track";
+        record.year = 1955 + 5 * i;
+        record.number = 1 << 16 | (i + 1);
+        record.duration = 300000;
+        tagstore_builder_add (b, &record);
+    }
+    return tagstore_builder_build (b);
+}
+
+/* Number of tracks matching text, checked both column-wise and per track */
+static guint
+count_matches (const TagStore *store, const gchar *text)
+{
+    gchar *error = NULL;
+    TagQuery *query = tagquery_parse (text, &error);
+    g_assert_null (error);
+    g_assert_nonnull (query);
+
+    GArray *tracks = tagquery_run (query, store);
+    guint n = tracks->len;
+    guint n_single = 0;
+    for (guint track = 0; track < tagstore_size (store); track++)
+        n_single += tagquery_match (query, store, track);
+    g_assert_cmpuint (n, ==, n_single);
+
+    g_array_unref (tracks);
+    tagquery_free (query);
+    return n;
+}
+
+static void
+test_ranges (void)
+{
+    TagStore *store = make_store ();
+    g_assert_cmpuint (count_matches (store, "year:1955..1960"), ==, 2);
+    g_assert_cmpuint (count_matches (store, "year:1960.."), ==, 2);
+    g_assert_cmpuint (count_matches (store, "year:..1955"), ==, 1);
+    g_assert_cmpuint (count_matches (store, "year:1965"), ==, 1);
+    g_assert_cmpuint (count_matches (store, "track>=2"), ==, 2);
+    g_assert_cmpuint (count_matches (store, "track<2"), ==, 1);
+    g_assert_cmpuint (count_matches (store, "-year:1960"), ==, 2);
+    tagstore_unref (store);
+}
+
+static void
+test_empty_ranges (void)
+{
+    TagStore *store = make_store ();
+    g_assert_cmpuint (count_matches (store, "track<0"), ==, 0);
+    g_assert_cmpuint (count_matches (store, "track>65535"), ==, 0);
+    g_assert_cmpuint (count_matches (store, "duration<0"), ==, 0);
+    g_assert_cmpuint (count_matches (store, "-track<0"), ==, 3);
+    tagstore_unref (store);
+}
+
+static void
+test_reversed_range (void)
+{
+    TagStore *store = make_store ();
+    g_assert_cmpuint (count_matches (store, "year:1965..1955"), ==, 0);
+    g_assert_cmpuint (count_matches (store, "-year:1965..1955"), ==, 3);
+    tagstore_unref (store);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/tagquery/ranges", test_ranges);
+    g_test_add_func ("/tagquery/empty-ranges", test_empty_ranges);
+    g_test_add_func ("/tagquery/reversed-range", test_reversed_range);
+
+    gint result = g_test_run ();
+    tagquery_shutdown ();
+    return result;
+}
@@ -0,0 +1,121 @@
+/* Tests for the GTK-free helpers: strings, cover images and cache paths */
+
+#include <sys/types.h>
+#include <utime.h>
+#include <glib.h>
+#include "utils.h"
+#include "testutil.h"
+
+
+static gchar *
+make_file (const gchar *dir, const gchar *name, time_t mtime)
+{
+    gchar *path = g_build_filename (dir, name, NULL);
+    g_assert_true (g_file_set_contents (path, "", 0, NULL));
+
+    struct utimbuf times = { mtime, mtime };
+    g_assert_cmpint (utime (path, &times), ==, 0);
+    return path;
+}
+
+static void
+test_strings (void)
+{
+    g_assert_true (utils_str_equal (NULL, NULL));
+    g_assert_false (utils_str_equal ("a", NULL));
+    g_assert_true (utils_str_equal ("Album", "Album"));
+    g_assert_false (utils_str_equal ("Album", "album"));
+
+    g_assert_cmpint (utils_str_casecmp ("Album", "album"), ==, 0);
+    g_assert_cmpint (utils_str_casecmp ("Ärzte", "ärzte"), ==, 0);
+    g_assert_cmpint (utils_str_casecmp ("abc", "ABD"), <, 0);
+
+    gchar *tooltip = utils_tooltip_from_uri ("/music/Simon & Garfunkel");
+    g_assert_cmpstr (tooltip, ==, "/music/Simon &amp; Garfunkel");
+    g_free (tooltip);
+    g_assert_null (utils_tooltip_from_uri (NULL));
+}
+
+static void
+test_find_coverart (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-cover-XXXXXX", NULL);
+    gchar *folder = make_file (dir, "folder.jpg", 1000);
+    gchar *cover = make_file (dir, "cover.jpg", 1000);
+
+    /* First existing name wins */
+    gchar *names[] = { "cover.png", "folder.jpg", "cover.jpg", NULL };
+    gchar *found = utils_find_coverart (dir, names);
+    g_assert_cmpstr (found, ==, folder);
+    g_free (found);
+
+    gchar *missing[] = { "front.png", NULL };
+    g_assert_null (utils_find_coverart (dir, missing));
+    g_assert_null (utils_find_coverart (dir, NULL));
+
+    remove_tree (dir);
+    g_free (folder);
+    g_free (cover);
+    g_free (dir);
+}
+
+static void
+test_cache_is_fresh (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-cache-XXXXXX", NULL);
+    gchar *source = make_file (dir, "cover.jpg", 2000);
+    gchar *cache = g_build_filename (dir, "cache.png", NULL);
+
+    g_assert_false (utils_cache_is_fresh (cache, source));
+    g_free (make_file (dir, "cache.png", 3000));
+    g_assert_true (utils_cache_is_fresh (cache, source));
+    g_free (make_file (dir, "cache.png", 1000));
+    g_assert_false (utils_cache_is_fresh (cache, source));
+
+    remove_tree (dir);
+    g_free (source);
+    g_free (cache);
+    g_free (dir);
+}
+
+static void
+test_cache_path (void)
+{
+    gchar *dir = g_dir_make_tmp ("fb-xdg-XXXXXX", NULL);
+    g_setenv ("XDG_CACHE_HOME", dir, TRUE);
+
+    gchar *path = utils_make_cache_path ("/home/user/Music/Some Artist", 24);
+    gchar *icons = g_build_filename (dir, "deadbeef-fb", "icons", "24", NULL);
+    g_assert_true (g_str_has_prefix (path, icons));
+    g_assert_true (g_str_has_suffix (path, "/home_user_Music_Some_Artist.png"));
+    g_assert_true (g_file_test (icons, G_FILE_TEST_IS_DIR));
+
+    gchar *other = utils_make_cache_path ("/home/user/Music/Some Artist", 32);
+    g_assert_cmpstr (path, !=, other);
+    g_free (other);
+
+    gchar *file = utils_make_cache_file ("session");
+    gchar *expected = g_build_filename (dir, "deadbeef-fb", "session", NULL);
+    g_assert_cmpstr (file, ==, expected);
+    g_free (expected);
+    g_free (file);
+
+    g_free (icons);
+    g_free (path);
+    g_unsetenv ("XDG_CACHE_HOME");
+    remove_tree (dir);
+    g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/utils/strings", test_strings);
+    g_test_add_func ("/utils/find-coverart", test_find_coverart);
+    g_test_add_func ("/utils/cache-is-fresh", test_cache_is_fresh);
+    g_test_add_func ("/utils/cache-path", test_cache_path);
+
+    return g_test_run ();
+}
@@ -0,0 +1,38 @@
+/* Helpers shared by the tests and benchmarks */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "testutil.h"
+
+
+void
+remove_tree (const gchar *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    if (dir) {
+        const gchar *name;
+        while ((name = g_dir_read_name (dir))) {
+            gchar *child = g_build_filename (path, name, NULL);
+            remove_tree (child);
+            g_free (child);
+        }
+        g_dir_close (dir);
+    }
+    g_remove (path);
+}
+
+gchar *
+json_quote (const gchar *str)
+{
+    GString *quoted = g_string_new ("\"");
+    for (const gchar *p = str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            g_string_append_printf (quoted, "\\%c", *p);
+        else if ((guchar) *p < 0x20)
+            g_string_append_printf (quoted, "\\u%04x", *p);
+        else
+            g_string_append_c (quoted, *p);
+    }
+    g_string_append_c (quoted, '"');
+    return g_string_free (quoted, FALSE);
+}
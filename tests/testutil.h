@@ -0,0 +1,17 @@
+#ifndef __TESTUTIL_H
+#define __TESTUTIL_H
+
+#include <glib.h>
+
+/* Helpers shared by the tests and benchmarks */
+
+
+/* Delete path and everything below it */
+void
+remove_tree (const gchar *path);
+
+/* Quoted and escaped string for JSON output, free with g_free() */
+gchar *
+json_quote (const gchar *str);
+
+#endif  /* __TESTUTIL_H */
@@ -0,0 +1,85 @@
+/* TYPE-AHEAD INDEX - find rows of large directories by prefix */
+
+#include <string.h>
+#include <glib.h>
+#include "typeahead.h"
+
+
+struct _TypeAheadIndex
+{
+    DirListing      *listing;       // owns the keys
+    GPtrArray       *keys;          // keys of the shown entries, directories first
+    guint           n_dirs;
+};
+
+
+/* Index rows added for listing, keeps a reference to it */
+TypeAheadIndex *
+typeahead_index_new (DirListing *listing)
+{
+    TypeAheadIndex *index = g_new0 (TypeAheadIndex, 1);
+    index->listing = listing_ref (listing);
+    index->keys = g_ptr_array_sized_new (listing->n_entries);
+    return index;
+}
+
+void
+typeahead_index_free (TypeAheadIndex *index)
+{
+    if (! index)
+        return;
+    g_ptr_array_free (index->keys, TRUE);
+    listing_unref (index->listing);
+    g_free (index);
+}
+
+/* Add the next shown entry of the listing, in listing order */
+void
+typeahead_index_add (TypeAheadIndex *index, const ListingEntry *entry)
+{
+    g_ptr_array_add (index->keys, entry->key);
+    if (entry->is_dir)
+        index->n_dirs++;
+}
+
+/* Get the listing the rows were taken from */
+DirListing *
+typeahead_index_get_listing (const TypeAheadIndex *index)
+{
+    return index->listing;
+}
+
+guint
+typeahead_index_size (const TypeAheadIndex *index)
+{
+    return index->keys->len;
+}
+
+/* First key in [start, end) that is not less than prefix */
+static guint
+lower_bound (const TypeAheadIndex *index, guint start, guint end, const gchar *prefix)
+{
+    while (start < end) {
+        guint mid = start + (end - start) / 2;
+        if (strcmp (g_ptr_array_index (index->keys, mid), prefix) < 0)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
+/* Get first row whose key starts with prefix, which must be lowercase
+ * like the keys; returns -1 if there is none */
+gint
+typeahead_index_find (const TypeAheadIndex *index, const gchar *prefix)
+{
+    guint runs[2][2] = { { 0, index->n_dirs }, { index->n_dirs, index->keys->len } };
+
+    for (guint r = 0; r < 2; r++) {
+        guint row = lower_bound (index, runs[r][0], runs[r][1], prefix);
+        if (row < runs[r][1] && g_str_has_prefix (g_ptr_array_index (index->keys, row), prefix))
+            return row;
+    }
+    return -1;
+}
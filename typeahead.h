@@ -0,0 +1,33 @@
+#ifndef __TYPEAHEAD_H
+#define __TYPEAHEAD_H
+
+#include <glib.h>
+#include "listing.h"
+
+/* Rows of one shown directory in the order of the tree, using the sort keys
+ * of its listing. Directories and files are each sorted by key, so the first
+ * row starting with a typed prefix is found with two binary searches
+ * instead of comparing every row.
+ */
+typedef struct _TypeAheadIndex TypeAheadIndex;
+
+
+TypeAheadIndex *
+typeahead_index_new (DirListing *listing);
+
+void
+typeahead_index_free (TypeAheadIndex *index);
+
+void
+typeahead_index_add (TypeAheadIndex *index, const ListingEntry *entry);
+
+DirListing *
+typeahead_index_get_listing (const TypeAheadIndex *index);
+
+guint
+typeahead_index_size (const TypeAheadIndex *index);
+
+gint
+typeahead_index_find (const TypeAheadIndex *index, const gchar *prefix);
+
+#endif  /* __TYPEAHEAD_H */
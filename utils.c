@@ -5,21 +5,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <gtk/gtk.h>
+#include <glib.h>
 #include "utils.h"
 
 
-/* Get pixbuf icon from current icon theme */
-GdkPixbuf *
-utils_pixbuf_from_stock (const gchar *icon_name, gint size)
-{
-    GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
-    if (icon_theme)
-        return gtk_icon_theme_load_icon (icon_theme, icon_name, size, 0, NULL);
-
-    return NULL;
-}
-
 /* Check if two strings are exactly the same */
 gboolean
 utils_str_equal (const gchar *a, const gchar *b)
@@ -179,7 +168,7 @@ utils_make_cache_path (const gchar *uri, gint imgsize)
     if (! g_file_test (cachedir, G_FILE_TEST_IS_DIR))
         utils_check_dir (cachedir, 0755);
 
-    fullpath = g_string_new (g_strdup (cachedir));
+    fullpath = g_string_new (cachedir);
 
     fname = g_strdup (uri);
     for (gchar *p = fname+1; *p; p++) {
@@ -196,6 +185,52 @@ utils_make_cache_path (const gchar *uri, gint imgsize)
     return g_string_free (fullpath, FALSE);
 }
 
+/* Get path of the cover image of directory uri, names are tried in order.
+ * Returns NULL if none of them exists. */
+gchar *
+utils_find_coverart (const gchar *uri, gchar * const *names)
+{
+    for (gint i = 0; names && names[i]; i++) {
+        gchar *coverfile = g_strconcat (uri, G_DIR_SEPARATOR_S, names[i], NULL);
+        if (g_file_test (coverfile, G_FILE_TEST_EXISTS))
+            return coverfile;
+        g_free (coverfile);
+    }
+    return NULL;
+}
+
+/* Check if cachefile exists and is not older than the file it was made from */
+gboolean
+utils_cache_is_fresh (const gchar *cachefile, const gchar *source)
+{
+    struct stat cache_stat, source_stat;
+    if (stat (cachefile, &cache_stat) != 0 || stat (source, &source_stat) != 0)
+        return FALSE;
+    return source_stat.st_mtime <= cache_stat.st_mtime;
+}
+
+/* Get path of a file inside the plugin's cache directory */
+gchar *
+utils_make_cache_file (const gchar *name)
+{
+    /* Files are placed next to the icon cache:
+     *     $XDG_CACHE_HOME/deadbeef-fb/<name>
+     * If $XDG_CACHE_HOME is undefined, $HOME/.cache/deadbeef-fb/ is used instead.
+     */
+    const gchar *cache = g_getenv ("XDG_CACHE_HOME");
+    gchar *cachedir = g_strdup_printf (cache ? "%s/deadbeef-fb/" : "%s/.cache/deadbeef-fb/",
+                    cache ? cache : g_getenv ("HOME"));
+
+    /* Create path if it doesn't exist already */
+    if (! g_file_test (cachedir, G_FILE_TEST_IS_DIR))
+        utils_check_dir (cachedir, 0755);
+
+    gchar *fullpath = g_strconcat (cachedir, name, NULL);
+    g_free (cachedir);
+
+    return fullpath;
+}
+
 /* Copied from  <deadbeef>/plugins/artwork/artwork.c  with few adjustments */
 gint
 utils_check_dir (const gchar *dir, mode_t mode)
@@ -224,98 +259,3 @@ utils_check_dir (const gchar *dir, mode_t mode)
     g_free (tmp);
     return 1;
 }
-
-void
-utils_construct_style (GtkWidget *widget, const gchar *bgcolor, const gchar *fgcolor, const gchar *bgcolor_sel, const gchar *fgcolor_sel)
-{
-    if (! widget)
-        return;
-
-    GString *style = g_string_new ("");
-#if !GTK_CHECK_VERSION(3,0,0)
-    style = g_string_append (style, "style \"deadbeef-filebrowser\" { \n");
-    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    base[NORMAL]   = \"%s\" \n", bgcolor);
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    base[SELECTED] = \"%s\" \n", bgcolor_sel);
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    base[ACTIVE]   = \"%s\" \n", bgcolor_sel);
-    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    text[NORMAL]   = \"%s\" \n", fgcolor);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    text[SELECTED] = \"%s\" \n", fgcolor_sel);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    text[ACTIVE]   = \"%s\" \n", fgcolor_sel);
-    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    bg[NORMAL]     = \"%s\" \n", bgcolor);
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    bg[SELECTED]   = \"%s\" \n", bgcolor_sel);
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    bg[ACTIVE]     = \"%s\" \n", bgcolor_sel);
-    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    fg[NORMAL]     = \"%s\" \n", fgcolor);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    fg[SELECTED]   = \"%s\" \n", fgcolor_sel);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    fg[ACTIVE]     = \"%s\" \n", fgcolor_sel);
-    style = g_string_append (style, "} \n");
-    style = g_string_append (style, "widget \"*.deadbeef_filebrowser_treeview\" style \"deadbeef-filebrowser\" \n");
-#else
-    style = g_string_append (style, "* { \n");
-    if (strlen(bgcolor) > 0)       g_string_append_printf (style, "    background-color: %s; \n", bgcolor);
-    if (strlen(fgcolor) > 0)       g_string_append_printf (style, "    color:            %s; \n", fgcolor);
-    style = g_string_append (style, "} \n");
-    style = g_string_append (style, "*:selected { \n");
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    background-color: %s; \n", bgcolor_sel);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    color:            %s; \n", fgcolor_sel);
-    style = g_string_append (style, "} \n");
-    style = g_string_append (style, "*:active { \n");
-    if (strlen(bgcolor_sel) > 0)   g_string_append_printf (style, "    background-color: %s; \n", bgcolor_sel);
-    if (strlen(fgcolor_sel) > 0)   g_string_append_printf (style, "    color:            %s; \n", fgcolor_sel);
-    style = g_string_append (style, "} \n");
-#endif
-
-    gchar* style_str = g_string_free (style, FALSE);
-    fprintf(stderr, "gtk style: \n%s", style_str);
-#if !GTK_CHECK_VERSION(3,0,0)
-    gtk_rc_parse_string (style_str);
-#else
-    GtkCssProvider *css_provider = gtk_css_provider_get_default ();  // do NOT free!
-    gtk_css_provider_load_from_data (css_provider, style_str, -1, NULL);
-    GtkStyleContext *style_ctx = gtk_widget_get_style_context (widget);  // do NOT free!
-    gtk_style_context_add_provider (style_ctx, (GtkStyleProvider *) css_provider, GTK_STYLE_PROVIDER_PRIORITY_USER);
-#endif
-    g_free (style_str);
-}
-
-gboolean
-tree_view_expand_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth)
-{
-    GtkTreeIter iter;
-    if (! gtk_tree_model_get_iter(model, &iter, parent))  // check if path is valid
-        return FALSE;
-
-    if (max_depth > 0 && gtk_tree_path_get_depth (parent) >= max_depth)
-        return FALSE;
-
-    // when expanding, this should come *before* going down the tree
-    gtk_tree_view_expand_row (view, parent, TRUE);
-
-    GtkTreePath *path = gtk_tree_path_copy (parent);
-    gtk_tree_path_down (path);
-    while (tree_view_expand_rows_recursive (model, view, path, max_depth))
-        gtk_tree_path_next (path);
-    gtk_tree_path_free (path);
-
-    return TRUE;
-}
-
-gboolean
-tree_view_collapse_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth)
-{
-    GtkTreeIter iter;
-    if (! gtk_tree_model_get_iter(model, &iter, parent))  // check if path is valid
-        return FALSE;
-
-    if (max_depth > 0 && gtk_tree_path_get_depth (parent) >= max_depth)
-        return FALSE;
-
-    GtkTreePath *path = gtk_tree_path_copy (parent);
-    gtk_tree_path_down (path);
-    while (tree_view_collapse_rows_recursive (model, view, path, max_depth))
-        gtk_tree_path_next (path);
-    gtk_tree_path_free (path);
-
-    // when expanding, this should come *after* going down the tree
-    gtk_tree_view_collapse_row (view, parent);
-
-    return TRUE;
-}
@@ -1,16 +1,16 @@
+#ifndef __UTILS_H
+#define __UTILS_H
+
+#include <sys/types.h>
 #include <string.h>
-#include <gtk/gtk.h>
+#include <glib.h>
 
 /* Helper macros */
 #define foreach_slist_free(node,list)               for (node = list, list = NULL; g_slist_free_1(list), node != NULL; list = node, node = node->next)
 #define foreach_dir(filename,dir)                   for ((filename) = g_dir_read_name(dir); (filename) != NULL; (filename) = g_dir_read_name(dir))
 #define NZV(ptr)                                    (G_LIKELY((ptr)) && G_LIKELY((ptr)[0]))
 #define setptr(ptr,result)                          { gpointer setptr_tmp = ptr; ptr = result; g_free(setptr_tmp); }
-#define GLADE_HOOKUP_OBJECT(component,widget,name)  g_object_set_data_full (G_OBJECT (component), name, gtk_widget_ref (widget), (GDestroyNotify) gtk_widget_unref)
-
 
-GdkPixbuf *
-utils_pixbuf_from_stock (const gchar *icon_name, gint size);
 
 gboolean
 utils_str_equal (const gchar *a, const gchar *b);
@@ -36,14 +36,16 @@ utils_tooltip_from_uri (const gchar *uri);
 gchar *
 utils_make_cache_path (const gchar *uri, gint imgsize);
 
-gint
-utils_check_dir (const gchar *dir, mode_t mode);
-
-void
-utils_construct_style (GtkWidget *widget, const gchar *bgcolor, const gchar *fgcolor, const gchar *bgcolor_sel, const gchar *fgcolor_sel);
+gchar *
+utils_find_coverart (const gchar *uri, gchar * const *names);
 
 gboolean
-tree_view_expand_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth);
+utils_cache_is_fresh (const gchar *cachefile, const gchar *source);
 
-gboolean
-tree_view_collapse_rows_recursive (GtkTreeModel *model, GtkTreeView *view, GtkTreePath *parent, gint max_depth);
+gchar *
+utils_make_cache_file (const gchar *name);
+
+gint
+utils_check_dir (const gchar *dir, mode_t mode);
+
+#endif  /* __UTILS_H */